@@ -0,0 +1,30 @@
+#ifndef BASELINE_HPP
+#define BASELINE_HPP
+
+#include <cstdint>
+
+#include "Z80.hpp"
+
+// A machine image to reset back to between short runs. Capturing copies the
+// registers, the bus map and every writable page once; the bus then tracks
+// which pages get written, so a reset only copies those back.
+//
+// Only writes through the bus are tracked. Code that writes state->memory
+// directly (rom_load, clearmem) must call bus_touch. Banks that aren't
+// mapped at capture time, and MMIO device state, are not part of the image.
+struct Baseline {
+    State       regs;       // Whole State at capture, bus map included
+    uint8_t     *pages;     // PAGE_COUNT pages; only the writable ones are filled
+};
+
+// Take a baseline of state and start tracking writes. base starts out
+// zeroed; capturing again reuses its buffer. Returns false if the
+// page buffer can't be allocated.
+bool baseline_capture(Baseline *base, State *state);
+
+// Put state back to the baseline. Returns the number of pages copied.
+unsigned baseline_restore(State *state, const Baseline *base);
+
+void baseline_free(Baseline *base);
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+// Non-interactive entry point: Zilog --run rom.bin [options]. Loads the ROM,
+// runs it at full speed and prints a one-line JSON summary on stdout.
+// Returns the process exit code.
+int batch_main(int argc, char* argv[]);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef CONSOLE_HPP
+#define CONSOLE_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Ports.hpp"
+
+// Character output for guest programs: each byte written to the console's
+// port is appended to a host buffer, which goes out in a single write()
+// when it fills, on console_flush and on console_close, rather than a
+// system call per out. Reading the port sees 0xff; there is no input.
+
+enum {
+    CONSOLE_PORT    = 0x01,         // Where the REPL attaches one
+    CONSOLE_BUFFER  = 1 << 20       // Default buffer size
+};
+
+struct Console {
+    PortHandler handler;            // Map this onto a port (ports_map)
+    int         fd;
+    uint8_t     *buffer;
+    size_t      size;
+    size_t      used;
+    uint64_t    bytes;              // Written by the guest
+    uint64_t    flushes;            // write() batches
+    int         error;              // errno of the first failed write; later output is dropped
+};
+
+// Buffer output for fd (not closed by the console). Null if out of memory.
+Console* console_create(int fd, size_t size = CONSOLE_BUFFER);
+
+// Write out what's buffered. False with errno set if any write has failed.
+bool console_flush(Console *console);
+
+// Flush and free; same result as console_flush
+bool console_close(Console *console);
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef DEBUG_HPP
+#define DEBUG_HPP
+
+#include <cstdint>
+
+#include "Z80.hpp"
+
+// Breakpoints and watchpoints. A debugger hangs off state->debug; with none
+// attached nothing below costs the core anything. Breakpoints are a bit per
+// pc, looked at only where the core already stops between blocks: the
+// translation cache never starts a block on a breakpoint and ends every
+// block before one, so the check sits in the one-instruction path the cache
+// falls back to. Without translation the instrumented loop runs, which
+// checks at every fetch.
+//
+// Watchpoints are a bit per address, trapped through the page map: a page
+// holding one has its read entry (WATCH_READS) or write entry
+// (WATCH_WRITES) parked, so only accesses to that page take the slow path,
+// where the address is looked up. A hit lets the instruction finish, then
+// the core stops with STOP_WATCHPOINT and the access in debug->last. The
+// running block is dropped to get out of it (native code leaves on its
+// own), so a hit costs a retranslation.
+//
+// A run stops with STOP_BREAKPOINT before the instruction at a breakpoint,
+// other than the one it started at, so running again carries on.
+
+enum {
+    DEBUG_READ  = 0x01,
+    DEBUG_WRITE = 0x02
+};
+
+struct WatchHit {
+    uint16_t    addr;
+    uint8_t     value;          // Read, or written
+    bool        write;
+};
+
+struct Debugger {
+    uint64_t    breaks[0x10000 / 64];   // Bit per pc
+    uint64_t    reads[0x10000 / 64];    // Bit per address whose reads stop the core
+    uint64_t    writes[0x10000 / 64];   // Bit per address whose writes do
+    uint16_t    page_reads[PAGE_COUNT]; // Read watchpoints in each page
+    uint16_t    page_writes[PAGE_COUNT];
+    uint32_t    breakpoints;            // Bits set in breaks
+    uint32_t    watchpoints;            // Bits set in reads and writes
+    uint32_t    epoch;                  // bus.epoch when the pages were last watched
+    bool        hit;                    // A watchpoint fired this run
+    WatchHit    last;                   // The access that fired it
+};
+
+// Null if out of memory
+Debugger* debug_create();
+void debug_free(Debugger *debug);
+
+// Hook debug to state's bus and translation cache, or unhook whatever is
+// attached (debug null). A page remapped through bus_map_* gets its watches
+// back at once, even from a device in the middle of a run.
+void debug_attach(State *state, Debugger *debug);
+
+// Set (on) or clear a breakpoint at pc, or a watchpoint on addr's reads
+// and/or writes (DEBUG_* bits), in the debugger attached to state. False if
+// there is none or nothing changed.
+bool debug_break(State *state, uint16_t pc, bool on);
+bool debug_watch(State *state, uint16_t addr, uint8_t kinds, bool on);
+
+inline bool debug_breaks(const Debugger *debug, uint16_t pc) {
+    return debug->breaks[pc >> 6] >> (pc & 63) & 1;
+}
+
+// Called by the core as a run starts: forget the last hit, and watch the
+// pages again if the bus changed some other way (a reset, a restore)
+void debug_enter(State *state);
+
+// True if a watchpoint fired since the run started
+inline bool debug_hit(const State *state) {
+    return state->debug && state->debug->hit;
+}
+
+#endif
@@ -1,12 +1,131 @@
 #ifndef DISASSEMBLER_HPP
 #define DISASSEMBLER_HPP
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+// Decoding is split from formatting: disasm_decode fills a plain record
+// (mnemonic, operands, length) without allocating or printing, and
+// disasm_format turns one into text in the caller's buffer. disasm_range
+// does a whole buffer into a DisasmSink, which hands text on in large
+// chunks. Nothing reads past the size it's given; an instruction cut off
+// by the end of the input decodes as a one-byte "db".
+
+enum DisasmMnemonic : uint8_t {
+    DM_NOP, DM_LD, DM_INC, DM_DEC, DM_RLCA, DM_RRCA, DM_RLA, DM_RRA,
+    DM_EX, DM_ADD, DM_DJNZ, DM_JR, DM_DAA, DM_CPL, DM_SCF, DM_CCF,
+    DM_HALT, DM_ADC, DM_SUB, DM_SBC, DM_AND, DM_XOR, DM_OR, DM_CP,
+    DM_RET, DM_POP, DM_JP, DM_CALL, DM_PUSH, DM_RST, DM_OUT, DM_EXX,
+    DM_IN, DM_DI, DM_EI, DM_RLC, DM_RRC, DM_RL, DM_RR, DM_SLA,
+    DM_SRA, DM_SLL, DM_SRL, DM_BIT, DM_RES, DM_SET, DM_NEG, DM_RETN,
+    DM_RETI, DM_IM, DM_RRD, DM_RLD, DM_LDI, DM_CPI, DM_INI, DM_OUTI,
+    DM_LDD, DM_CPD, DM_IND, DM_OUTD, DM_LDIR, DM_CPIR, DM_INIR, DM_OTIR,
+    DM_LDDR, DM_CPDR, DM_INDR, DM_OTDR,
+    DM_NOP_UNDEFINED,   // Undefined ED opcode, or a DD/FD another prefix overrides
+    DM_DB,              // A byte that doesn't start a whole instruction
+    DM_COUNT
+};
+
+enum DisasmRegister : uint8_t {
+    DR_B, DR_C, DR_D, DR_E, DR_H, DR_L, DR_A, DR_I, DR_R,
+    DR_IXH, DR_IXL, DR_IYH, DR_IYL,
+    DR_BC, DR_DE, DR_HL, DR_SP, DR_AF, DR_AF_ALT, DR_IX, DR_IY,
+    DR_COUNT
+};
+
+enum DisasmOperandKind : uint8_t {
+    DO_REG,             // reg
+    DO_IND,             // (reg)
+    DO_INDEX,           // (reg+d): value is d as a signed byte
+    DO_IMM8,            // n
+    DO_IMM16,           // nn
+    DO_ADDR,            // (nn)
+    DO_PORT,            // (n)
+    DO_TARGET,          // Relative jump: value is the address it goes to
+    DO_COND,            // reg is the condition, 0-7 for nz z nc c po pe p m
+    DO_NUM,             // A bit number, interrupt mode or the 0 of out (c),0
+    DO_RST              // Restart address
+};
+
+struct DisasmOperand {
+    uint8_t     kind;
+    uint8_t     reg;
+    uint16_t    value;
+};
+
+struct DisasmInstruction {
+    uint32_t        pc;
+    uint8_t         length;         // Bytes, 1 to 4
+    uint8_t         mnemonic;       // DisasmMnemonic
+    uint8_t         count;          // Operands in use
+    DisasmOperand   operands[3];
+};
+
+enum {
+    DISASM_TEXT_MAX     = 32,       // disasm_format never writes more, NUL included
+    DISASM_LINE_MAX     = 48,       // Nor does one line of disasm_range
+    DISASM_SINK_BYTES   = 1 << 16,  // A good size for a sink's buffer
+    DISASM_CHUNK        = 1 << 18   // Bytes of input per disasm_parallel job
+};
+
+// Decode the instruction at code[0], which is at address pc, seeing no more
+// than size bytes. Returns its length, or 0 if size is 0.
+int disasm_decode(const uint8_t *code, size_t size, uint32_t pc, DisasmInstruction *out);
+
+// Write "ld    a,(ix+$05)" and a NUL; returns the length without the NUL.
+// size must be at least DISASM_TEXT_MAX.
+size_t disasm_format(const DisasmInstruction *in, char *out, size_t size);
+
+// The same, for any output iterator over char
+template <typename OutputIt>
+OutputIt disasm_format(const DisasmInstruction &in, OutputIt out) {
+    char text[DISASM_TEXT_MAX];
+    size_t n = disasm_format(&in, text, sizeof(text));
+    return std::copy(text, text + n, out);
+}
+
+const char* disasm_mnemonic_name(uint8_t mnemonic);
+
+// Formatted lines collect in buffer (at least DISASM_LINE_MAX bytes) and go
+// to write whenever it's close to full, and on disasm_flush. After a write
+// has failed, text is dropped and failed stays set.
+struct DisasmSink {
+    char        *buffer;
+    size_t      size;
+    size_t      used;
+    bool        (*write)(void *context, const char *data, size_t size);
+    void        *context;
+    bool        failed;
+};
+
+// A sink writing to a FILE * given as the context
+bool disasm_write_file(void *file, const char *data, size_t size);
+
+inline DisasmSink disasm_sink(char *buffer, size_t size,
+                              bool (*write)(void*, const char*, size_t), void *context) {
+    return DisasmSink{ buffer, size, 0, write, context, false };
+}
+
+// Disassemble all size bytes of code, the first at address pc, one
+// "pc first-byte text" line per instruction. Returns the instruction count.
+uint64_t disasm_range(const uint8_t *code, size_t size, uint32_t pc, DisasmSink *sink);
+
+// The same lines in the same order, with the input split into chunks
+// disassembled on up to threads threads (0 = one per core). Each chunk's
+// text is built in memory and handed to sink->write whole.
+uint64_t disasm_parallel(const uint8_t *code, size_t size, uint32_t pc, DisasmSink *sink,
+                         unsigned threads = 0);
+
+// Hand on whatever is buffered; false if any write has failed
+bool disasm_flush(DisasmSink *sink);
+
+// The REPL's one-at-a-time interface, printing each line to stdout
 class Disassembler {
     public:
-      Disassembler(); 
+      // Disassemble buffer[pc], reading at most 4 bytes
       int disassemble(unsigned char* buffer, int pc);
-      void foo();
-    private:
-      int test = 1;  
+      // Same, for code that has been copied away from its address
+      int disassemble_at(unsigned char* code, int pc, size_t size = 4);
 };
 #endif
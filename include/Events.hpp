@@ -0,0 +1,58 @@
+#ifndef EVENTS_HPP
+#define EVENTS_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Z80.hpp"
+
+// Device callbacks keyed on T-state. A scheduler hangs off state->events;
+// the core never polls devices, it only compares state->cycles against
+// state->stop_cycle, which scheduling an event lowers to the event's time.
+// When it gets there it fires every event that is due, oldest time first
+// (same time: in the order they were scheduled), then looks at the
+// interrupt lines. An event fires at the first instruction boundary at or
+// after its time; the handler gets the time it asked for, so it can tell by
+// how much state->cycles has passed it.
+
+typedef void (*EventHandler)(State *state, void *context, uint64_t when);
+
+struct Event {
+    uint64_t        when;
+    uint64_t        order;          // Scheduling order, for ties
+    EventHandler    handler;
+    void            *context;
+};
+
+enum {
+    EVENTS_MAX = 64                 // Pending events per scheduler
+};
+
+struct Scheduler {
+    Event       heap[EVENTS_MAX];   // Binary min-heap on (when, order)
+    uint32_t    count;
+    uint64_t    scheduled;          // Events ever scheduled
+};
+
+// Null if out of memory
+Scheduler* events_create();
+void events_free(Scheduler *events);
+
+// Call handler(state, context, when) once state->cycles reaches when.
+// Returns false if the scheduler is full (or state has none).
+bool event_schedule(State *state, uint64_t when, EventHandler handler, void *context);
+
+// Drop every pending event with this handler and context; returns how many
+size_t event_cancel(State *state, EventHandler handler, void *context);
+
+// T-state of the earliest pending event, UINT64_MAX if there is none
+inline uint64_t events_next(const Scheduler *events) {
+    return events && events->count ? events->heap[0].when : UINT64_MAX;
+}
+
+// Fire every event due at state->cycles, including any a handler schedules
+// for a time already passed. The core calls this; handlers may schedule and
+// cancel.
+void events_fire(State *state);
+
+#endif
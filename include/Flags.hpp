@@ -0,0 +1,67 @@
+#ifndef FLAGS_HPP
+#define FLAGS_HPP
+
+#include <cstdint>
+
+// Bit positions in the packed F register
+enum {
+    FLAG_C  = 0x01,     // Carry - Set if last add/sub resulted in a carry/borrow
+    FLAG_N  = 0x02,     // Add/Subtract - Used in DAA instruction. 0 = add, 1 = sub
+    FLAG_PV = 0x04,     // Parity/Overflow - Parity for logic ops, signed overflow for arithmetic
+    FLAG_X  = 0x08,     // Undocumented - Copy of bit 3 of the result
+    FLAG_H  = 0x10,     // Half-Carry - Carry/borrow out of bit 3
+    FLAG_Y  = 0x20,     // Undocumented - Copy of bit 5 of the result
+    FLAG_Z  = 0x40,     // Zero - Set if result is 0
+    FLAG_S  = 0x80      // Sign - Set if result is negative
+};
+
+// Precomputed flag results, filled once by flags_init(). The ALU helpers in
+// Z80.cpp turn every 8-bit op into one or two loads from these.
+extern uint8_t sz53[256];                   // S, Z, X, Y of a result byte
+extern uint8_t sz53p[256];                  // ... plus parity, for logic ops and DAA
+extern uint8_t szhv_inc[256];               // inc8, indexed by the result (C untouched)
+extern uint8_t szhv_dec[256];               // dec8, indexed by the result (C untouched)
+extern uint8_t szhvc_add[2][256][256];      // add8/adc, indexed by [carry in][r1][r2]
+extern uint8_t szhvc_sub[2][256][256];      // sub/sbc/cp, indexed by [carry in][r1][r2]
+
+// Build the tables; safe to call from several threads, only the first call works
+void flags_init();
+
+// Deferred flags. The 8-bit ALU ops don't build F; they record what they did
+// and F is worked out from that only when something reads it. Most results
+// are overwritten by the next ALU op before anything looks.
+enum FlagOp : uint8_t {
+    FLAGS_READY,        // F is current; nothing deferred
+    FLAGS_ADD,          // add/adc: r1 + r2 + c
+    FLAGS_SUB,          // sub/sbc: r1 - r2 - c
+    FLAGS_CP,           // cp: as sub, but X and Y come from r2
+    FLAGS_AND,
+    FLAGS_LOGIC,        // or, xor
+    FLAGS_INC,          // inc8; c is the carry it keeps
+    FLAGS_DEC           // dec8; likewise
+};
+
+struct LazyFlags {
+    uint8_t     op;     // FlagOp
+    uint8_t     r;      // Result (S and Z always follow it)
+    uint8_t     r1;     // Operands, for the ops that need them
+    uint8_t     r2;
+    uint8_t     c;      // Carry in, or the carry inc/dec leave alone
+    uint8_t     carry;  // Carry out, kept ready for adc/sbc, inc/dec and jr c
+};
+
+// The F the deferred op would have left
+inline uint8_t flags_eval(const LazyFlags &l) {
+    switch (l.op) {
+        case FLAGS_ADD:   return szhvc_add[l.c][l.r1][l.r2];
+        case FLAGS_SUB:   return szhvc_sub[l.c][l.r1][l.r2];
+        case FLAGS_CP:    return (szhvc_sub[0][l.r1][l.r2] & ~(FLAG_X | FLAG_Y)) | (l.r2 & (FLAG_X | FLAG_Y));
+        case FLAGS_AND:   return sz53p[l.r] | FLAG_H;
+        case FLAGS_LOGIC: return sz53p[l.r];
+        case FLAGS_INC:   return l.c | szhv_inc[l.r];
+        case FLAGS_DEC:   return l.c | szhv_dec[l.r];
+    }
+    return 0;
+}
+
+#endif
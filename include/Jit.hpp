@@ -0,0 +1,82 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Translate.hpp"
+#include "Z80.hpp"
+
+// Tier-2 compiler for hot translated blocks (x86-64 hosts). A block that
+// has been entered JIT_THRESHOLD times is compiled to native code that keeps
+// the live Z80 registers in host registers for its whole run and writes
+// them back to State on the way out. Memory goes through the page table
+// inline; trapped pages call the bus slow path.
+//
+// Native code covers the unprefixed and CB instructions. Anything else
+// (I/O, DD/FD/ED, exchanges with the other banks, halt, di/ei) ends the
+// compiled code and the executor interprets from there, as it does after an
+// access that hit a device or dropped translated code. Between blocks
+// control is always back in the executor, so budgets, stop reasons and the
+// counters come out exactly as interpreted.
+//
+// JIT_CHECK replays every native run through the interpreter on a shadow
+// machine and compares registers, counters and memory. A block that
+// disagrees is reported on stderr, the interpreter's result is kept, and
+// that block start is never compiled again.
+
+#if (defined(__x86_64__) || defined(_M_X64)) && defined(__unix__) && !defined(ZILOG_NO_JIT)
+#define ZILOG_JIT 1
+#else
+#define ZILOG_JIT 0
+#endif
+
+// Values for State::jit
+enum {
+    JIT_OFF,
+    JIT_ON,
+    JIT_CHECK
+};
+
+enum {
+    JIT_THRESHOLD   = 32        // Block entries before it's compiled
+};
+
+struct Jit {
+    uint8_t     *code;              // Executable arena; shared stubs first
+    size_t      size;
+    size_t      used;
+    size_t      stubs;              // Bytes of stubs, kept across flushes
+    const uint8_t *read_stub;       // Slow-path calls native code makes
+    const uint8_t *write_stub;
+    uint8_t     never[0x10000 / 8]; // Block starts that failed a check
+    uint64_t    device;             // Device (MMIO, open bus) accesses from native code
+
+    // JIT_CHECK
+    State       *shadow;            // Replays each block; memory is the pre-image
+    State       before;             // State at block entry
+
+    // Counters for tuning
+    uint64_t    compiled;
+    uint64_t    runs;
+    uint64_t    exits;              // Runs that left before the block's end
+    uint64_t    checks;
+    uint64_t    mismatches;
+};
+
+// Drop all compiled code (the translation cache is being flushed)
+void jit_flush(Jit *jit);
+void jit_destroy(Jit *jit);
+
+// Compile b, creating tc->jit on first use. False if b can't be compiled
+// (nothing in it is supported, the arena is full, or it failed a check);
+// it then keeps running as micro-ops.
+bool jit_compile(TranslationCache *tc, State *state, Block *b);
+
+// Run b's native code: charge the block like the micro-op executor does,
+// hand back what an early exit didn't execute, and check it if asked. A
+// block that branches back to its own start goes round without leaving
+// while both limits would have let the executor enter it again.
+void jit_run(TranslationCache *tc, State *state, Block *b, uint64_t limit, uint64_t cycle_limit);
+
+#endif
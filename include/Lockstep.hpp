@@ -0,0 +1,47 @@
+#ifndef LOCKSTEP_HPP
+#define LOCKSTEP_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Z80.hpp"
+
+// Lockstep execution of many machines that run the same code, as in a
+// parameter sweep: one ROM, thousands of inputs. Machines are taken
+// LOCKSTEP_LANES at a time as a gang whose main registers and counters are
+// held as arrays, one element per lane (structure of arrays). Each step
+// picks the lowest pc among the gang's running lanes and executes the
+// instruction there for every lane at it, with masked array kernels the
+// compiler turns into AVX2 or AVX-512 code, picked at run time. On code
+// every lane shares, the step goes on through the straight run after it (no
+// jumps or stores) up to the next pc another lane waits at. Lanes that
+// branched elsewhere wait and rejoin when their pc comes round again.
+//
+// The unprefixed loads, 8- and 16-bit arithmetic, jumps, calls, returns,
+// push and pop run in the kernels; memory operands go through each lane's
+// own bus. Anything else (prefixes, I/O, exchanges with the other banks,
+// di/ei), and any lane whose code at pc differs from the leader's, takes
+// one interpreted step on that lane's State. A lane that waits more than
+// LOCKSTEP_PEEL_STEPS steps in a row is peeled off and finishes on the
+// scalar core, with translation and the JIT as it had them, as does any
+// machine with a scheduler (Events.hpp) or an interrupt line held, the last
+// lane left in a gang, and every lane of a gang whose steps averaged fewer
+// than LOCKSTEP_MIN_WORK lane-instructions over the last LOCKSTEP_PEEL_STEPS.
+// Every machine ends exactly as run_budgets would leave it.
+//
+// While a gang runs it owns its States' dirty-page tracking (Memory.hpp),
+// which it uses to learn which code pages are still the same in every lane.
+
+enum {
+    LOCKSTEP_LANES      = 32,
+    LOCKSTEP_PEEL_STEPS = 4096,
+    LOCKSTEP_MIN_WORK   = 8
+};
+
+// Run states[0..count) with the given budgets, on up to threads threads
+// (0 = one per core). why[i] is what run_budgets would have returned;
+// seconds, if not null, gets the wall time of the gang each machine ran in.
+void lockstep_run(State **states, size_t count, uint64_t max_instructions, uint64_t max_cycles,
+                  StopReason *why, double *seconds = nullptr, unsigned threads = 0);
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef MEMORY_HPP
+#define MEMORY_HPP
+
+#include <cstdint>
+
+// The 64 KiB address space is a table of 1 KiB pages. A page either points
+// straight at host memory, which the core reads and writes with one indexed
+// load, or is null, which sends the access through the slow path to an MMIO
+// handler (or open bus). Remapping a bank only rewrites table entries.
+enum {
+    PAGE_SHIFT  = 10,
+    PAGE_SIZE   = 1 << PAGE_SHIFT,
+    PAGE_MASK   = PAGE_SIZE - 1,
+    PAGE_COUNT  = 0x10000 >> PAGE_SHIFT
+};
+
+// Called for every access to a page mapped with bus_map_io. Either callback
+// may be null: reads then see 0xff and writes are dropped.
+struct MmioHandler {
+    uint8_t     (*read)(void *ctx, uint16_t addr);
+    void        (*write)(void *ctx, uint16_t addr, uint8_t value);
+    void        *ctx;
+};
+
+// Reasons a direct page's accesses are trapped (see bus_watch)
+enum {
+    WATCH_DIRTY = 0x01,     // Dirty-page tracking; cleared by the first write
+    WATCH_CODE  = 0x02,     // Page holds translated code; writes go to code_write
+    WATCH_WRITES = 0x04,    // Debugger watchpoint; writes go to watch_hit
+    WATCH_READS = 0x08      // Debugger watchpoint; reads are trapped too and go to watch_hit
+};
+
+// Page entries are stored pre-biased by the page's own base address, so the
+// full 16-bit address indexes them directly: byte = entry + addr.
+struct MemoryMap {
+    uintptr_t           read[PAGE_COUNT];   // Biased host page for reads, or 0 to trap
+    uintptr_t           write[PAGE_COUNT];  // Biased host page for writes, or 0 to trap
+    const MmioHandler   *mmio[PAGE_COUNT];  // Where trapped accesses go; null = open bus
+    uintptr_t           parked[PAGE_COUNT]; // Real write entry while the page's writes are watched
+    uintptr_t           parked_read[PAGE_COUNT]; // Real read entry while WATCH_READS is set
+    uint8_t             watch[PAGE_COUNT];  // WATCH_* bits
+    uint64_t            dirty;              // Bit per page written (or remapped) since tracking began
+    uint32_t            epoch;              // Bumped whenever memory may change behind the bus
+
+    // Called before a write lands on a WATCH_CODE page
+    void                (*code_write)(void *ctx, uint16_t addr);
+    void                *code_ctx;
+
+    // Called before an access to a WATCH_READS or WATCH_WRITES page lands;
+    // value is what was read or is about to be written
+    void                (*watch_hit)(void *ctx, uint16_t addr, uint8_t value, bool write);
+    // Called after a page is remapped, which clears its traps, to put its
+    // watches back; a device can bank-switch in the middle of a run
+    void                (*watch_remap)(void *ctx, unsigned page);
+    void                *watch_ctx;
+};
+
+// Region setup. addr and len must be multiples of PAGE_SIZE; host must
+// hold len bytes and outlive the mapping. Bank switching is just another
+// call with a different host pointer.
+void bus_map_ram(MemoryMap *bus, uint16_t addr, uint32_t len, uint8_t *host);
+void bus_map_rom(MemoryMap *bus, uint16_t addr, uint32_t len, const uint8_t *host);  // Writes dropped
+void bus_map_io(MemoryMap *bus, uint16_t addr, uint32_t len, const MmioHandler *handler);
+void bus_unmap(MemoryMap *bus, uint16_t addr, uint32_t len);   // Reads 0xff, writes dropped
+
+// Trap writes to a direct page for the given WATCH_* reasons. The write
+// entry is parked while any reason is set; pages without direct writes
+// (ROM, MMIO) can't change through the bus and are left alone. WATCH_READS
+// parks the read entry instead, on any page with direct reads.
+void bus_watch(MemoryMap *bus, unsigned page, uint8_t flags);
+void bus_unwatch(MemoryMap *bus, unsigned page, uint8_t flags);
+
+// Dirty-page tracking. Watches every direct page and clears dirty; the
+// first write to a page then traps once, sets its dirty bit and stops
+// watching, so later writes run at full speed. Remapping a page marks every
+// page dirty, since aliasing the caller relied on may be gone.
+void bus_track_writes(MemoryMap *bus);
+void bus_untrack_writes(MemoryMap *bus);
+
+// Host memory was written without going through the bus (a loader, a
+// snapshot): mark every page dirty and bump epoch so cached code is dropped
+void bus_touch(MemoryMap *bus);
+
+// Trapped accesses; kept out of line so the fast path stays small
+uint8_t bus_read_slow(const MemoryMap *bus, uint16_t addr);
+void bus_write_slow(MemoryMap *bus, uint16_t addr, uint8_t value);
+
+inline uint8_t bus_read(const MemoryMap *bus, uint16_t addr) {
+    uintptr_t page = bus->read[(unsigned)addr >> PAGE_SHIFT];
+    if (page)
+        return *(const uint8_t*)(page + addr);
+    return bus_read_slow(bus, addr);
+}
+
+inline void bus_write(MemoryMap *bus, uint16_t addr, uint8_t value) {
+    uintptr_t page = bus->write[(unsigned)addr >> PAGE_SHIFT];
+    if (page)
+        *(uint8_t*)(page + addr) = value;
+    else
+        bus_write_slow(bus, addr, value);
+}
+
+// Host address of addr if its page is direct, else null. Only good up to
+// the end of addr's page; bulk copies walk page by page.
+inline const uint8_t* bus_read_ptr(const MemoryMap *bus, uint16_t addr) {
+    uintptr_t page = bus->read[(unsigned)addr >> PAGE_SHIFT];
+    return page ? (const uint8_t*)(page + addr) : nullptr;
+}
+
+inline uint8_t* bus_write_ptr(const MemoryMap *bus, uint16_t addr) {
+    uintptr_t page = bus->write[(unsigned)addr >> PAGE_SHIFT];
+    return page ? (uint8_t*)(page + addr) : nullptr;
+}
+
+#endif
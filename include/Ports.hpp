@@ -0,0 +1,48 @@
+#ifndef PORTS_HPP
+#define PORTS_HPP
+
+#include <cstdint>
+
+// I/O port bus. in and out look their port up in a flat table of device
+// handlers hung off state->ports; with no bus, or no handler on a port,
+// reads see 0xff (a floating bus) and writes go nowhere. Most machines only
+// decode the low byte of the port address, so the default table has 256
+// entries indexed by it; a bus created full has one entry per 16-bit port
+// for machines that decode the upper byte (b of bc, or a for in a,(n)) too.
+
+// Either callback may be null, as for MmioHandler
+struct PortHandler {
+    uint8_t     (*read)(void *ctx, uint16_t port);
+    void        (*write)(void *ctx, uint16_t port, uint8_t value);
+    void        *ctx;
+};
+
+struct PortBus {
+    const PortHandler   **table;    // mask + 1 entries, after the header
+    uint32_t            mask;       // 0xff, or 0xffff for a full bus
+    uint32_t            readers;    // Entries with a read callback
+};
+
+// Null if out of memory
+PortBus* ports_create(bool full = false);
+void ports_free(PortBus *ports);
+
+// Put handler (null to detach) on port; on a 256-port bus only its low
+// byte counts
+void ports_map(PortBus *ports, uint16_t port, const PortHandler *handler);
+
+// Every port whose low byte is low, on either kind of bus
+void ports_map_low(PortBus *ports, uint8_t low, const PortHandler *handler);
+
+inline uint8_t port_read(const PortBus *ports, uint16_t port) {
+    const PortHandler *h = ports->table[port & ports->mask];
+    return h && h->read ? h->read(h->ctx, port) : 0xff;
+}
+
+inline void port_write(const PortBus *ports, uint16_t port, uint8_t value) {
+    const PortHandler *h = ports->table[port & ports->mask];
+    if (h && h->write)
+        h->write(h->ctx, port, value);
+}
+
+#endif
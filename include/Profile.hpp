@@ -0,0 +1,139 @@
+#ifndef PROFILE_HPP
+#define PROFILE_HPP
+
+#include <cstdint>
+#include <cstdio>
+
+#include "Z80.hpp"
+
+// Where emulated time goes. With state->profile set, every instruction is
+// counted, with the T-states it took, against its opcode, its pc and the
+// call stack it ran under. Counters are flat arrays indexed directly; the
+// call stack is a tree of frames keyed by call target, grown as calls are
+// seen (call, call cc and rst that pushed, and interrupts) and climbed on
+// returns (ret, ret cc, retn and reti that popped). Like tracing, profiling
+// runs in the core's instrumented loop.
+
+enum {
+    PROFILE_OPS     = 5 * 256,      // Unprefixed, CB, ED, DD/FD, DD/FD CB
+    PROFILE_FRAMES  = 1 << 16       // Call-tree nodes; deeper calls charge the caller
+};
+
+// Base of each opcode group in the per-opcode counters
+enum {
+    PROFILE_BASE    = 0,
+    PROFILE_CB      = 256,
+    PROFILE_ED      = 512,
+    PROFILE_XY      = 768,
+    PROFILE_XYCB    = 1024
+};
+
+struct ProfileFrame {
+    uint16_t    addr;           // Call target; 0 for the root
+    uint32_t    parent;
+    uint32_t    child;          // First callee, 0 if none
+    uint32_t    sibling;        // Next callee of parent, 0 if none
+    uint64_t    cycles;         // T-states spent in this frame itself
+};
+
+struct Profile {
+    uint64_t    op_count[PROFILE_OPS];
+    uint64_t    op_cycles[PROFILE_OPS];
+    uint64_t    pc_count[0x10000];
+    uint64_t    pc_cycles[0x10000];
+    ProfileFrame frames[PROFILE_FRAMES];    // frames[0] is the root
+    uint32_t    used;           // Frames in use
+    uint32_t    frame;          // Frame now running
+    uint64_t    dropped;        // Calls not given a frame because the tree was full
+    uint32_t    excess;         // Of those, ones still to return
+
+    // The instruction being run, charged when it has finished
+    bool        pending;
+    uint16_t    pc;
+    uint16_t    sp;
+    uint16_t    op;             // Counter index
+    uint64_t    cycles;         // state->cycles at its fetch
+};
+
+// Null if out of memory
+Profile* profile_create();
+void profile_free(Profile *p);
+
+// Start a frame for a call to addr under the current one (or find it)
+void profile_enter(Profile *p, uint16_t addr);
+
+// Tables sorted by T-states: opcodes, then the top pcs
+void profile_report(const Profile *p, FILE *out, unsigned top_pcs = 32);
+
+// One line per call stack with time of its own, "root;0x1234;0x5678 cycles",
+// as flamegraph.pl and similar tools read
+void profile_write_folded(const Profile *p, FILE *out);
+
+// Counter index of the instruction at pc, read without side effects
+inline uint16_t profile_opcode(const State *s) {
+    const uint8_t *p = bus_read_ptr(&s->bus, s->pc);
+    uint8_t op = p ? *p : 0xff;
+    if (op != 0xCB && op != 0xED && op != 0xDD && op != 0xFD)
+        return PROFILE_BASE + op;
+    p = bus_read_ptr(&s->bus, s->pc + 1);
+    uint8_t next = p ? *p : 0xff;
+    if (op == 0xCB)
+        return PROFILE_CB + next;
+    if (op == 0xED)
+        return PROFILE_ED + next;
+    if (next != 0xCB)
+        return PROFILE_XY + next;
+    p = bus_read_ptr(&s->bus, s->pc + 3);
+    return PROFILE_XYCB + (p ? *p : 0xff);
+}
+
+inline bool profile_is_call(uint16_t op) {
+    return op == 0xCD || (op < 256 && ((op & 0xC7) == 0xC4 || (op & 0xC7) == 0xC7));
+}
+
+inline bool profile_is_return(uint16_t op) {
+    return op == 0xC9 || (op < 256 && (op & 0xC7) == 0xC0)
+        || (op >= PROFILE_ED && op < PROFILE_XY && (op & 0xC7) == 0x45);
+}
+
+// Charge the instruction in flight to its opcode, pc and frame, and follow
+// it if it was a call or return that was taken. The core calls this at the
+// next fetch and when a run stops.
+inline void profile_retire(Profile *p, const State *s) {
+    uint64_t c = s->cycles - p->cycles;
+    p->pending = false;
+    p->op_count[p->op]++;
+    p->op_cycles[p->op] += c;
+    p->pc_count[p->pc]++;
+    p->pc_cycles[p->pc] += c;
+    p->frames[p->frame].cycles += c;
+    if (profile_is_call(p->op) && s->sp == (uint16_t)(p->sp - 2))
+        profile_enter(p, s->pc);
+    else if (profile_is_return(p->op) && s->sp == (uint16_t)(p->sp + 2)) {
+        if (p->excess)
+            p->excess--;
+        else
+            p->frame = p->frames[p->frame].parent;
+    }
+}
+
+// An accepted interrupt is a call to its handler, which also gets the
+// T-states of the acknowledge. The core retires the interrupted
+// instruction first.
+inline void profile_interrupt(Profile *p, const State *s, uint32_t cycles) {
+    profile_enter(p, s->pc);
+    p->frames[p->frame].cycles += cycles;
+}
+
+// Called at every fetch: charge the last instruction, note this one
+inline void profile_step(Profile *p, const State *s) {
+    if (p->pending)
+        profile_retire(p, s);
+    p->pending = true;
+    p->pc = s->pc;
+    p->sp = s->sp;
+    p->cycles = s->cycles;
+    p->op = profile_opcode(s);
+}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef ROM_HPP
+#define ROM_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Z80.hpp"
+
+// A ROM image mapped read-only from disk. The bytes are never copied until
+// they're loaded into a machine, and then only what can't be mapped.
+struct Rom {
+    const uint8_t   *data;      // Image bytes, size long
+    size_t          size;
+    int             fd;         // Kept open so rom_load can map pages again
+    void            *map;       // Whole mapping, for munmap
+    size_t          map_size;
+};
+
+// Map path read-only, keeping at most length bytes (0 = the whole file).
+// On failure returns false with errno set and leaves rom empty.
+bool rom_open(Rom *rom, const char *path, size_t length = 0);
+void rom_close(Rom *rom);
+
+// Place the image at org in state's memory. Whole pages at a page-aligned
+// org are mapped copy-on-write straight from the file; the rest is copied.
+// Returns false, leaving memory untouched, if the image doesn't fit.
+bool rom_load(State *state, const Rom *rom, uint32_t org);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Z80.hpp"
+
+// Machine snapshots on disk. A snapshot holds the registers, the run
+// counters and state->memory; the bus map (host pointers) and MMIO device
+// state aren't saved, and restoring maps memory as z80init does.
+//
+// Layout, all integers little-endian:
+//   "ZSNP"  u16 version  u16 header bytes (from the start of the file)
+//   registers: af af' bc de hl bc' de' hl' (u16 each, bank 0 first),
+//              af_bank gp_bank (u8), sp pc ix iy (u16),
+//              i r iff1 iff2 im halted (u8)
+//   u64 instructions  u64 cycles  u32 memory bytes
+//   int_line int_data nmi_pending (u8)  u64 ei_after (older files end
+//   the header before these)
+//   any later fields, which readers skip: the pages start at header bytes
+//   then one record per 1 KiB page of memory:
+//     0                 page is all zero
+//     1  <1024 bytes>   stored as-is
+//     2  <runs>         (u8 length-1, u8 byte) pairs covering the page
+enum {
+    SNAPSHOT_VERSION = 1
+};
+
+// Encode into / decode from a buffer. Decoding returns false and leaves
+// state alone if the data is truncated, corrupt or a newer version.
+void snapshot_encode(const State *state, std::vector<uint8_t> &out);
+bool snapshot_decode(State *state, const uint8_t *data, size_t size);
+
+// File wrappers. On failure return false with errno set (EINVAL for a file
+// that isn't a usable snapshot).
+bool snapshot_save(const State *state, const char *path);
+bool snapshot_restore(State *state, const char *path);
+
+#endif
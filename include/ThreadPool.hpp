@@ -0,0 +1,21 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <cstddef>
+#include <functional>
+
+// Run job(worker, i) for every i in [0, count) on up to threads threads
+// (0 = one per core) and return once all of them are done. worker is the
+// calling thread's index in [0, threads), so jobs can keep per-thread state
+// such as a reusable State.
+//
+// Each worker starts with a contiguous share of the indexes and takes from
+// the back of its own queue; one that runs dry steals from the front of the
+// fullest other queue. Jobs that finish early (a ROM that halts at once)
+// leave no thread idle while others still have work queued.
+void parallel_for(size_t count, unsigned threads, const std::function<void(unsigned, size_t)> &job);
+
+// Workers parallel_for would use for threads = 0
+unsigned default_threads();
+
+#endif
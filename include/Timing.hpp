@@ -0,0 +1,17 @@
+#ifndef TIMING_HPP
+#define TIMING_HPP
+
+#include <cstdint>
+
+// T-states per opcode, charged once the opcode byte has been fetched. Each
+// prefix table holds the full cost of its instructions, so the prefix byte
+// itself is 0 in the table that leads to it.
+extern const uint8_t cycles_op[256];        // Unprefixed; conditionals not taken
+extern const uint8_t cycles_op_taken[256];  // Extra for a taken jr/djnz/call/ret cc
+extern const uint8_t cycles_cb[256];        // CB xx
+extern const uint8_t cycles_ed[256];        // ED xx; block repeats on their last step
+extern const uint8_t cycles_ed_taken[256];  // Extra for a block repeat that loops
+extern const uint8_t cycles_xy[256];        // DD xx and FD xx
+extern const uint8_t cycles_xycb[256];      // DD CB d xx and FD CB d xx
+
+#endif
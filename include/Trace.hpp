@@ -0,0 +1,103 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+
+#include "Z80.hpp"
+
+// Binary instruction trace. With state->tracer set, the core appends one
+// fixed-size record per instruction to a single-producer ring buffer; a
+// writer thread drains it to the file in large sequential writes. The core
+// only pays for this in its tracing loop, which run() picks when tracer (or
+// the text trace) is set. zilog_trace decodes a file back to text.
+//
+// File layout: a TraceHeader, then TraceRecords back to back until the end
+// of the file. Both are written in host byte order; byte_order tells a
+// reader on the other kind of host to swap.
+
+enum {
+    TRACE_VERSION       = 1,
+    TRACE_BYTE_ORDER    = 0x01020304,
+    TRACE_RING_RECORDS  = 1 << 16       // Default ring size (2 MiB)
+};
+
+struct TraceHeader {
+    char        magic[4];           // "ZTRC"
+    uint16_t    version;
+    uint16_t    record_size;        // sizeof(TraceRecord)
+    uint32_t    byte_order;         // TRACE_BYTE_ORDER as written
+    uint32_t    reserved;
+};
+
+// The machine as the instruction at pc is fetched, before it runs
+struct TraceRecord {
+    uint64_t    cycles;             // T-states elapsed
+    uint16_t    pc;
+    uint16_t    sp;
+    uint16_t    af;                 // Live banks
+    uint16_t    bc;
+    uint16_t    de;
+    uint16_t    hl;
+    uint16_t    ix;
+    uint16_t    iy;
+    uint8_t     bytes[4];           // Memory at pc; 0xff where it isn't direct
+    uint8_t     r;
+    uint8_t     banks;              // af_bank | gp_bank << 1
+    uint8_t     reserved[2];
+};
+
+static_assert(sizeof(TraceHeader) == 16, "trace header layout");
+static_assert(sizeof(TraceRecord) == 32, "trace record layout");
+
+struct Tracer {
+    TraceRecord             *ring;
+    uint64_t                mask;           // Ring records - 1
+    std::atomic<uint64_t>   head{0};        // Records produced; only the core writes it
+    std::atomic<uint64_t>   tail{0};        // Records written out; only the writer moves it
+    std::atomic<bool>       stop{false};
+    std::atomic<bool>       failed{false};  // A write failed; later records are discarded
+    int                     error = 0;      // errno of the failed write
+    FILE                    *file;
+    std::thread             writer;
+    uint64_t                waits = 0;      // Times the core found the ring full
+};
+
+// Start a trace into path with a ring of at least records entries (rounded
+// up to a power of two). Null with errno set if the file can't be created.
+Tracer* trace_open(const char *path, uint32_t records = TRACE_RING_RECORDS);
+
+// Drain what's left, stop the writer and close the file. False with errno
+// set if any write failed.
+bool trace_close(Tracer *tracer);
+
+// Block until the writer has made room; out of line, the ring is rarely full
+void trace_wait(Tracer *tracer);
+
+inline void trace_record(Tracer *t, State *s) {
+    uint64_t h = t->head.load(std::memory_order_relaxed);
+    if (h - t->tail.load(std::memory_order_acquire) > t->mask)
+        trace_wait(t);
+    TraceRecord &rec = t->ring[h & t->mask];
+    rec.cycles = s->cycles;
+    rec.pc = s->pc;
+    rec.sp = s->sp;
+    rec.af = reg_af(s).w;
+    rec.bc = reg_bc(s).w;
+    rec.de = reg_de(s).w;
+    rec.hl = reg_hl(s).w;
+    rec.ix = s->ix.w;
+    rec.iy = s->iy.w;
+    for (int i = 0; i < 4; i++) {
+        const uint8_t *p = bus_read_ptr(&s->bus, s->pc + i);
+        rec.bytes[i] = p ? *p : 0xff;
+    }
+    rec.r = s->r;
+    rec.banks = s->af_bank | s->gp_bank << 1;
+    rec.reserved[0] = rec.reserved[1] = 0;
+    t->head.store(h + 1, std::memory_order_release);
+}
+
+#endif
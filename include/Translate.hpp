@@ -0,0 +1,130 @@
+#ifndef TRANSLATE_HPP
+#define TRANSLATE_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Memory.hpp"
+
+struct State;
+struct Jit;
+
+// Translation cache. Straight-line code is decoded once into a block of
+// micro-ops keyed by start pc; running a block skips the per-instruction
+// fetch, budget check and counter updates. A block ends at anything that
+// can move pc somewhere other than the next instruction (jumps, calls,
+// returns, rst, djnz, block repeats, halt), at ei, at ld a,r / ld r,a, and
+// at the end of its 1 KiB page. Blocks only start if they can finish before
+// state->stop_cycle, so events and interrupts land between blocks.
+//
+// Pages holding blocks are watched (WATCH_CODE). A write to a byte some
+// block was decoded from drops every block in that page; one that keeps
+// getting rewritten is left to the interpreter until the next flush.
+//
+// A block that is nothing but a counted delay loop branching back to its
+// own start (djnz $; dec r / jr nz,$; dec rr / ld a,hi / or lo / jr nz,$)
+// gets an extra first uop that runs all but the last pass at once. One that
+// spins on memory or a port (reads, tests, branches back to its start, and
+// writes nothing) gets a first uop that watches for a pass that starts with
+// the same registers as the one before: every later pass would too, until
+// an event changes something, so the passes up to state->stop_cycle are
+// charged at once.
+//
+// A block remembers the two blocks that ran after it (exits), so going on
+// to the next one is usually a compare rather than a map lookup. Even so,
+// code that is mostly one-instruction blocks (jr after jr) runs faster
+// through the plain interpreter. The executor looks at how many
+// instructions each BLOCK_SAMPLE entries ran; below BLOCK_SHORT apiece it
+// hands the next INTERPRET_SLICE instructions to the interpreter, then
+// looks again.
+
+// One instruction. Each micro-op stands in for the interpreter's fetch: the
+// executor sets pc past the opcode bytes and jumps to the handler, which
+// reads any operands itself. CB and ED instructions go straight to their
+// second-level handler; DD/FD ones go through the prefix handler as usual.
+struct Uop {
+    const void  *handler;   // Handler label
+    uint8_t     op;         // Opcode the handler sees
+    uint8_t     skip;       // Opcode bytes in front of the operands
+    uint8_t     cycles;     // T-states charged on block entry
+    uint8_t     m1;         // Opcode fetches charged on entry; 0 ends the block
+    uint16_t    pc;         // pc past the opcode bytes; unused if skip is 0
+};
+
+enum {
+    BLOCK_MAX_UOPS  = 64,       // Longest block, in instructions
+    BLOCK_SAMPLE    = 1024,     // Block entries per look at how far they get
+    BLOCK_SHORT     = 2,        // Instructions per entry blocks need to pay
+    INTERPRET_SLICE = 1 << 18   // Instructions interpreted before the next look
+};
+
+// Compiled block (Jit.hpp): runs while both limits allow, returns how many
+// of the block's instructions its last pass got through
+typedef uint32_t (*NativeBlock)(State *state, uint64_t limit, uint64_t cycle_limit);
+
+struct Block {
+    uint32_t    start;      // pc of the first instruction; 0x10000 once dropped
+    uint16_t    count;      // Instructions; 0 means "interpret this pc"
+    uint16_t    m1;         // Sum over uops, added to r on entry
+    uint32_t    cycles;     // Sum over uops, added to cycles on entry
+    uint32_t    lead;       // T-states before the last instruction starts
+    Block       *page_next; // Next block starting in the same page
+    uint32_t    hits;       // Entries, until the JIT looks at it
+    NativeBlock native;     // Compiled code, or null
+    Block       *exits[2];  // Blocks that ran next, tried before the map; tc->none if unset
+    Uop         *uops;      // count uops, then the end marker
+};
+
+// Handler addresses the executor hands in; they're labels inside it
+struct TcHandlers {
+    void* const *base;
+    void* const *cb;
+    void* const *ed;
+    const void  *end;       // Block finished: look up the next one
+    const void  *bail;      // Block was dropped while it ran
+    const void  *loop;      // Fast-forward a counted delay loop
+    const void  *idle;      // Fast-forward a spin-wait
+};
+
+struct TranslationCache {
+    Block       *map[0x10000];                  // Block starting at each pc, if any
+    Block       none;                           // Shared "interpret" entry
+    Block       *pages[PAGE_COUNT];             // Blocks starting in each page
+    uint64_t    code[PAGE_COUNT][PAGE_SIZE / 64];   // Bytes some block was decoded from
+    uint8_t     rewrites[PAGE_COUNT];           // Times a page's blocks were dropped
+    uint64_t    mapped;                         // Pages with map entries
+    uint32_t    epoch;                          // bus.epoch the cache matches
+    uint64_t    interpret;                      // Instructions left to the interpreter
+    TcHandlers  handlers;
+    MemoryMap   *bus;                           // Bus the write hook is on
+    Jit         *jit;                           // Compiled blocks, once State::jit asks
+    uint8_t     *arena;                         // Blocks and uops, bump allocated
+    size_t      used;
+
+    // Counters for tuning
+    uint64_t    translated;
+    uint64_t    dropped;
+    uint64_t    flushes;
+};
+
+// Create a cache for state and hook it to state's bus; tc_attach re-hooks
+// an existing cache after state was reset, dropping everything in it.
+TranslationCache* tc_create(State *state);
+void tc_attach(TranslationCache *tc, State *state);
+void tc_destroy(TranslationCache *tc);
+
+// Drop every block, e.g. after memory changed behind the bus
+void tc_flush(TranslationCache *tc, MemoryMap *bus);
+
+// Drop the blocks in addr's page, as a write to their code would, but
+// without counting it against the page. A running block is left before its
+// next instruction.
+void tc_drop(TranslationCache *tc, uint16_t addr);
+
+// Decode the block starting at pc. Returns &tc->none if pc can't be
+// translated (MMIO or aliased page, instruction crossing a page, a page
+// that keeps being rewritten, a breakpoint). The result is also stored in
+// map[pc]. Blocks end before any other breakpoint.
+Block* tc_translate(TranslationCache *tc, State *state, uint16_t pc);
+
+#endif
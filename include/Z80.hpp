@@ -0,0 +1,139 @@
+#ifndef Z80_HPP
+#define Z80_HPP
+
+#include <cstdint>
+#include <cstdio>
+
+#include "Flags.hpp"
+#include "Memory.hpp"
+
+struct TranslationCache;
+struct Tracer;
+struct Profile;
+struct Scheduler;
+struct PortBus;
+struct Debugger;
+
+// A register pair whose 8-bit halves share storage with the 16-bit value.
+// The half order follows the host byte order so w, b.h and b.l always agree.
+union Pair {
+    uint16_t    w;
+    struct {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        uint8_t h, l;
+#else
+        uint8_t l, h;
+#endif
+    } b;
+};
+
+// BC, DE and HL; exx switches between the two copies as a unit
+struct RegBank {
+    Pair        bc;
+    Pair        de;
+    Pair        hl;
+};
+
+struct State {
+    // Main and alternate registers in one block. Only the bank indexes
+    // move on ex af,af' and exx; use the reg_* accessors below.
+    Pair        af[2];      // a is the high byte, f (see Flags.hpp) the low byte
+    RegBank     gp[2];
+    uint8_t     af_bank;    // Live af[] entry
+    uint8_t     gp_bank;    // Live gp[] entry
+    LazyFlags   lazy;       // Pending update of the live f; read f through reg_f
+
+    // Special-Purpose Registers
+    uint16_t    sp;         // Stack pointer
+    uint16_t    pc;         // Program counter
+    Pair        ix;         // Index registers; the halves are the undocumented ixh/ixl
+    Pair        iy;
+    uint8_t     i;          // Interrupt register
+    uint8_t     r;          // Memory-refresh register
+    uint8_t     iff1;       // Interrupt enable flip-flops
+    uint8_t     iff2;
+    uint8_t     im;         // Interrupt mode 0, 1 or 2
+
+    // Interrupts. /INT is level triggered: each device holding it low owns a
+    // bit of int_line (see z80_int). /NMI is an edge.
+    uint8_t     int_line;       // Devices asserting /INT
+    uint8_t     int_data = 0xff; // On the data bus at acknowledge: IM 0 opcode, IM 2 vector low byte
+    uint8_t     nmi_pending;    // /NMI edge not taken yet
+    uint64_t    ei_after;       // instructions at the last ei; /INT waits until one more has run
+
+    // Run control
+    uint8_t     halted;         // Set by HALT, cleared by an interrupt or reset
+    uint8_t     trace;          // Print every fetched opcode (tracing loop only)
+    uint8_t     translate;      // Run through the translation cache (Translate.hpp)
+    uint8_t     jit;            // Compile hot blocks: JIT_OFF, JIT_ON or JIT_CHECK (Jit.hpp)
+    FILE        *trace_file;    // Where trace lines go; null means stdout
+    Tracer      *tracer;        // Binary trace of every instruction (Trace.hpp); null = off
+    Profile     *profile;       // Per-opcode, per-pc and call-stack counters (Profile.hpp); null = off
+    uint64_t    instructions;   // Instructions retired since init
+    uint64_t    cycles;         // T-states elapsed since init
+    uint64_t    stop_cycle;     // The running core stops here for events, interrupts or its budget
+    Scheduler   *events;        // Device callbacks by T-state (Events.hpp); null = none
+    PortBus     *ports;         // Devices on in and out (Ports.hpp); null = none
+    Debugger    *debug;         // Breakpoints and watchpoints (Debug.hpp); null = none
+    TranslationCache *tc;       // Created on first run; not shared between States
+
+    // The core only goes through bus. memory is the 64 KiB of RAM that z80init
+    // maps across the whole bus; loaders fill it directly.
+    MemoryMap   bus;
+    uint8_t     *memory;    // Loc of memory
+    uint32_t    mem_size = 0x10000;
+};
+
+// Why run() handed control back to the caller
+enum StopReason {
+    STOP_BUDGET,        // Instruction or cycle budget spent
+    STOP_HALT,          // Executed HALT
+    STOP_BREAKPOINT,    // pc is at a breakpoint (Debug.hpp)
+    STOP_WATCHPOINT     // The last instruction touched a watched address
+};
+
+// z80 functions
+State* z80init(void);
+void z80free(State *state);
+void z80reset(State *state);     // Zero registers, counters and memory; default map
+StopReason run(State *state, uint64_t max_instructions);
+StopReason run_cycles(State *state, uint64_t max_cycles);
+StopReason run_budgets(State *state, uint64_t max_instructions, uint64_t max_cycles);
+int emulate(State *state);
+const char* stop_reason_name(StopReason reason);
+
+// Interrupt lines, for devices. z80_int asserts or releases source's bit(s)
+// of /INT; the CPU takes it at an instruction boundary while iff1 is set,
+// but not straight after ei. Put the acknowledge byte in int_data first.
+// z80_nmi is an edge, taken at the next boundary whatever iff1 says.
+void z80_int(State *state, uint8_t source, bool asserted);
+void z80_nmi(State *state);
+
+// Fold a deferred ALU result into the live f. Set ZILOG_NO_LAZY_FLAGS to
+// build f on every op instead.
+inline void flags_settle(State *state) {
+    if (state->lazy.op != FLAGS_READY) {
+        state->af[state->af_bank].b.l = flags_eval(state->lazy);
+        state->lazy.op = FLAGS_READY;
+    }
+}
+
+// The live f without settling it, for callers that can't write
+inline uint8_t flags_peek(const State *state) {
+    return state->lazy.op != FLAGS_READY ? flags_eval(state->lazy) : state->af[state->af_bank].b.l;
+}
+
+// Live register accessors. reg_af and reg_f settle f first; reg_a doesn't need to.
+inline Pair& reg_af(State *state) { flags_settle(state); return state->af[state->af_bank]; }
+inline Pair& reg_bc(State *state) { return state->gp[state->gp_bank].bc; }
+inline Pair& reg_de(State *state) { return state->gp[state->gp_bank].de; }
+inline Pair& reg_hl(State *state) { return state->gp[state->gp_bank].hl; }
+inline uint8_t& reg_a(State *state) { return state->af[state->af_bank].b.h; }
+inline uint8_t& reg_f(State *state) { return reg_af(state).b.l; }
+
+// Auxilliary Emulator functions
+// F is stored packed once settled, so PUSH AF/POP AF move it as-is
+inline uint8_t flagstoInt(State *state) { return reg_f(state); }
+inline void inttoFlags(State *state, uint8_t f) { reg_f(state) = f; }
+
+#endif
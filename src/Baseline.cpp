@@ -0,0 +1,82 @@
+#include "Baseline.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+#include "Debug.hpp"
+#include "Events.hpp"
+#include "Translate.hpp"
+
+// Host memory behind page p if the bus can write it, else null. A page
+// being watched for other reasons keeps its entry parked.
+static inline uint8_t* page_host(const MemoryMap *bus, unsigned p) {
+    uintptr_t entry = bus->write[p] ? bus->write[p] : bus->parked[p];
+    return entry ? (uint8_t*)(entry + ((uintptr_t)p << PAGE_SHIFT)) : nullptr;
+}
+
+bool baseline_capture(Baseline *base, State *state) {
+    if (!base->pages) {
+        base->pages = (uint8_t*)malloc(PAGE_COUNT * PAGE_SIZE);
+        if (!base->pages)
+            return false;
+    }
+
+    // The stored map shouldn't carry a previous baseline's tracking
+    bus_untrack_writes(&state->bus);
+    base->regs = *state;
+    for (unsigned p = 0; p < PAGE_COUNT; p++) {
+        uint8_t *host = page_host(&state->bus, p);
+        if (host)
+            memcpy(base->pages + p * PAGE_SIZE, host, PAGE_SIZE);
+    }
+    base->regs.bus.dirty = 0;
+    bus_track_writes(&state->bus);
+    return true;
+}
+
+unsigned baseline_restore(State *state, const Baseline *base) {
+    // Dirty bits name pages of the baseline map; after a remap every bit is
+    // set and the whole image goes back.
+    uint64_t dirty = state->bus.dirty;
+    uint32_t epoch = state->bus.epoch;
+    unsigned copied = 0;
+    for (unsigned p = 0; p < PAGE_COUNT; p++) {
+        uint8_t *host = page_host(&base->regs.bus, p);
+        if (host && (dirty >> p & 1)) {
+            memcpy(host, base->pages + p * PAGE_SIZE, PAGE_SIZE);
+            copied++;
+        }
+    }
+    // The copies went behind the bus, so the epoch moves on rather than
+    // back to the captured one. The translation cache, any trace, any
+    // profile, the port bus and any debugger belong to state, not to the
+    // image; the cache and debugger are re-hooked to the restored bus (the
+    // cache emptied), and the others carry on. The scheduler is kept too, but emptied as
+    // z80reset does: its events were timed against the cycles being left.
+    TranslationCache *tc = state->tc;
+    Tracer *tracer = state->tracer;
+    Profile *profile = state->profile;
+    Debugger *debug = state->debug;
+    Scheduler *events = state->events;
+    PortBus *ports = state->ports;
+    *state = base->regs;
+    state->bus.epoch = epoch + 1;
+    state->tc = tc;
+    state->tracer = tracer;
+    state->profile = profile;
+    state->events = events;
+    state->ports = ports;
+    if (events)
+        events->count = 0;
+    if (tc)
+        tc_attach(tc, state);
+    if (debug)
+        debug_attach(state, debug);
+    bus_track_writes(&state->bus);
+    return copied;
+}
+
+void baseline_free(Baseline *base) {
+    free(base->pages);
+    base->pages = nullptr;
+}
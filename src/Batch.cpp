@@ -0,0 +1,573 @@
+#include "Batch.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "Console.hpp"
+#include "Debug.hpp"
+#include "Events.hpp"
+#include "Jit.hpp"
+#include "Lockstep.hpp"
+#include "Ports.hpp"
+#include "Profile.hpp"
+#include "Rom.hpp"
+#include "Snapshot.hpp"
+#include "ThreadPool.hpp"
+#include "Trace.hpp"
+#include "Z80.hpp"
+
+// Exit codes, so scripts can tell how a ROM finished without parsing
+enum BatchExit {
+    EXIT_HALTED = 0,    // Ran to HALT
+    EXIT_USAGE = 1,     // Bad arguments or unreadable ROM
+    EXIT_BUDGET = 2,    // Cycle or instruction budget ran out first
+    EXIT_BREAK = 4      // Stopped at a breakpoint or watchpoint (3 is unused)
+};
+
+// How bad a status is when several ROMs report one: a ROM that didn't load
+// is the worst, then the ones that didn't run to the end, HALT the least
+static int severity(int status) {
+    switch (status) {
+        case EXIT_HALTED: return 0;
+        case EXIT_BUDGET: return 1;
+        case EXIT_BREAK: return 2;
+    }
+    return 3;
+}
+
+struct BatchOptions {
+    std::vector<std::string> roms;          // One job each
+    unsigned    jobs = 0;                   // Worker threads; 0 = one per core
+    bool        many = false;               // Per-job lines plus a totals line
+    const char  *restore = nullptr;         // Snapshot every job starts from
+    const char  *save = nullptr;            // Snapshot to write when the run stops
+    const char  *trace = nullptr;           // Binary instruction trace of the run
+    const char  *profile = nullptr;         // Opcode and pc report
+    const char  *folded = nullptr;          // Folded call stacks for flame graphs
+    uint32_t    org = 0;                    // Load address
+    uint64_t    length = 0;                 // Bytes of the ROM to load; 0 = all
+    uint32_t    entry = 0;                  // Initial pc; defaults to org
+    bool        entry_set = false;
+    uint64_t    max_cycles = UINT64_MAX;
+    uint64_t    max_instructions = UINT64_MAX;
+    uint8_t     jit = JIT_OFF;              // --jit, --jit-check
+    bool        lockstep = false;           // Run the jobs in lockstep gangs
+    uint64_t    int_every = 0;              // T-states between timer interrupts; 0 = none
+    uint16_t    console_port = 0;           // Port guest output goes to stdout from
+    bool        console = false;
+    std::vector<uint16_t> breaks;           // --break pcs
+    std::vector<uint16_t> watch_writes;     // --watch addresses
+    std::vector<uint16_t> watch_reads;      // --watch-read addresses
+};
+
+enum {
+    BATCH_INT_HOLD = 32         // T-states the timer holds /INT down
+};
+
+static void usage() {
+    fprintf(stderr,
+        "usage: Zilog [--restore snap] [--run rom.bin] [--org addr] [--length n] [--pc addr]\n"
+        "             [--max-cycles n] [--max-instructions n] [--save snap] [--trace file]\n"
+        "             [--profile file] [--folded file] [--jit | --jit-check] [--lockstep]\n"
+        "             [--int-every n] [--console port] [--break addr] [--watch addr]\n"
+        "             [--watch-read addr]\n"
+        "       Zilog [--restore snap] --run rom.bin --run ... | --list file [--jobs n] [options]\n"
+        "Loads rom.bin (or its first n bytes) at org (default 0), runs from pc (default org) until HALT\n"
+        "or a budget runs out, and prints a JSON summary. --restore starts from a snapshot instead\n"
+        "(any ROM is loaded over it, and pc is kept unless --pc is given); --save writes one when\n"
+        "the run stops. --trace records every instruction to a binary file for zilog_trace.\n"
+        "--profile writes T-states per opcode and per pc, --folded the time per call stack in\n"
+        "flame graph input format; either runs the profiling (interpreted) loop.\n"
+        "Exit status: 0 halted, 1 usage or load error, 2 budget exhausted, 4 breakpoint or\n"
+        "watchpoint.\n"
+        "With several ROMs (repeated --run, or --list naming one per line) each is a separate\n"
+        "machine; they run on --jobs threads (default one per core), a JSON line per ROM is\n"
+        "printed in order, then a totals line. Exit status is the worst of any ROM, from\n"
+        "worst: load error, breakpoint, budget, halt.\n"
+        "--jit compiles hot blocks to native code; --jit-check also replays each native run\n"
+        "through the interpreter and reports any difference on stderr.\n"
+        "--lockstep loads every ROM into its own machine and runs them together, many lanes at\n"
+        "a time, executing each instruction the lanes share once for all of them; results are\n"
+        "the same as without it. Meant for many runs of one program on different inputs.\n"
+        "--int-every n pulls /INT low for 32 T-states every n T-states, like a frame interrupt;\n"
+        "the data bus reads 0xff at acknowledge.\n"
+        "--console port sends bytes the program writes with out to that port to stdout, buffered\n"
+        "and written when the run finishes (before the JSON); ports above 0xff match all 16 bits.\n"
+        "--break addr stops before the instruction at addr, --watch addr after one that writes\n"
+        "addr, --watch-read addr after one that reads it; each can be repeated.\n");
+}
+
+// Numbers take any base std::stoull understands (0x10, 16, 020)
+static bool parse_number(const char *text, uint64_t max, uint64_t &out) {
+    try {
+        size_t used = 0;
+        unsigned long long v = std::stoull(text, &used, 0);
+        if (text[used] != '\0' || v > max)
+            return false;
+        out = v;
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+static bool parse_args(int argc, char* argv[], BatchOptions &opt) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h")
+            return false;
+        if (arg == "--jit" || arg == "--jit-check") {
+            opt.jit = arg == "--jit" ? JIT_ON : JIT_CHECK;
+            continue;
+        }
+        if (arg == "--lockstep") {
+            opt.lockstep = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "error: %s needs a value\n", argv[i]);
+            return false;
+        }
+        const char *value = argv[++i];
+        uint64_t n = 0;
+        if (arg == "--run") {
+            opt.roms.push_back(value);
+            continue;
+        }
+        if (arg == "--list") {
+            std::ifstream list(value);
+            std::string line;
+            if (!list) {
+                fprintf(stderr, "error: couldn't open %s: %s\n", value, strerror(errno));
+                return false;
+            }
+            while (std::getline(list, line))
+                if (!line.empty())
+                    opt.roms.push_back(line);
+            opt.many = true;
+            continue;
+        }
+        if (arg == "--restore") {
+            opt.restore = value;
+            continue;
+        }
+        if (arg == "--save") {
+            opt.save = value;
+            continue;
+        }
+        if (arg == "--trace") {
+            opt.trace = value;
+            continue;
+        }
+        if (arg == "--profile") {
+            opt.profile = value;
+            continue;
+        }
+        if (arg == "--folded") {
+            opt.folded = value;
+            continue;
+        }
+        bool address = arg == "--org" || arg == "--pc" || arg == "--console"
+            || arg == "--break" || arg == "--watch" || arg == "--watch-read";
+        if (!parse_number(value, address ? 0xffff : UINT64_MAX, n)) {
+            fprintf(stderr, "error: bad value for %s: %s\n", argv[i - 1], value);
+            return false;
+        }
+        if (arg == "--org") opt.org = n;
+        else if (arg == "--length") opt.length = n;
+        else if (arg == "--pc") { opt.entry = n; opt.entry_set = true; }
+        else if (arg == "--max-cycles") opt.max_cycles = n;
+        else if (arg == "--max-instructions") opt.max_instructions = n;
+        else if (arg == "--jobs") opt.jobs = n;
+        else if (arg == "--int-every") opt.int_every = n;
+        else if (arg == "--console") { opt.console_port = n; opt.console = true; }
+        else if (arg == "--break") opt.breaks.push_back(n);
+        else if (arg == "--watch") opt.watch_writes.push_back(n);
+        else if (arg == "--watch-read") opt.watch_reads.push_back(n);
+        else {
+            fprintf(stderr, "error: unknown option %s\n", argv[i - 1]);
+            return false;
+        }
+    }
+    if (opt.roms.empty() && !opt.restore) {
+        fprintf(stderr, "error: no ROM or snapshot given\n");
+        return false;
+    }
+    if (opt.roms.size() > 1)
+        opt.many = true;
+    // Several jobs' console output would come out in whatever order they finish
+    if (opt.many && (opt.save || opt.trace || opt.profile || opt.folded || opt.console)) {
+        fprintf(stderr, "error: --save, --trace, --profile, --folded and --console take a single run\n");
+        return false;
+    }
+    if (opt.lockstep && (opt.trace || opt.profile || opt.folded)) {
+        fprintf(stderr, "error: --trace, --profile and --folded don't work with --lockstep\n");
+        return false;
+    }
+    // A snapshot with no ROM is still one job
+    if (opt.roms.empty())
+        opt.roms.push_back("");
+    if (!opt.entry_set && !opt.restore)
+        opt.entry = opt.org;
+    return true;
+}
+
+// On failure leaves a message in error
+static bool load_rom(State *state, const char *path, const BatchOptions &opt, std::string &error) {
+    Rom rom;
+    char text[256];
+    if (!rom_open(&rom, path, opt.length)) {
+        snprintf(text, sizeof(text), "couldn't open %s: %s", path, strerror(errno));
+        error = text;
+        return false;
+    }
+    bool ok = rom_load(state, &rom, opt.org);
+    if (!ok) {
+        snprintf(text, sizeof(text), "%s (%zu bytes) doesn't fit at %04x", path, rom.size, opt.org);
+        error = text;
+    }
+    rom_close(&rom);
+    return ok;
+}
+
+// Append name to out as a JSON string body. Control characters (a newline
+// in a file name, say) aren't allowed raw in a JSON string.
+static void append_escaped(std::string &out, const std::string &name) {
+    for (char c : name) {
+        if ((unsigned char)c < 0x20) {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", (unsigned char)c);
+            out += code;
+            continue;
+        }
+        if (c == '"' || c == '\\')
+            out += '\\';
+        out += c;
+    }
+}
+
+static std::string summary_json(const std::string &name, State *state, StopReason why, double seconds) {
+    State *s = state;
+    char text[512];
+    std::string out = "{\"rom\":\"";
+    append_escaped(out, name);
+    snprintf(text, sizeof(text),
+             "\",\"stop\":\"%s\","
+             "\"pc\":%u,\"sp\":%u,\"af\":%u,\"bc\":%u,\"de\":%u,\"hl\":%u,"
+             "\"af_\":%u,\"bc_\":%u,\"de_\":%u,\"hl_\":%u,"
+             "\"ix\":%u,\"iy\":%u,\"i\":%u,\"r\":%u,\"iff1\":%u,\"iff2\":%u,\"im\":%u,"
+             "\"cycles\":%llu,\"instructions\":%llu,\"wall_seconds\":%.6f}",
+             stop_reason_name(why),
+             s->pc, s->sp, reg_af(s).w, reg_bc(s).w, reg_de(s).w, reg_hl(s).w,
+             s->af[s->af_bank ^ 1].w, s->gp[s->gp_bank ^ 1].bc.w,
+             s->gp[s->gp_bank ^ 1].de.w, s->gp[s->gp_bank ^ 1].hl.w,
+             s->ix.w, s->iy.w, s->i, s->r, s->iff1, s->iff2, s->im,
+             (unsigned long long)s->cycles, (unsigned long long)s->instructions, seconds);
+    return out + text;
+}
+
+static int exit_code(StopReason why) {
+    switch (why) {
+        case STOP_HALT: return EXIT_HALTED;
+        case STOP_BUDGET: return EXIT_BUDGET;
+        case STOP_BREAKPOINT:
+        case STOP_WATCHPOINT: return EXIT_BREAK;
+    }
+    return EXIT_USAGE;
+}
+
+// What one ROM run left behind, filled in by whichever worker ran it
+struct JobResult {
+    std::string line;           // JSON summary, or the error for a failed load
+    int         status = EXIT_USAGE;
+    StopReason  why = STOP_BUDGET;
+    uint64_t    cycles = 0;
+    uint64_t    instructions = 0;
+};
+
+// Everything a job needs; the snapshot is mapped once and decoded per job
+struct BatchJobs {
+    const BatchOptions      *opt;
+    Rom                     snapshot;
+    std::vector<State*>     machines;   // One per worker, reused across jobs (one per job in lockstep)
+    std::vector<Console*>   consoles;   // --console: each job's, until it finishes
+    unsigned                threads;
+    std::vector<JobResult>  results;
+};
+
+static bool write_report(const char *path, const Profile *p, void (*write)(const Profile*, FILE*),
+                         std::string &error) {
+    FILE *f = fopen(path, "w");
+    if (f) {
+        write(p, f);
+        if (fclose(f) == 0)
+            return true;
+    }
+    error = std::string("couldn't write ") + path + ": " + strerror(errno);
+    return false;
+}
+
+static void write_tables(const Profile *p, FILE *f) {
+    profile_report(p, f);
+}
+
+// On failure leaves a message in error
+static bool write_profile(const Profile *p, const BatchOptions &opt, std::string &error) {
+    if (opt.profile && !write_report(opt.profile, p, write_tables, error))
+        return false;
+    return !opt.folded || write_report(opt.folded, p, profile_write_folded, error);
+}
+
+// --int-every: a timer on its own scheduler, context pointing at the period
+static void timer_release(State *state, void *, uint64_t) {
+    z80_int(state, 1, false);
+}
+
+static void timer_tick(State *state, void *context, uint64_t when) {
+    z80_int(state, 1, true);
+    event_schedule(state, when + BATCH_INT_HOLD, timer_release, nullptr);
+    event_schedule(state, when + *(const uint64_t*)context, timer_tick, context);
+}
+
+// Reset (or create) state and set it up for job index. On failure leaves the
+// error in the job's result and returns false.
+static bool prepare_job(BatchJobs &b, State *&state, size_t index) {
+    const BatchOptions &opt = *b.opt;
+    const std::string &rom = opt.roms[index];
+    JobResult &result = b.results[index];
+
+    if (!state)
+        state = z80init();
+    else
+        z80reset(state);
+    if (!state) {
+        result.line = "out of memory";
+        return false;
+    }
+    if (opt.restore && !snapshot_decode(state, b.snapshot.data, b.snapshot.size)) {
+        result.line = std::string(opt.restore) + " isn't a usable snapshot";
+        return false;
+    }
+    if (!rom.empty() && !load_rom(state, rom.c_str(), opt, result.line))
+        return false;
+    if (opt.entry_set || !opt.restore)
+        state->pc = opt.entry;
+    state->jit = opt.jit;
+    if (opt.int_every) {
+        if (!state->events && !(state->events = events_create())) {
+            result.line = "out of memory";
+            return false;
+        }
+        event_schedule(state, state->cycles + opt.int_every, timer_tick, (void*)&opt.int_every);
+    }
+    if (opt.trace && !(state->tracer = trace_open(opt.trace))) {
+        result.line = std::string("couldn't create ") + opt.trace + ": " + strerror(errno);
+        return false;
+    }
+
+    if ((opt.profile || opt.folded) && !(state->profile = profile_create())) {
+        result.line = "out of memory";
+        return false;
+    }
+    if (opt.console) {
+        // A port above 0xff needs the upper byte decoded too
+        bool full = opt.console_port > 0xff;
+        if (!state->ports && !(state->ports = ports_create(full))) {
+            result.line = "out of memory";
+            return false;
+        }
+        if (!(b.consoles[index] = console_create(STDOUT_FILENO))) {
+            result.line = "out of memory";
+            return false;
+        }
+        ports_map(state->ports, opt.console_port, &b.consoles[index]->handler);
+    }
+    if (!opt.breaks.empty() || !opt.watch_writes.empty() || !opt.watch_reads.empty()) {
+        // A reused machine keeps its debugger, and its points, across resets
+        if (!state->debug) {
+            Debugger *debug = debug_create();
+            if (!debug) {
+                result.line = "out of memory";
+                return false;
+            }
+            debug_attach(state, debug);
+        }
+        for (uint16_t pc : opt.breaks)
+            debug_break(state, pc, true);
+        for (uint16_t addr : opt.watch_writes)
+            debug_watch(state, addr, DEBUG_WRITE, true);
+        for (uint16_t addr : opt.watch_reads)
+            debug_watch(state, addr, DEBUG_READ, true);
+    }
+    return true;
+}
+
+// Flush the console, close the trace, write the profile and build the
+// summary once the run that stopped for why has finished
+static void finish_job(BatchJobs &b, State *state, size_t index, StopReason why, double seconds) {
+    const BatchOptions &opt = *b.opt;
+    const std::string &rom = opt.roms[index];
+    const std::string &name = rom.empty() ? std::string(opt.restore) : rom;
+    JobResult &result = b.results[index];
+
+    result.why = why;
+    if (Console *console = b.consoles[index]) {
+        bool ok = console_close(console);
+        b.consoles[index] = nullptr;
+        ports_map(state->ports, opt.console_port, nullptr);
+        if (!ok) {
+            result.line = std::string("couldn't write the console output: ") + strerror(errno);
+            return;
+        }
+    }
+    if (state->tracer) {
+        bool ok = trace_close(state->tracer);
+        state->tracer = nullptr;
+        if (!ok) {
+            result.line = std::string("couldn't write ") + opt.trace + ": " + strerror(errno);
+            return;
+        }
+    }
+    if (state->profile) {
+        bool ok = write_profile(state->profile, opt, result.line);
+        profile_free(state->profile);
+        state->profile = nullptr;
+        if (!ok)
+            return;
+    }
+
+    result.line = summary_json(name, state, why, seconds);
+    result.status = exit_code(why);
+    result.cycles = state->cycles;
+    result.instructions = state->instructions;
+}
+
+static void run_job(BatchJobs &b, unsigned worker, size_t index) {
+    State *&state = b.machines[worker];
+    if (!prepare_job(b, state, index))
+        return;
+    auto t0 = std::chrono::steady_clock::now();
+    StopReason why = run_budgets(state, b.opt->max_instructions, b.opt->max_cycles);
+    auto t1 = std::chrono::steady_clock::now();
+    finish_job(b, state, index, why, std::chrono::duration<double>(t1 - t0).count());
+}
+
+// --lockstep: a machine per job, all set up first and then run together in
+// lockstep gangs; each job's wall time is its gang's
+static void run_lockstep(BatchJobs &b, unsigned threads) {
+    const BatchOptions &opt = *b.opt;
+    b.machines.assign(opt.roms.size(), nullptr);
+    std::vector<char> ready(opt.roms.size());
+    parallel_for(opt.roms.size(), threads, [&](unsigned, size_t i) {
+        ready[i] = prepare_job(b, b.machines[i], i);
+    });
+
+    std::vector<State*> states;
+    std::vector<size_t> jobs;
+    for (size_t i = 0; i < opt.roms.size(); i++) {
+        if (ready[i]) {
+            states.push_back(b.machines[i]);
+            jobs.push_back(i);
+        }
+    }
+    std::vector<StopReason> why(states.size());
+    std::vector<double> seconds(states.size());
+    lockstep_run(states.data(), states.size(), opt.max_instructions, opt.max_cycles,
+                 why.data(), seconds.data(), threads);
+    for (size_t k = 0; k < states.size(); k++)
+        finish_job(b, states[k], jobs[k], why[k], seconds[k]);
+}
+
+// Per-ROM lines in --run/--list order, then the totals
+static int report_many(const BatchJobs &b, double seconds) {
+    const BatchOptions &opt = *b.opt;
+    size_t counts[4] = {};      // halt, budget, error, breakpoint or watchpoint
+    uint64_t cycles = 0, instructions = 0;
+    int status = EXIT_HALTED;
+    for (size_t i = 0; i < b.results.size(); i++) {
+        const JobResult &r = b.results[i];
+        if (r.status == EXIT_USAGE) {
+            std::string line = "{\"rom\":\"";
+            append_escaped(line, opt.roms[i].empty() ? std::string(opt.restore) : opt.roms[i]);
+            line += "\",\"error\":\"";
+            append_escaped(line, r.line);
+            printf("%s\"}\n", line.c_str());
+            counts[2]++;
+        } else {
+            printf("%s\n", r.line.c_str());
+            counts[r.why == STOP_HALT ? 0 : r.why == STOP_BUDGET ? 1 : 3]++;
+        }
+        cycles += r.cycles;
+        instructions += r.instructions;
+        if (severity(r.status) > severity(status))
+            status = r.status;
+    }
+    printf("{\"jobs\":%zu,\"threads\":%zu,\"halted\":%zu,\"budget\":%zu,\"errors\":%zu,"
+           "\"breakpoint\":%zu,\"cycles\":%llu,\"instructions\":%llu,\"wall_seconds\":%.6f,\"mips\":%.2f}\n",
+           b.results.size(), (size_t)b.threads, counts[0], counts[1], counts[2], counts[3],
+           (unsigned long long)cycles, (unsigned long long)instructions, seconds,
+           seconds > 0 ? instructions / seconds / 1e6 : 0.0);
+    return status;
+}
+
+int batch_main(int argc, char* argv[]) {
+    BatchOptions opt;
+    if (!parse_args(argc, argv, opt)) {
+        usage();
+        return EXIT_USAGE;
+    }
+
+    BatchJobs b;
+    b.opt = &opt;
+    if (opt.restore && !rom_open(&b.snapshot, opt.restore)) {
+        fprintf(stderr, "error: couldn't restore %s: %s\n", opt.restore, strerror(errno));
+        return EXIT_USAGE;
+    }
+    unsigned threads = opt.jobs ? opt.jobs : default_threads();
+    if (threads > opt.roms.size())
+        threads = opt.roms.size();
+    b.threads = threads;
+    b.machines.assign(threads, nullptr);
+    b.results.resize(opt.roms.size());
+    b.consoles.assign(opt.roms.size(), nullptr);
+
+    auto t0 = std::chrono::steady_clock::now();
+    if (opt.lockstep)
+        run_lockstep(b, threads);
+    else
+        parallel_for(opt.roms.size(), threads, [&](unsigned worker, size_t i) { run_job(b, worker, i); });
+    auto t1 = std::chrono::steady_clock::now();
+
+    int status = EXIT_USAGE;
+    if (opt.many) {
+        status = report_many(b, std::chrono::duration<double>(t1 - t0).count());
+    } else if (b.results[0].status == EXIT_USAGE) {
+        fprintf(stderr, "error: %s\n", b.results[0].line.c_str());
+    } else {
+        printf("%s\n", b.results[0].line.c_str());
+        status = b.results[0].status;
+        if (opt.save && !snapshot_save(b.machines[0], opt.save)) {
+            fprintf(stderr, "error: couldn't save %s: %s\n", opt.save, strerror(errno));
+            status = EXIT_USAGE;
+        }
+    }
+
+    for (State *state : b.machines) {
+        if (state) {
+            events_free(state->events);
+            ports_free(state->ports);
+            debug_free(state->debug);
+        }
+        z80free(state);
+    }
+    if (opt.restore)
+        rom_close(&b.snapshot);
+    return status;
+}
@@ -0,0 +1,57 @@
+#include "Console.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+
+static void console_write(void *ctx, uint16_t, uint8_t value) {
+    Console *c = (Console*)ctx;
+    if (c->used == c->size)
+        console_flush(c);
+    c->buffer[c->used++] = value;
+    c->bytes++;
+}
+
+Console* console_create(int fd, size_t size) {
+    Console *c = (Console*)calloc(1, sizeof(Console));
+    if (!c)
+        return nullptr;
+    c->buffer = (uint8_t*)malloc(size ? size : 1);
+    if (!c->buffer) {
+        free(c);
+        return nullptr;
+    }
+    c->handler = { nullptr, console_write, c };
+    c->fd = fd;
+    c->size = size ? size : 1;
+    return c;
+}
+
+bool console_flush(Console *c) {
+    size_t done = 0;
+    while (!c->error && done < c->used) {
+        ssize_t n = write(c->fd, c->buffer + done, c->used - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            c->error = n < 0 ? errno : EIO;
+        else
+            done += n;
+    }
+    if (c->used)
+        c->flushes++;
+    c->used = 0;
+    errno = c->error ? c->error : errno;
+    return !c->error;
+}
+
+bool console_close(Console *c) {
+    if (!c)
+        return true;
+    bool ok = console_flush(c);
+    int err = errno;
+    free(c->buffer);
+    free(c);
+    errno = err;
+    return ok;
+}
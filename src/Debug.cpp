@@ -0,0 +1,124 @@
+#include "Debug.hpp"
+
+#include <cstdlib>
+
+#include "Translate.hpp"
+
+Debugger* debug_create() {
+    return (Debugger*)calloc(1, sizeof(Debugger));
+}
+
+void debug_free(Debugger *debug) {
+    free(debug);
+}
+
+static inline bool test(const uint64_t *bits, uint16_t addr) {
+    return bits[addr >> 6] >> (addr & 63) & 1;
+}
+
+// Set or clear addr's bit; false if it already was
+static bool change(uint64_t *bits, uint16_t addr, bool on) {
+    uint64_t mask = 1ull << (addr & 63);
+    if (!(bits[addr >> 6] & mask) == !on)
+        return false;
+    bits[addr >> 6] ^= mask;
+    return true;
+}
+
+// Bus hook for accesses to a watched page. Only the first hit of a run is
+// kept. Stopping at cycle 0 makes the next check anywhere in the core stop,
+// and dropping the page pc is in takes the executor out of the running
+// block after this instruction.
+static void watch_hit(void *ctx, uint16_t addr, uint8_t value, bool write) {
+    State *s = (State*)ctx;
+    Debugger *d = s->debug;
+    if (!d || d->hit || !test(write ? d->writes : d->reads, addr))
+        return;
+    d->hit = true;
+    d->last = WatchHit{ addr, value, write };
+    s->stop_cycle = 0;
+    if (s->tc)
+        tc_drop(s->tc, s->pc - 1);
+}
+
+// Bring page p's traps in line with its watchpoints
+static void watch_page(MemoryMap *bus, const Debugger *d, unsigned p) {
+    uint8_t flags = (d->page_reads[p] ? WATCH_READS : 0) | (d->page_writes[p] ? WATCH_WRITES : 0);
+    bus_unwatch(bus, p, (WATCH_READS | WATCH_WRITES) & ~flags);
+    if (flags)
+        bus_watch(bus, p, flags);
+}
+
+// Bus hook for a remapped page
+static void watch_remap(void *ctx, unsigned p) {
+    State *s = (State*)ctx;
+    if (s->debug)
+        watch_page(&s->bus, s->debug, p);
+}
+
+static void watch_pages(State *state, Debugger *d) {
+    MemoryMap *bus = &state->bus;
+    bus->watch_hit = watch_hit;
+    bus->watch_remap = watch_remap;
+    bus->watch_ctx = state;
+    for (unsigned p = 0; p < PAGE_COUNT; p++)
+        watch_page(bus, d, p);
+    d->epoch = bus->epoch;
+}
+
+void debug_attach(State *state, Debugger *debug) {
+    Debugger *old = state->debug;
+    if (old && old != debug)
+        for (unsigned p = 0; p < PAGE_COUNT; p++)
+            bus_unwatch(&state->bus, p, WATCH_READS | WATCH_WRITES);
+    state->debug = debug;
+    if (debug) {
+        debug->hit = false;
+        watch_pages(state, debug);
+    }
+    // Blocks were cut around the old breakpoints
+    if (state->tc && old != debug)
+        tc_flush(state->tc, &state->bus);
+}
+
+bool debug_break(State *state, uint16_t pc, bool on) {
+    Debugger *d = state->debug;
+    if (!d || !change(d->breaks, pc, on))
+        return false;
+    d->breakpoints += on ? 1 : -1;
+    if (state->tc)
+        tc_drop(state->tc, pc);
+    return true;
+}
+
+bool debug_watch(State *state, uint16_t addr, uint8_t kinds, bool on) {
+    Debugger *d = state->debug;
+    if (!d)
+        return false;
+    unsigned p = addr >> PAGE_SHIFT;
+    bool changed = false;
+    if ((kinds & DEBUG_READ) && change(d->reads, addr, on)) {
+        d->page_reads[p] += on ? 1 : -1;
+        d->watchpoints += on ? 1 : -1;
+        changed = true;
+    }
+    if ((kinds & DEBUG_WRITE) && change(d->writes, addr, on)) {
+        d->page_writes[p] += on ? 1 : -1;
+        d->watchpoints += on ? 1 : -1;
+        changed = true;
+    }
+    if (changed) {
+        state->bus.watch_hit = watch_hit;
+        state->bus.watch_remap = watch_remap;
+        state->bus.watch_ctx = state;
+        watch_page(&state->bus, d, p);
+    }
+    return changed;
+}
+
+void debug_enter(State *state) {
+    Debugger *d = state->debug;
+    d->hit = false;
+    if (d->epoch != state->bus.epoch)
+        watch_pages(state, d);
+}
@@ -1,297 +1,619 @@
 #include "Disassembler.hpp"
-#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
 
-Disassembler::Disassembler() {
-    std::cout << "Disassembler Loaded" << std::endl;
+#include "ThreadPool.hpp"
+
+static const char *mnemonic_names[DM_COUNT] = {
+    "nop", "ld", "inc", "dec", "rlca", "rrca", "rla", "rra",
+    "ex", "add", "djnz", "jr", "daa", "cpl", "scf", "ccf",
+    "halt", "adc", "sub", "sbc", "and", "xor", "or", "cp",
+    "ret", "pop", "jp", "call", "push", "rst", "out", "exx",
+    "in", "di", "ei", "rlc", "rrc", "rl", "rr", "sla",
+    "sra", "sll", "srl", "bit", "res", "set", "neg", "retn",
+    "reti", "im", "rrd", "rld", "ldi", "cpi", "ini", "outi",
+    "ldd", "cpd", "ind", "outd", "ldir", "cpir", "inir", "otir",
+    "lddr", "cpdr", "indr", "otdr",
+    "nop*", "db"
+};
+
+static const char *register_names[DR_COUNT] = {
+    "b", "c", "d", "e", "h", "l", "a", "i", "r",
+    "ixh", "ixl", "iyh", "iyl",
+    "bc", "de", "hl", "sp", "af", "af'", "ix", "iy"
+};
+
+static const char *condition_names[8] = { "nz", "z", "nc", "c", "po", "pe", "p", "m" };
+
+// Operand fields of the opcode byte, in the usual x/y/z/p/q split
+static const uint8_t reg8[8] = { DR_B, DR_C, DR_D, DR_E, DR_H, DR_L, 0, DR_A };    // 6 is (hl)
+static const uint8_t pairs_sp[4] = { DR_BC, DR_DE, DR_HL, DR_SP };
+static const uint8_t pairs_af[4] = { DR_BC, DR_DE, DR_HL, DR_AF };
+static const uint8_t alu_ops[8] = { DM_ADD, DM_ADC, DM_SUB, DM_SBC, DM_AND, DM_XOR, DM_OR, DM_CP };
+static const uint8_t rot_ops[8] = { DM_RLC, DM_RRC, DM_RL, DM_RR, DM_SLA, DM_SRA, DM_SLL, DM_SRL };
+static const uint8_t cb_ops[4] = { 0, DM_BIT, DM_RES, DM_SET };
+static const uint8_t x0z7_ops[8] = { DM_RLCA, DM_RRCA, DM_RLA, DM_RRA, DM_DAA, DM_CPL, DM_SCF, DM_CCF };
+static const uint8_t block_ops[4][4] = {
+    { DM_LDI, DM_CPI, DM_INI, DM_OUTI },
+    { DM_LDD, DM_CPD, DM_IND, DM_OUTD },
+    { DM_LDIR, DM_CPIR, DM_INIR, DM_OTIR },
+    { DM_LDDR, DM_CPDR, DM_INDR, DM_OTDR }
+};
+
+// Bytes are fetched through here, so a cut-off instruction reads zeros
+// and is caught by the length check at the end
+struct Decoding {
+    const uint8_t       *code;
+    size_t              size;
+    DisasmInstruction   *out;
+    unsigned            xy;         // 0, or DR_IX/DR_IY under a DD/FD prefix
+    int8_t              disp;       // (ix+d) displacement, when xy is set
+
+    uint8_t byte(unsigned i) const { return i < size ? code[i] : 0; }
+    uint16_t word(unsigned i) const { return byte(i) | byte(i + 1) << 8; }
+
+    void op(uint8_t mnemonic) { out->mnemonic = mnemonic; }
+    void add(uint8_t kind, uint8_t reg = 0, uint16_t value = 0) {
+        out->operands[out->count++] = DisasmOperand{ kind, reg, value };
+    }
+    // hl, or the index register replacing it
+    uint8_t hl() const { return xy ? xy : (uint8_t)DR_HL; }
+    // r[i]; under a prefix, (hl) is (ix+d), and h and l are the index
+    // register's halves unless the instruction also has an (ix+d)
+    void reg(unsigned i, bool memory) {
+        if (i == 6) {
+            if (xy)
+                add(DO_INDEX, xy, (uint16_t)disp);
+            else
+                add(DO_IND, DR_HL);
+        } else if (xy && !memory && (i == 4 || i == 5)) {
+            add(DO_REG, (xy == DR_IX ? DR_IXH : DR_IYH) + (i - 4));
+        } else {
+            add(DO_REG, reg8[i]);
+        }
+    }
+};
+
+// Unprefixed opcodes, and DD/FD ones with hl and (hl) swapped. p is where
+// the opcode is; returns the full length.
+static unsigned decode_main(Decoding &d, unsigned p) {
+    uint8_t op = d.byte(p);
+    unsigned x = op >> 6, y = (op >> 3) & 7, z = op & 7;
+    unsigned q = y & 1, pp = y >> 1;
+    bool memory = (x == 0 && z >= 4 && z <= 6 && y == 6) || (x == 1 && (y == 6 || z == 6) && op != 0x76)
+        || (x == 2 && z == 6);
+    unsigned imm = p + 1;
+    if (memory && d.xy) {
+        d.disp = (int8_t)d.byte(imm);
+        imm++;
+    }
+
+    switch (x) {
+    case 0:
+        switch (z) {
+        case 0:
+            if (y == 0) {
+                d.op(DM_NOP);
+            } else if (y == 1) {
+                d.op(DM_EX);
+                d.add(DO_REG, DR_AF);
+                d.add(DO_REG, DR_AF_ALT);
+            } else {
+                d.op(y == 2 ? DM_DJNZ : DM_JR);
+                if (y >= 4)
+                    d.add(DO_COND, y - 4);
+                d.add(DO_TARGET, 0, (uint16_t)(d.out->pc + imm + 1 + (int8_t)d.byte(imm)));
+                return imm + 1;
+            }
+            return imm;
+        case 1: {
+            uint8_t pair = pp == 2 ? d.hl() : pairs_sp[pp];
+            if (q) {
+                d.op(DM_ADD);
+                d.add(DO_REG, d.hl());
+                d.add(DO_REG, pair);
+                return imm;
+            }
+            d.op(DM_LD);
+            d.add(DO_REG, pair);
+            d.add(DO_IMM16, 0, d.word(imm));
+            return imm + 2;
+        }
+        case 2: {
+            // ld (bc),a / ld (de),a / ld (nn),hl / ld (nn),a and the loads back
+            DisasmOperand mem = pp < 2 ? DisasmOperand{ DO_IND, pp ? DR_DE : DR_BC, 0 }
+                                       : DisasmOperand{ DO_ADDR, 0, d.word(imm) };
+            DisasmOperand reg = { DO_REG, pp == 2 ? d.hl() : (uint8_t)DR_A, 0 };
+            d.op(DM_LD);
+            d.out->operands[0] = q ? reg : mem;
+            d.out->operands[1] = q ? mem : reg;
+            d.out->count = 2;
+            return pp < 2 ? imm : imm + 2;
+        }
+        case 3:
+            d.op(q ? DM_DEC : DM_INC);
+            d.add(DO_REG, pp == 2 ? d.hl() : pairs_sp[pp]);
+            return imm;
+        case 4:
+        case 5:
+            d.op(z == 4 ? DM_INC : DM_DEC);
+            d.reg(y, memory);
+            return imm;
+        case 6:
+            d.op(DM_LD);
+            d.reg(y, memory);
+            d.add(DO_IMM8, 0, d.byte(imm));
+            return imm + 1;
+        default:
+            d.op(x0z7_ops[y]);
+            return imm;
+        }
+    case 1:
+        if (op == 0x76) {
+            d.op(DM_HALT);
+            return imm;
+        }
+        d.op(DM_LD);
+        d.reg(y, memory);
+        d.reg(z, memory);
+        return imm;
+    case 2:
+        d.op(alu_ops[y]);
+        if (y == 0 || y == 1 || y == 3)
+            d.add(DO_REG, DR_A);
+        d.reg(z, memory);
+        return imm;
+    }
+
+    switch (z) {
+    case 0:
+        d.op(DM_RET);
+        d.add(DO_COND, y);
+        return imm;
+    case 1:
+        if (!q) {
+            d.op(DM_POP);
+            d.add(DO_REG, pp == 2 ? d.hl() : pairs_af[pp]);
+        } else if (pp == 0) {
+            d.op(DM_RET);
+        } else if (pp == 1) {
+            d.op(DM_EXX);
+        } else if (pp == 2) {
+            d.op(DM_JP);
+            d.add(DO_IND, d.hl());
+        } else {
+            d.op(DM_LD);
+            d.add(DO_REG, DR_SP);
+            d.add(DO_REG, d.hl());
+        }
+        return imm;
+    case 2:
+        d.op(DM_JP);
+        d.add(DO_COND, y);
+        d.add(DO_IMM16, 0, d.word(imm));
+        return imm + 2;
+    case 3:
+        switch (y) {
+        case 0:
+            d.op(DM_JP);
+            d.add(DO_IMM16, 0, d.word(imm));
+            return imm + 2;
+        case 2:
+            d.op(DM_OUT);
+            d.add(DO_PORT, 0, d.byte(imm));
+            d.add(DO_REG, DR_A);
+            return imm + 1;
+        case 3:
+            d.op(DM_IN);
+            d.add(DO_REG, DR_A);
+            d.add(DO_PORT, 0, d.byte(imm));
+            return imm + 1;
+        case 4:
+            d.op(DM_EX);
+            d.add(DO_IND, DR_SP);
+            d.add(DO_REG, d.hl());
+            return imm;
+        case 5:
+            d.op(DM_EX);
+            d.add(DO_REG, DR_DE);
+            d.add(DO_REG, DR_HL);
+            return imm;
+        default:
+            d.op(y == 6 ? DM_DI : DM_EI);
+            return imm;
+        }
+    case 4:
+        d.op(DM_CALL);
+        d.add(DO_COND, y);
+        d.add(DO_IMM16, 0, d.word(imm));
+        return imm + 2;
+    case 5:
+        if (!q) {
+            d.op(DM_PUSH);
+            d.add(DO_REG, pp == 2 ? d.hl() : pairs_af[pp]);
+            return imm;
+        }
+        d.op(DM_CALL);
+        d.add(DO_IMM16, 0, d.word(imm));
+        return imm + 2;
+    case 6:
+        d.op(alu_ops[y]);
+        if (y == 0 || y == 1 || y == 3)
+            d.add(DO_REG, DR_A);
+        d.add(DO_IMM8, 0, d.byte(imm));
+        return imm + 1;
+    default:
+        d.op(DM_RST);
+        d.add(DO_RST, 0, y * 8);
+        return imm;
+    }
+}
+
+// CB xx, and DD/FD CB d xx with p at the CB. Rotates/shifts, then bit, res
+// and set; the indexed forms other than bit also copy the result to r[z].
+static unsigned decode_cb(Decoding &d, unsigned p) {
+    if (d.xy)
+        d.disp = (int8_t)d.byte(p + 1);
+    uint8_t op = d.byte(d.xy ? p + 2 : p + 1);
+    unsigned x = op >> 6, y = (op >> 3) & 7, z = op & 7;
+    d.op(x ? cb_ops[x] : rot_ops[y]);
+    if (x)
+        d.add(DO_NUM, 0, y);
+    if (!d.xy) {
+        d.reg(z, true);
+        return p + 2;
+    }
+    d.reg(6, true);
+    if (x != 1 && z != 6)
+        d.add(DO_REG, reg8[z]);
+    return p + 3;
+}
+
+// ED xx: extended instructions; undefined slots decode as a two-byte nop*
+static unsigned decode_ed(Decoding &d, unsigned p) {
+    uint8_t op = d.byte(p + 1);
+    unsigned x = op >> 6, y = (op >> 3) & 7, z = op & 7;
+    unsigned q = y & 1, pp = y >> 1;
+    if (x == 2 && y >= 4 && z <= 3) {
+        d.op(block_ops[y - 4][z]);
+        return p + 2;
+    }
+    if (x != 1) {
+        d.op(DM_NOP_UNDEFINED);
+        return p + 2;
+    }
+    switch (z) {
+    case 0:
+        d.op(DM_IN);
+        if (y != 6)
+            d.add(DO_REG, reg8[y]);
+        d.add(DO_IND, DR_C);
+        return p + 2;
+    case 1:
+        d.op(DM_OUT);
+        d.add(DO_IND, DR_C);
+        if (y != 6)
+            d.add(DO_REG, reg8[y]);
+        else
+            d.add(DO_NUM, 0, 0);
+        return p + 2;
+    case 2:
+        d.op(q ? DM_ADC : DM_SBC);
+        d.add(DO_REG, DR_HL);
+        d.add(DO_REG, pairs_sp[pp]);
+        return p + 2;
+    case 3:
+        d.op(DM_LD);
+        if (q) {
+            d.add(DO_REG, pairs_sp[pp]);
+            d.add(DO_ADDR, 0, d.word(p + 2));
+        } else {
+            d.add(DO_ADDR, 0, d.word(p + 2));
+            d.add(DO_REG, pairs_sp[pp]);
+        }
+        return p + 4;
+    case 4:
+        d.op(DM_NEG);
+        return p + 2;
+    case 5:
+        d.op(y == 1 ? DM_RETI : DM_RETN);
+        return p + 2;
+    case 6: {
+        static const uint8_t modes[8] = { 0, 0, 1, 2, 0, 0, 1, 2 };
+        d.op(DM_IM);
+        d.add(DO_NUM, 0, modes[y]);
+        return p + 2;
+    }
+    default: {
+        static const uint8_t ops[8] = { DM_LD, DM_LD, DM_LD, DM_LD, DM_RRD, DM_RLD, DM_NOP_UNDEFINED, DM_NOP_UNDEFINED };
+        static const uint8_t regs[4][2] = { { DR_I, DR_A }, { DR_R, DR_A }, { DR_A, DR_I }, { DR_A, DR_R } };
+        d.op(ops[y]);
+        if (y < 4) {
+            d.add(DO_REG, regs[y][0]);
+            d.add(DO_REG, regs[y][1]);
+        }
+        return p + 2;
+    }
+    }
+}
+
+int disasm_decode(const uint8_t *code, size_t size, uint32_t pc, DisasmInstruction *out) {
+    if (!size)
+        return 0;
+    out->pc = pc;
+    out->count = 0;
+    Decoding d = { code, size, out, 0, 0 };
+    unsigned length;
+    uint8_t op = code[0];
+    if (op == 0xDD || op == 0xFD) {
+        uint8_t next = d.byte(1);
+        if (next == 0xDD || next == 0xFD || next == 0xED) {
+            // The later prefix wins; this one only costs time
+            out->mnemonic = DM_NOP_UNDEFINED;
+            out->length = 1;
+            return 1;
+        }
+        d.xy = op == 0xDD ? DR_IX : DR_IY;
+        length = next == 0xCB ? decode_cb(d, 1) : decode_main(d, 1);
+    } else if (op == 0xCB) {
+        length = decode_cb(d, 0);
+    } else if (op == 0xED) {
+        length = decode_ed(d, 0);
+    } else {
+        length = decode_main(d, 0);
+    }
+
+    if (length > size) {
+        out->mnemonic = DM_DB;
+        out->count = 1;
+        out->operands[0] = DisasmOperand{ DO_IMM8, 0, op };
+        length = 1;
+    }
+    out->length = length;
+    return length;
+}
+
+const char* disasm_mnemonic_name(uint8_t mnemonic) {
+    return mnemonic < DM_COUNT ? mnemonic_names[mnemonic] : "?";
+}
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static char* put_text(char *out, const char *text) {
+    while (*text)
+        *out++ = *text++;
+    return out;
+}
+
+static char* put_hex2(char *out, unsigned v) {
+    *out++ = hex_digits[(v >> 4) & 15];
+    *out++ = hex_digits[v & 15];
+    return out;
+}
+
+static char* put_hex4(char *out, unsigned v) {
+    return put_hex2(put_hex2(out, v >> 8), v);
+}
+
+static char* put_operand(char *out, const DisasmOperand &o) {
+    switch (o.kind) {
+    case DO_REG:
+        return put_text(out, register_names[o.reg]);
+    case DO_IND:
+        *out++ = '(';
+        out = put_text(out, register_names[o.reg]);
+        *out++ = ')';
+        return out;
+    case DO_INDEX: {
+        int v = (int8_t)o.value;
+        *out++ = '(';
+        out = put_text(out, register_names[o.reg]);
+        *out++ = v < 0 ? '-' : '+';
+        *out++ = '$';
+        out = put_hex2(out, v < 0 ? -v : v);
+        *out++ = ')';
+        return out;
+    }
+    case DO_IMM8:
+        return put_hex2(out, o.value);
+    case DO_IMM16:
+        return put_hex4(put_text(out, "#$"), o.value);
+    case DO_ADDR:
+        out = put_hex4(put_text(out, "(#$"), o.value);
+        *out++ = ')';
+        return out;
+    case DO_PORT:
+        *out++ = '(';
+        out = put_hex2(out, o.value);
+        *out++ = ')';
+        return out;
+    case DO_TARGET:
+        *out++ = '$';
+        return put_hex4(out, o.value);
+    case DO_COND:
+        return put_text(out, condition_names[o.reg & 7]);
+    case DO_NUM:
+        *out++ = '0' + (o.value & 7);
+        return out;
+    default:
+        out = put_hex2(out, o.value);
+        *out++ = 'h';
+        return out;
+    }
+}
+
+// Unchecked: the longest instruction ("set   7,(ix-$80),a") is far inside
+// DISASM_TEXT_MAX
+static char* put_instruction(char *out, const DisasmInstruction &in) {
+    const char *name = disasm_mnemonic_name(in.mnemonic);
+    char *start = out;
+    out = put_text(out, name);
+    if (!in.count)
+        return out;
+    while (out < start + 6)
+        *out++ = ' ';
+    for (unsigned i = 0; i < in.count && i < 3; i++) {
+        if (i)
+            *out++ = ',';
+        out = put_operand(out, in.operands[i]);
+    }
+    return out;
+}
+
+size_t disasm_format(const DisasmInstruction *in, char *out, size_t size) {
+    if (size < DISASM_TEXT_MAX) {
+        if (size)
+            *out = '\0';
+        return 0;
+    }
+    char *end = put_instruction(out, *in);
+    *end = '\0';
+    return end - out;
+}
+
+// "pc first-byte text", as the REPL has always printed them
+static char* put_line(char *out, const DisasmInstruction &in, uint8_t first) {
+    int digits = 4;
+    while (digits < 8 && in.pc >> (digits * 4))
+        digits++;
+    while (digits--)
+        *out++ = hex_digits[(in.pc >> (digits * 4)) & 15];
+    *out++ = ' ';
+    if (first >= 16)
+        *out++ = hex_digits[first >> 4];
+    *out++ = hex_digits[first & 15];
+    *out++ = ' ';
+    out = put_instruction(out, in);
+    *out++ = '\n';
+    return out;
 }
 
-/*
-void Disassembler::foo() {
-    std::cout << "kek" << std::endl;
+bool disasm_write_file(void *file, const char *data, size_t size) {
+    return fwrite(data, 1, size, (FILE*)file) == size;
+}
+
+bool disasm_flush(DisasmSink *sink) {
+    if (sink->used && !sink->failed)
+        sink->failed = !sink->write(sink->context, sink->buffer, sink->used);
+    sink->used = 0;
+    return !sink->failed;
+}
+
+// Lines for the instructions starting in [at, end) of code; the last may
+// run on past end. Returns where the next instruction starts.
+static size_t put_lines(const uint8_t *code, size_t size, uint32_t pc, size_t at, size_t end,
+                        DisasmSink *sink, uint64_t *count) {
+    DisasmInstruction in;
+    while (at < end) {
+        int n = disasm_decode(code + at, size - at, pc + at, &in);
+        if (sink->size - sink->used < DISASM_LINE_MAX)
+            disasm_flush(sink);
+        sink->used = put_line(sink->buffer + sink->used, in, code[at]) - sink->buffer;
+        at += n;
+        ++*count;
+    }
+    return at;
+}
+
+uint64_t disasm_range(const uint8_t *code, size_t size, uint32_t pc, DisasmSink *sink) {
+    uint64_t count = 0;
+    put_lines(code, size, pc, 0, size, sink, &count);
+    return count;
+}
+
+// Where the instructions starting in [at, end) leave off, and the mark in
+// starts[] of each one's offset from base
+static size_t walk(const uint8_t *code, size_t size, size_t at, size_t end, size_t base,
+                   std::vector<uint8_t> &starts) {
+    DisasmInstruction in;
+    for (; at < end; at += disasm_decode(code + at, size - at, 0, &in))
+        starts[at - base] = 1;
+    return at;
+}
+
+// Chunk k covers [k * DISASM_CHUNK, (k + 1) * DISASM_CHUNK). An instruction
+// can run up to 3 bytes over the end of one, so a chunk can be entered at
+// any of its first 4 offsets. Each chunk works out where it is left for all
+// four at once: the walk from offset 0 marks its instruction starts, and
+// the walks from 1-3 stop as soon as they land on one of those, since from
+// there on they're the same walk (Z80 code usually falls into step within
+// a few instructions). Chaining the exits from chunk 0 then gives every
+// chunk its true entry. The chunks are formatted independently, a wave at
+// a time so only a few are held in memory, and written in order.
+uint64_t disasm_parallel(const uint8_t *code, size_t size, uint32_t pc, DisasmSink *sink, unsigned threads) {
+    if (!threads)
+        threads = default_threads();
+    size_t chunks = (size + DISASM_CHUNK - 1) / DISASM_CHUNK;
+    if (threads < 2 || chunks < 2)
+        return disasm_range(code, size, pc, sink);
+
+    std::vector<size_t> exits(chunks * 4);
+    std::vector<std::vector<uint8_t>> starts(threads, std::vector<uint8_t>(DISASM_CHUNK));
+    parallel_for(chunks, threads, [&](unsigned worker, size_t k) {
+        size_t begin = k * DISASM_CHUNK;
+        size_t end = std::min(size, begin + DISASM_CHUNK);
+        std::vector<uint8_t> &marks = starts[worker];
+        std::fill(marks.begin(), marks.end(), 0);
+        size_t exit = walk(code, size, begin, end, begin, marks);
+        exits[k * 4] = exit;
+        for (size_t j = 1; j < 4; j++) {
+            DisasmInstruction in;
+            size_t at = begin + j;
+            while (at < end && !marks[at - begin])
+                at += disasm_decode(code + at, size - at, 0, &in);
+            exits[k * 4 + j] = at < end ? exit : at;
+        }
+    });
+    std::vector<size_t> entries(chunks);
+    for (size_t k = 1; k < chunks; k++)
+        entries[k] = exits[(k - 1) * 4 + (entries[k - 1] - (k - 1) * DISASM_CHUNK)];
+
+    struct Output {
+        std::string text;
+        uint64_t    count;
+    };
+    std::vector<Output> outputs(threads * 2);
+    std::vector<std::vector<char>> buffers(threads, std::vector<char>(DISASM_SINK_BYTES));
+    uint64_t count = 0;
+    for (size_t first = 0; first < chunks; first += outputs.size()) {
+        size_t wave = std::min(outputs.size(), chunks - first);
+        parallel_for(wave, threads, [&](unsigned worker, size_t i) {
+            size_t k = first + i;
+            Output &out = outputs[i];
+            out.text.clear();
+            out.count = 0;
+            DisasmSink chunk = disasm_sink(buffers[worker].data(), buffers[worker].size(),
+                                           [](void *text, const char *data, size_t n) {
+                                               ((std::string*)text)->append(data, n);
+                                               return true;
+                                           }, &out.text);
+            put_lines(code, size, pc, entries[k], std::min(size, (k + 1) * DISASM_CHUNK), &chunk, &out.count);
+            disasm_flush(&chunk);
+        });
+        disasm_flush(sink);
+        for (size_t i = 0; i < wave; i++) {
+            if (!sink->failed)
+                sink->failed = !sink->write(sink->context, outputs[i].text.data(), outputs[i].text.size());
+            count += outputs[i].count;
+        }
+    }
+    return count;
 }
-*/
 
 // Take byte data from a buffer and translate it into an opcode + data
 int Disassembler::disassemble(unsigned char *buffer, int pc) {
     // buffer is a pointer to machine code in .h file
     // pc is current offset
-    unsigned char *code = &buffer[pc];
-    int opbytes = 1;
-    printf("%04x ", pc);  
-    printf("%x ",*code);
-    switch(*code) {
-        case 0x00: printf("nop"); break;    
-        case 0x01: printf("ld    bc,#$%02x%02x", code[2], code[1]); opbytes=3; break;
-        case 0x02: printf("ld    (bc),a"); break;
-        case 0x03: printf("inc   bc"); break;
-        case 0x04: printf("inc   b"); break;
-        case 0x05: printf("dec   b"); break; 
-        case 0x06: printf("ld    b,%02x", code[1]); opbytes=2; break; 
-        case 0x07: printf("rlca"); break; 
-        case 0x08: printf("ex    af,af'"); break; 
-        case 0x09: printf("add   hl,bc"); break; 
-        case 0x0A: printf("ld    a,(bc)"); break; 
-        case 0x0B: printf("dec   bc"); break; 
-        case 0x0C: printf("inc   c"); break; 
-        case 0x0D: printf("dec   c"); break; 
-        case 0x0E: printf("ld    c,%02x", code[1]); opbytes=2; break; 
-        case 0x0F: printf("rrca"); break; 
-        
-        case 0x10: printf("djnz  %02x", code[1]); opbytes=2; break; 
-        case 0x11: printf("ld    de,#$%02x%02x",code[2], code[1]); opbytes=3; break;
-        case 0x12: printf("ld    (de),a"); break; 
-        case 0x13: printf("inc   de"); break; 
-        case 0x14: printf("inc   d"); break; 
-        case 0x15: printf("dec   d"); break; 
-        case 0x16: printf("ld    d,%02x", code[1]); opbytes=2; break; 
-        case 0x17: printf("rla"); break; 
-        case 0x18: printf("jr    %02x", code[1]); opbytes=2; break; 
-        case 0x19: printf("add   hl,de"); break; 
-        case 0x1A: printf("ld    a,(de)"); break; 
-        case 0x1B: printf("dec   de"); break; 
-        case 0x1C: printf("inc   e"); break; 
-        case 0x1D: printf("inc   e"); break; 
-        case 0x1E: printf("ld    e,%02x", code[1]); opbytes=2; break; 
-        case 0x1F: printf("rra"); break; 
-        
-        case 0x20: printf("jr    nz,%02x", code[1]); opbytes=2; break; 
-        case 0x21: printf("ld    hl,#$%02x%02x",code[2], code[1]); opbytes=3; break; 
-        case 0x22: printf("id    (#$%02x%02x),hl",code[2],code[1]); opbytes=3; break; 
-        case 0x23: printf("inc   hl"); break; 
-        case 0x24: printf("inc   h"); break; 
-        case 0x25: printf("dec   h"); break; 
-        case 0x26: printf("ld    h,%02x", code[1]); opbytes=2; break; 
-        case 0x27: printf("daa"); break; 
-        case 0x28: printf("jr    z,%02x", code[1]); opbytes=2; break; 
-        case 0x29: printf("add   hl,hl"); break; 
-        case 0x2A: printf("ld    hl,(#$%02x%02x)", code[2], code[1]); opbytes=3; break; 
-        case 0x2B: printf("dec   hl"); break; 
-        case 0x2C: printf("inc   l"); break; 
-        case 0x2D: printf("dec   l"); break; 
-        case 0x2E: printf("ld    l,%02x", code[1]); opbytes=2; break; 
-        case 0x2F: printf("cpl"); break; 
-        
-        case 0x30: printf("jr    nc,%02x", code[1]); opbytes=2; break;           
-        case 0x31: printf("ld    sp, #$%02x%02x", code[2], code[1]); opbytes=3; break; 
-        case 0x32: printf("ld    (#$%02x%02x),a", code[2], code[1]); opbytes=3; break; 
-        case 0x33: printf("inc   sp"); break; 
-        case 0x34: printf("inc   (hl)"); break; 
-        case 0x35: printf("dec   (hl)"); break; 
-        case 0x36: printf("ld    (hl),%02x", code[1]); opbytes=2; break; 
-        case 0x37: printf("scf"); break; 
-        case 0x38: printf("jr    c,%02x", code[1]); opbytes=2; break; 
-        case 0x39: printf("add   hl,sp"); break; 
-        case 0x3A: printf("ld    a,(#$%02x%02x)", code[2], code[1]); opbytes=3; break; 
-        case 0x3B: printf("dec   sp"); break; 
-        case 0x3C: printf("inc   a"); break; 
-        case 0x3D: printf("dec   a"); break; 
-        case 0x3E: printf("ld    a,%02x", code[1]); opbytes=2; break; 
-        case 0x3F: printf("ccf"); break; 
-        
-        case 0x40: printf("ld    b,b"); break; 
-        case 0x41: printf("ld    b,c"); break; 
-        case 0x42: printf("ld    b,d"); break; 
-        case 0x43: printf("ld    b,e"); break; 
-        case 0x44: printf("ld    b,h"); break; 
-        case 0x45: printf("ld    b,l"); break; 
-        case 0x46: printf("ld    b,(hl)"); break; 
-        case 0x47: printf("ld    b,a"); break; 
-        case 0x48: printf("ld    c,b"); break; 
-        case 0x49: printf("ld    c,c"); break; 
-        case 0x4A: printf("ld    c,d"); break; 
-        case 0x4B: printf("ld    c,e"); break; 
-        case 0x4C: printf("ld    c,h"); break; 
-        case 0x4D: printf("ld    c,l"); break; 
-        case 0x4E: printf("ld    c,(hl)"); break; 
-        case 0x4F: printf("ld    c,a"); break; 
-        
-        case 0x50: printf("ld    d,b"); break; 
-        case 0x51: printf("ld    d,c"); break; 
-        case 0x52: printf("ld    d,d"); break; 
-        case 0x53: printf("ld    d,e"); break; 
-        case 0x54: printf("ld    d,h"); break; 
-        case 0x55: printf("ld    d,l"); break; 
-        case 0x56: printf("ld    d,(hl)"); break; 
-        case 0x57: printf("ld    d,a"); break; 
-        case 0x58: printf("ld    e,b"); break; 
-        case 0x59: printf("ld    e,c"); break; 
-        case 0x5A: printf("ld    e,d"); break; 
-        case 0x5B: printf("ld    e,e"); break; 
-        case 0x5C: printf("ld    e,h"); break; 
-        case 0x5D: printf("ld    e,l"); break; 
-        case 0x5E: printf("ld    e,(hl)"); break; 
-        case 0x5F: printf("ld    e,a"); break; 
-        
-        case 0x60: printf("ld    h,b"); break; 
-        case 0x61: printf("ld    h,c"); break; 
-        case 0x62: printf("ld    h,d"); break; 
-        case 0x63: printf("ld    h,e"); break; 
-        case 0x64: printf("ld    h,h"); break; 
-        case 0x65: printf("ld    h,l"); break; 
-        case 0x66: printf("ld    h,(hl)"); break; 
-        case 0x67: printf("ld    h,a"); break; 
-        case 0x68: printf("ld    l,b"); break; 
-        case 0x69: printf("ld    l,c"); break; 
-        case 0x6A: printf("ld    l,d"); break; 
-        case 0x6B: printf("ld    l,e"); break; 
-        case 0x6C: printf("ld    l,h"); break; 
-        case 0x6D: printf("ld    l,l"); break; 
-        case 0x6E: printf("ld    l,(hl)"); break; 
-        case 0x6F: printf("ld    l,a"); break; 
-        
-        case 0x70: printf("ld    (hl),b"); break; 
-        case 0x71: printf("ld    (hl),c"); break; 
-        case 0x72: printf("ld    (hl),d"); break; 
-        case 0x73: printf("ld    (hl),e"); break; 
-        case 0x74: printf("ld    (hl),h"); break; 
-        case 0x75: printf("ld    (hl),l"); break; 
-        case 0x76: printf("halt"); break; 
-        case 0x77: printf("ld    (hl),a"); break; 
-        case 0x78: printf("ld    a,b"); break; 
-        case 0x79: printf("ld    a,c"); break; 
-        case 0x7A: printf("ld    a,d"); break; 
-        case 0x7B: printf("ld    a,e"); break; 
-        case 0x7C: printf("ld    a,h"); break; 
-        case 0x7D: printf("ld    a,l"); break; 
-        case 0x7E: printf("ld    a,(hl)"); break; 
-        case 0x7F: printf("ld    a,a"); break; 
-        
-        case 0x80: printf("add   a,b"); break; 
-        case 0x81: printf("add   a,c"); break; 
-        case 0x82: printf("add   a,d"); break; 
-        case 0x83: printf("add   a,e"); break; 
-        case 0x84: printf("add   a,h"); break; 
-        case 0x85: printf("add   a,l"); break; 
-        case 0x86: printf("add   a,(hl)"); break; 
-        case 0x87: printf("add   a,a"); break; 
-        case 0x88: printf("adc   a,b"); break; 
-        case 0x89: printf("adc   a,c"); break; 
-        case 0x8A: printf("adc   a,d"); break; 
-        case 0x8B: printf("adc   a,e"); break; 
-        case 0x8C: printf("adc   a,h"); break; 
-        case 0x8D: printf("adc   a,l"); break; 
-        case 0x8E: printf("adc   a,(hl)"); break; 
-        case 0x8F: printf("adc   a,a"); break; 
-        
-        case 0x90: printf("sub   b"); break; 
-        case 0x91: printf("sub   c"); break; 
-        case 0x92: printf("sub   d"); break; 
-        case 0x93: printf("sub   e"); break; 
-        case 0x94: printf("sub   h"); break; 
-        case 0x95: printf("sub   l"); break; 
-        case 0x96: printf("sub   (hl)"); break; 
-        case 0x97: printf("sub   a"); break; 
-        case 0x98: printf("sbc   a,b"); break; 
-        case 0x99: printf("sbc   a,c"); break; 
-        case 0x9A: printf("sbc   a,d"); break; 
-        case 0x9B: printf("sbc   a,e"); break; 
-        case 0x9C: printf("sbc   a,h"); break; 
-        case 0x9D: printf("sbc   a,l"); break; 
-        case 0x9E: printf("sbc   a,(hl)"); break; 
-        case 0x9F: printf("sbc   a,a"); break; 
-        
-        case 0xA0: printf("and   b"); break; 
-        case 0xA1: printf("and   c"); break; 
-        case 0xA2: printf("and   d"); break; 
-        case 0xA3: printf("and   e"); break; 
-        case 0xA4: printf("and   h"); break; 
-        case 0xA5: printf("and   l"); break; 
-        case 0xA6: printf("and   (hl)"); break; 
-        case 0xA7: printf("and   a"); break; 
-        case 0xA8: printf("xor   b"); break; 
-        case 0xA9: printf("xor   c"); break; 
-        case 0xAA: printf("xor   d"); break; 
-        case 0xAB: printf("xor   e"); break; 
-        case 0xAC: printf("xor   h"); break; 
-        case 0xAD: printf("xor   l"); break; 
-        case 0xAE: printf("xor   (hl)"); break; 
-        case 0xAF: printf("xor   a"); break; 
-        
-        case 0xB0: printf("or    b"); break; 
-        case 0xB1: printf("or    c"); break; 
-        case 0xB2: printf("or    d"); break; 
-        case 0xB3: printf("or    e"); break; 
-        case 0xB4: printf("or    h"); break; 
-        case 0xB5: printf("or    l"); break; 
-        case 0xB6: printf("or    (hl)"); break; 
-        case 0xB7: printf("or    a"); break; 
-        case 0xB8: printf("cp    b"); break; 
-        case 0xB9: printf("cp    c"); break; 
-        case 0xBA: printf("cp    d"); break; 
-        case 0xBB: printf("cp    e"); break; 
-        case 0xBC: printf("cp    h"); break; 
-        case 0xBD: printf("cp    l"); break; 
-        case 0xBE: printf("cp    (hl)"); break; 
-        case 0xBF: printf("cp    a"); break; 
-        
-        case 0xC0: printf("ret   nz"); break; 
-        case 0xC1: printf("pop   bc"); break; 
-        case 0xC2: printf("jp    nz,#$%02x%02x", code[2], code[1]); opbytes=3; break; 
-        case 0xC3: printf("jp    #$%02x%02x", code[2], code[1]); opbytes=3; break; 
-        case 0xC4: printf("call  nz,#$%02x%02x", code[2], code[1]); opbytes=3; break; 
-        case 0xC5: printf("push  bc"); break; 
-        case 0xC6: printf("add   a,%02x", code[1]); opbytes=2; break; 
-        case 0xC7: printf("rst   00h"); break; 
-        case 0xC8: printf("ret   z"); break; 
-        case 0xC9: printf("ret"); break; 
-        case 0xCA: printf("jp    z,#$%02x%02x", code[2], code[1]); opbytes=3; break; 
-        case 0xCB: printf("BITS"); break; 
-        case 0xCC: printf("call  z,#$%02x%02x", code[2], code[1]); opbytes=3; break; 
-        case 0xCD: printf("call  #$%02x%02x", code[2], code[1]); opbytes=3; break; 
-        case 0xCE: printf("adc   a,%02x", code[1]); opbytes=2; break; 
-        case 0xCF: printf("rst   08h"); break; 
-        
-        case 0xD0: printf("ret   nc"); break; 
-        case 0xD1: printf("pop   de"); break; 
-        case 0xD2: printf("jp    nc,#$%02x%02x", code[2], code[1]); opbytes=3; break; 
-        case 0xD3: printf("out   (%02x),a", code[1]); opbytes=2; break; 
-        case 0xD4: printf("call  nc,#$%02x%02x", code[2], code[1]); opbytes=3; break; 
-        case 0xD5: printf("push  de"); break; 
-        case 0xD6: printf("sub   %02x", code[1]); opbytes=2; break; 
-        case 0xD7: printf("rst   10h"); break; 
-        case 0xD8: printf("ret   c"); break; 
-        case 0xD9: printf("exx"); break; 
-        case 0xDA: printf("jp    c,#$%02x%02x", code[2], code[1]); opbytes=3; break; 
-        case 0xDB: printf("in    a,(%02x)", code[1]); opbytes=2; break; 
-        case 0xDC: printf("call  c,#$%02x%02x", code[2], code[1]); opbytes=3; break; 
-        case 0xDD: printf("IX"); break; 
-        case 0xDE: printf("sbc   a,%02x", code[1]); opbytes=2; break; 
-        case 0xDF: printf("rst   18h"); break; 
-        
-        case 0xE0: printf("ret   po"); break; 
-        case 0xE1: printf("pop   hl"); break; 
-        case 0xE2: printf("jp    po,#$%02x%02x", code[2], code[1]); opbytes=3; break; 
-        case 0xE3: printf("ex    (sp),hl"); break; 
-        case 0xE4: printf("call  po,#$%02x%02x", code[2], code[1]); opbytes=3; break; 
-        case 0xE5: printf("push  hl"); break; 
-        case 0xE6: printf("and   %02x", code[1]); opbytes=2; break; 
-        case 0xE7: printf("ret   20h"); break; 
-        case 0xE8: printf("ret   pe"); break; 
-        case 0xE9: printf("jp    (hl)"); break; 
-        case 0xEA: printf("jp    pe,#$%02x%02x", code[2], code[1]); opbytes=3; break; 
-        case 0xEB: printf("ex    de,hl"); break; 
-        case 0xEC: printf("call  pe,#$%02x%02x", code[2], code[1]); opbytes=3; break; 
-        case 0xED: printf("EXTD"); break; 
-        case 0xEE: printf("xor   %02x", code[1]); opbytes=2; break; 
-        case 0xEF: printf("rst   28h"); break; 
-        
-        case 0xF0: printf("ret   p"); break; 
-        case 0xF1: printf("pop   af"); break; 
-        case 0xF2: printf("jp    p,#$%02x%02x", code[2], code[1]); opbytes=3; break; 
-        case 0xF3: printf("di"); break; 
-        case 0xF4: printf("call  p,#$%02x%02x", code[2], code[1]); opbytes=3; break; 
-        case 0xF5: printf("push  af"); break; 
-        case 0xF6: printf("or    %02x", code[1]); opbytes=2; break; 
-        case 0xF7: printf("rst   30h"); break; 
-        case 0xF8: printf("ret   m"); break; 
-        case 0xF9: printf("ld    sp,hl"); break; 
-        case 0xFA: printf("jp    m,#$%02x%02x", code[2], code[1]); opbytes=3; break; 
-        case 0xFB: printf("ei"); break; 
-        case 0xFC: printf("call  m,#$%02x%02x", code[2], code[1]); opbytes=3; break; 
-        case 0xFD: printf("IY"); break; 
-        case 0xFE: printf("cp    %02x", code[1]); opbytes=2; break; 
-        case 0xFF: printf("rst   38h"); break;
-    }
-    printf("\n");
-    return opbytes;
+    return disassemble_at(&buffer[pc], pc);
+}
+
+int Disassembler::disassemble_at(unsigned char *code, int pc, size_t size) {
+    DisasmInstruction in;
+    char line[DISASM_LINE_MAX];
+    int n = disasm_decode(code, size, pc, &in);
+    if (n)
+        fwrite(line, 1, put_line(line, in, code[0]) - line, stdout);
+    return n;
 }
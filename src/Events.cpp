@@ -0,0 +1,84 @@
+#include "Events.hpp"
+
+#include <cstdlib>
+
+Scheduler* events_create() {
+    return (Scheduler*)calloc(1, sizeof(Scheduler));
+}
+
+void events_free(Scheduler *events) {
+    free(events);
+}
+
+static bool before(const Event &a, const Event &b) {
+    return a.when != b.when ? a.when < b.when : a.order < b.order;
+}
+
+static void sift_up(Scheduler *q, uint32_t i) {
+    Event e = q->heap[i];
+    while (i && before(e, q->heap[(i - 1) / 2])) {
+        q->heap[i] = q->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    q->heap[i] = e;
+}
+
+static void sift_down(Scheduler *q, uint32_t i) {
+    Event e = q->heap[i];
+    for (;;) {
+        uint32_t c = 2 * i + 1;
+        if (c >= q->count)
+            break;
+        if (c + 1 < q->count && before(q->heap[c + 1], q->heap[c]))
+            c++;
+        if (!before(q->heap[c], e))
+            break;
+        q->heap[i] = q->heap[c];
+        i = c;
+    }
+    q->heap[i] = e;
+}
+
+bool event_schedule(State *state, uint64_t when, EventHandler handler, void *context) {
+    Scheduler *q = state->events;
+    if (!q || q->count == EVENTS_MAX)
+        return false;
+    q->heap[q->count] = Event{ when, q->scheduled++, handler, context };
+    sift_up(q, q->count++);
+    if (when < state->stop_cycle)
+        state->stop_cycle = when;
+    return true;
+}
+
+// Removing can only make the next event later, so stop_cycle is left for
+// the core to work out again at its next stop
+size_t event_cancel(State *state, EventHandler handler, void *context) {
+    Scheduler *q = state->events;
+    if (!q)
+        return 0;
+    size_t removed = 0;
+    for (uint32_t i = 0; i < q->count;) {
+        if (q->heap[i].handler == handler && q->heap[i].context == context) {
+            q->heap[i] = q->heap[--q->count];
+            removed++;
+        } else {
+            i++;
+        }
+    }
+    if (removed)
+        for (uint32_t i = q->count / 2; i-- > 0;)
+            sift_down(q, i);
+    return removed;
+}
+
+void events_fire(State *state) {
+    Scheduler *q = state->events;
+    while (q && q->count && q->heap[0].when <= state->cycles) {
+        Event e = q->heap[0];
+        q->heap[0] = q->heap[--q->count];
+        if (q->count)
+            sift_down(q, 0);
+        e.handler(state, e.context, e.when);
+        q = state->events;
+    }
+}
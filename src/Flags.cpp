@@ -0,0 +1,45 @@
+#include "Flags.hpp"
+
+uint8_t sz53[256];
+uint8_t sz53p[256];
+uint8_t szhv_inc[256];
+uint8_t szhv_dec[256];
+uint8_t szhvc_add[2][256][256];
+uint8_t szhvc_sub[2][256][256];
+
+static bool build_tables() {
+    for (int r = 0; r < 256; r++) {
+        uint8_t f = (r & (FLAG_S | FLAG_X | FLAG_Y)) | (r == 0 ? FLAG_Z : 0);
+        int bits = 0;
+        for (int i = 0; i < 8; i++)
+            bits += (r >> i) & 1;
+        sz53[r] = f;
+        sz53p[r] = f | ((bits & 1) ? 0 : FLAG_PV);
+        szhv_inc[r] = f | ((r & 0x0f) == 0x00 ? FLAG_H : 0) | (r == 0x80 ? FLAG_PV : 0);
+        szhv_dec[r] = f | ((r & 0x0f) == 0x0f ? FLAG_H : 0) | (r == 0x7f ? FLAG_PV : 0) | FLAG_N;
+    }
+
+    for (int c = 0; c < 2; c++) {
+        for (int a = 0; a < 256; a++) {
+            for (int b = 0; b < 256; b++) {
+                int r = a + b + c;
+                szhvc_add[c][a][b] = sz53[r & 0xff]
+                                   | ((a ^ b ^ r) & FLAG_H)
+                                   | (((a ^ r) & (b ^ r) & 0x80) ? FLAG_PV : 0)
+                                   | (r > 0xff ? FLAG_C : 0);
+                r = a - b - c;
+                szhvc_sub[c][a][b] = sz53[r & 0xff]
+                                   | ((a ^ b ^ r) & FLAG_H)
+                                   | (((a ^ b) & (a ^ r) & 0x80) ? FLAG_PV : 0)
+                                   | (r < 0 ? FLAG_C : 0)
+                                   | FLAG_N;
+            }
+        }
+    }
+    return true;
+}
+
+void flags_init() {
+    static const bool built = build_tables();
+    (void)built;
+}
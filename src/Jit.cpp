@@ -0,0 +1,1201 @@
+#include "Jit.hpp"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "Debug.hpp"
+#include "Timing.hpp"
+
+#if ZILOG_JIT
+#include <sys/mman.h>
+
+enum {
+    CODE_SIZE   = 4 << 20,      // Native code; full stops compiling until the next flush
+    MAX_NATIVE  = 64 << 10      // Most one block can take
+};
+
+// x86-64 registers. Pinned for the length of a native block:
+//   r15 State*, r8 a, r9 f, r10 b, r11 c, r12 d, r13 e, r14 h, rbx l, rbp sp
+// Every pinned register holds its value zero-extended. rax, rcx, rdx, rsi
+// and rdi are scratch; the stubs take an address in esi and a value in eax.
+enum Reg {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+    NONE = -1
+};
+
+enum { RA = R8, RF = R9, RSTATE = R15, RSPZ = RBP };
+
+// Host register for each Z80 register field (b c d e h l (hl) a)
+static const int z80_reg[8] = { R10, R11, R12, R13, R14, RBX, NONE, R8 };
+
+// Condition codes
+enum { CC_AE = 3, CC_E = 4, CC_NE = 5, CC_A = 7 };
+
+// [base + index * (1 << scale) + disp], always encoded with a SIB byte and a
+// 32-bit displacement to keep the emitter small
+struct Mem {
+    int         base;
+    int         index;
+    int         scale;
+    int32_t     disp;
+};
+
+static Mem at(int base, int32_t disp) { return { base, NONE, 0, disp }; }
+static Mem at(int base, int index, int scale, int32_t disp) { return { base, index, scale, disp }; }
+
+struct Asm {
+    uint8_t     *p;
+    uint8_t     *end;
+    bool        full;
+
+    void b(uint8_t v) {
+        if (p < end)
+            *p++ = v;
+        else
+            full = true;
+    }
+    void d16(uint16_t v) { b(v); b(v >> 8); }
+    void d32(uint32_t v) { d16(v); d16(v >> 16); }
+    void d64(uint64_t v) { d32(v); d32(v >> 32); }
+
+    // REX for a reg field, SIB index and rm/base; byte forces one so that
+    // registers 4-7 mean spl..dil rather than ah..bh
+    void rex(bool w, int reg, int index, int base, bool byte = false) {
+        uint8_t v = 0x40 | (w << 3) | ((reg >> 3) & 1) << 2 | ((index >> 3) & 1) << 1 | ((base >> 3) & 1);
+        if (v != 0x40 || (byte && ((reg >= 4 && reg < 8) || (base >= 4 && base < 8))))
+            b(v);
+    }
+    void rr(int reg, int rm) { b(0xC0 | (reg & 7) << 3 | (rm & 7)); }
+    void rm(int reg, Mem m) {
+        b(0x84 | (reg & 7) << 3);
+        b(m.scale << 6 | ((m.index == NONE ? RSP : m.index) & 7) << 3 | (m.base & 7));
+        d32(m.disp);
+    }
+    int ix(Mem m) { return m.index == NONE ? 0 : m.index; }
+
+    // 32-bit register forms
+    void mov(int dst, int src) { if (dst != src) { rex(0, src, 0, dst); b(0x89); rr(src, dst); } }
+    void alu(uint8_t opc, int dst, int src) { rex(0, src, 0, dst); b(opc); rr(src, dst); }
+    void add(int dst, int src) { alu(0x01, dst, src); }
+    void orr(int dst, int src) { alu(0x09, dst, src); }
+    void andr(int dst, int src) { alu(0x21, dst, src); }
+    void sub(int dst, int src) { alu(0x29, dst, src); }
+    void xorr(int dst, int src) { alu(0x31, dst, src); }
+    void imm(int ext, int dst, uint32_t v) { rex(0, 0, 0, dst); b(0x81); rr(ext, dst); d32(v); }
+    void addi(int dst, uint32_t v) { imm(0, dst, v); }
+    void ori(int dst, uint32_t v) { imm(1, dst, v); }
+    void andi(int dst, uint32_t v) { imm(4, dst, v); }
+    void subi(int dst, uint32_t v) { imm(5, dst, v); }
+    void xori(int dst, uint32_t v) { imm(6, dst, v); }
+    void testi(int dst, uint32_t v) { rex(0, 0, 0, dst); b(0xF7); rr(0, dst); d32(v); }
+    void shl(int dst, uint8_t n) { rex(0, 0, 0, dst); b(0xC1); rr(4, dst); b(n); }
+    void shr(int dst, uint8_t n) { rex(0, 0, 0, dst); b(0xC1); rr(5, dst); b(n); }
+    void movi(int dst, uint32_t v) { rex(0, 0, 0, dst); b(0xB8 + (dst & 7)); d32(v); }
+    void movi64(int dst, uint64_t v) { rex(1, 0, 0, dst); b(0xB8 + (dst & 7)); d64(v); }
+    void movq(int dst, int src) { rex(1, src, 0, dst); b(0x89); rr(src, dst); }
+    void testq(int dst, int src) { rex(1, src, 0, dst); b(0x85); rr(src, dst); }
+    void zx8(int dst, int src) { rex(0, dst, 0, src, true); b(0x0F); b(0xB6); rr(dst, src); }
+
+    // Memory forms
+    void zx8(int dst, Mem m) { rex(0, dst, ix(m), m.base); b(0x0F); b(0xB6); rm(dst, m); }
+    void zx16(int dst, Mem m) { rex(0, dst, ix(m), m.base); b(0x0F); b(0xB7); rm(dst, m); }
+    void loadq(int dst, Mem m) { rex(1, dst, ix(m), m.base); b(0x8B); rm(dst, m); }
+    void store8(Mem m, int src) { rex(0, src, ix(m), m.base, true); b(0x88); rm(src, m); }
+    void store16(Mem m, int src) { b(0x66); rex(0, src, ix(m), m.base); b(0x89); rm(src, m); }
+    void store8i(Mem m, uint8_t v) { rex(0, 0, ix(m), m.base); b(0xC6); rm(0, m); b(v); }
+    void store16i(Mem m, uint16_t v) { b(0x66); rex(0, 0, ix(m), m.base); b(0xC7); rm(0, m); d16(v); }
+    void cmp8i(Mem m, uint8_t v) { rex(0, 0, ix(m), m.base); b(0x80); rm(7, m); b(v); }
+    void addqi(Mem m, uint32_t v) { rex(1, 0, ix(m), m.base); b(0x81); rm(0, m); d32(v); }
+    void storeq(Mem m, int src) { rex(1, src, ix(m), m.base); b(0x89); rm(src, m); }
+    void cmpq(int dst, Mem m) { rex(1, dst, ix(m), m.base); b(0x3B); rm(dst, m); }
+    void addq(int dst, uint32_t v) { rex(1, 0, 0, dst); b(0x81); rr(0, dst); d32(v); }
+    void lea(int dst, Mem m) { rex(0, dst, ix(m), m.base); b(0x8D); rm(dst, m); }
+
+    // Control flow. Forward jumps return the rel32 to patch with bind().
+    uint8_t* jcc(int cc) { b(0x0F); b(0x80 + cc); uint8_t *at = p; d32(0); return at; }
+    uint8_t* jmp() { b(0xE9); uint8_t *at = p; d32(0); return at; }
+    void bind(uint8_t *rel, const uint8_t *to = nullptr) {
+        if (!rel || full)
+            return;
+        int32_t d = (int32_t)((to ? to : p) - (rel + 4));
+        memcpy(rel, &d, 4);
+    }
+    void call(const void *to) { b(0xE8); uint8_t *at = p; d32(0); bind(at, (const uint8_t*)to); }
+    void call_abs(const void *fn) { movi64(RAX, (uint64_t)(uintptr_t)fn); b(0xFF); b(0xD0); }
+    void push(int r) { if (r >= 8) b(0x41); b(0x50 + (r & 7)); }
+    void pop(int r) { if (r >= 8) b(0x41); b(0x58 + (r & 7)); }
+    void ret() { b(0xC3); }
+};
+
+// State fields the native code touches
+static const int32_t OFF_AF = offsetof(State, af);
+static const int32_t OFF_GP = offsetof(State, gp);
+static const int32_t OFF_AF_BANK = offsetof(State, af_bank);
+static const int32_t OFF_GP_BANK = offsetof(State, gp_bank);
+static const int32_t OFF_SP = offsetof(State, sp);
+static const int32_t OFF_PC = offsetof(State, pc);
+static const int32_t OFF_R = offsetof(State, r);
+static const int32_t OFF_INSTRUCTIONS = offsetof(State, instructions);
+static const int32_t OFF_CYCLES = offsetof(State, cycles);
+static const int32_t OFF_READ = offsetof(State, bus) + offsetof(MemoryMap, read);
+static const int32_t OFF_WRITE = offsetof(State, bus) + offsetof(MemoryMap, write);
+
+// Byte offsets of b c d e h l inside a RegBank
+static const int32_t bank_off[6] = { 1, 0, 3, 2, 5, 4 };
+
+// Pinned registers <-> State, through the live banks. Clobbers rcx only.
+static void spill(Asm &a) {
+    a.zx8(RCX, at(RSTATE, OFF_AF_BANK));
+    a.store8(at(RSTATE, RCX, 1, OFF_AF + 1), RA);
+    a.store8(at(RSTATE, RCX, 1, OFF_AF), RF);
+    a.zx8(RCX, at(RSTATE, OFF_GP_BANK));
+    a.lea(RCX, at(RCX, RCX, 1, 0));                 // * 3, then * 2 below
+    for (int r = 0; r < 6; r++)
+        a.store8(at(RSTATE, RCX, 1, OFF_GP + bank_off[r]), z80_reg[r]);
+    a.store16(at(RSTATE, OFF_SP), RSPZ);
+}
+
+static void reload(Asm &a) {
+    a.zx8(RCX, at(RSTATE, OFF_AF_BANK));
+    a.zx8(RA, at(RSTATE, RCX, 1, OFF_AF + 1));
+    a.zx8(RF, at(RSTATE, RCX, 1, OFF_AF));
+    a.zx8(RCX, at(RSTATE, OFF_GP_BANK));
+    a.lea(RCX, at(RCX, RCX, 1, 0));
+    for (int r = 0; r < 6; r++)
+        a.zx8(z80_reg[r], at(RSTATE, RCX, 1, OFF_GP + bank_off[r]));
+    a.zx16(RSPZ, at(RSTATE, OFF_SP));
+}
+
+// Slow paths the stubs call. Reads only trap for devices, open bus and
+// watchpoints; writes also trap for dirty tracking and code watching,
+// which native code can carry on past unless translated code was dropped
+// or a watchpoint fired.
+static uint8_t jit_read(State *s, uint16_t addr) {
+    s->tc->jit->device++;
+    return bus_read_slow(&s->bus, addr);
+}
+
+static bool jit_write(State *s, uint16_t addr, uint8_t value) {
+    TranslationCache *tc = s->tc;
+    unsigned p = addr >> PAGE_SHIFT;
+    bool device = !s->bus.parked[p];
+    uint64_t dropped = tc->dropped;
+    uint32_t epoch = s->bus.epoch;
+    bus_write_slow(&s->bus, addr, value);
+    if (device)
+        tc->jit->device++;
+    return device || tc->dropped != dropped || s->bus.epoch != epoch || debug_hit(s);
+}
+
+// Called from a block's frame, so its exit flag is at [rsp + 8] here
+static void emit_stubs(Jit *jit, Asm &a) {
+    jit->read_stub = a.p;
+    spill(a);
+    a.movq(RDI, RSTATE);
+    a.b(0x48); a.b(0x83); a.b(0xEC); a.b(0x08);     // sub rsp, 8
+    a.call_abs((const void*)jit_read);
+    a.b(0x48); a.b(0x83); a.b(0xC4); a.b(0x08);     // add rsp, 8
+    a.zx8(RAX, RAX);
+    reload(a);
+    a.store8i(at(RSP, 8), 1);
+    a.ret();
+
+    jit->write_stub = a.p;
+    spill(a);
+    a.mov(RDX, RAX);
+    a.movq(RDI, RSTATE);
+    a.b(0x48); a.b(0x83); a.b(0xEC); a.b(0x08);
+    a.call_abs((const void*)jit_write);
+    a.b(0x48); a.b(0x83); a.b(0xC4); a.b(0x08);
+    reload(a);
+    a.b(0x84); a.b(0xC0);                           // test al, al
+    uint8_t *stay = a.jcc(CC_E);
+    a.store8i(at(RSP, 8), 1);
+    a.bind(stay);
+    a.ret();
+}
+
+// Native block frame: [rsp] exit flag, [rsp + 8] instruction limit,
+// [rsp + 16] cycle limit
+enum { FRAME = 24 };
+
+// What the compiler needs to know about an instruction before emitting it
+struct Info {
+    uint8_t     len;        // Bytes; 0 if native code doesn't cover it
+    bool        reads;      // Its result depends on f
+    uint8_t     writes;     // 1 sets some flags and keeps the rest, 2 sets all of f
+    bool        mem;        // Goes to memory, so the block may be left after it
+    bool        last;       // Branch; always ends the block
+};
+
+static Info describe(const uint8_t *code) {
+    uint8_t op = code[0];
+    int y = (op >> 3) & 7;
+    int z = op & 7;
+    if (op == 0x76)
+        return {};
+    if (op >= 0x40 && op < 0x80)
+        return { 1, false, 0, z == 6 || y == 6, false };
+    if (op >= 0x80 && op < 0xC0)
+        return { 1, y == 1 || y == 3, 2, z == 6, false };
+    if (op < 0x40) {
+        switch (z) {
+            case 1: return op & 8 ? Info{ 1, false, 1, false, false } : Info{ 3, false, 0, false, false };
+            case 3: return { 1, false, 0, false, false };
+            case 4: case 5: return { 1, false, 1, y == 6, false };
+            case 6: return { 2, false, 0, y == 6, false };
+        }
+        switch (op) {
+            case 0x00: return { 1, false, 0, false, false };
+            case 0x02: case 0x12: case 0x0A: case 0x1A: return { 1, false, 0, true, false };
+            case 0x22: case 0x2A: case 0x32: case 0x3A: return { 3, false, 0, true, false };
+            case 0x07: case 0x0F: case 0x2F: case 0x37: return { 1, false, 1, false, false };
+            case 0x17: case 0x1F: case 0x3F: return { 1, true, 1, false, false };
+            case 0x10: case 0x18: return { 2, false, 0, false, true };
+            case 0x20: case 0x28: case 0x30: case 0x38: return { 2, true, 0, false, true };
+        }
+        return {};
+    }
+    switch (op) {
+        case 0xC3: return { 3, false, 0, false, true };
+        case 0xC9: return { 1, false, 0, true, true };
+        case 0xCD: return { 3, false, 0, true, true };
+        case 0xE9: return { 1, false, 0, false, true };
+        case 0xEB: case 0xF9: return { 1, false, 0, false, false };
+        case 0xCB: {
+            uint8_t op2 = code[1];
+            int n = (op2 >> 3) & 7;
+            bool mem = (op2 & 7) == 6;
+            switch (op2 >> 6) {
+                case 0: return { 2, n == 2 || n == 3, 2, mem, false };
+                case 1: return { 2, false, 1, mem, false };
+                default: return { 2, false, 0, mem, false };
+            }
+        }
+    }
+    switch (z) {
+        case 0: return { 1, true, 0, true, true };                          // ret cc
+        case 1: return y & 1 ? Info{} : Info{ 1, false, (uint8_t)(y == 6 ? 2 : 0), true, false };
+        case 2: return { 3, true, 0, false, true };                         // jp cc
+        case 4: return { 3, true, 0, true, true };                          // call cc
+        case 5: return y & 1 ? Info{} : Info{ 1, y == 6, 0, true, false };
+        case 6: return { 2, y == 1 || y == 3, 2, false, false };            // alu a,n
+        case 7: return { 1, false, 0, true, true };                         // rst
+    }
+    return {};
+}
+
+// Compiles one block
+struct Compiler {
+    Asm         a;
+    const Jit   *jit;
+    const Block *block;
+    uint8_t     *body;              // After the prologue; self-loops jump here
+    std::vector<uint8_t*> exits;    // jmps to the epilogue
+    bool        touched;            // Current instruction went to memory
+    bool        live;               // Something reads f before it's next set
+
+    // eax = byte at esi
+    void read() {
+        a.mov(RAX, RSI);
+        a.shr(RAX, PAGE_SHIFT);
+        a.loadq(RDX, at(RSTATE, RAX, 3, OFF_READ));
+        a.testq(RDX, RDX);
+        uint8_t *slow = a.jcc(CC_E);
+        a.zx8(RAX, at(RDX, RSI, 0, 0));
+        uint8_t *done = a.jmp();
+        a.bind(slow);
+        a.call(jit->read_stub);
+        a.bind(done);
+        touched = true;
+    }
+
+    // byte at esi = al
+    void write() {
+        a.mov(RCX, RSI);
+        a.shr(RCX, PAGE_SHIFT);
+        a.loadq(RDX, at(RSTATE, RCX, 3, OFF_WRITE));
+        a.testq(RDX, RDX);
+        uint8_t *slow = a.jcc(CC_E);
+        a.store8(at(RDX, RSI, 0, 0), RAX);
+        uint8_t *done = a.jmp();
+        a.bind(slow);
+        a.call(jit->write_stub);
+        a.bind(done);
+        touched = true;
+    }
+
+    // Register pairs: 0 bc, 1 de, 2 hl, 3 sp. Values are 16-bit.
+    void get_pair(int pair, int dst) {
+        if (pair == 3) {
+            a.mov(dst, RSPZ);
+            return;
+        }
+        a.mov(dst, z80_reg[pair * 2]);
+        a.shl(dst, 8);
+        a.orr(dst, z80_reg[pair * 2 + 1]);
+    }
+
+    void set_pair(int pair, int src) {
+        if (pair == 3) {
+            a.mov(RSPZ, src);
+            return;
+        }
+        a.zx8(z80_reg[pair * 2 + 1], src);
+        a.mov(z80_reg[pair * 2], src);
+        a.shr(z80_reg[pair * 2], 8);
+    }
+
+    void set_pair(int pair, uint16_t v) {
+        if (pair == 3) {
+            a.movi(RSPZ, v);
+            return;
+        }
+        a.movi(z80_reg[pair * 2], v >> 8);
+        a.movi(z80_reg[pair * 2 + 1], v & 0xff);
+    }
+
+    // f = table[index]
+    void flags_from(const uint8_t *table, int index) {
+        a.movi64(RDX, (uint64_t)(uintptr_t)table);
+        a.zx8(RF, at(RDX, index, 0, 0));
+    }
+
+    // Keep f's bits in mask and or in src's
+    void merge_flags(uint8_t mask, int src) {
+        a.andi(RF, mask);
+        a.orr(RF, src);
+    }
+
+    // a = a op ecx for alu group op (add adc sub sbc and xor or cp)
+    void alu(int op) {
+        if (!live) {
+            if (op == 1 || op == 3) {
+                a.mov(RDI, RF);
+                a.andi(RDI, FLAG_C);
+            }
+            switch (op) {
+                case 0: case 1: a.add(RA, RCX); break;
+                case 2: case 3: a.sub(RA, RCX); break;
+                case 4: a.andr(RA, RCX); break;
+                case 5: a.xorr(RA, RCX); break;
+                case 6: a.orr(RA, RCX); break;
+                case 7: return;
+            }
+            if (op == 1)
+                a.add(RA, RDI);
+            else if (op == 3)
+                a.sub(RA, RDI);
+            a.zx8(RA, RA);
+            return;
+        }
+        const uint8_t *table = (op == 0 || op == 1) ? &szhvc_add[0][0][0] : &szhvc_sub[0][0][0];
+        switch (op) {
+            case 0: case 1: case 2: case 3: case 7:
+                if (op == 1 || op == 3) {
+                    a.mov(RDI, RF);
+                    a.andi(RDI, FLAG_C);
+                    a.mov(RAX, RDI);
+                    a.shl(RAX, 8);
+                    a.orr(RAX, RA);
+                } else {
+                    a.mov(RAX, RA);
+                }
+                a.shl(RAX, 8);
+                a.orr(RAX, RCX);
+                flags_from(table, RAX);
+                if (op == 7) {
+                    a.andi(RF, ~(FLAG_X | FLAG_Y) & 0xff);
+                    a.mov(RAX, RCX);
+                    a.andi(RAX, FLAG_X | FLAG_Y);
+                    a.orr(RF, RAX);
+                    return;
+                }
+                if (op < 2) {
+                    a.add(RA, RCX);
+                    if (op == 1)
+                        a.add(RA, RDI);
+                } else {
+                    a.sub(RA, RCX);
+                    if (op == 3)
+                        a.sub(RA, RDI);
+                }
+                a.zx8(RA, RA);
+                return;
+            case 4: a.andr(RA, RCX); break;
+            case 5: a.xorr(RA, RCX); break;
+            case 6: a.orr(RA, RCX); break;
+        }
+        flags_from(sz53p, RA);
+        if (op == 4)
+            a.ori(RF, FLAG_H);
+    }
+
+    // r = r +/- 1 with inc8/dec8 flags
+    void incdec(int r, bool dec) {
+        if (dec)
+            a.subi(r, 1);
+        else
+            a.addi(r, 1);
+        a.zx8(r, r);
+        if (!live)
+            return;
+        a.movi64(RDX, (uint64_t)(uintptr_t)(dec ? szhv_dec : szhv_inc));
+        a.zx8(RAX, at(RDX, r, 0, 0));
+        merge_flags(FLAG_C, RAX);
+    }
+
+    // CB xx on the value in r
+    void cb(uint8_t op, int r) {
+        int n = (op >> 3) & 7;
+        switch (op >> 6) {
+            case 1:         // bit n
+                if (!live)
+                    return;
+                a.mov(RAX, r);
+                a.andi(RAX, 1u << n);
+                a.movi64(RDX, (uint64_t)(uintptr_t)sz53p);
+                a.zx8(RAX, at(RDX, RAX, 0, 0));
+                a.andi(RAX, ~(FLAG_X | FLAG_Y) & 0xff);
+                a.andi(RF, FLAG_C);
+                a.orr(RF, RAX);
+                a.ori(RF, FLAG_H);
+                a.mov(RAX, r);
+                a.andi(RAX, FLAG_X | FLAG_Y);
+                a.orr(RF, RAX);
+                return;
+            case 2: a.andi(r, ~(1u << n) & 0xff); return;
+            case 3: a.ori(r, 1u << n); return;
+        }
+        // Rotates and shifts: eax = bit shifted out
+        bool left = !(n & 1);
+        a.mov(RAX, r);
+        if (left)
+            a.shr(RAX, 7);
+        else
+            a.andi(RAX, 1);
+        switch (n) {
+            case 0:     // rlc
+                a.shl(r, 1);
+                a.orr(r, RAX);
+                break;
+            case 1:     // rrc
+                a.shr(r, 1);
+                a.mov(RDI, RAX);
+                a.shl(RDI, 7);
+                a.orr(r, RDI);
+                break;
+            case 2:     // rl
+                a.mov(RDI, RF);
+                a.andi(RDI, FLAG_C);
+                a.shl(r, 1);
+                a.orr(r, RDI);
+                break;
+            case 3:     // rr
+                a.mov(RDI, RF);
+                a.andi(RDI, FLAG_C);
+                a.shl(RDI, 7);
+                a.shr(r, 1);
+                a.orr(r, RDI);
+                break;
+            case 4:     // sla
+                a.shl(r, 1);
+                break;
+            case 5:     // sra
+                a.mov(RDI, r);
+                a.andi(RDI, 0x80);
+                a.shr(r, 1);
+                a.orr(r, RDI);
+                break;
+            case 6:     // sll
+                a.shl(r, 1);
+                a.ori(r, 1);
+                break;
+            case 7:     // srl
+                a.shr(r, 1);
+                break;
+        }
+        a.zx8(r, r);
+        if (!live)
+            return;
+        flags_from(sz53p, r);
+        a.orr(RF, RAX);
+    }
+
+    // Leave with pc and the number of instructions done
+    void exit(uint16_t pc, uint32_t done) {
+        a.store16i(at(RSTATE, OFF_PC), pc);
+        a.movi(RAX, done);
+        exits.push_back(a.jmp());
+    }
+
+    // Leave after a taken or not-taken branch, pc already stored
+    void leave(uint32_t done) {
+        a.movi(RAX, done);
+        exits.push_back(a.jmp());
+    }
+
+    // Leave for pc, unless pc is this block's start and both budgets would
+    // let the executor run it again: then charge it and go round natively
+    void branch(uint16_t pc, uint32_t done) {
+        if (pc == block->start) {
+            a.loadq(RAX, at(RSTATE, OFF_INSTRUCTIONS));
+            a.addq(RAX, block->count);
+            a.cmpq(RAX, at(RSP, 8));
+            uint8_t *over = a.jcc(CC_A);
+            a.loadq(RCX, at(RSTATE, OFF_CYCLES));
+            a.addq(RCX, block->lead);
+            a.cmpq(RCX, at(RSP, 16));
+            uint8_t *spent = a.jcc(CC_AE);
+            a.storeq(at(RSTATE, OFF_INSTRUCTIONS), RAX);
+            a.addqi(at(RSTATE, OFF_CYCLES), block->cycles);
+            a.zx8(RAX, at(RSTATE, OFF_R));
+            a.mov(RCX, RAX);
+            a.andi(RCX, 0x80);
+            a.addi(RAX, block->m1);
+            a.andi(RAX, 0x7f);
+            a.orr(RAX, RCX);
+            a.store8(at(RSTATE, OFF_R), RAX);
+            a.bind(a.jmp(), body);
+            a.bind(over);
+            a.bind(spent);
+        }
+        exit(pc, done);
+    }
+
+    void taken(uint8_t op) {
+        if (cycles_op_taken[op])
+            a.addqi(at(RSTATE, OFF_CYCLES), cycles_op_taken[op]);
+    }
+
+    // Jump over the taken path unless condition cc (nz z nc c po pe p m) holds
+    uint8_t* unless(int cc) {
+        static const uint8_t bits[4] = { FLAG_Z, FLAG_C, FLAG_PV, FLAG_S };
+        a.testi(RF, bits[cc >> 1]);
+        return a.jcc(cc & 1 ? CC_E : CC_NE);
+    }
+
+    void push(int pair_or_af, uint16_t value, bool constant) {
+        // Value to push goes hi byte first
+        for (int half = 0; half < 2; half++) {
+            a.subi(RSPZ, 1);
+            a.andi(RSPZ, 0xffff);
+            a.mov(RSI, RSPZ);
+            if (constant)
+                a.movi(RAX, half ? value & 0xff : value >> 8);
+            else if (pair_or_af == 3)
+                a.mov(RAX, half ? RF : RA);
+            else
+                a.mov(RAX, z80_reg[pair_or_af * 2 + half]);
+            write();
+        }
+    }
+
+    // Pop into dst_lo / dst_hi (host registers), or into pc when they're NONE
+    void pop(int lo, int hi) {
+        for (int half = 0; half < 2; half++) {
+            a.mov(RSI, RSPZ);
+            read();
+            int dst = half ? hi : lo;
+            if (dst == NONE)
+                a.store8(at(RSTATE, OFF_PC + half), RAX);
+            else
+                a.mov(dst, RAX);
+            a.addi(RSPZ, 1);
+            a.andi(RSPZ, 0xffff);
+        }
+    }
+
+    // Emit instruction i at pc from code. Returns its length, or 0 if it
+    // isn't supported. *last is set for branches, which store pc and leave.
+    unsigned insn(const uint8_t *code, uint16_t pc, uint32_t i, bool *last);
+};
+
+unsigned Compiler::insn(const uint8_t *code, uint16_t pc, uint32_t i, bool *last) {
+    uint8_t op = code[0];
+    int y = (op >> 3) & 7;
+    int z = op & 7;
+    int pair = (op >> 4) & 3;
+    uint16_t nn = code[1] | (code[2] << 8);
+    *last = false;
+
+    // ld r,r' / ld r,(hl) / ld (hl),r
+    if (op >= 0x40 && op < 0x80 && op != 0x76) {
+        if (z == 6) {
+            get_pair(2, RSI);
+            read();
+            a.mov(z80_reg[y], RAX);
+        } else if (y == 6) {
+            get_pair(2, RSI);
+            a.mov(RAX, z80_reg[z]);
+            write();
+        } else {
+            a.mov(z80_reg[y], z80_reg[z]);
+        }
+        return 1;
+    }
+    // alu a,r / a,(hl)
+    if (op >= 0x80 && op < 0xC0) {
+        if (z == 6) {
+            get_pair(2, RSI);
+            read();
+            a.mov(RCX, RAX);
+        } else {
+            a.mov(RCX, z80_reg[z]);
+        }
+        alu(y);
+        return 1;
+    }
+    if (op < 0x40) {
+        switch (z) {
+            case 1:
+                if (op & 8) {           // add hl,rr
+                    get_pair(2, RAX);
+                    get_pair(pair, RCX);
+                    a.lea(RDX, at(RAX, RCX, 0, 0));
+                    if (!live) {
+                        a.andi(RDX, 0xffff);
+                        set_pair(2, RDX);
+                        return 1;
+                    }
+                    a.mov(RDI, RAX);
+                    a.xorr(RDI, RCX);
+                    a.xorr(RDI, RDX);
+                    a.shr(RDI, 8);
+                    a.andi(RDI, FLAG_H);
+                    a.andi(RF, FLAG_S | FLAG_Z | FLAG_PV);
+                    a.orr(RF, RDI);
+                    a.mov(RDI, RDX);
+                    a.shr(RDI, 8);
+                    a.andi(RDI, FLAG_X | FLAG_Y);
+                    a.orr(RF, RDI);
+                    a.mov(RDI, RDX);
+                    a.shr(RDI, 16);
+                    a.orr(RF, RDI);
+                    a.andi(RDX, 0xffff);
+                    set_pair(2, RDX);
+                } else {                // ld rr,nn
+                    set_pair(pair, nn);
+                }
+                return op & 8 ? 1 : 3;
+            case 3:                     // inc rr / dec rr
+                get_pair(pair, RAX);
+                if (op & 8)
+                    a.subi(RAX, 1);
+                else
+                    a.addi(RAX, 1);
+                a.andi(RAX, 0xffff);
+                set_pair(pair, RAX);
+                return 1;
+            case 4: case 5:             // inc r / dec r
+                if (y == 6) {
+                    get_pair(2, RSI);
+                    read();
+                    a.mov(RCX, RAX);
+                    incdec(RCX, z == 5);
+                    get_pair(2, RSI);
+                    a.mov(RAX, RCX);
+                    write();
+                } else {
+                    incdec(z80_reg[y], z == 5);
+                }
+                return 1;
+            case 6:                     // ld r,n
+                if (y == 6) {
+                    get_pair(2, RSI);
+                    a.movi(RAX, code[1]);
+                    write();
+                } else {
+                    a.movi(z80_reg[y], code[1]);
+                }
+                return 2;
+        }
+        switch (op) {
+            case 0x00:
+                return 1;
+            case 0x02: case 0x12:       // ld (bc),a / ld (de),a
+                get_pair(pair, RSI);
+                a.mov(RAX, RA);
+                write();
+                return 1;
+            case 0x0A: case 0x1A:       // ld a,(bc) / ld a,(de)
+                get_pair(pair, RSI);
+                read();
+                a.mov(RA, RAX);
+                return 1;
+            case 0x22:                  // ld (nn),hl
+                a.movi(RSI, nn);
+                a.mov(RAX, z80_reg[5]);
+                write();
+                a.movi(RSI, (uint16_t)(nn + 1));
+                a.mov(RAX, z80_reg[4]);
+                write();
+                return 3;
+            case 0x2A:                  // ld hl,(nn)
+                a.movi(RSI, nn);
+                read();
+                a.mov(z80_reg[5], RAX);
+                a.movi(RSI, (uint16_t)(nn + 1));
+                read();
+                a.mov(z80_reg[4], RAX);
+                return 3;
+            case 0x32:                  // ld (nn),a
+                a.movi(RSI, nn);
+                a.mov(RAX, RA);
+                write();
+                return 3;
+            case 0x3A:                  // ld a,(nn)
+                a.movi(RSI, nn);
+                read();
+                a.mov(RA, RAX);
+                return 3;
+            case 0x07:                  // rlca
+                a.mov(RAX, RA);
+                a.shr(RAX, 7);
+                a.shl(RA, 1);
+                a.orr(RA, RAX);
+                a.zx8(RA, RA);
+                if (!live)
+                    return 1;
+                a.mov(RAX, RA);
+                a.andi(RAX, FLAG_X | FLAG_Y | FLAG_C);
+                merge_flags(FLAG_S | FLAG_Z | FLAG_PV, RAX);
+                return 1;
+            case 0x0F: case 0x17: case 0x1F: {      // rrca / rla / rra
+                a.mov(RCX, RA);
+                if (op == 0x17)
+                    a.shr(RCX, 7);
+                else
+                    a.andi(RCX, 1);
+                if (op == 0x0F) {
+                    a.mov(RAX, RCX);
+                    a.shl(RAX, 7);
+                } else {
+                    a.mov(RAX, RF);
+                    a.andi(RAX, FLAG_C);
+                    if (op == 0x1F)
+                        a.shl(RAX, 7);
+                }
+                if (op == 0x17)
+                    a.shl(RA, 1);
+                else
+                    a.shr(RA, 1);
+                a.orr(RA, RAX);
+                a.zx8(RA, RA);
+                if (!live)
+                    return 1;
+                a.mov(RAX, RA);
+                a.andi(RAX, FLAG_X | FLAG_Y);
+                a.orr(RAX, RCX);
+                merge_flags(FLAG_S | FLAG_Z | FLAG_PV, RAX);
+                return 1;
+            }
+            case 0x2F:                  // cpl
+                a.xori(RA, 0xff);
+                if (!live)
+                    return 1;
+                a.mov(RAX, RA);
+                a.andi(RAX, FLAG_X | FLAG_Y);
+                a.ori(RAX, FLAG_H | FLAG_N);
+                merge_flags(FLAG_S | FLAG_Z | FLAG_PV | FLAG_C, RAX);
+                return 1;
+            case 0x37:                  // scf
+                if (!live)
+                    return 1;
+                a.mov(RAX, RA);
+                a.andi(RAX, FLAG_X | FLAG_Y);
+                a.ori(RAX, FLAG_C);
+                merge_flags(FLAG_S | FLAG_Z | FLAG_PV, RAX);
+                return 1;
+            case 0x3F:                  // ccf: H takes the old carry
+                if (!live)
+                    return 1;
+                a.mov(RAX, RF);
+                a.andi(RAX, FLAG_C);
+                a.shl(RAX, 4);
+                a.mov(RCX, RA);
+                a.andi(RCX, FLAG_X | FLAG_Y);
+                a.orr(RAX, RCX);
+                merge_flags(FLAG_S | FLAG_Z | FLAG_PV | FLAG_C, RAX);
+                a.xori(RF, FLAG_C);
+                return 1;
+            case 0x10: case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: {
+                uint16_t to = pc + 2 + (int8_t)code[1];
+                uint8_t *skip = nullptr;
+                if (op == 0x10) {       // djnz
+                    a.subi(R10, 1);
+                    a.zx8(R10, R10);
+                    skip = a.jcc(CC_E);
+                } else if (op != 0x18) {
+                    skip = unless((op >> 3) & 3);
+                }
+                taken(op);
+                branch(to, i + 1);
+                if (skip) {
+                    a.bind(skip);
+                    exit(pc + 2, i + 1);
+                }
+                *last = true;
+                return 2;
+            }
+        }
+        return 0;
+    }
+
+    if (op == 0x76)                     // halt stops the run; left to the interpreter
+        return 0;
+    switch (op) {
+        case 0xC3:                      // jp nn
+            branch(nn, i + 1);
+            *last = true;
+            return 3;
+        case 0xC9:                      // ret
+            pop(NONE, NONE);
+            leave(i + 1);
+            *last = true;
+            return 1;
+        case 0xCD:                      // call nn
+            push(0, pc + 3, true);
+            taken(op);
+            exit(nn, i + 1);
+            *last = true;
+            return 3;
+        case 0xE9:                      // jp (hl)
+            get_pair(2, RAX);
+            a.store16(at(RSTATE, OFF_PC), RAX);
+            leave(i + 1);
+            *last = true;
+            return 1;
+        case 0xEB:                      // ex de,hl
+            a.mov(RAX, R12);
+            a.mov(R12, R14);
+            a.mov(R14, RAX);
+            a.mov(RAX, R13);
+            a.mov(R13, RBX);
+            a.mov(RBX, RAX);
+            return 1;
+        case 0xF9:                      // ld sp,hl
+            get_pair(2, RSPZ);
+            return 1;
+        case 0xCB: {
+            uint8_t op2 = code[1];
+            int r = op2 & 7;
+            if (r != 6) {
+                cb(op2, z80_reg[r]);
+                return 2;
+            }
+            get_pair(2, RSI);
+            read();
+            a.mov(RCX, RAX);
+            cb(op2, RCX);
+            if ((op2 >> 6) != 1) {
+                get_pair(2, RSI);
+                a.mov(RAX, RCX);
+                write();
+            }
+            return 2;
+        }
+    }
+    switch (z) {
+        case 0: {                       // ret cc
+            uint8_t *skip = unless(y);
+            pop(NONE, NONE);
+            taken(op);
+            leave(i + 1);
+            a.bind(skip);
+            exit(pc + 1, i + 1);
+            *last = true;
+            return 1;
+        }
+        case 1:                         // pop rr / pop af
+            if (y & 1)
+                return 0;
+            if (pair == 3)
+                pop(RF, RA);
+            else
+                pop(z80_reg[pair * 2 + 1], z80_reg[pair * 2]);
+            return 1;
+        case 2: case 4: {               // jp cc,nn / call cc,nn
+            uint8_t *skip = unless(y);
+            if (z == 4) {
+                push(0, pc + 3, true);
+                taken(op);
+                exit(nn, i + 1);
+            } else {
+                branch(nn, i + 1);
+            }
+            a.bind(skip);
+            exit(pc + 3, i + 1);
+            *last = true;
+            return 3;
+        }
+        case 5:                         // push rr / push af
+            if (y & 1)
+                return 0;
+            push(pair, 0, false);
+            return 1;
+        case 6:                         // alu a,n
+            a.movi(RCX, code[1]);
+            alu(y);
+            return 2;
+        case 7:                         // rst
+            push(0, pc + 1, true);
+            exit(op & 0x38, i + 1);
+            *last = true;
+            return 1;
+    }
+    return 0;
+}
+
+static Jit* jit_create() {
+    Jit *jit = (Jit*)calloc(1, sizeof(Jit));
+    if (!jit)
+        return nullptr;
+    void *code = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        free(jit);
+        return nullptr;
+    }
+    jit->code = (uint8_t*)code;
+    jit->size = CODE_SIZE;
+    Asm a = { jit->code, jit->code + jit->size, false };
+    emit_stubs(jit, a);
+    jit->stubs = jit->used = a.p - jit->code;
+    return jit;
+}
+
+void jit_flush(Jit *jit) {
+    jit->used = jit->stubs;
+}
+
+void jit_destroy(Jit *jit) {
+    if (!jit)
+        return;
+    munmap(jit->code, jit->size);
+    if (jit->shadow)
+        z80free(jit->shadow);
+    free(jit);
+}
+
+bool jit_compile(TranslationCache *tc, State *state, Block *b) {
+    if (!tc->jit && !(tc->jit = jit_create()))
+        return false;
+    Jit *jit = tc->jit;
+    if ((jit->never[b->start >> 3] >> (b->start & 7) & 1)
+        || b->uops[0].handler == tc->handlers.loop          // Already fast-forwarded
+        || b->uops[0].handler == tc->handlers.idle
+        || jit->size - jit->used < MAX_NATIVE)
+        return false;
+    const uint8_t *code = bus_read_ptr(&state->bus, b->start);
+    if (!code)
+        return false;
+
+    // Find the instructions to compile, walking the block's bytes alongside
+    // its uops (they must agree), then which of them need to produce f: it's
+    // needed at every exit, and before anything that reads it
+    Info info[BLOCK_MAX_UOPS];
+    bool live[BLOCK_MAX_UOPS];
+    uint32_t n = 0;
+    for (unsigned off = 0; n < b->count; n++) {
+        const Uop &u = b->uops[n];
+        info[n] = describe(code + off);
+        if (!info[n].len || u.op != code[off + u.skip - 1])
+            break;
+        off += info[n].len;
+        if (info[n].last) {
+            n++;
+            break;
+        }
+    }
+    if (!n) {
+        b->hits = JIT_THRESHOLD + 1;    // Don't come back to it
+        return false;
+    }
+    bool needed = true;
+    for (uint32_t i = n; i-- > 0;) {
+        live[i] = needed || info[i].mem;
+        needed = info[i].writes == 2 ? info[i].reads : live[i] || info[i].reads;
+    }
+
+    uint8_t *start = jit->code + jit->used;
+    Compiler c = { { start, start + MAX_NATIVE, false }, jit, b, nullptr, {}, false, false };
+    Asm &a = c.a;
+    a.push(RBX); a.push(RBP); a.push(R12); a.push(R13); a.push(R14); a.push(R15);
+    a.b(0x48); a.b(0x83); a.b(0xEC); a.b(FRAME);    // sub rsp, FRAME; keeps calls aligned
+    a.movq(RSTATE, RDI);
+    a.storeq(at(RSP, 8), RSI);
+    a.storeq(at(RSP, 16), RDX);
+    a.store8i(at(RSP, 0), 0);
+    reload(a);
+    c.body = a.p;
+
+    uint16_t pc = b->start;
+    bool last = false;
+    for (uint32_t i = 0; i < n; i++) {
+        c.touched = false;
+        c.live = live[i];
+        if (c.insn(code + (pc - b->start), pc, i, &last) != info[i].len) {
+            b->hits = JIT_THRESHOLD + 1;
+            return false;
+        }
+        pc += info[i].len;
+        if (c.touched && !last) {
+            // A device access or dropped code ends the block here
+            a.cmp8i(at(RSP, 0), 0);
+            uint8_t *stay = a.jcc(CC_E);
+            c.exit(pc, i + 1);
+            a.bind(stay);
+        }
+    }
+    if (!last)
+        c.exit(pc, n);
+
+    uint8_t *epilogue = a.p;
+    spill(a);
+    a.b(0x48); a.b(0x83); a.b(0xC4); a.b(FRAME);    // add rsp, FRAME
+    a.pop(R15); a.pop(R14); a.pop(R13); a.pop(R12); a.pop(RBP); a.pop(RBX);
+    a.ret();
+    for (uint8_t *rel : c.exits)
+        a.bind(rel, epilogue);
+    if (a.full) {
+        b->hits = JIT_THRESHOLD + 1;
+        return false;
+    }
+
+    b->native = (NativeBlock)start;
+    jit->used += a.p - start;
+    jit->compiled++;
+    return true;
+}
+
+// Shadow bus entry for an entry of the real bus: RAM inside state->memory
+// moves to the shadow's copy, other direct pages are read in place, and
+// writes anywhere else are dropped
+static uintptr_t shadow_entry(const State *state, const uint8_t *mem, uintptr_t entry,
+                              unsigned p, bool writes) {
+    if (!entry)
+        return 0;
+    const uint8_t *host = (const uint8_t*)(entry + ((uintptr_t)p << PAGE_SHIFT));
+    if (host >= state->memory && host < state->memory + state->mem_size)
+        return (uintptr_t)(mem + (host - state->memory)) - ((uintptr_t)p << PAGE_SHIFT);
+    return writes ? 0 : entry;
+}
+
+static bool same_registers(const State *a, const State *b) {
+    return !memcmp(a->af, b->af, sizeof(a->af)) && !memcmp(a->gp, b->gp, sizeof(a->gp))
+        && a->af_bank == b->af_bank && a->gp_bank == b->gp_bank
+        && a->sp == b->sp && a->pc == b->pc && a->ix.w == b->ix.w && a->iy.w == b->iy.w
+        && a->i == b->i && a->r == b->r && a->iff1 == b->iff1 && a->iff2 == b->iff2
+        && a->im == b->im && a->halted == b->halted
+        && a->instructions == b->instructions && a->cycles == b->cycles;
+}
+
+static void check_begin(Jit *jit, State *state) {
+    jit->before = *state;
+    memcpy(jit->shadow->memory, state->memory, state->mem_size);
+}
+
+// Replay the instructions native code ran on the shadow and compare
+static void check_end(Jit *jit, State *state, Block *b, bool device) {
+    if (device)
+        return;                 // A device saw the access; replaying would repeat it
+    State *sh = jit->shadow;
+    uint8_t *mem = sh->memory;
+    *sh = jit->before;
+    sh->memory = mem;
+    sh->tc = nullptr;
+    sh->translate = 0;
+    sh->jit = JIT_OFF;
+    sh->trace = 0;
+    sh->tracer = nullptr;
+    sh->profile = nullptr;
+    sh->debug = nullptr;
+    for (unsigned p = 0; p < PAGE_COUNT; p++) {
+        const MemoryMap &bus = jit->before.bus;
+        uintptr_t read = bus.read[p] ? bus.read[p] : bus.parked_read[p];
+        uintptr_t write = bus.write[p] ? bus.write[p] : bus.parked[p];
+        sh->bus.read[p] = shadow_entry(state, mem, read, p, false);
+        sh->bus.write[p] = shadow_entry(state, mem, write, p, true);
+        sh->bus.mmio[p] = nullptr;
+        sh->bus.parked[p] = 0;
+        sh->bus.parked_read[p] = 0;
+        sh->bus.watch[p] = 0;
+    }
+    sh->bus.code_write = nullptr;
+    uint64_t done = state->instructions - jit->before.instructions;
+    if (done)
+        run(sh, done);
+    flags_settle(sh);
+    jit->checks++;
+    if (same_registers(sh, state) && !memcmp(mem, state->memory, state->mem_size))
+        return;
+
+    jit->mismatches++;
+    fprintf(stderr, "jit: block at %04x differs from the interpreter after %llu instructions\n"
+            "  native: pc=%04x af=%04x bc=%04x de=%04x hl=%04x sp=%04x cycles=%llu\n"
+            "  interp: pc=%04x af=%04x bc=%04x de=%04x hl=%04x sp=%04x cycles=%llu\n",
+            b->start, (unsigned long long)done,
+            state->pc, reg_af(state).w, reg_bc(state).w, reg_de(state).w, reg_hl(state).w,
+            state->sp, (unsigned long long)state->cycles,
+            sh->pc, reg_af(sh).w, reg_bc(sh).w, reg_de(sh).w, reg_hl(sh).w,
+            sh->sp, (unsigned long long)sh->cycles);
+
+    // Keep the interpreter's answer and stop compiling this block
+    memcpy(state->af, sh->af, sizeof(state->af));
+    memcpy(state->gp, sh->gp, sizeof(state->gp));
+    state->af_bank = sh->af_bank;
+    state->gp_bank = sh->gp_bank;
+    state->sp = sh->sp;
+    state->pc = sh->pc;
+    state->ix = sh->ix;
+    state->iy = sh->iy;
+    state->r = sh->r;
+    state->instructions = sh->instructions;
+    state->cycles = sh->cycles;
+    memcpy(state->memory, mem, state->mem_size);
+    bus_touch(&state->bus);
+    jit->never[b->start >> 3] |= 1 << (b->start & 7);
+    b->native = nullptr;
+}
+
+void jit_run(TranslationCache *tc, State *state, Block *b, uint64_t limit, uint64_t cycle_limit) {
+    Jit *jit = tc->jit;
+    flags_settle(state);        // Native code keeps f in a register
+    bool check = state->jit == JIT_CHECK && (jit->shadow || (jit->shadow = z80init()));
+    if (check)
+        check_begin(jit, state);
+    uint64_t device = jit->device;
+
+    state->instructions += b->count;
+    state->cycles += b->cycles;
+    state->r = (state->r & 0x80) | ((state->r + b->m1) & 0x7f);
+    uint32_t done = b->native(state, limit, cycle_limit);
+    jit->runs++;
+    if (done < b->count) {
+        // Hand back what the early exit skipped
+        uint32_t m1 = 0;
+        for (const Uop *u = b->uops + done; u->m1; u++) {
+            state->instructions--;
+            state->cycles -= u->cycles;
+            m1 += u->m1;
+        }
+        state->r = (state->r & 0x80) | ((state->r - m1) & 0x7f);
+        jit->exits++;
+    }
+    if (check)
+        check_end(jit, state, b, jit->device != device);
+}
+
+#else
+
+void jit_flush(Jit*) {}
+void jit_destroy(Jit*) {}
+bool jit_compile(TranslationCache*, State*, Block*) { return false; }
+void jit_run(TranslationCache*, State*, Block*, uint64_t, uint64_t) {}
+
+#endif
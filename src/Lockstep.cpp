@@ -0,0 +1,809 @@
+#include "Lockstep.hpp"
+
+#include <chrono>
+#include <cstring>
+
+#include "ThreadPool.hpp"
+#include "Timing.hpp"
+
+// The step is built once per instruction set and the loader picks the best
+// the host has; the kernels are forced inline so each copy gets its own
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__) && defined(__linux__)
+#define LOCKSTEP_TARGETS    __attribute__((target_clones("arch=skylake-avx512", "avx2", "default")))
+#else
+#define LOCKSTEP_TARGETS
+#endif
+#if defined(__GNUC__)
+#define KERNEL              static inline __attribute__((always_inline))
+#else
+#define KERNEL              static inline
+#endif
+
+enum {
+    L       = LOCKSTEP_LANES,
+    RUN     = 64,           // Most instructions a straight run takes in one step
+    STRETCH = 1 << 30       // Most of a budget a lane's 32-bit counts hold at once
+};
+
+#define LANES   for (unsigned i = 0; i < L; i++)
+
+struct Gang {
+    // Main registers of every lane; f is always settled
+    alignas(64) uint8_t a[L];
+    uint8_t     f[L], b[L], c[L], d[L], e[L], h[L], l[L];
+    uint8_t     r[L];
+    uint16_t    pc[L];
+    uint16_t    sp[L];
+    uint64_t    instructions[L];    // As of the last refill; left says how far since
+    uint64_t    cycles[L];
+    uint64_t    limit[L];           // Absolute, as execute() works them out
+    uint64_t    cycle_limit[L];
+    int32_t     left[L];            // Budget left in the stretch; spent at 0 or below
+    int32_t     cycles_left[L];
+    int32_t     stretch[L];         // What left and cycles_left were refilled to
+    int32_t     cycle_stretch[L];
+
+    uint8_t     live[L];            // 0xff while the lane runs in the gang
+    uint8_t     run[L];             // 0xff for lanes the current kernel applies to
+    uint8_t     scalar[L];          // Lanes taking an interpreted step instead
+    uint32_t    seen[L];            // Value of steps when the lane last ran
+    uint8_t     peeled[L];
+    uint8_t     translate[L];       // The lane's State::translate, put back at the end
+    State       *state[L];          // Null past the gang's last machine
+    StopReason  why[L];
+    uint64_t    shared;             // Pages direct in every lane and the same in all
+    uint32_t    steps;
+    uint32_t    work;               // Lane-instructions in this window of steps
+};
+
+// Bytes of each unprefixed opcode the kernels run; 0 for the ones that take
+// an interpreted step
+static const uint8_t kernel_length[256] = {
+    1, 3, 1, 1, 1, 1, 2, 1, 0, 1, 1, 1, 1, 1, 2, 1,     // 08 ex af,af'
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+    2, 3, 3, 1, 1, 1, 2, 0, 2, 1, 3, 1, 1, 1, 2, 1,     // 27 daa
+    2, 3, 3, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 0, 3, 3, 2, 1,     // cb
+    1, 1, 3, 0, 3, 1, 2, 1, 1, 0, 3, 0, 3, 0, 2, 1,     // out, exx, in, dd
+    1, 1, 3, 0, 3, 1, 2, 1, 1, 1, 3, 1, 3, 0, 2, 1,     // ex (sp),hl, ed
+    1, 1, 3, 0, 3, 1, 2, 1, 1, 1, 3, 0, 3, 0, 2, 1,     // di, ei, fd
+};
+
+// The step counts budgets down in 32-bit lanes so its checks vectorize.
+// Each refill folds what a lane spent into its totals and hands it the next
+// stretch of what is left, at most STRETCH.
+static void refill(Gang &g, unsigned i) {
+    g.instructions[i] += g.stretch[i] - g.left[i];
+    g.cycles[i] += (int64_t)g.cycle_stretch[i] - g.cycles_left[i];
+    uint64_t n = g.limit[i] > g.instructions[i] ? g.limit[i] - g.instructions[i] : 0;
+    uint64_t c = g.cycle_limit[i] > g.cycles[i] ? g.cycle_limit[i] - g.cycles[i] : 0;
+    g.left[i] = g.stretch[i] = n < STRETCH ? n : (uint64_t)STRETCH;
+    g.cycles_left[i] = g.cycle_stretch[i] = c < STRETCH ? c : (uint64_t)STRETCH;
+}
+
+// Register file <-> State. f is settled on the way in and handed back
+// settled.
+static void load_lane(Gang &g, unsigned i) {
+    State *s = g.state[i];
+    Pair &af = reg_af(s);
+    g.a[i] = af.b.h;
+    g.f[i] = af.b.l;
+    g.b[i] = reg_bc(s).b.h;
+    g.c[i] = reg_bc(s).b.l;
+    g.d[i] = reg_de(s).b.h;
+    g.e[i] = reg_de(s).b.l;
+    g.h[i] = reg_hl(s).b.h;
+    g.l[i] = reg_hl(s).b.l;
+    g.r[i] = s->r;
+    g.pc[i] = s->pc;
+    g.sp[i] = s->sp;
+    g.instructions[i] = s->instructions;
+    g.cycles[i] = s->cycles;
+    g.left[i] = g.stretch[i] = 0;
+    g.cycles_left[i] = g.cycle_stretch[i] = 0;
+    refill(g, i);
+}
+
+static void store_lane(const Gang &g, unsigned i) {
+    State *s = g.state[i];
+    s->lazy.op = FLAGS_READY;
+    s->af[s->af_bank].b.h = g.a[i];
+    s->af[s->af_bank].b.l = g.f[i];
+    reg_bc(s).b.h = g.b[i];
+    reg_bc(s).b.l = g.c[i];
+    reg_de(s).b.h = g.d[i];
+    reg_de(s).b.l = g.e[i];
+    reg_hl(s).b.h = g.h[i];
+    reg_hl(s).b.l = g.l[i];
+    s->r = g.r[i];
+    s->pc = g.pc[i];
+    s->sp = g.sp[i];
+    s->instructions = g.instructions[i] + (g.stretch[i] - g.left[i]);
+    s->cycles = g.cycles[i] + ((int64_t)g.cycle_stretch[i] - g.cycles_left[i]);
+}
+
+// n bytes at pc through s's page table; false if any page isn't direct
+static bool fetch(const State *s, uint16_t pc, uint8_t *code, unsigned n) {
+    for (unsigned j = 0; j < n; j++) {
+        const uint8_t *p = bus_read_ptr(&s->bus, (uint16_t)(pc + j));
+        if (!p)
+            return false;
+        code[j] = *p;
+    }
+    return true;
+}
+
+// One interpreted instruction on lane i. A block repeat (ldir, cpir, inir,
+// otir and the rest) gets enough of the lane's budget to run to its end, so
+// the core can do it in bulk rather than an iteration per gang step.
+static void scalar_step(Gang &g, unsigned i) {
+    State *s = g.state[i];
+    store_lane(g, i);
+    uint64_t n = 1;
+    uint8_t code[2];
+    if (fetch(s, s->pc, code, 2) && code[0] == 0xED && (code[1] & 0xF4) == 0xB0) {
+        uint8_t b = reg_bc(s).b.h;
+        uint16_t bc = reg_bc(s).w;
+        n = code[1] & 2 ? (b ? b : 0x100) : (bc ? bc : 0x10000);
+        if (n > g.limit[i] - s->instructions)
+            n = g.limit[i] - s->instructions;
+    }
+    uint64_t cycles = g.cycle_limit[i] == UINT64_MAX ? UINT64_MAX : g.cycle_limit[i] - s->cycles;
+    StopReason why = run_budgets(s, n, cycles);
+    if (why != STOP_BUDGET) {
+        g.why[i] = why;
+        g.live[i] = 0;
+    }
+    load_lane(g, i);
+}
+
+// Lane i has waited too long: it finishes alone on the scalar core, with
+// translation and the JIT back as it had them
+static void peel(Gang &g, unsigned i) {
+    State *s = g.state[i];
+    store_lane(g, i);
+    bus_untrack_writes(&s->bus);
+    s->translate = g.translate[i];
+    g.why[i] = run_budgets(s, g.limit[i] - s->instructions,
+                           g.cycle_limit[i] == UINT64_MAX ? UINT64_MAX : g.cycle_limit[i] - s->cycles);
+    g.live[i] = 0;
+    g.peeled[i] = 1;
+}
+
+// Interrupts, events and breakpoints need the scalar core's checks between
+// instructions. A device behind MMIO can raise a line mid-run, so lanes are
+// looked at again after every step that could have written.
+static bool interruptible(const State *s) {
+    return s->events || s->int_line || s->nmi_pending || s->debug;
+}
+
+// Pages every lane maps directly with identical contents. Code on them can
+// be fetched from the leader alone until some lane writes there.
+static uint64_t shared_pages(const Gang &g) {
+    uint64_t shared = 0;
+    for (unsigned p = 0; p < PAGE_COUNT; p++) {
+        const uint8_t *first = bus_read_ptr(&g.state[0]->bus, p << PAGE_SHIFT);
+        bool same = first != nullptr;
+        for (unsigned i = 1; i < L && g.state[i] && same; i++) {
+            const uint8_t *page = bus_read_ptr(&g.state[i]->bus, p << PAGE_SHIFT);
+            same = page && memcmp(first, page, PAGE_SIZE) == 0;
+        }
+        if (same)
+            shared |= 1ull << p;
+    }
+    return shared;
+}
+
+KERNEL uint8_t sz53_of(uint8_t r) {
+    return (r & (FLAG_S | FLAG_X | FLAG_Y)) | (r ? 0 : FLAG_Z);
+}
+
+KERNEL uint8_t parity_of(uint8_t r) {
+    r ^= r >> 4;
+    r ^= r >> 2;
+    r ^= r >> 1;
+    return (~r & 1) << 2;
+}
+
+// cc of jp/jr/call/ret cc: nz z nc c po pe p m
+KERNEL bool condition(unsigned cc, uint8_t f) {
+    static const uint8_t bits[4] = { FLAG_Z, FLAG_C, FLAG_PV, FLAG_S };
+    return ((f & bits[cc >> 1]) != 0) == (cc & 1);
+}
+
+// a for a running lane (run is 0xff), else b, as a blend: the compiler
+// turns run ? a : b on a byte or word back into a conditional store, which
+// only AVX-512 can vectorize
+KERNEL uint16_t pick(uint8_t run, uint16_t a, uint16_t b) {
+    uint16_t m = (int8_t)run;
+    return (a & m) | (b & ~m);
+}
+
+KERNEL uint8_t* reg8(Gang &g, unsigned r) {
+    uint8_t *regs[8] = { g.b, g.c, g.d, g.e, g.h, g.l, nullptr, g.a };
+    return regs[r];
+}
+
+KERNEL uint16_t hl_of(const Gang &g, unsigned i) {
+    return g.h[i] << 8 | g.l[i];
+}
+
+// Pair p (bc de hl sp, or af with af set) of every lane into v
+KERNEL void pair_get(const Gang &g, unsigned p, bool af, uint16_t *v) {
+    if (p == 3 && !af) {
+        LANES v[i] = g.sp[i];
+        return;
+    }
+    const uint8_t *hi = p == 0 ? g.b : p == 1 ? g.d : p == 2 ? g.h : g.a;
+    const uint8_t *lo = p == 0 ? g.c : p == 1 ? g.e : p == 2 ? g.l : g.f;
+    LANES v[i] = hi[i] << 8 | lo[i];
+}
+
+// dst = src for the running lanes. The register arrays come from tables,
+// so restrict is what tells the compiler they are apart.
+KERNEL void move8(const Gang &g, uint8_t *__restrict dst, const uint8_t *__restrict src) {
+    LANES dst[i] = pick(g.run[i], src[i], dst[i]);
+}
+
+KERNEL void split(const Gang &g, uint8_t *__restrict hi, uint8_t *__restrict lo, const uint16_t *__restrict v) {
+    LANES {
+        hi[i] = pick(g.run[i], v[i] >> 8, hi[i]);
+        lo[i] = pick(g.run[i], v[i] & 0xff, lo[i]);
+    }
+}
+
+KERNEL void pair_set(Gang &g, unsigned p, bool af, const uint16_t *v) {
+    if (p == 3 && !af) {
+        LANES g.sp[i] = pick(g.run[i], v[i], g.sp[i]);
+        return;
+    }
+    split(g, p == 0 ? g.b : p == 1 ? g.d : p == 2 ? g.h : g.a,
+          p == 0 ? g.c : p == 1 ? g.e : p == 2 ? g.l : g.f, v);
+}
+
+enum { ALU_ADD, ALU_ADC, ALU_SUB, ALU_SBC, ALU_AND, ALU_XOR, ALU_OR, ALU_CP };
+
+// a op v for every running lane, with F built as the flag tables would
+template <int Op>
+KERNEL void alu(Gang &g, const uint8_t *__restrict v) {
+    LANES {
+        uint16_t a = g.a[i], b = v[i];
+        uint16_t c = (Op == ALU_ADC || Op == ALU_SBC) ? (g.f[i] & FLAG_C) : 0;
+        uint8_t ra, rf;
+        if (Op == ALU_ADD || Op == ALU_ADC) {
+            uint16_t r = a + b + c;
+            ra = r;
+            rf = sz53_of(ra) | ((a ^ b ^ ra) & FLAG_H) | (((a ^ ra) & (b ^ ra) & 0x80) >> 5) | (r >> 8);
+        } else if (Op == ALU_SUB || Op == ALU_SBC || Op == ALU_CP) {
+            uint16_t r = a - b - c;
+            ra = r;
+            rf = sz53_of(ra) | ((a ^ b ^ ra) & FLAG_H) | (((a ^ b) & (a ^ ra) & 0x80) >> 5)
+               | ((r >> 8) & FLAG_C) | FLAG_N;
+            if (Op == ALU_CP) {
+                rf = (rf & ~(FLAG_X | FLAG_Y)) | (b & (FLAG_X | FLAG_Y));
+                ra = a;
+            }
+        } else {
+            ra = Op == ALU_AND ? a & b : Op == ALU_XOR ? a ^ b : a | b;
+            rf = sz53_of(ra) | parity_of(ra) | (Op == ALU_AND ? FLAG_H : 0);
+        }
+        g.a[i] = pick(g.run[i], ra, g.a[i]);
+        g.f[i] = pick(g.run[i], rf, g.f[i]);
+    }
+}
+
+KERNEL void alu_op(Gang &g, unsigned y, const uint8_t *v) {
+    switch (y) {
+        case ALU_ADD: alu<ALU_ADD>(g, v); break;
+        case ALU_ADC: alu<ALU_ADC>(g, v); break;
+        case ALU_SUB: alu<ALU_SUB>(g, v); break;
+        case ALU_SBC: alu<ALU_SBC>(g, v); break;
+        case ALU_AND: alu<ALU_AND>(g, v); break;
+        case ALU_XOR: alu<ALU_XOR>(g, v); break;
+        case ALU_OR:  alu<ALU_OR>(g, v); break;
+        default:      alu<ALU_CP>(g, v); break;
+    }
+}
+
+// inc8/dec8 of v in place; C survives
+template <bool Dec>
+KERNEL void inc_dec(Gang &g, uint8_t *__restrict v) {
+    LANES {
+        uint8_t r = Dec ? v[i] - 1 : v[i] + 1;
+        uint8_t f = (g.f[i] & FLAG_C) | sz53_of(r);
+        if (Dec)
+            f |= ((r & 0x0f) == 0x0f ? FLAG_H : 0) | (r == 0x7f ? FLAG_PV : 0) | FLAG_N;
+        else
+            f |= ((r & 0x0f) == 0x00 ? FLAG_H : 0) | (r == 0x80 ? FLAG_PV : 0);
+        v[i] = pick(g.run[i], r, v[i]);
+        g.f[i] = pick(g.run[i], f, g.f[i]);
+    }
+}
+
+// The accumulator rotates and cpl/scf/ccf, by opcode bits 5-3
+template <int Y>
+KERNEL void accumulator(Gang &g) {
+    LANES {
+        uint8_t a = g.a[i], f = g.f[i], keep = f & (FLAG_S | FLAG_Z | FLAG_PV), ra = a, rf;
+        switch (Y) {
+            case 0: ra = a << 1 | a >> 7; rf = keep | (ra & (FLAG_X | FLAG_Y | FLAG_C)); break;
+            case 1: ra = a >> 1 | a << 7; rf = keep | (ra & (FLAG_X | FLAG_Y)) | (a & 1); break;
+            case 2: ra = a << 1 | (f & FLAG_C); rf = keep | (ra & (FLAG_X | FLAG_Y)) | a >> 7; break;
+            case 3: ra = a >> 1 | (f & FLAG_C) << 7; rf = keep | (ra & (FLAG_X | FLAG_Y)) | (a & 1); break;
+            case 5: ra = ~a; rf = (f & (FLAG_S | FLAG_Z | FLAG_PV | FLAG_C)) | FLAG_H | FLAG_N | (ra & (FLAG_X | FLAG_Y)); break;
+            case 6: rf = keep | FLAG_C | (a & (FLAG_X | FLAG_Y)); break;
+            default: rf = ((f & (FLAG_S | FLAG_Z | FLAG_PV | FLAG_C)) | ((f & FLAG_C) << 4) | (a & (FLAG_X | FLAG_Y))) ^ FLAG_C; break;
+        }
+        g.a[i] = pick(g.run[i], ra, a);
+        g.f[i] = pick(g.run[i], rf, f);
+    }
+}
+
+KERNEL void accumulator_op(Gang &g, unsigned y) {
+    switch (y) {
+        case 0:  accumulator<0>(g); break;
+        case 1:  accumulator<1>(g); break;
+        case 2:  accumulator<2>(g); break;
+        case 3:  accumulator<3>(g); break;
+        case 5:  accumulator<5>(g); break;
+        case 6:  accumulator<6>(g); break;
+        default: accumulator<7>(g); break;
+    }
+}
+
+KERNEL void push_lane(Gang &g, unsigned i, uint16_t v) {
+    MemoryMap *bus = &g.state[i]->bus;
+    bus_write(bus, --g.sp[i], v >> 8);
+    bus_write(bus, --g.sp[i], v & 0xff);
+}
+
+KERNEL uint16_t pop_lane(Gang &g, unsigned i) {
+    const MemoryMap *bus = &g.state[i]->bus;
+    uint16_t lo = bus_read(bus, g.sp[i]++);
+    uint16_t hi = bus_read(bus, g.sp[i]++);
+    return hi << 8 | lo;
+}
+
+// Execute op (code holds its bytes) for the running lanes, whose pc has
+// already stepped past it. Returns true if memory may have been written.
+KERNEL bool kernel(Gang &g, uint8_t op, const uint8_t *code) {
+    unsigned x = op >> 6, y = (op >> 3) & 7, z = op & 7, p = y >> 1, q = y & 1;
+    uint8_t n = code[1];
+    uint16_t nn = n | code[2] << 8;
+    alignas(64) uint8_t v8[L];
+    alignas(64) uint16_t v16[L], w16[L];
+
+    if (x == 1) {
+        if (op == 0x76) {                                               // halt
+            LANES if (g.run[i]) {
+                g.state[i]->halted = 1;
+                g.why[i] = STOP_HALT;
+                g.live[i] = 0;
+            }
+            return false;
+        }
+        if (y == 6) {                                                   // ld (hl),r
+            const uint8_t *src = reg8(g, z);
+            LANES if (g.run[i]) bus_write(&g.state[i]->bus, hl_of(g, i), src[i]);
+            return true;
+        }
+        uint8_t *dst = reg8(g, y);
+        if (z == 6) {                                                   // ld r,(hl)
+            LANES if (g.run[i]) dst[i] = bus_read(&g.state[i]->bus, hl_of(g, i));
+            return false;
+        }
+        if (y != z)                                                     // ld r,r'
+            move8(g, dst, reg8(g, z));
+        return false;
+    }
+    if (x == 2 || (x == 3 && z == 6)) {                                 // alu r / (hl) / n
+        const uint8_t *v = v8;
+        if (x == 3)
+            LANES v8[i] = n;
+        else if (z == 6)
+            LANES v8[i] = g.run[i] ? bus_read(&g.state[i]->bus, hl_of(g, i)) : 0;
+        else
+            v = reg8(g, z);
+        alu_op(g, y, v);
+        return false;
+    }
+
+    if (x == 0) {
+        switch (z) {
+        case 0:
+            if (y == 0)                                                 // nop
+                return false;
+            if (y == 2) {                                               // djnz
+                LANES g.b[i] -= g.run[i] & 1;
+                LANES {
+                    uint8_t taken = g.run[i] & -(uint8_t)(g.b[i] != 0);
+                    g.pc[i] = pick(taken, g.pc[i] + (int8_t)n, g.pc[i]);
+                    g.cycles_left[i] -= cycles_op_taken[op] & -(int32_t)(taken & 1);
+                }
+                return false;
+            }
+            LANES {                                                     // jr, jr cc
+                uint8_t taken = g.run[i] & -(uint8_t)(y == 3 ? 1 : condition(y - 4, g.f[i]));
+                g.pc[i] = pick(taken, g.pc[i] + (int8_t)n, g.pc[i]);
+                g.cycles_left[i] -= cycles_op_taken[op] & -(int32_t)(taken & 1);
+            }
+            return false;
+        case 1:
+            if (!q) {                                                   // ld rr,nn
+                LANES v16[i] = nn;
+                pair_set(g, p, false, v16);
+                return false;
+            }
+            pair_get(g, 2, false, v16);                                 // add hl,rr
+            pair_get(g, p, false, w16);
+            LANES {
+                uint32_t r = v16[i] + w16[i];
+                uint8_t f = (g.f[i] & (FLAG_S | FLAG_Z | FLAG_PV)) | (((v16[i] ^ w16[i] ^ r) >> 8) & FLAG_H)
+                          | ((r >> 8) & (FLAG_X | FLAG_Y)) | (r >> 16);
+                g.f[i] = pick(g.run[i], f, g.f[i]);
+                v16[i] = r;
+            }
+            pair_set(g, 2, false, v16);
+            return false;
+        case 2:
+            switch (y) {
+            case 0: case 2:                                             // ld (bc),a / ld (de),a
+                LANES if (g.run[i])
+                    bus_write(&g.state[i]->bus, (y ? g.d[i] << 8 | g.e[i] : g.b[i] << 8 | g.c[i]), g.a[i]);
+                return true;
+            case 1: case 3:                                             // ld a,(bc) / ld a,(de)
+                LANES if (g.run[i])
+                    g.a[i] = bus_read(&g.state[i]->bus, (y == 3 ? g.d[i] << 8 | g.e[i] : g.b[i] << 8 | g.c[i]));
+                return false;
+            case 4:                                                     // ld (nn),hl
+                LANES if (g.run[i]) {
+                    bus_write(&g.state[i]->bus, nn, g.l[i]);
+                    bus_write(&g.state[i]->bus, (uint16_t)(nn + 1), g.h[i]);
+                }
+                return true;
+            case 5:                                                     // ld hl,(nn)
+                LANES if (g.run[i]) {
+                    g.l[i] = bus_read(&g.state[i]->bus, nn);
+                    g.h[i] = bus_read(&g.state[i]->bus, (uint16_t)(nn + 1));
+                }
+                return false;
+            case 6:                                                     // ld (nn),a
+                LANES if (g.run[i]) bus_write(&g.state[i]->bus, nn, g.a[i]);
+                return true;
+            default:                                                    // ld a,(nn)
+                LANES if (g.run[i]) g.a[i] = bus_read(&g.state[i]->bus, nn);
+                return false;
+            }
+        case 3:                                                         // inc rr / dec rr
+            pair_get(g, p, false, v16);
+            LANES v16[i] += q ? -1 : 1;
+            pair_set(g, p, false, v16);
+            return false;
+        case 4:
+        case 5:
+            if (y == 6) {                                               // inc (hl) / dec (hl)
+                LANES v8[i] = g.run[i] ? bus_read(&g.state[i]->bus, hl_of(g, i)) : 0;
+                if (z == 4)
+                    inc_dec<false>(g, v8);
+                else
+                    inc_dec<true>(g, v8);
+                LANES if (g.run[i]) bus_write(&g.state[i]->bus, hl_of(g, i), v8[i]);
+                return true;
+            }
+            if (z == 4)
+                inc_dec<false>(g, reg8(g, y));
+            else
+                inc_dec<true>(g, reg8(g, y));
+            return false;
+        case 6:
+            if (y == 6) {                                               // ld (hl),n
+                LANES if (g.run[i]) bus_write(&g.state[i]->bus, hl_of(g, i), n);
+                return true;
+            } else {                                                    // ld r,n
+                LANES v8[i] = n;
+                move8(g, reg8(g, y), v8);
+                return false;
+            }
+        default:
+            accumulator_op(g, y);
+            return false;
+        }
+    }
+
+    switch (z) {
+    case 0:                                                             // ret cc
+        LANES if (g.run[i] && condition(y, g.f[i])) {
+            g.pc[i] = pop_lane(g, i);
+            g.cycles_left[i] -= cycles_op_taken[op];
+        }
+        return false;
+    case 1:
+        if (!q) {                                                       // pop qq
+            LANES v16[i] = g.run[i] ? pop_lane(g, i) : 0;
+            pair_set(g, p, true, v16);
+            return false;
+        }
+        if (p == 0) {                                                   // ret
+            LANES if (g.run[i]) g.pc[i] = pop_lane(g, i);
+        } else if (p == 2) {                                            // jp (hl)
+            LANES g.pc[i] = pick(g.run[i], hl_of(g, i), g.pc[i]);
+        } else {                                                        // ld sp,hl
+            LANES g.sp[i] = pick(g.run[i], hl_of(g, i), g.sp[i]);
+        }
+        return false;
+    case 2:                                                             // jp cc,nn
+        LANES g.pc[i] = pick(g.run[i] & -(uint8_t)condition(y, g.f[i]), nn, g.pc[i]);
+        return false;
+    case 3:
+        if (y == 0) {                                                   // jp nn
+            LANES g.pc[i] = pick(g.run[i], nn, g.pc[i]);
+        } else {                                                        // ex de,hl
+            LANES {
+                uint8_t d = g.d[i], e = g.e[i];
+                g.d[i] = pick(g.run[i], g.h[i], d);
+                g.e[i] = pick(g.run[i], g.l[i], e);
+                g.h[i] = pick(g.run[i], d, g.h[i]);
+                g.l[i] = pick(g.run[i], e, g.l[i]);
+            }
+        }
+        return false;
+    case 4:
+    case 5:
+        if (z == 5 && !q) {                                             // push qq
+            pair_get(g, p, true, v16);
+            LANES if (g.run[i]) push_lane(g, i, v16[i]);
+            return true;
+        }
+        LANES if (g.run[i] && (z == 5 || condition(y, g.f[i]))) {       // call, call cc
+            push_lane(g, i, g.pc[i]);
+            g.pc[i] = nn;
+            g.cycles_left[i] -= cycles_op_taken[op];
+        }
+        return true;
+    default:                                                            // rst
+        LANES if (g.run[i]) {
+            push_lane(g, i, g.pc[i]);
+            g.pc[i] = y * 8;
+        }
+        return true;
+    }
+}
+
+// Opcodes a straight run goes on past: no jump, call, return, halt or
+// memory write, so every lane goes on to the next pc and the code there is
+// still what was read
+KERNEL bool straight(uint8_t op) {
+    unsigned x = op >> 6, y = (op >> 3) & 7, z = op & 7;
+    switch (x) {
+    case 0:
+        if (z == 0)
+            return y == 0;                                              // nop, not djnz or jr
+        if (z == 2)
+            return y & 1;                                               // loads, not stores
+        return (z != 4 && z != 5 && z != 6) || y != 6;                  // not (hl) writes
+    case 1:
+        return y != 6;                                                  // not ld (hl),r or halt
+    case 2:
+        return true;
+    default:
+        return z == 6 || (z == 1 && !(op & 8)) || op == 0xF9 || op == 0xEB;    // alu n, pop, ld sp,hl, ex de,hl
+    }
+}
+
+// One step for every lane at the lowest pc. On pages every lane shares, a
+// straight run of kernels up to the next pc another lane waits at is taken
+// as one step, as the lowest-pc rule would take it an instruction at a time,
+// so the lead and the lanes at it are worked out once for the whole run.
+// False once no lane runs.
+LOCKSTEP_TARGETS
+static bool step(Gang &g) {
+    // Lanes that aren't live are put past every pc
+    unsigned lead = 0x10000;
+    LANES {
+        unsigned at = g.pc[i] | (~g.live[i] & 1u) << 16;
+        lead = at < lead ? at : lead;
+    }
+    if (lead >= 0x10000)
+        return false;
+
+    // Lanes at the leader's pc. Those whose stretch is spent are refilled,
+    // and those with nothing left stop here, as FETCH would stop them.
+    uint8_t spent_any = 0;
+    LANES {
+        uint8_t at = g.live[i] & -(uint8_t)(g.pc[i] == lead);
+        uint8_t spent = -(uint8_t)((g.left[i] <= 0) | (g.cycles_left[i] <= 0));
+        g.run[i] = at & ~spent;
+        spent_any |= at & spent;
+    }
+    if (spent_any)
+        for (unsigned i = 0; i < L; i++)
+            if (g.live[i] && g.pc[i] == lead && !g.run[i]) {
+                refill(g, i);
+                if (g.left[i] > 0 && g.cycles_left[i] > 0)
+                    g.run[i] = 0xff;
+                else
+                    g.live[i] = 0;
+            }
+    unsigned leader = L;
+    LANES {
+        unsigned at = g.run[i] ? i : (unsigned)L;
+        leader = at < leader ? at : leader;
+    }
+    if (leader == L)
+        return true;
+
+    // The code, from the leader alone if its bytes are on pages every lane
+    // shares, else checked lane by lane: offsets[] are where the run's
+    // instructions start in code[]. Lanes with other code there, and every
+    // lane for opcodes without a kernel, take a scalar step.
+    uint8_t buf[4] = {};
+    const uint8_t *code = buf;
+    uint16_t offsets[RUN];
+    unsigned n = 0, length = 0, cycles = 0;
+    const State *s = g.state[leader];
+    const uint8_t *at = bus_read_ptr(&s->bus, lead);
+    bool scalar = false;
+    if (at && (g.shared >> (lead >> PAGE_SHIFT) & 1) && (lead & PAGE_MASK) <= PAGE_SIZE - sizeof(buf)) {
+        unsigned other = 0x10000, room = PAGE_SIZE - sizeof(buf) - (lead & PAGE_MASK);
+        LANES {
+            unsigned pc = g.pc[i], here = ((pc ^ lead) - 1) >> 31;
+            pc |= ((~g.live[i] & 1u) | here) << 16;
+            other = pc < other ? pc : other;
+        }
+        code = at;
+        while (n < RUN && kernel_length[at[length]]) {
+            uint8_t op = at[length];
+            offsets[n++] = length;
+            length += kernel_length[op];
+            cycles += cycles_op[op];
+            if (!straight(op) || length > room || lead + length >= other)
+                break;
+        }
+        // Every lane needs the budget to start the run's last instruction
+        int32_t before = n ? cycles - cycles_op[at[offsets[n - 1]]] : 0;
+        uint8_t short_any = 0;
+        LANES short_any |= g.run[i] & -(uint8_t)((g.left[i] < (int32_t)n) | (g.cycles_left[i] <= before));
+        if (n > 1 && short_any) {
+            n = 1;
+            length = kernel_length[at[0]];
+            cycles = cycles_op[at[0]];
+        }
+    } else {
+        uint8_t op = 0;
+        if (fetch(s, lead, &op, 1) && (length = kernel_length[op]) && fetch(s, lead, buf, length)) {
+            offsets[n++] = 0;
+            cycles = cycles_op[op];
+            if (!(g.shared >> (lead >> PAGE_SHIFT) & g.shared >> (((lead + length - 1) & 0xffff) >> PAGE_SHIFT) & 1)) {
+                memset(g.scalar, 0, sizeof(g.scalar));
+                LANES if (g.run[i] && i != leader) {
+                    uint8_t mine[4] = {};
+                    if (!fetch(g.state[i], lead, mine, length) || memcmp(mine, buf, length) != 0) {
+                        g.run[i] = 0;
+                        g.scalar[i] = 0xff;
+                        scalar = true;
+                    }
+                }
+            }
+        }
+    }
+    if (!n) {
+        memcpy(g.scalar, g.run, sizeof(g.scalar));
+        memset(g.run, 0, sizeof(g.run));
+        scalar = true;
+    }
+
+    // Counters for the whole run first: the kernels before the last don't
+    // look at them, and the last sees pc past itself
+    bool wrote = false;
+    g.steps++;
+    if (n) {
+        uint16_t next = lead + length;
+        int32_t count = n, spend = cycles;
+        uint32_t lanes = 0;
+        LANES {
+            uint8_t m = g.run[i];
+            int32_t on = -(int32_t)(m & 1);
+            g.pc[i] = pick(m, next, g.pc[i]);
+            g.left[i] -= count & on;
+            g.cycles_left[i] -= spend & on;
+            g.r[i] = (g.r[i] & (0x80 | ~m)) | ((g.r[i] + count) & 0x7f & m);
+            g.seen[i] = (g.steps & on) | (g.seen[i] & ~on);
+            lanes += m & 1;
+        }
+        g.work += lanes * n;
+        for (unsigned j = 0; j < n; j++)
+            wrote = kernel(g, code[offsets[j]], code + offsets[j]);
+    }
+    if (scalar)
+        LANES if (g.scalar[i]) {
+            scalar_step(g, i);
+            g.seen[i] = g.steps;
+            g.work++;
+        }
+    if (wrote || scalar)
+        LANES if (g.run[i] || (scalar && g.scalar[i])) {
+            g.shared &= ~g.state[i]->bus.dirty;
+            if (g.live[i] && interruptible(g.state[i]))
+                peel(g, i);
+        }
+
+    // Lanes left behind too long go off on their own. So does a lane left
+    // alone, and every lane of a gang whose steps have been doing too little
+    // to pay for themselves: the scalar core runs those faster, translated.
+    if (g.steps % 256 == 0) {
+        unsigned live = 0;
+        LANES live += g.live[i] & 1;
+        bool idle = false;
+        if (g.steps % LOCKSTEP_PEEL_STEPS == 0) {
+            idle = g.work < (uint32_t)LOCKSTEP_PEEL_STEPS * LOCKSTEP_MIN_WORK;
+            g.work = 0;
+        }
+        LANES if (g.live[i] && (live == 1 || idle || g.steps - g.seen[i] > LOCKSTEP_PEEL_STEPS))
+            peel(g, i);
+    }
+    return true;
+}
+
+static void run_gang(State **states, size_t count, uint64_t max_instructions, uint64_t max_cycles,
+                     StopReason *why) {
+    Gang gang = {}, *g = &gang;
+    for (unsigned i = 0; i < count; i++) {
+        State *s = states[i];
+        g->state[i] = s;
+        g->limit[i] = s->instructions + max_instructions;
+        if (g->limit[i] < s->instructions)
+            g->limit[i] = UINT64_MAX;
+        g->cycle_limit[i] = s->cycles + max_cycles;
+        if (g->cycle_limit[i] < s->cycles)
+            g->cycle_limit[i] = UINT64_MAX;
+        load_lane(*g, i);
+        g->live[i] = 0xff;
+        g->why[i] = STOP_BUDGET;
+        g->translate[i] = s->translate;
+        s->translate = 0;           // Single steps stay in the plain interpreter
+        bus_track_writes(&s->bus);
+    }
+    // A lane left at HALT goes on past it the way execute() does, unless
+    // something could wake it, which the scalar core handles
+    for (unsigned i = 0; i < count; i++) {
+        if (interruptible(states[i]))
+            peel(*g, i);
+        else
+            states[i]->halted = 0;
+    }
+    g->shared = shared_pages(*g);
+
+    while (step(*g))
+        ;
+
+    for (unsigned i = 0; i < count; i++) {
+        if (!g->peeled[i]) {
+            store_lane(*g, i);
+            bus_untrack_writes(&states[i]->bus);
+            states[i]->translate = g->translate[i];
+        }
+        why[i] = g->why[i];
+    }
+}
+
+void lockstep_run(State **states, size_t count, uint64_t max_instructions, uint64_t max_cycles,
+                  StopReason *why, double *seconds, unsigned threads) {
+    size_t gangs = (count + L - 1) / L;
+    parallel_for(gangs, threads, [&](unsigned, size_t k) {
+        size_t first = k * L;
+        size_t n = count - first < (size_t)L ? count - first : (size_t)L;
+        auto t0 = std::chrono::steady_clock::now();
+        run_gang(states + first, n, max_instructions, max_cycles, why + first);
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        for (size_t i = 0; seconds && i < n; i++)
+            seconds[first + i] = sec;
+    });
+}
@@ -1,431 +1,43 @@
 #include <iostream>
-#include <fstream>
 #include <string>
 #include <vector>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
 #include <readline/history.h>
 #include <readline/readline.h>
 
+#include "Baseline.hpp"
+#include "Batch.hpp"
+#include "Console.hpp"
+#include "Debug.hpp"
 #include "Disassembler.hpp"
-
-int counter;
-uint16_t pc;
-char* input[2048];
-
-struct Flags {    
-    uint8_t    z:1;     // Zero - Set if result is 0
-    uint8_t    s:1;     // Sign - Set if result is negative
-    uint8_t    pv:1;    // Parity/Overflow - Set if number of 1 bits in result is even. pv 1 = pe even, pv 0 = po odd.
-    uint8_t    c:1;     // Carry - Set if last add/sub resulted in a carry/borrow
-    uint8_t    hc:1;    // Half-Carry - Set if Binary-Coded Decimal arithmetic is used
-    uint8_t    n:1;     // Add/Subtract - Used in DAA instruction. 0 = add, 1 = sub
-};
-
-struct State {
-    // Main registers
-    uint8_t     a;         
-    struct      Flags flags;
-    uint8_t     b;               
-    uint8_t     c;
-    uint8_t     d;
-    uint8_t     e;
-    uint8_t     h;
-    uint8_t     l;
-    uint16_t    bc; 
-    uint16_t    de;
-    uint16_t    hl;
-
-    // Alternate Registers
-    uint8_t     a_prime;
-    struct      Flags flags_prime;
-    uint8_t     b_prime;
-    uint8_t     c_prime;
-    uint8_t     d_prime;
-    uint8_t     e_prime;
-    uint8_t     h_prime;
-    uint8_t     l_prime;
-    uint16_t    bc_prime;
-    uint16_t    de_prime;
-    uint16_t    hl_prime;
-
-    // Special-Purpose Registers
-    uint16_t    sp;         // Stack pointer
-    uint16_t    pc;         // Program counter
-    uint8_t     ix;         // Index registers
-    uint8_t     iy;         
-    uint16_t    i;          // Interrupt register
-    uint8_t     r;          // Memory-refresh register
-
-    uint8_t     *memory;    // Loc of memory
-    uint32_t    mem_size = 0x10000;
-};
+#include "Jit.hpp"
+#include "Ports.hpp"
+#include "Rom.hpp"
+#include "Snapshot.hpp"
+#include "Trace.hpp"
+#include "Z80.hpp"
 
 // z80 functions
 int disassemble_file(std::vector<std::string> args);
 int load_file(State* state, std::vector<std::string> args);
-int emulate(State *state);
-State* z80init(void);
-void bad_inst(State *state);
 void clearmem(State *state);
 void printmem(State *state, std::vector<std::string> args);
+void mips(std::vector<std::string> args);
 void helptext();
-int reset(State *state);
+int reset(State *state, const Baseline *base);
+void save_snapshot(State *state, std::vector<std::string> args);
+int restore_snapshot(State *state, std::vector<std::string> args);
+void trace(State *state, std::vector<std::string> args);
+void breakpoint(State *state, std::vector<std::string> args);
+void watchpoint(State *state, std::vector<std::string> args);
 
 //tokenize
 std::vector<std::string> tokenize(const char*, char c);
 
-// Auxilliary Emulator functions
-uint8_t flagstoInt(State *state) {
-    uint8_t a = 0;
-    a |= state->flags.c << 0;
-    a |= state->flags.n << 1;
-    a |= state->flags.pv << 2;
-    a |= state->flags.hc << 4;
-    a |= state->flags.z << 6;
-    a |= state->flags.s << 7;
-    return a;
-}
-
-void inttoFlags(State *state, uint8_t f) {
-    state->flags.c = (f >> 0);
-    state->flags.n = (f >> 1);
-    state->flags.pv = (f >> 2);
-    state->flags.hc = (f >> 4);
-    state->flags.z = (f >> 6);
-    state->flags.s = (f >> 7);
-}
-
-// Z80 opcodes
-// Load Group
-uint8_t ld8(uint8_t r, unsigned char op1) { r = op1; return r; }
-uint16_t ld16(uint16_t r, unsigned char op1, unsigned char op2) { return r = (op1 << 8) | op2; }
-uint16_t ld16(uint16_t rmem, uint16_t r) { return rmem = r; }
-
-void push(uint8_t &r1, uint8_t &r2, State *state) {
-    state->sp -= 1;
-    state->memory[state->sp] = r1;
-    state->sp -= 1;
-    state->memory[state->sp] = r2;
-}
-
-void push(uint8_t &r1, State *state) {
-    state->sp -= 1;
-    state->memory[state->sp] = r1;
-    state->sp -= 1;
-    state->memory[state->sp] = flagstoInt(state);
-}
-
-void pop(uint8_t &r1, uint8_t &r2, State *state) {
-    r1 = state->memory[state->sp];
-    state->sp += 1;
-    r2 = state->memory[state->sp];
-    state->sp += 1;
-}
-
-void pop(uint8_t &r1,  State *state) {
-    r1 = state->memory[state->sp];
-    state->sp += 1;
-    uint8_t f = state->memory[state->sp];
-    inttoFlags(state, f);
-    state->sp += 1;
-}
-
-// Exchange, Block Transfer, and Search Group
-void ex(uint16_t &r1, uint16_t &r2) {
-    uint16_t t = r1;
-    r1 = r2;
-    r2 = t;
-}
-
-void ex(uint8_t &r1, uint16_t &r2) {
-    uint8_t array[2];
-    array[0]=r2 & 0xff;  // lsb
-    array[1]=(r2 >> 8);  // msb
-    
-    r2 = ((r1 << 8) | (r1+1));
-    r1 = array[0];
-    r1++;
-    r1 = array[1];
-}
-
-void ex(State *state) {
-    Flags t = state->flags;
-    state->flags = state->flags_prime;
-    state->flags_prime = t;
-}
-
-void exx(State *state) {
-    uint16_t temp_bc = state->bc;
-    uint16_t temp_de = state->de;
-    uint16_t temp_hl = state->hl;
-
-    state->bc = state->bc_prime;
-    state->de = state->de_prime;
-    state->hl = state->hl_prime;
-
-    state->bc_prime = temp_bc;
-    state->de_prime = temp_de;
-    state->hl_prime = temp_hl;
-}
-
-// General-Purpose Arithmetic and CPU Control Groups
-void daa();
-void cpl();
-void ccf();
-void scf();
-void di();
-void ei();
-
-// Arithmetical and Logical
-uint8_t add8(uint8_t r1, uint8_t r2) { return r1 += r2; }
-uint16_t add16(uint16_t r1, uint16_t r2) { return r1 += r2; }
-uint8_t adc(uint8_t r1, uint8_t r2, uint8_t c) { return r1 + r2 + c; }
-uint8_t sub(uint8_t r1, uint8_t r2) { return r1 - r2; }
-uint8_t sbc(uint8_t r1, uint8_t r2, uint8_t c) { return r1 - r2 - c; }
-uint8_t _and(uint8_t r1, uint8_t r2) { return r1 & r2; }
-uint8_t _xor(uint8_t r1, uint8_t r2) { return r1 ^ r2; }
-uint8_t _or(uint8_t r1, uint8_t r2) { return r1 | r2; }
-void cp(uint8_t r1, uint8_t r2, State *state) { if (r1 == r2 ) { state->flags.z=1; } }
-uint8_t inc8(uint8_t r1) { return r1 += 1; }
-uint16_t inc16(uint16_t r1) { return r1 += 1; }
-uint8_t dec8(uint8_t r1) { return r1 -= 1; }
-uint16_t dec16(uint16_t r1) { return r1 -= 1; }
-
-
-// Rotate and Shift
-void rrca(State *state) { uint8_t tempc = state->a & 1; state->a = ((state->a >> 1 ) | (tempc << 7)); }
-void rra(State *state) { }
-void rla(State *state) { }
-void rlca(State *state) { uint8_t tempc = state->a >> 7; state->a = ((state->a << 1 ) | tempc); }
-void srl();
-
-// Jump, Call, and Return
-void jrc(uint8_t flag, unsigned char op1, State *state) {
-    if(flag == 1)
-        state->pc += (signed char)op1;
-}
-void jrnc(uint8_t flag, unsigned char op1, State *state) {
-    if(flag == 0)
-        state->pc += (signed char)op1;
-}
-
-void jrz(uint8_t flag, unsigned char op1, State *state) {
-    if(flag == 1)
-        state->pc += (signed char)op1;
-}
-
-void jrnz(uint8_t flag, unsigned char op1, State *state) {
-    if(flag == 0)
-        state->pc += (signed char)op1;
-}
-
-void jr(unsigned char op1, State *state) {
-    state->pc += (signed char)op1;
-}
-
-uint16_t jp(unsigned char op1, unsigned char op2) {
-    return (uint16_t)((op1 << 8) | op2);
-    
-   
-}
-
-void jp_cc(unsigned char opcode, unsigned char op1, unsigned char op2, State *state) {
-    switch (opcode) {
-        case 0xC2: if(state->flags.z == 0) state->pc = ((op2 << 8) | op1); break;   // nz    
-        case 0xCA: if(state->flags.z == 1) state->pc = ((op2 << 8) | op1); break;   // z
-        case 0xD2: if(state->flags.c == 0) state->pc = ((op2 << 8) | op1); break;   // nc , nc is 0
-        case 0xDA: if(state->flags.c == 1) state->pc = ((op2 << 8) | op1); break;   // c  , c is 1
-        case 0xE2: if(state->flags.pv == 0) state->pc = ((op2 << 8) | op1); break;   // po , po is odd  0
-        case 0xEA: if(state->flags.pv == 0) state->pc = ((op2 << 8) | op1); break;   // pe , pe is even 1
-        case 0xF2: if(state->flags.s == 0) state->pc = ((op2 << 8) | op1);break;   // p 
-        case 0xFA: if(state->flags.s == 0) state->pc = ((op2 << 8) | op1);break;   // m
-    }
-}
-
-void call(unsigned char opcode, unsigned char op1, unsigned char op2, State *state) {
-    uint16_t value = state->pc;
-    uint8_t array[2];
-    uint8_t  pcl = array[0]=value & 0xff;  // lsb
-    uint8_t  pch = array[1]=(value >> 8);  // msb
-    switch (opcode) {   
-        case 0xC4: if (state->flags.z == 0) { 
-                       state->memory[(state->sp-1)] = pch; 
-                       state->memory[(state->sp-2)] = pcl; 
-                       state->pc = ((op1 << 8) | op2); } break; // nz
-        case 0xCC: if (state->flags.z == 1) { 
-                       state->memory[(state->sp-1)] = pch;
-                       state->memory[(state->sp-2)] = pcl; 
-                       state->pc = ((op1 << 8) | op2); } break; // z
-        case 0xD4: if (state->flags.c == 0) { 
-                       state->memory[(state->sp-1)] = pch;
-                       state->memory[(state->sp-2)] = pcl; 
-                       state->pc = ((op1 << 8) | op2); } break; // nc
-        case 0xDC: if (state->flags.c == 1) { 
-                       state->memory[(state->sp-1)] = pch;
-                       state->memory[(state->sp-2)] = pcl; 
-                       state->pc = ((op1 << 8) | op2); } break; // c
-        case 0xE4: if (state->flags.pv == 0) {
-                       state->memory[(state->sp-1)] = pch;
-                       state->memory[(state->sp-2)] = pcl; 
-                       state->pc = ((op1 << 8) | op2); } break; // po
-        case 0xEC: if (state->flags.pv == 1) {
-                       state->memory[(state->sp-1)] = pch;
-                       state->memory[(state->sp-2)] = pcl; 
-                       state->pc = ((op1 << 8) | op2); } break; // pe
-        case 0xF4: if (state->flags.s == 0) {
-                       state->memory[(state->sp-1)] = pch;
-                       state->memory[(state->sp-2)] = pcl; 
-                       state->pc = ((op1 << 8) | op2); } break; // p
-        case 0xFC: if (state->flags.s == 1) {
-                       state->memory[(state->sp-1)] = pch;
-                       state->memory[(state->sp-2)] = pcl; 
-                       state->pc = ((op1 << 8) | op2); } break; // m
-        case 0xCD:     state->memory[(state->sp-1)] = pch;
-                       state->memory[(state->sp-2)] = pcl;
-                       state->pc = ((op1 << 8) | op2); break;   // unconditional 
-    }
-}
-void djnz(State *state, signed char jump) {
-    state->b -= 1;
-    if (state->b != 0)
-        state->pc += jump;
-}
-
-
-uint16_t ret(uint16_t pc, State *state) {
-    uint8_t pcl = state->memory[state->sp];
-    uint8_t pch = state->memory[state->sp+1];
-    pc = ((pcl << 8) | pch);
-    return pc;
-}
-uint16_t ret_nz(uint8_t z, State *state) {
-    if (z == 0) {
-        uint8_t pcl = state->memory[state->sp];
-        uint8_t pch = state->memory[state->sp+1];
-        state->pc = ((pcl << 8) | pch);
-        state->pc += 1;
-    }
-    return state->pc;
-}
-uint16_t ret_z(uint8_t z, State *state) {
-    if (z == 1) {
-        uint8_t pcl = state->memory[state->sp];
-        uint8_t pch = state->memory[state->sp+1];
-        state->pc = ((pcl << 8) | pch);
-        state->pc += 1;
-    }
-    return state->pc;
-}
-uint16_t ret_nc(uint8_t c, State *state) {
-    if (c == 0) {
-        uint8_t pcl = state->memory[state->sp];
-        uint8_t pch = state->memory[state->sp+1];
-        state->pc = ((pcl << 8) | pch);
-        state->pc += 1;
-    }
-    return state->pc;
-}
-uint16_t ret_c(uint8_t c, State *state) {
-    if (c == 1) {
-        uint8_t pcl = state->memory[state->sp];
-        uint8_t pch = state->memory[state->sp+1];
-        state->pc = ((pcl << 8) | pch);
-        state->pc += 1;
-    }
-    return state->pc;
-}
-uint16_t ret_po(uint8_t pv, State *state) {
-    if (pv == 0) {
-        uint8_t pcl = state->memory[state->sp];
-        uint8_t pch = state->memory[state->sp+1];
-        state->pc = ((pcl << 8) | pch);
-        state->pc += 1;
-    }
-    return state->pc;
-}
-uint16_t ret_pe(uint8_t pv, State *state) {
-    if (pv == 1) {
-        uint8_t pcl = state->memory[state->sp];
-        uint8_t pch = state->memory[state->sp+1];
-        state->pc = ((pcl << 8) | pch);
-        state->pc += 1;
-    }
-    return state->pc;
-}
-uint16_t ret_p(uint8_t s, State *state) {
-    if (s == 0) {
-        uint8_t pcl = state->memory[state->sp];
-        uint8_t pch = state->memory[state->sp+1];
-        state->pc = ((pcl << 8) | pch);
-        state->pc += 1;
-    }
-    return state->pc;
-}
-uint16_t ret_m(uint8_t s, State *state) {
-    if (s == 1) {
-        uint8_t pcl = state->memory[state->sp];
-        uint8_t pch = state->memory[state->sp+1];
-        state->pc = ((pcl << 8) | pch);
-        state->pc += 1;
-    }
-    return state->pc;
-}
-
-
-void rst(unsigned char opcode, State *state) {
-    uint16_t value = state->pc;
-    uint8_t  array[2];
-    uint8_t  pcl = array[0]=value & 0xff;  // lsb
-    uint8_t  pch = array[1]=(value >> 8);  // msb
-
-    switch(opcode) {
-        case 0xC7: state->memory[(state->sp-1)] = pch;
-                   state->memory[(state->sp-2)] = pcl; 
-                   pch = 0x00;
-                   pcl = 0x00;
-                   break;
-        case 0xCF: state->memory[(state->sp-1)] = pch;
-                   state->memory[(state->sp-2)] = pcl;
-                   pch = 0x00;
-                   pcl = 0x08;
-                   break;
-        case 0xD7: state->memory[(state->sp-1)] = pch;
-                   state->memory[(state->sp-2)] = pcl;
-                   pch = 0x00;
-                   pcl = 0x10;
-                   break;
-        case 0xDF: state->memory[(state->sp-1)] = pch;
-                   state->memory[(state->sp-2)] = pcl;
-                   pch = 0x00;
-                   pcl = 0x18;
-                   break;
-        case 0xE7: state->memory[(state->sp-1)] = pch;
-                   state->memory[(state->sp-2)] = pcl;
-                   pch = 0x00;
-                   pcl = 0x20;
-                   break;
-        case 0xEF: state->memory[(state->sp-1)] = pch;
-                   state->memory[(state->sp-2)] = pcl;
-                   pch = 0x00;
-                   pcl = 0x28;
-                   break;
-        case 0xF7: state->memory[(state->sp-1)] = pch;
-                   state->memory[(state->sp-2)] = pcl;
-                   pch = 0x00;
-                   pcl = 0x30;
-                   break;
-        case 0xFF: state->memory[(state->sp-1)] = pch;
-                   state->memory[(state->sp-2)] = pcl;
-                   pch = 0x00;
-                   pcl = 0x38;
-                   break;
-    }
-    state->pc = ((pcl << 8) | pch);
-}
-
-// CPU Control
-void nop();
-void halt();
-
 // User prompts
 enum Actions {
     EXIT,
@@ -436,13 +48,31 @@ enum Actions {
     PRINT_MEM,
     RUN,
     RESET,
+    BASELINE,
+    SAVE,
+    RESTORE,
+    MIPS,
+    TRACE,
+    BREAK,
+    WATCH,
     DEFAULT
 };
 
 int main(int argc, char* argv[]) {
-  
+    // Any arguments mean batch mode: no banner, no prompt
+    if (argc > 1)
+        return batch_main(argc, argv);
+
     int done = 0;
     State* state = z80init();
+    Baseline base = {};
+    // out to CONSOLE_PORT prints, a buffer at a time
+    PortBus *ports = ports_create();
+    Console *console = console_create(STDOUT_FILENO);
+    if (ports && console) {
+        ports_map(ports, CONSOLE_PORT, &console->handler);
+        state->ports = ports;
+    }
     std::cout << "Z80 State Initialized" << std::endl;
     std::cout << state->mem_size << "KB Available" << std::endl;
     std::cout << "Welcome. For help, enter \"help\"." << std::endl;
@@ -470,6 +100,13 @@ int main(int argc, char* argv[]) {
         else if (args[0] == "clearmem") {a = CLEAR_MEM;}
         else if (args[0] == "run") {a = RUN;}
         else if (args[0] == "reset") {a = RESET;}
+        else if (args[0] == "baseline") {a = BASELINE;}
+        else if (args[0] == "save") {a = SAVE;}
+        else if (args[0] == "restore") {a = RESTORE;}
+        else if (args[0] == "mips") {a = MIPS;}
+        else if (args[0] == "trace") {a = TRACE;}
+        else if (args[0] == "break") {a = BREAK;}
+        else if (args[0] == "watch") {a = WATCH;}
         else { std::cout << "Enter \"help\" for commands." << std::endl; a = DEFAULT; }
         
         switch(a) {
@@ -479,327 +116,69 @@ int main(int argc, char* argv[]) {
             case LOAD_PGRM: load_file(state, args); break;
             case PRINT_MEM: printmem(state, args); break;
             case CLEAR_MEM: clearmem(state); break;
-            case RESET: done = reset(state); break;
-            case RUN: 
-                        while(done == 0)
-                            done = emulate(state);
+            case RESET: done = reset(state, &base); break;
+            case BASELINE:
+                        if (baseline_capture(&base, state))
+                            std::cout << "Baseline taken; reset now returns here." << std::endl;
+                        else
+                            std::cout << "Out of memory." << std::endl;
+                        break;
+            case SAVE: save_snapshot(state, args); break;
+            case RESTORE: if (restore_snapshot(state, args) == 0) done = 0; break;
+            case MIPS: mips(args); break;
+            case TRACE: trace(state, args); break;
+            case BREAK: breakpoint(state, args); break;
+            case WATCH: watchpoint(state, args); break;
+            case RUN:
+                        if (done == 0) {
+                            std::cout << std::flush;
+                            StopReason why = run(state, UINT64_MAX);
+                            if (console && !console_flush(console))
+                                printf("error: console write failed: %s\n", strerror(errno));
+                            printf("Stopped (%s) at %04x after %llu T-states\n", stop_reason_name(why), state->pc,
+                                   (unsigned long long)state->cycles);
+                            if (why == STOP_WATCHPOINT) {
+                                const WatchHit &hit = state->debug->last;
+                                printf("%s %02x at %04x\n", hit.write ? "Wrote" : "Read", hit.value, hit.addr);
+                            }
+                            // run again carries on past a breakpoint or watchpoint
+                            done = why != STOP_BREAKPOINT && why != STOP_WATCHPOINT;
+                        }
+                        break;
             default: break;
         }
         
         free(input);
 
     } while (a != EXIT);
+    if (state->tracer)
+        trace(state, { "trace" });
+    baseline_free(&base);
+    debug_free(state->debug);
+    z80free(state);
+    console_close(console);
+    ports_free(ports);
     return 0;
 }
 
-// Emulation loop
-int emulate(State* state) {
-    int halt = 0;
-    unsigned char *opcode = &state->memory[state->pc];
-    printf("%04x ", pc);
-    printf("%x \n", *opcode);
-    switch(*opcode) {
-        case 0x00: break;                          
-        case 0x01: state->bc = ld16(state->bc, opcode[1], opcode[2]); state->pc += 2; break;        
-        case 0x02: state->memory[state->bc] = ld8(state->memory[state->bc], state->a); break; 
-        case 0x03: state->bc = inc16(state->bc); break;                           
-        case 0x04: state->b = inc8(state->b); break;                          
-        case 0x05: state->b = dec8(state->b); break;                           
-        case 0x06: state->b = ld8(state->b, opcode[1]); break;
-        case 0x07: rlca(state); break;
-        case 0x08: ex(state); break;         
-        case 0x09: state->hl = add16(state->hl, state->bc); break;                          
-        case 0x0A: state->a = ld16(state->a, state->memory[state->bc]); break;    
-        case 0x0B: state->bc = dec16(state->bc); break;                           
-        case 0x0C: state-> c = inc8(state->c); break;                          
-        case 0x0D: state->c = dec8(state->c); break;                          
-        case 0x0E: state->c = ld8(state->c, opcode[1]); break;                           
-        case 0x0F: rrca(state); break;   // rrca
-   
-        case 0x10: djnz(state, opcode[1]); break;                     // djnz *
-        case 0x11: state->de = ld16(state->de, opcode[1], opcode[2]); state->pc += 2; break; 
-        case 0x12: state->memory[state->de] = ld8(state->memory[state->de], state->a); 
-        case 0x13: state->de = inc16(state->de); break;
-        case 0x14: state->d = inc8(state->d); break;
-        case 0x15: state->d = dec8(state->d); break;
-        case 0x16: state->d = ld8(state->d, opcode[1]); break;
-        case 0x17: rla(state); break;                                // rla
-        case 0x18: jr(opcode[1], state); break;                          
-        case 0x19: state->hl = add16(state->hl, state->de); break;        
-        case 0x1A: state->a = ld8(state->a, state->memory[state->de]); break;                   
-        case 0x1B: state->de = dec16(state->de); break;
-        case 0x1C: state->e = inc8(state->e); break;
-        case 0x1D: state->e = dec8(state->e); break;
-        case 0x1E: state->e = ld8(state->e, opcode[1]); break;
-        case 0x1F: rra(state); break;          //rra
-        
-        case 0x20: jrnz(state->flags.z, opcode[1], state); break;
-        case 0x21: state->hl = ld16(state->hl, opcode[1], opcode[2]); state->pc += 2; break;
-        case 0x22: state->memory[((opcode[1] << 8) |opcode[2])] = ld16(state->memory[((opcode[2] << 8) |opcode[1])], state->hl); break;
-        case 0x23: state->hl = inc16(state->hl); break;
-        case 0x24: state->h = inc8(state->h); break;
-        case 0x25: state->h = dec8(state->h); break;
-        case 0x26: state->h = ld8(state->h, opcode[1]); break;
-        case 0x27: bad_inst(state); break;                                // daa
-        case 0x28: jrz(state->flags.z, opcode[1], state); break;                          
-        case 0x29: state->hl = add16(state->hl, state->hl); break;                           
-        case 0x2A: state->hl = ld16(state->hl, state->memory[((opcode[2] << 8) |opcode[1])]); break;
-        case 0x2B: state->hl = dec16(state->hl); break;
-        case 0x2C: state->l = inc8(state->l); break;
-        case 0x2D: state->l = dec8(state->l); break;
-        case 0x2E: state->l = ld8(state->l, opcode[1]); break;
-        case 0x2F: bad_inst(state); break;                                // cpl
-        
-        case 0x30: jrnc(state->flags.c, opcode[1], state);  break;
-        case 0x31: state->sp = ld16(state->sp, opcode[1], opcode[2]); break;
-        case 0x32: state->memory[((opcode[2] << 8) |opcode[1])] = ld8(state->memory[((opcode[2] << 8) |opcode[1])], state->a);
-        case 0x33: state->sp = inc16(state->sp); break;                           
-        case 0x34: state->hl = inc16(state->memory[state->hl]); break;
-        case 0x35: state->hl = dec16(state->memory[state->hl]); break;
-        case 0x36: state->hl = ld8(state->h, opcode[1]); break;          
-        case 0x37: bad_inst(state);  break;                               // scf
-        case 0x38: jrc(state->pc, opcode[1], state); break;
-        case 0x39: state->hl = add16(state->hl, state->sp); break;
-        case 0x3A: state->a = ld8(state->a, state->memory[((opcode[2] << 8) |opcode[1])]); break;
-        case 0x3B: state->sp = dec16(state->sp); break;
-        case 0x3C: state->a = inc8(state->a); break;
-        case 0x3D: state->a = dec8(state->a); break;
-        case 0x3E: state->a = ld8(state->a, opcode[1]); break;
-        case 0x3F: bad_inst(state);  break;                               // ccf
-        
-        case 0x40: state->b = ld8(state->b, state->b); break;
-        case 0x41: state->b = ld8(state->b, state->c); break;
-        case 0x42: state->b = ld8(state->b, state->d); break;
-        case 0x43: state->b = ld8(state->b, state->e); break;
-        case 0x44: state->b = ld8(state->b, state->h); break;
-        case 0x45: state->b = ld8(state->b, state->l); break;
-        case 0x46: state->b = ld8(state->b, state->memory[state->hl]); break;
-        case 0x47: state->b = ld8(state->b, state->a); break;
-        case 0x48: state->c = ld8(state->c, state->b); break;
-        case 0x49: state->c = ld8(state->c, state->c); break;
-        case 0x4A: state->c = ld8(state->c, state->d); break;
-        case 0x4B: state->c = ld8(state->c, state->e); break;
-        case 0x4C: state->c = ld8(state->c, state->h); break;
-        case 0x4D: state->c = ld8(state->c, state->l); break;
-        case 0x4E: state->c = ld8(state->b, state->memory[state->hl]); break;
-        case 0x4F: state->c = ld8(state->c, state->a); break;
-        
-        case 0x50: state->d = ld8(state->d, state->b); break;
-        case 0x51: state->d = ld8(state->d, state->c); break;
-        case 0x52: state->d = ld8(state->d, state->d); break;
-        case 0x53: state->d = ld8(state->d, state->e); break;
-        case 0x54: state->d = ld8(state->d, state->h); break;
-        case 0x55: state->d = ld8(state->d, state->l); break;
-        case 0x56: state->d = ld8(state->d, state->memory[state->hl]); break;
-        case 0x57: state->d = ld8(state->d, state->a); break;
-        case 0x58: state->e = ld8(state->e, state->b); break;
-        case 0x59: state->e = ld8(state->e, state->c); break;
-        case 0x5A: state->e = ld8(state->e, state->d); break;
-        case 0x5B: state->e = ld8(state->e, state->e); break;
-        case 0x5C: state->e = ld8(state->e, state->h); break;
-        case 0x5D: state->e = ld8(state->e, state->l); break;
-        case 0x5E: state->e = ld8(state->e, state->memory[state->hl]); break;
-        case 0x5F: state->e = ld8(state->e, state->a); break;
-        
-        case 0x60: state->h = ld8(state->h, state->b); break;
-        case 0x61: state->h = ld8(state->h, state->c); break;
-        case 0x62: state->h = ld8(state->h, state->d); break;
-        case 0x63: state->h = ld8(state->h, state->e); break;
-        case 0x64: state->h = ld8(state->h, state->h); break;
-        case 0x65: state->h = ld8(state->h, state->l); break;
-        case 0x66: state->h = ld8(state->h, state->memory[state->hl]); break;
-        case 0x67: state->h = ld8(state->h, state->a); break;
-        case 0x68: state->l = ld8(state->l, state->b); break;
-        case 0x69: state->l = ld8(state->l, state->c); break;
-        case 0x6A: state->l = ld8(state->l, state->d); break;
-        case 0x6B: state->l = ld8(state->l, state->e); break;
-        case 0x6C: state->l = ld8(state->l, state->h); break;
-        case 0x6D: state->l = ld8(state->l, state->l); break;
-        case 0x6E: state->l = ld8(state->l, state->memory[state->hl]); break;
-        case 0x6F: state->l = ld8(state->l, state->a); break;
-        
-        case 0x70: state->memory[state->hl] = ld8(state->memory[state->hl], state->b); break;
-        case 0x71: state->memory[state->hl] = ld8(state->memory[state->hl], state->c); break;
-        case 0x72: state->memory[state->hl] = ld8(state->memory[state->hl], state->d); break;
-        case 0x73: state->memory[state->hl] = ld8(state->memory[state->hl], state->e); break;
-        case 0x74: state->memory[state->hl] = ld8(state->memory[state->hl], state->h); break;
-        case 0x75: state->memory[state->hl] = ld8(state->memory[state->hl], state->l); break;
-        case 0x76: halt = 1; break;
-        case 0x77: state->memory[state->hl] = ld8(state->memory[state->hl], state->a); break;
-        case 0x78: state->a = ld8(state->a, state->b); break;
-        case 0x79: state->a = ld8(state->a, state->c); break;
-        case 0x7A: state->a = ld8(state->a, state->d); break;
-        case 0x7B: state->a = ld8(state->a, state->e); break;
-        case 0x7C: state->a = ld8(state->a, state->h); break;
-        case 0x7D: state->a = ld8(state->a, state->l); break;
-        case 0x7E: state->a = ld8(state->a, state->memory[state->hl]); break;
-        case 0x7F: state->a = ld8(state->a, state->a); break;
-                   
-        case 0x80: state->a = add8(state->a,state->b); break;
-        case 0x81: state->a = add8(state->a,state->c); break;
-        case 0x82: state->a = add8(state->a,state->d); break;
-        case 0x83: state->a = add8(state->a,state->e); break;
-        case 0x84: state->a = add8(state->a,state->h); break;
-        case 0x85: state->a = add8(state->a,state->l); break;
-        case 0x86: state->a = add8(state->a, state->memory[state->hl]); break;
-        case 0x87: state->a = add8(state->a,state->a); break;
-        case 0x88: state->a = adc(state->a, state->b, state->flags.c); break;
-        case 0x89: state->a = adc(state->a, state->c, state->flags.c); break;
-        case 0x8A: state->a = adc(state->a, state->d, state->flags.c); break;
-        case 0x8B: state->a = adc(state->a, state->e, state->flags.c); break;
-        case 0x8C: state->a = adc(state->a, state->h, state->flags.c); break;
-        case 0x8D: state->a = adc(state->a, state->l, state->flags.c); break;
-        case 0x8E: state->a = adc(state->a, state->memory[state->hl], state->flags.c); break;
-        case 0x8F: state->a = adc(state->a, state->a, state->flags.c); break;
-        
-        case 0x90: state->a = sub(state->a, state->b); break;
-        case 0x91: state->a = sub(state->a, state->c); break;
-        case 0x92: state->a = sub(state->a, state->d); break;
-        case 0x93: state->a = sub(state->a, state->e); break;
-        case 0x94: state->a = sub(state->a, state->h); break;
-        case 0x95: state->a = sub(state->a, state->l); break;
-        case 0x96: state->a = sub(state->a, state->memory[state->hl]); break;       
-        case 0x97: state->a = sub(state->a, state->a); break;
-        case 0x98: state->a = sbc(state->a, state->b, state->flags.c); break;
-        case 0x99: state->a = sbc(state->a, state->c, state->flags.c); break;
-        case 0x9A: state->a = sbc(state->a, state->d, state->flags.c); break;
-        case 0x9B: state->a = sbc(state->a, state->e, state->flags.c); break;
-        case 0x9C: state->a = sbc(state->a, state->h, state->flags.c); break;
-        case 0x9D: state->a = sbc(state->a, state->l, state->flags.c); break;
-        case 0x9E: state->a = sbc(state->a, state->memory[state->hl], state->flags.c); break;         
-        case 0x9F: state->a = sbc(state->a, state->a, state->flags.c); break;
-        
-        case 0xA0: state->a = _and(state->a, state->b); break;
-        case 0xA1: state->a = _and(state->a, state->c); break;
-        case 0xA2: state->a = _and(state->a, state->d); break;
-        case 0xA3: state->a = _and(state->a, state->e); break;
-        case 0xA4: state->a = _and(state->a, state->h); break;
-        case 0xA5: state->a = _and(state->a, state->l); break;
-        case 0xA6: state->a = _and(state->a, state->memory[state->hl]); break;
-        case 0xA7: state->a = _and(state->a, state->a); break;
-        case 0xA8: state->a = _xor(state->a, state->b); break;
-        case 0xA9: state->a = _xor(state->a, state->c); break;
-        case 0xAA: state->a = _xor(state->a, state->d); break;
-        case 0xAB: state->a = _xor(state->a, state->e); break;
-        case 0xAC: state->a = _xor(state->a, state->h); break;
-        case 0xAD: state->a = _xor(state->a, state->l); break;
-        case 0xAE: state->a = _xor(state->a, state->memory[state->hl]); break;      
-        case 0xAF: state->a = _xor(state->a, state->a); break;
-        
-        case 0xB0: state->a = _or(state->a, state->b); break;
-        case 0xB1: state->a = _or(state->a, state->c); break;
-        case 0xB2: state->a = _or(state->a, state->d); break;
-        case 0xB3: state->a = _or(state->a, state->e); break;
-        case 0xB4: state->a = _or(state->a, state->h); break;
-        case 0xB5: state->a = _or(state->a, state->l); break;
-        case 0xB6: state->a = _or(state->a, state->memory[state->hl]); break;
-        case 0xB7: state->a = _or(state->a, state->a); break;
-        case 0xB8: cp(state->a, state->b, state); break;
-        case 0xB9: cp(state->a, state->c, state); break;
-        case 0xBA: cp(state->a, state->d, state); break;
-        case 0xBB: cp(state->a, state->e, state); break;
-        case 0xBC: cp(state->a, state->h, state); break;
-        case 0xBD: cp(state->a, state->l, state); break;
-        case 0xBE: cp(state->a, state->memory[state->hl], state); break;
-        case 0xBF: cp(state->a, state->a, state); break;
-       
-        case 0xC0: state->pc = ret_nz(state->flags.z, state); break;
-        case 0xC1: pop(state->b, state->c, state); break;
-        case 0xC2: jp_cc(*opcode, opcode[1], opcode[2], state); break;
-        case 0xC3: state->pc = jp(opcode[1], opcode[2]); break;
-        case 0xC4: call(*opcode, opcode[1], opcode[2], state); break;      
-        case 0xC5: push(state->b, state->c, state); break;
-        case 0xC6: state->a = add8(state->a, opcode[1]); break;
-        case 0xC7: rst(*opcode, state); break;                         
-        case 0xC8: state->pc = ret_z(state->flags.z, state); break;
-        case 0xC9: state->pc = ret(state->pc, state); break;
-        case 0xCA: jp_cc(*opcode, opcode[1], opcode[2], state); break;
-        case 0xCB: std::cout << "BITS"; break;
-        case 0xCC: call(*opcode, opcode[1], opcode[2], state); break;
-        case 0xCD: call(*opcode, opcode[1], opcode[2], state); break;
-        case 0xCE: state->a = adc(state->a, opcode[1], state->flags.c); break;
-        case 0xCF: rst(*opcode, state); break;          
-        
-        case 0xD0: state->pc = ret_nc(state->flags.c, state); break;
-        case 0xD1: pop(state->d, state->e, state); break;
-        case 0xD2: jp_cc(*opcode, opcode[1], opcode[2], state); break;
-        //case 0xD3: bad_inst(state); break;            // out (*) a
-        case 0xD4: call(*opcode, opcode[1], opcode[2], state); break;            
-        case 0xD5: push(state->d, state->e, state); break;
-        case 0xD6: state->a = sub(state->a, opcode[1]); break;
-        case 0xD7: rst(*opcode, state); break;            
-        case 0xD8: state->pc = ret_c(state->flags.c, state); break;
-        case 0xD9: exx(state); break;            //exx
-        case 0xDA: jp_cc(*opcode, opcode[1], opcode[2], state); break;
-        //case 0xDB: bad_inst(state); break;            // in a (*)
-        case 0xDC: call(*opcode, opcode[1], opcode[2], state); break;
-        case 0xDD: std::cout << "IX"; break;
-        case 0xDE: state->a = sbc(state->a, opcode[1], state->flags.c); break;
-        case 0xDF: rst(*opcode, state); break;            
-
-        case 0xE0: state->pc = ret_po(state->flags.pv, state); break;
-        case 0xE1: pop(state->h, state->l, state); break;
-        case 0xE2: jp_cc(*opcode, opcode[1], opcode[2], state); break;
-        case 0xE3: ex(state->memory[state->sp], state->hl); break;
-        case 0xE4: call(*opcode, opcode[1], opcode[2], state); break;
-        case 0xE5: push(state->h, state->l, state); break;
-        case 0xE6: state->a = _and(state->a, opcode[1]); break;
-        case 0xE7: rst(*opcode, state); break;            
-        case 0xE8: state->pc = ret_po(state->flags.pv, state); break;
-        case 0xE9: bad_inst(state); break;
-        case 0xEA: jp_cc(*opcode, opcode[1], opcode[2], state); break;
-        case 0xEB: ex(state->de, state->hl); break;
-        case 0xEC: call(*opcode, opcode[1], opcode[2], state); break;
-        case 0xED: std::cout << "EXTD"; break;
-        case 0xEE: state->a = _xor(state->a, opcode[1]); break;
-        case 0xEF: rst(*opcode, state); break;            
-        
-        case 0xF0: state->pc = ret_p(state->flags.s, state); break;
-        case 0xF1: pop(state->a, state); break;
-        case 0xF2: jp_cc(*opcode, opcode[1], opcode[2], state); break;
-        //case 0xF3: bad_inst(state); break;            // di
-        case 0xF4: call(*opcode, opcode[1], opcode[2], state); break;
-        case 0xF5: push(state->a, state); break;
-        case 0xF6: state->a = _or(state->a, opcode[1]); break;
-        case 0xF7: rst(*opcode, state); break;            
-        case 0xF8: state->pc = ret_m(state->flags.s, state); break;
-        case 0xF9: state->sp = ld16(state->sp, state->hl); break;
-        case 0xFA: jp_cc(*opcode, opcode[1], opcode[2], state); break;
-        //case 0xFB: bad_inst(state); break;            // ei
-        case 0xFC: call(*opcode, opcode[1], opcode[2], state); break;
-        case 0xFD: std::cout << "IY"; break;
-        case 0xFE: cp(state->a, opcode[1], state); break;
-        case 0xFF: rst(*opcode, state); break;            
-    }
-    state->pc+=1;
-    return halt;
-}
-
-// Initialize space for z80 states and memory
-State* z80init(void) {
-    State* state = (State*)calloc(1,sizeof(State));
-    state->mem_size = 0x10000;
-    state->memory = (uint8_t*)calloc(state->mem_size, sizeof(uint8_t));  //64kb
-    return state;
-}
-
-void bad_inst(State* state) {
-    state->pc--; 
-    printf("Bad instruction\n");
-    exit(1);
-}
-
 // Display the helptext
 
 void helptext() {
     std::cout << "Available commands are: \n";
     std::cout << "help\t\t -- Displays this message.\n";
-    std::cout << "disassemble\t -- Starts a prompt for disassembling a file.\n";
-    std::cout << "load\t\t -- Loads a file into memory starting at the given position.\n";
+    std::cout << "disassemble [f]\t -- Disassembles file f, prompting for it if not given.\n";
+    std::cout << "load f [org] [n]\t -- Loads n bytes (default all) of file f into memory at org.\n";
     std::cout << "printmem\t -- Displays an ncurses window of the current memory of the machine.\n";
     std::cout << "clearmem\t -- Zeroes out memory.\n";
-    std::cout << "run\t\t -- Runs whatever is currently loaded into memory.\n";
-    std::cout << "reset\t\t -- Resets the program counter.\n";
+    std::cout << "run\t\t -- Runs whatever is currently loaded into memory; out (1),a prints a.\n";
+    std::cout << "baseline\t -- Takes a snapshot of the machine for reset to return to.\n";
+    std::cout << "reset\t\t -- Returns to the baseline, or just resets the program counter.\n";
+    std::cout << "save f\t\t -- Saves the machine to snapshot file f.\n";
+    std::cout << "restore f\t -- Loads the machine from snapshot file f.\n";
+    std::cout << "mips [n]\t -- Benchmarks the core over n instructions.\n";
+    std::cout << "trace [f]\t -- Records every instruction run to binary trace file f; no f stops.\n";
+    std::cout << "break [addr]\t -- Sets or clears a breakpoint at addr; no addr lists them.\n";
+    std::cout << "watch [addr] [r|w|rw] -- Sets or clears a watchpoint on addr (default w); no addr lists them.\n";
     std::cout << "exit\t\t -- Exits the program.\n";
 }
 
@@ -817,73 +196,76 @@ std::vector<std::string> tokenize (const char *str, char c = ' ') {
 }
 
 
+// ROM names are looked up as given, then under ../ROMS/ as before
+std::string rom_path(const std::string &name) {
+    if (access(name.c_str(), R_OK) == 0)
+        return name;
+    return "../ROMS/" + name;
+}
+
 // Dissassemble file
 int disassemble_file(std::vector<std::string> args) {
-    Disassembler d;
     std::string filename;
-    std::string path = "../ROMS/";
-    std::cout << "Please enter the name of the file you wish to disassemble: \n";
-    std::cin >> filename;
-    filename.insert(0, path);
-    const char* cfilename = filename.c_str();
-
-    std::streampos begin,end, size;
-    char * memblock;
-
-    std::ifstream input(cfilename, std::ios::binary);
-    begin = input.tellg();
-    input.seekg(0,std::ios::end);
-    end = input.tellg();
-    size = end - begin;
-    memblock = new char [size];
-    input.seekg(0, std::ios::beg);
-    input.read(memblock, size);
-    
-    std::cout << "Filesize is " + (end-begin) << std::endl;
+    if (args.size() > 1 && !args[1].empty()) {
+        filename = args[1];
+    } else {
+        std::cout << "Please enter the name of the file you wish to disassemble: \n";
+        std::cin >> filename;
+    }
+    filename = rom_path(filename);
 
-    if (input.is_open()) {
-    std::cout << filename + " opened successfully." << std::endl;
-        pc = 0;
-        while(pc < size) {
-            pc += d.disassemble((unsigned char *)memblock,pc);
-        }
+    Rom rom;
+    if (!rom_open(&rom, filename.c_str())) {
+        printf("error: Couldn't open %s: %s\n", filename.c_str(), strerror(errno));
+        return 1;
     }
-    input.close();
+    std::cout << filename + " opened successfully." << std::endl;
+    std::cout << "Filesize is " << rom.size << std::endl;
+
+    // Lines are buffered and written to stdout a chunk at a time; big
+    // files are split over all cores
+    std::vector<char> buffer(DISASM_SINK_BYTES);
+    DisasmSink sink = disasm_sink(buffer.data(), buffer.size(), disasm_write_file, stdout);
+    std::cout << std::flush;
+    disasm_parallel(rom.data, rom.size, 0, &sink);
+    if (!disasm_flush(&sink) || fflush(stdout) != 0)
+        printf("error: Couldn't write the disassembly: %s\n", strerror(errno));
+    rom_close(&rom);
     std::cout << filename + " closed successfully." << std::endl;
     return 0;
 }
 
+// load <file> [org] [length]
 int load_file(State *state, std::vector<std::string> args) {
-    for(auto i : args)
-        std::cout << i << ' ';
-
-    std::string filename;
-    std::string path = "../ROMS/";
-    filename.insert(0, path);
-    const char* cfilename = filename.c_str();
-    std::cout << cfilename << std::endl;
-
-    /*
-    const char* toffset = args[1];
-    std::string stroffset(toffset);
-    //str to uint32
-    uint32_t offset = std::stoul(stroffset,nullptr,0);
-    std::cout << stroffset;
-    */
+    if (args.size() < 2 || args[1].empty()) {
+        std::cout << "usage: load <file> [org] [length]" << std::endl;
+        return 1;
+    }
+    std::string filename = rom_path(args[1]);
+    uint32_t org = 0;
+    size_t length = 0;
+    try {
+        if (args.size() > 2)
+            org = std::stoul(args[2], nullptr, 0);
+        if (args.size() > 3)
+            length = std::stoul(args[3], nullptr, 0);
+    } catch (...) {
+        std::cout << "error: org and length must be numbers (e.g 0x100)" << std::endl;
+        return 1;
+    }
 
-    FILE *f= fopen(cfilename, "rb");
-	if (f==NULL) {
-		printf("error: Couldn't open %s\n", cfilename);
-		return 1;
-	}
-	fseek(f, 0L, SEEK_END);
-	int fsize = ftell(f);
-	fseek(f, 0L, SEEK_SET);
-
-	uint8_t *buffer = &state->memory[0];
-	fread(buffer, fsize, 1, f);
-	fclose(f);
-    return 0;
+    Rom rom;
+    if (!rom_open(&rom, filename.c_str(), length)) {
+        printf("error: Couldn't open %s: %s\n", filename.c_str(), strerror(errno));
+        return 1;
+    }
+    bool ok = rom_load(state, &rom, org);
+    if (ok)
+        printf("Loaded %zu bytes of %s at %04x\n", rom.size, filename.c_str(), org);
+    else
+        printf("error: %s (%zu bytes) doesn't fit at %04x\n", filename.c_str(), rom.size, org);
+    rom_close(&rom);
+    return ok ? 0 : 1;
 }
 
 void printmem(State *state, std::vector<std::string> args) {
@@ -909,11 +291,207 @@ void printmem(State *state, std::vector<std::string> args) {
     std::cout << std::endl;
 }
 
+// Memory stays the mapping z80init made; rom_load maps ROM pages into it
 void clearmem(State *state) {
-    state->memory = (uint8_t*)calloc(state->mem_size, sizeof(uint8_t));
+    memset(state->memory, 0, state->mem_size);
+    // Bypassed the bus, so a baseline reset has to copy every page back
+    bus_touch(&state->bus);
 }
 
-int reset(State *state) {
-    state->pc = 0;
+int reset(State *state, const Baseline *base) {
+    if (base->pages)
+        baseline_restore(state, base);
+    else
+        state->pc = 0;
     return 0;
 }
+
+void save_snapshot(State *state, std::vector<std::string> args) {
+    if (args.size() < 2) {
+        std::cout << "usage: save <file>" << std::endl;
+        return;
+    }
+    if (!snapshot_save(state, args[1].c_str()))
+        std::cout << "Couldn't save " << args[1] << ": " << strerror(errno) << std::endl;
+}
+
+int restore_snapshot(State *state, std::vector<std::string> args) {
+    if (args.size() < 2) {
+        std::cout << "usage: restore <file>" << std::endl;
+        return -1;
+    }
+    if (!snapshot_restore(state, args[1].c_str())) {
+        std::cout << "Couldn't restore " << args[1] << ": " << strerror(errno) << std::endl;
+        return -1;
+    }
+    printf("Restored at %04x after %llu T-states\n", state->pc, (unsigned long long)state->cycles);
+    return 0;
+}
+
+// trace <file> starts a binary trace (see zilog_trace); trace alone ends it
+void trace(State *state, std::vector<std::string> args) {
+    if (state->tracer) {
+        Tracer *t = state->tracer;
+        uint64_t records = t->head;
+        state->tracer = nullptr;
+        if (trace_close(t))
+            printf("Trace closed after %llu instructions\n", (unsigned long long)records);
+        else
+            printf("error: trace write failed: %s\n", strerror(errno));
+    }
+    if (args.size() < 2 || args[1].empty())
+        return;
+    state->tracer = trace_open(args[1].c_str());
+    if (state->tracer)
+        printf("Tracing to %s\n", args[1].c_str());
+    else
+        printf("error: Couldn't create %s: %s\n", args[1].c_str(), strerror(errno));
+}
+
+// Time the threaded core, interpreted, through translated blocks and (where
+// there's a JIT) through compiled blocks, against the old loop shape (one
+// emulate() call and one trace line per instruction) on the same
+// straight-line ALU/load mix.
+void mips(std::vector<std::string> args) {
+    uint64_t count = 50000000;
+    if (args.size() > 1) {
+        bool ok = false;
+        try {
+            size_t used = 0;
+            count = std::stoull(args[1], &used, 0);
+            ok = used == args[1].size() && count > 0;
+        } catch (...) {
+        }
+        if (!ok) {
+            std::cout << "usage: mips [instructions] (e.g 1000000)" << std::endl;
+            return;
+        }
+    }
+    uint64_t step_count = count / 10;
+
+    static const uint8_t mix[] = { 0x04, 0x80, 0x4F, 0xA9, 0x15, 0x00, 0x78, 0xB1 };
+    State* state = z80init();
+    for (uint32_t i = 0; i < state->mem_size; i++)
+        state->memory[i] = mix[i % sizeof(mix)];
+
+    // Trace output goes to /dev/null so the terminal doesn't set the pace
+    fflush(stdout);
+    int saved = dup(1);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, 1);
+    state->trace = 1;
+    auto t0 = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < step_count; i++)
+        emulate(state);
+    auto t1 = std::chrono::steady_clock::now();
+    fflush(stdout);
+    dup2(saved, 1);
+    close(devnull);
+    close(saved);
+
+    state->trace = 0;
+    state->translate = 0;
+    auto t2 = std::chrono::steady_clock::now();
+    run(state, count);
+    auto t3 = std::chrono::steady_clock::now();
+    state->translate = 1;
+    run(state, count);
+    auto t4 = std::chrono::steady_clock::now();
+#if ZILOG_JIT
+    state->jit = JIT_ON;
+    run(state, count);
+    auto t5 = std::chrono::steady_clock::now();
+    state->jit = JIT_OFF;
+#endif
+
+    double step_mips = step_count / std::chrono::duration<double>(t1 - t0).count() / 1e6;
+    double run_mips = count / std::chrono::duration<double>(t3 - t2).count() / 1e6;
+    double block_mips = count / std::chrono::duration<double>(t4 - t3).count() / 1e6;
+    printf("step loop: %8.2f MIPS (%llu instructions)\n", step_mips, (unsigned long long)step_count);
+    printf("threaded:  %8.2f MIPS (%llu instructions)\n", run_mips, (unsigned long long)count);
+    printf("blocks:    %8.2f MIPS (%llu instructions)\n", block_mips, (unsigned long long)count);
+#if ZILOG_JIT
+    double jit_mips = count / std::chrono::duration<double>(t5 - t4).count() / 1e6;
+    printf("jit:       %8.2f MIPS (%llu instructions)\n", jit_mips, (unsigned long long)count);
+#endif
+    printf("speedup:   %8.1fx, %.1fx with blocks\n", run_mips / step_mips, block_mips / step_mips);
+
+    z80free(state);
+}
+
+// The REPL's debugger, attached the first time a point is set
+static Debugger* repl_debugger(State *state) {
+    if (!state->debug) {
+        Debugger *debug = debug_create();
+        if (!debug) {
+            std::cout << "Out of memory." << std::endl;
+            return nullptr;
+        }
+        debug_attach(state, debug);
+    }
+    return state->debug;
+}
+
+static bool parse_addr(const std::string &text, uint16_t &addr) {
+    try {
+        size_t used = 0;
+        unsigned long v = std::stoul(text, &used, 0);
+        if (used != text.size() || v > 0xffff)
+            return false;
+        addr = v;
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+// break lists the breakpoints; break <addr> sets one there, or clears it
+void breakpoint(State *state, std::vector<std::string> args) {
+    Debugger *debug = repl_debugger(state);
+    if (!debug)
+        return;
+    if (args.size() < 2 || args[1].empty()) {
+        for (uint32_t pc = 0; pc < 0x10000; pc++)
+            if (debug_breaks(debug, pc))
+                printf("break %04x\n", pc);
+        return;
+    }
+    uint16_t pc;
+    if (!parse_addr(args[1], pc)) {
+        std::cout << "usage: break [addr]" << std::endl;
+        return;
+    }
+    bool on = !debug_breaks(debug, pc);
+    debug_break(state, pc, on);
+    printf("Breakpoint at %04x %s\n", pc, on ? "set" : "cleared");
+}
+
+// watch lists the watchpoints; watch <addr> [r|w|rw] sets one on those
+// accesses to addr, or clears it if it was already set
+void watchpoint(State *state, std::vector<std::string> args) {
+    Debugger *debug = repl_debugger(state);
+    if (!debug)
+        return;
+    if (args.size() < 2 || args[1].empty()) {
+        for (uint32_t addr = 0; addr < 0x10000; addr++) {
+            bool r = debug->reads[addr >> 6] >> (addr & 63) & 1;
+            bool w = debug->writes[addr >> 6] >> (addr & 63) & 1;
+            if (r || w)
+                printf("watch %04x %s%s\n", addr, r ? "r" : "", w ? "w" : "");
+        }
+        return;
+    }
+    uint16_t addr;
+    std::string kind = args.size() > 2 ? args[2] : "w";
+    uint8_t kinds = kind == "r" ? DEBUG_READ : kind == "w" ? DEBUG_WRITE : kind == "rw" ? DEBUG_READ | DEBUG_WRITE : 0;
+    if (!parse_addr(args[1], addr) || !kinds) {
+        std::cout << "usage: watch [addr] [r|w|rw]" << std::endl;
+        return;
+    }
+    if (debug_watch(state, addr, kinds, true)) {
+        printf("Watchpoint on %04x set\n", addr);
+    } else {
+        debug_watch(state, addr, kinds, false);
+        printf("Watchpoint on %04x cleared\n", addr);
+    }
+}
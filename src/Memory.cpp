@@ -0,0 +1,144 @@
+#include "Memory.hpp"
+
+// Table entry for host memory backing page p (see MemoryMap)
+static inline uintptr_t biased(const uint8_t *host, unsigned p) {
+    return (uintptr_t)host - ((uintptr_t)p << PAGE_SHIFT);
+}
+
+// Page index of the page off bytes into a region starting at addr; regions
+// that run off the top wrap around to 0 like the address bus does
+static inline unsigned page_at(uint16_t addr, uint32_t off) {
+    return ((addr + off) & 0xffff) >> PAGE_SHIFT;
+}
+
+void bus_map_ram(MemoryMap *bus, uint16_t addr, uint32_t len, uint8_t *host) {
+    for (uint32_t off = 0; off < len; off += PAGE_SIZE) {
+        unsigned p = page_at(addr, off);
+        bus->read[p] = biased(host + off, p);
+        bus->write[p] = biased(host + off, p);
+        bus->mmio[p] = nullptr;
+        bus->parked[p] = 0;
+        bus->parked_read[p] = 0;
+        bus->watch[p] = 0;
+        if (bus->watch_remap)
+            bus->watch_remap(bus->watch_ctx, p);
+    }
+    bus_touch(bus);
+}
+
+void bus_map_rom(MemoryMap *bus, uint16_t addr, uint32_t len, const uint8_t *host) {
+    for (uint32_t off = 0; off < len; off += PAGE_SIZE) {
+        unsigned p = page_at(addr, off);
+        bus->read[p] = biased(host + off, p);
+        bus->write[p] = 0;
+        bus->mmio[p] = nullptr;
+        bus->parked[p] = 0;
+        bus->parked_read[p] = 0;
+        bus->watch[p] = 0;
+        if (bus->watch_remap)
+            bus->watch_remap(bus->watch_ctx, p);
+    }
+    bus_touch(bus);
+}
+
+void bus_map_io(MemoryMap *bus, uint16_t addr, uint32_t len, const MmioHandler *handler) {
+    for (uint32_t off = 0; off < len; off += PAGE_SIZE) {
+        unsigned p = page_at(addr, off);
+        bus->read[p] = 0;
+        bus->write[p] = 0;
+        bus->mmio[p] = handler;
+        bus->parked[p] = 0;
+        bus->parked_read[p] = 0;
+        bus->watch[p] = 0;
+        if (bus->watch_remap)
+            bus->watch_remap(bus->watch_ctx, p);
+    }
+    bus_touch(bus);
+}
+
+void bus_unmap(MemoryMap *bus, uint16_t addr, uint32_t len) {
+    bus_map_io(bus, addr, len, nullptr);
+}
+
+void bus_watch(MemoryMap *bus, unsigned page, uint8_t flags) {
+    if ((flags & WATCH_READS) && !(bus->watch[page] & WATCH_READS) && bus->read[page]) {
+        bus->parked_read[page] = bus->read[page];
+        bus->read[page] = 0;
+        bus->watch[page] |= WATCH_READS;
+    }
+    flags &= ~WATCH_READS;
+    if (!flags)
+        return;
+    if (!(bus->watch[page] & ~WATCH_READS)) {
+        if (!bus->write[page])
+            return;
+        bus->parked[page] = bus->write[page];
+        bus->write[page] = 0;
+    }
+    bus->watch[page] |= flags;
+}
+
+void bus_unwatch(MemoryMap *bus, unsigned page, uint8_t flags) {
+    if (flags & bus->watch[page] & WATCH_READS) {
+        bus->read[page] = bus->parked_read[page];
+        bus->parked_read[page] = 0;
+        bus->watch[page] &= ~WATCH_READS;
+    }
+    flags &= ~WATCH_READS;
+    if (!(bus->watch[page] & flags))
+        return;
+    bus->watch[page] &= ~flags;
+    if (!(bus->watch[page] & ~WATCH_READS)) {
+        bus->write[page] = bus->parked[page];
+        bus->parked[page] = 0;
+    }
+}
+
+void bus_track_writes(MemoryMap *bus) {
+    for (unsigned p = 0; p < PAGE_COUNT; p++)
+        bus_watch(bus, p, WATCH_DIRTY);
+    bus->dirty = 0;
+}
+
+void bus_untrack_writes(MemoryMap *bus) {
+    for (unsigned p = 0; p < PAGE_COUNT; p++)
+        bus_unwatch(bus, p, WATCH_DIRTY);
+}
+
+void bus_touch(MemoryMap *bus) {
+    bus->dirty = ~0ull;
+    bus->epoch++;
+}
+
+uint8_t bus_read_slow(const MemoryMap *bus, uint16_t addr) {
+    unsigned p = addr >> PAGE_SHIFT;
+    if (bus->watch[p] & WATCH_READS) {
+        uint8_t value = *(const uint8_t*)(bus->parked_read[p] + addr);
+        bus->watch_hit(bus->watch_ctx, addr, value, false);
+        return value;
+    }
+    const MmioHandler *h = bus->mmio[p];
+    if (h && h->read)
+        return h->read(h->ctx, addr);
+    return 0xff;
+}
+
+void bus_write_slow(MemoryMap *bus, uint16_t addr, uint8_t value) {
+    unsigned p = addr >> PAGE_SHIFT;
+    if (bus->watch[p] & ~WATCH_READS) {
+        uintptr_t page = bus->parked[p];
+        if (bus->watch[p] & WATCH_WRITES)
+            bus->watch_hit(bus->watch_ctx, addr, value, true);
+        if (bus->watch[p] & WATCH_DIRTY) {
+            bus->dirty |= 1ull << p;
+            bus_unwatch(bus, p, WATCH_DIRTY);
+        }
+        if (bus->watch[p] & WATCH_CODE)
+            bus->code_write(bus->code_ctx, addr);
+        *(uint8_t*)(page + addr) = value;
+        return;
+    }
+    const MmioHandler *h = bus->mmio[p];
+    if (h && h->write)
+        h->write(h->ctx, addr, value);
+}
@@ -0,0 +1,29 @@
+#include "Ports.hpp"
+
+#include <cstdlib>
+
+PortBus* ports_create(bool full) {
+    uint32_t entries = full ? 0x10000 : 0x100;
+    PortBus *ports = (PortBus*)calloc(1, sizeof(PortBus) + entries * sizeof(PortHandler*));
+    if (!ports)
+        return nullptr;
+    ports->table = (const PortHandler**)(ports + 1);
+    ports->mask = entries - 1;
+    return ports;
+}
+
+void ports_free(PortBus *ports) {
+    free(ports);
+}
+
+void ports_map(PortBus *ports, uint16_t port, const PortHandler *handler) {
+    const PortHandler *&entry = ports->table[port & ports->mask];
+    ports->readers -= entry && entry->read;
+    ports->readers += handler && handler->read;
+    entry = handler;
+}
+
+void ports_map_low(PortBus *ports, uint8_t low, const PortHandler *handler) {
+    for (uint32_t port = low; port <= ports->mask; port += 0x100)
+        ports_map(ports, port, handler);
+}
@@ -0,0 +1,114 @@
+#include "Profile.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+Profile* profile_create() {
+    Profile *p = (Profile*)calloc(1, sizeof(Profile));
+    if (p)
+        p->used = 1;        // The root
+    return p;
+}
+
+void profile_free(Profile *p) {
+    free(p);
+}
+
+void profile_enter(Profile *p, uint16_t addr) {
+    ProfileFrame &caller = p->frames[p->frame];
+    uint32_t f = caller.child;
+    while (f && p->frames[f].addr != addr)
+        f = p->frames[f].sibling;
+    if (!f) {
+        if (p->used == PROFILE_FRAMES) {
+            p->dropped++;
+            p->excess++;
+            return;
+        }
+        f = p->used++;
+        ProfileFrame &callee = p->frames[f];
+        callee.addr = addr;
+        callee.parent = p->frame;
+        callee.sibling = caller.child;
+        caller.child = f;
+    }
+    p->frame = f;
+}
+
+// "ed b0", "xy cb 46" (DD and FD share counters)
+static void opcode_name(unsigned op, char *out, size_t size) {
+    static const char *groups[] = { "", "cb ", "ed ", "xy ", "xy cb " };
+    snprintf(out, size, "%s%02x", groups[op / 256], op % 256);
+}
+
+void profile_report(const Profile *p, FILE *out, unsigned top_pcs) {
+    uint64_t instructions = 0, cycles = 0;
+    std::vector<unsigned> ops;
+    for (unsigned op = 0; op < PROFILE_OPS; op++) {
+        instructions += p->op_count[op];
+        cycles += p->op_cycles[op];
+        if (p->op_count[op])
+            ops.push_back(op);
+    }
+    double scale = cycles ? 100.0 / cycles : 0;
+    std::sort(ops.begin(), ops.end(), [p](unsigned a, unsigned b) {
+        return p->op_cycles[a] != p->op_cycles[b] ? p->op_cycles[a] > p->op_cycles[b] : a < b;
+    });
+    fprintf(out, "%llu instructions, %llu T-states\n\n",
+            (unsigned long long)instructions, (unsigned long long)cycles);
+    fprintf(out, "opcode            count      T-states       %%\n");
+    for (unsigned op : ops) {
+        char name[16];
+        opcode_name(op, name, sizeof(name));
+        fprintf(out, "%-8s %14llu %14llu %6.2f\n", name, (unsigned long long)p->op_count[op],
+                (unsigned long long)p->op_cycles[op], p->op_cycles[op] * scale);
+    }
+
+    std::vector<unsigned> pcs;
+    for (unsigned pc = 0; pc < 0x10000; pc++)
+        if (p->pc_count[pc])
+            pcs.push_back(pc);
+    size_t shown = std::min<size_t>(pcs.size(), top_pcs);
+    std::partial_sort(pcs.begin(), pcs.begin() + shown, pcs.end(), [p](unsigned a, unsigned b) {
+        return p->pc_cycles[a] != p->pc_cycles[b] ? p->pc_cycles[a] > p->pc_cycles[b] : a < b;
+    });
+    fprintf(out, "\npc                count      T-states       %%\n");
+    for (size_t i = 0; i < shown; i++) {
+        unsigned pc = pcs[i];
+        fprintf(out, "%04x     %14llu %14llu %6.2f\n", pc, (unsigned long long)p->pc_count[pc],
+                (unsigned long long)p->pc_cycles[pc], p->pc_cycles[pc] * scale);
+    }
+    if (p->dropped)
+        fprintf(out, "\n%llu calls went deeper than the %d-frame call tree and were charged to their caller\n",
+                (unsigned long long)p->dropped, PROFILE_FRAMES);
+}
+
+// Depth-first over the call tree with an explicit stack, since recursive
+// Z80 code can make it as deep as it has frames
+void profile_write_folded(const Profile *p, FILE *out) {
+    struct Visit {
+        uint32_t    frame;
+        size_t      length;     // Of path up to and including the parent
+    };
+    std::vector<Visit> stack = { { 0, 0 } };
+    std::string path;
+    while (!stack.empty()) {
+        Visit v = stack.back();
+        stack.pop_back();
+        const ProfileFrame &f = p->frames[v.frame];
+        path.resize(v.length);
+        if (v.frame) {
+            char name[8];
+            snprintf(name, sizeof(name), ";0x%04x", f.addr);
+            path += name;
+        } else {
+            path = "root";
+        }
+        if (f.cycles)
+            fprintf(out, "%s %llu\n", path.c_str(), (unsigned long long)f.cycles);
+        for (uint32_t c = f.child; c; c = p->frames[c].sibling)
+            stack.push_back({ c, path.size() });
+    }
+}
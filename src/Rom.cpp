@@ -0,0 +1,75 @@
+#include "Rom.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool rom_open(Rom *rom, const char *path, size_t length) {
+    memset(rom, 0, sizeof(*rom));
+    rom->fd = open(path, O_RDONLY);
+    if (rom->fd < 0)
+        return false;
+
+    struct stat st;
+    int err = 0;
+    if (fstat(rom->fd, &st) < 0)
+        err = errno;
+    else if (!S_ISREG(st.st_mode))
+        err = S_ISDIR(st.st_mode) ? EISDIR : EINVAL;
+    if (err) {
+        rom_close(rom);
+        errno = err;
+        return false;
+    }
+    rom->size = st.st_size;
+    if (length && length < rom->size)
+        rom->size = length;
+
+    // mmap rejects empty mappings; an empty image just has no data
+    if (rom->size) {
+        rom->map = mmap(NULL, rom->size, PROT_READ, MAP_PRIVATE, rom->fd, 0);
+        if (rom->map == MAP_FAILED) {
+            err = errno;
+            rom->map = NULL;
+            rom_close(rom);
+            errno = err;
+            return false;
+        }
+        rom->map_size = rom->size;
+        rom->data = (const uint8_t*)rom->map;
+    }
+    return true;
+}
+
+void rom_close(Rom *rom) {
+    if (rom->map)
+        munmap(rom->map, rom->map_size);
+    if (rom->fd >= 0)
+        close(rom->fd);
+    memset(rom, 0, sizeof(*rom));
+    rom->fd = -1;
+}
+
+bool rom_load(State *state, const Rom *rom, uint32_t org) {
+    if (org > state->mem_size || rom->size > state->mem_size - org)
+        return false;
+
+    // Machine memory is page-aligned (see z80init), so a page-aligned org
+    // lets the file pages stand in for RAM until the program writes them
+    uint8_t *dst = state->memory + org;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t mapped = 0;
+    if (org % page == 0 && rom->size >= page) {
+        size_t len = rom->size / page * page;
+        if (mmap(dst, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, rom->fd, 0) != MAP_FAILED)
+            mapped = len;
+    }
+    if (rom->size > mapped)
+        memcpy(dst + mapped, rom->data + mapped, rom->size - mapped);
+    // Written behind the bus, so dirty-page tracking can't have seen it
+    bus_touch(&state->bus);
+    return true;
+}
@@ -0,0 +1,252 @@
+#include "Snapshot.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+enum PageRecord {
+    PAGE_ZERO = 0,
+    PAGE_RAW = 1,
+    PAGE_RLE = 2
+};
+
+static const char magic[4] = { 'Z', 'S', 'N', 'P' };
+
+static void put8(std::vector<uint8_t> &out, uint8_t v) { out.push_back(v); }
+
+static void put16(std::vector<uint8_t> &out, uint16_t v) {
+    out.push_back(v & 0xff);
+    out.push_back(v >> 8);
+}
+
+static void put32(std::vector<uint8_t> &out, uint32_t v) {
+    put16(out, v & 0xffff);
+    put16(out, v >> 16);
+}
+
+static void put64(std::vector<uint8_t> &out, uint64_t v) {
+    put32(out, v & 0xffffffff);
+    put32(out, v >> 32);
+}
+
+// Bounds-checked reader; once it runs off the end every get returns 0 and
+// ok stays false
+struct Reader {
+    const uint8_t   *p;
+    const uint8_t   *end;
+    bool            ok;
+};
+
+static uint8_t get8(Reader &in) {
+    if (in.p >= in.end) {
+        in.ok = false;
+        return 0;
+    }
+    return *in.p++;
+}
+
+static uint16_t get16(Reader &in) {
+    uint16_t lo = get8(in);
+    return lo | get8(in) << 8;
+}
+
+static uint32_t get32(Reader &in) {
+    uint32_t lo = get16(in);
+    return lo | (uint32_t)get16(in) << 16;
+}
+
+static uint64_t get64(Reader &in) {
+    uint64_t lo = get32(in);
+    return lo | (uint64_t)get32(in) << 32;
+}
+
+// Length of the run starting at page[i], capped to what one RLE pair holds
+static size_t run_length(const uint8_t *page, size_t size, size_t i) {
+    size_t j = i + 1;
+    while (j < size && j - i < 256 && page[j] == page[i])
+        j++;
+    return j - i;
+}
+
+// Runs needed to cover page, or SIZE_MAX once RLE can't beat raw
+static size_t rle_runs(const uint8_t *page, size_t size) {
+    size_t runs = 0;
+    for (size_t i = 0; i < size; i += run_length(page, size, i))
+        if (++runs * 2 >= size)
+            return SIZE_MAX;
+    return runs;
+}
+
+static void encode_page(std::vector<uint8_t> &out, const uint8_t *page, size_t size) {
+    size_t runs = rle_runs(page, size);
+    if (runs == 1 && page[0] == 0) {
+        put8(out, PAGE_ZERO);
+    } else if (runs == SIZE_MAX) {
+        put8(out, PAGE_RAW);
+        out.insert(out.end(), page, page + size);
+    } else {
+        put8(out, PAGE_RLE);
+        for (size_t i = 0, n; i < size; i += n) {
+            n = run_length(page, size, i);
+            put8(out, n - 1);
+            put8(out, page[i]);
+        }
+    }
+}
+
+static bool decode_page(Reader &in, uint8_t *page, size_t size) {
+    switch (get8(in)) {
+        case PAGE_ZERO:
+            memset(page, 0, size);
+            return in.ok;
+        case PAGE_RAW:
+            if ((size_t)(in.end - in.p) < size)
+                return false;
+            memcpy(page, in.p, size);
+            in.p += size;
+            return true;
+        case PAGE_RLE:
+            for (size_t i = 0; i < size;) {
+                size_t n = get8(in) + 1;
+                uint8_t v = get8(in);
+                if (!in.ok || n > size - i)
+                    return false;
+                memset(page + i, v, n);
+                i += n;
+            }
+            return true;
+    }
+    return false;
+}
+
+void snapshot_encode(const State *state, std::vector<uint8_t> &out) {
+    const State *s = state;
+    out.clear();
+    for (char c : magic)
+        put8(out, c);
+    put16(out, SNAPSHOT_VERSION);
+    put16(out, 0);      // Header size, patched below
+
+    for (int b = 0; b < 2; b++)
+        put16(out, b == s->af_bank ? (s->af[b].b.h << 8) | flags_peek(s) : s->af[b].w);
+    for (int b = 0; b < 2; b++) {
+        put16(out, s->gp[b].bc.w);
+        put16(out, s->gp[b].de.w);
+        put16(out, s->gp[b].hl.w);
+    }
+    put8(out, s->af_bank);
+    put8(out, s->gp_bank);
+    put16(out, s->sp);
+    put16(out, s->pc);
+    put16(out, s->ix.w);
+    put16(out, s->iy.w);
+    put8(out, s->i);
+    put8(out, s->r);
+    put8(out, s->iff1);
+    put8(out, s->iff2);
+    put8(out, s->im);
+    put8(out, s->halted);
+    put64(out, s->instructions);
+    put64(out, s->cycles);
+    put32(out, s->mem_size);
+    put8(out, s->int_line);
+    put8(out, s->int_data);
+    put8(out, s->nmi_pending);
+    put64(out, s->ei_after);
+    out[6] = out.size() & 0xff;
+    out[7] = out.size() >> 8;
+
+    for (uint32_t off = 0; off < s->mem_size; off += PAGE_SIZE)
+        encode_page(out, s->memory + off, PAGE_SIZE);
+}
+
+bool snapshot_decode(State *state, const uint8_t *data, size_t size) {
+    Reader in = { data, data + size, true };
+    if (size < 8 || memcmp(data, magic, 4) != 0)
+        return false;
+    in.p += 4;
+    uint16_t version = get16(in);
+    uint16_t header = get16(in);
+    if (version == 0 || version > SNAPSHOT_VERSION || header > size)
+        return false;
+
+    // Fill a copy so a bad file can't leave state half-restored
+    State s = *state;
+    for (int b = 0; b < 2; b++)
+        s.af[b].w = get16(in);
+    s.lazy.op = FLAGS_READY;
+    for (int b = 0; b < 2; b++) {
+        s.gp[b].bc.w = get16(in);
+        s.gp[b].de.w = get16(in);
+        s.gp[b].hl.w = get16(in);
+    }
+    s.af_bank = get8(in) & 1;
+    s.gp_bank = get8(in) & 1;
+    s.sp = get16(in);
+    s.pc = get16(in);
+    s.ix.w = get16(in);
+    s.iy.w = get16(in);
+    s.i = get8(in);
+    s.r = get8(in);
+    s.iff1 = get8(in);
+    s.iff2 = get8(in);
+    s.im = get8(in);
+    s.halted = get8(in);
+    s.instructions = get64(in);
+    s.cycles = get64(in);
+    uint32_t mem_size = get32(in);
+    if (!in.ok || mem_size != state->mem_size || (size_t)(in.p - data) > header)
+        return false;
+    if ((size_t)(in.p - data) + 11 <= header) {     // Interrupt lines, added later
+        s.int_line = get8(in);
+        s.int_data = get8(in);
+        s.nmi_pending = get8(in);
+        s.ei_after = get64(in);
+    }
+    in.p = data + header;   // Skip fields appended since; only a version bump breaks readers
+
+    std::vector<uint8_t> memory(mem_size);
+    for (uint32_t off = 0; off < mem_size; off += PAGE_SIZE)
+        if (!decode_page(in, memory.data() + off, PAGE_SIZE))
+            return false;
+
+    memcpy(state->memory, memory.data(), mem_size);
+    s.bus = state->bus;
+    s.memory = state->memory;
+    *state = s;
+    bus_map_ram(&state->bus, 0, state->mem_size, state->memory);
+    return true;
+}
+
+bool snapshot_save(const State *state, const char *path) {
+    std::vector<uint8_t> data;
+    snapshot_encode(state, data);
+    FILE *f = fopen(path, "wb");
+    if (!f)
+        return false;
+    bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    int err = errno;
+    if (fclose(f) != 0 && ok) {
+        ok = false;
+        err = errno;
+    }
+    errno = err;
+    return ok;
+}
+
+bool snapshot_restore(State *state, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return false;
+    std::vector<uint8_t> data;
+    uint8_t chunk[16384];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+        data.insert(data.end(), chunk, chunk + n);
+    int err = ferror(f) ? EIO : 0;
+    fclose(f);
+    if (!err && !snapshot_decode(state, data.data(), data.size()))
+        err = EINVAL;
+    errno = err;
+    return !err;
+}
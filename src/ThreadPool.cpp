@@ -0,0 +1,88 @@
+#include "ThreadPool.hpp"
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct WorkQueue {
+    std::mutex          lock;
+    std::deque<size_t>  jobs;
+    std::atomic<size_t> size{0};    // jobs.size(), readable without the lock
+};
+
+static bool take_own(WorkQueue &q, size_t &out) {
+    std::lock_guard<std::mutex> hold(q.lock);
+    if (q.jobs.empty())
+        return false;
+    out = q.jobs.back();
+    q.jobs.pop_back();
+    q.size = q.jobs.size();
+    return true;
+}
+
+// Steal from the victim with the most work left. The sizes are read without
+// locking, so the pick is only a hint; the pop rechecks under the lock.
+static bool steal(std::vector<WorkQueue> &queues, unsigned self, size_t &out) {
+    for (;;) {
+        unsigned victim = self;
+        size_t most = 0;
+        for (unsigned w = 0; w < queues.size(); w++) {
+            size_t n = queues[w].size;
+            if (w != self && n > most) {
+                most = n;
+                victim = w;
+            }
+        }
+        if (victim == self)
+            return false;
+        std::lock_guard<std::mutex> hold(queues[victim].lock);
+        if (!queues[victim].jobs.empty()) {
+            out = queues[victim].jobs.front();
+            queues[victim].jobs.pop_front();
+            queues[victim].size = queues[victim].jobs.size();
+            return true;
+        }
+    }
+}
+
+unsigned default_threads() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+void parallel_for(size_t count, unsigned threads, const std::function<void(unsigned, size_t)> &job) {
+    if (threads == 0)
+        threads = default_threads();
+    if (threads > count)
+        threads = count ? count : 1;
+    if (threads == 1) {
+        for (size_t i = 0; i < count; i++)
+            job(0, i);
+        return;
+    }
+
+    // Contiguous shares keep neighbouring jobs (often similar ROMs) on one
+    // thread; stealing from the front takes the work its owner reaches last
+    std::vector<WorkQueue> queues(threads);
+    for (unsigned w = 0; w < threads; w++) {
+        for (size_t i = count * w / threads; i < count * (w + 1) / threads; i++)
+            queues[w].jobs.push_back(i);
+        queues[w].size = queues[w].jobs.size();
+    }
+
+    // No new work appears once started, so a worker that finds every queue
+    // empty is done
+    auto worker = [&](unsigned self) {
+        size_t i;
+        while (take_own(queues[self], i) || steal(queues, self, i))
+            job(self, i);
+    };
+    std::vector<std::thread> pool;
+    for (unsigned w = 1; w < threads; w++)
+        pool.emplace_back(worker, w);
+    worker(0);
+    for (auto &t : pool)
+        t.join();
+}
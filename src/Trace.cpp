@@ -0,0 +1,105 @@
+#include "Trace.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+enum {
+    WRITE_RECORDS   = 4096          // Smallest write the writer makes unless idle or stopping
+};
+
+static const char magic[4] = { 'Z', 'T', 'R', 'C' };
+
+// Write out [tail, head) a contiguous span at a time. Once a write has
+// failed the records are still consumed, so the core never waits on a dead
+// file.
+static void drain(Tracer *t, uint64_t head) {
+    uint64_t tail = t->tail.load(std::memory_order_relaxed);
+    while (tail != head) {
+        uint64_t at = tail & t->mask;
+        uint64_t n = head - tail;
+        if (n > t->mask + 1 - at)
+            n = t->mask + 1 - at;
+        if (!t->failed.load(std::memory_order_relaxed)
+            && fwrite(t->ring + at, sizeof(TraceRecord), n, t->file) != n) {
+            t->error = errno;
+            t->failed.store(true, std::memory_order_relaxed);
+        }
+        tail += n;
+        t->tail.store(tail, std::memory_order_release);
+    }
+}
+
+// Sleep while there's less than a write's worth, unless the ring has sat
+// part-filled for a while; stopping drains everything
+static void writer_loop(Tracer *t) {
+    unsigned idle = 0;
+    for (;;) {
+        bool stopping = t->stop.load(std::memory_order_acquire);
+        uint64_t head = t->head.load(std::memory_order_acquire);
+        uint64_t pending = head - t->tail.load(std::memory_order_relaxed);
+        if (pending >= WRITE_RECORDS || pending > t->mask / 2 || stopping || (pending && idle >= 10)) {
+            drain(t, head);
+            idle = 0;
+            if (stopping)
+                return;
+            continue;
+        }
+        idle++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+Tracer* trace_open(const char *path, uint32_t records) {
+    uint64_t size = 1;
+    while (size < records)
+        size <<= 1;
+    FILE *file = fopen(path, "wb");
+    if (!file)
+        return nullptr;
+
+    TraceHeader header = {};
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version = TRACE_VERSION;
+    header.record_size = sizeof(TraceRecord);
+    header.byte_order = TRACE_BYTE_ORDER;
+    TraceRecord *ring = (TraceRecord*)calloc(size, sizeof(TraceRecord));
+    if (!ring || fwrite(&header, sizeof(header), 1, file) != 1) {
+        int err = ring ? errno : ENOMEM;
+        free(ring);
+        fclose(file);
+        errno = err;
+        return nullptr;
+    }
+
+    Tracer *t = new Tracer;
+    t->ring = ring;
+    t->mask = size - 1;
+    t->file = file;
+    t->writer = std::thread(writer_loop, t);
+    return t;
+}
+
+bool trace_close(Tracer *t) {
+    t->stop.store(true, std::memory_order_release);
+    t->writer.join();
+    bool ok = !t->failed.load();
+    int err = t->error;
+    if (fclose(t->file) != 0 && ok) {
+        ok = false;
+        err = errno;
+    }
+    free(t->ring);
+    delete t;
+    errno = err;
+    return ok;
+}
+
+// The writer is behind; give it the core (there may be only one)
+void trace_wait(Tracer *t) {
+    t->waits++;
+    uint64_t head = t->head.load(std::memory_order_relaxed);
+    while (head - t->tail.load(std::memory_order_acquire) > t->mask)
+        std::this_thread::yield();
+}
@@ -0,0 +1,421 @@
+#include "Translate.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+#include "Debug.hpp"
+#include "Jit.hpp"
+#include "Timing.hpp"
+#include "Z80.hpp"
+
+enum {
+    ARENA_SIZE      = 2 << 20,      // Flush everything when it fills
+    REWRITE_LIMIT   = 16            // Drops before a page is left to the interpreter
+};
+
+// Largest block, header, loop uop and end marker included
+static const size_t MAX_BLOCK = sizeof(Block) + (BLOCK_MAX_UOPS + 2) * sizeof(Uop);
+
+// What translation needs to know about one instruction
+struct Insn {
+    uint8_t     len;        // Bytes, operands included
+    bool        last;       // May leave pc anywhere but the next instruction
+    uint8_t     lead;       // T-states it takes before any branch is taken
+    Uop         uop;
+};
+
+// Bytes of an unprefixed instruction
+static unsigned base_length(uint8_t op) {
+    switch (op) {
+        case 0x01: case 0x11: case 0x21: case 0x31:     // ld rr,nn
+        case 0x22: case 0x2A: case 0x32: case 0x3A:     // ld (nn),hl / a and back
+        case 0xC3: case 0xCD:                           // jp nn, call nn
+            return 3;
+        case 0x06: case 0x0E: case 0x16: case 0x1E:     // ld r,n
+        case 0x26: case 0x2E: case 0x36: case 0x3E:
+        case 0x10: case 0x18: case 0x20: case 0x28:     // djnz, jr
+        case 0x30: case 0x38:
+        case 0xC6: case 0xCE: case 0xD6: case 0xDE:     // alu a,n
+        case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+        case 0xD3: case 0xDB:                           // out (n),a / in a,(n)
+            return 2;
+    }
+    if (op >= 0xC0 && ((op & 7) == 2 || (op & 7) == 4))    // jp cc / call cc
+        return 3;
+    return 1;
+}
+
+// Unprefixed opcodes that can move pc non-sequentially, plus halt, and ei
+// so that its one-instruction delay is timed from outside the block
+static bool base_last(uint8_t op) {
+    switch (op) {
+        case 0x10: case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+        case 0x76: case 0xC3: case 0xC9: case 0xCD: case 0xE9: case 0xFB:
+            return true;
+    }
+    // ret cc, jp cc, call cc, rst
+    return op >= 0xC0 && ((op & 7) == 0 || (op & 7) == 2 || (op & 7) == 4 || (op & 7) == 7);
+}
+
+// DD/FD opcodes that take a displacement byte for (ix+d)
+static bool uses_index(uint8_t op) {
+    switch (op) {
+        case 0x34: case 0x35: case 0x36:
+        case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x77:
+            return true;
+    }
+    return ((op & 0xC7) == 0x46 && op != 0x76)      // ld r,(ix+d)
+        || (op & 0xC7) == 0x86;                     // alu a,(ix+d)
+}
+
+// True if the instruction at code (already decoded, so its bytes are there)
+// reads or writes a port
+static bool port_access(const uint8_t *code) {
+    uint8_t op = code[0];
+    if (op == 0xD3 || op == 0xDB)                                   // out (n),a / in a,(n)
+        return true;
+    return op == 0xED && (((code[1] & 0xC6) == 0x40)               // in r,(c) / out (c),r
+                          || (code[1] & 0xF6) == 0xA2);             // ini outi ind outd
+}
+
+// True if it reads or writes memory other than its own bytes: the stack,
+// (hl), (ix+d), (bc), (de) or (nn). Jumps, calls and returns end blocks anyway.
+static bool data_access(const uint8_t *code) {
+    uint8_t op = code[0];
+    if (op == 0xCB)
+        return (code[1] & 7) == 6;                                  // rot/bit/res/set (hl)
+    if (op == 0xED) {
+        uint8_t op2 = code[1];
+        return (op2 & 0xC7) == 0x43                                 // ld (nn),rr / ld rr,(nn)
+            || op2 == 0x67 || op2 == 0x6F                           // rrd / rld
+            || (op2 & 0xF4) == 0xA0;                                // ldi cpi ini outi ...
+    }
+    if (op == 0xDD || op == 0xFD) {
+        uint8_t op2 = code[1];
+        return op2 == 0xCB || uses_index(op2)
+            || op2 == 0x22 || op2 == 0x2A                           // ld (nn),ix / ld ix,(nn)
+            || op2 == 0xE1 || op2 == 0xE3 || op2 == 0xE5;           // pop / ex (sp) / push ix
+    }
+    switch (op) {
+        case 0x02: case 0x0A: case 0x12: case 0x1A:                 // ld (bc),a ... ld a,(de)
+        case 0x22: case 0x2A: case 0x32: case 0x3A:                 // ld (nn),hl / a and back
+        case 0x34: case 0x35: case 0x36: case 0xE3:                 // inc/dec/ld (hl), ex (sp),hl
+            return true;
+    }
+    return ((op & 0xC7) == 0x46 && op != 0x76)                      // ld r,(hl)
+        || (op >= 0x70 && op <= 0x77 && op != 0x76)                 // ld (hl),r
+        || (op & 0xC7) == 0x86                                      // alu a,(hl)
+        || (op & 0xCB) == 0xC1;                                     // push / pop
+}
+
+// True if some page has a device behind it
+static bool devices_mapped(const MemoryMap *bus) {
+    for (unsigned p = 0; p < PAGE_COUNT; p++)
+        if (!bus->read[p] && bus->mmio[p] && (bus->mmio[p]->read || bus->mmio[p]->write))
+            return true;
+    return false;
+}
+
+// Decode the instruction at code with room bytes left in its page. False if
+// it doesn't fit or is a prefix chain (DD DD, DD ED, ...) left to the
+// interpreter.
+static bool decode(const TcHandlers &h, const uint8_t *code, unsigned room, Insn &out) {
+    uint8_t op = code[0];
+    Uop &u = out.uop;
+    u.handler = h.base[op];
+    u.op = op;
+    u.skip = 1;
+    u.cycles = cycles_op[op];
+    u.m1 = 1;
+    out.lead = cycles_op[op];
+    out.last = base_last(op);
+    out.len = base_length(op);
+    if (op == 0xCB || op == 0xED || op == 0xDD || op == 0xFD) {
+        if (room < 2)
+            return false;
+        uint8_t op2 = code[1];
+        if (op == 0xCB) {
+            u.handler = h.cb[op2];
+            u.op = op2;
+            u.skip = 2;
+            u.cycles = out.lead = cycles_cb[op2];
+            u.m1 = 2;
+            out.len = 2;
+            out.last = false;
+        } else if (op == 0xED) {
+            u.handler = h.ed[op2];
+            u.op = op2;
+            u.skip = 2;
+            u.cycles = out.lead = cycles_ed[op2];
+            u.m1 = 2;
+            out.len = (op2 & 0xC7) == 0x43 ? 4 : 2;         // ld (nn),rr / ld rr,(nn)
+            out.last = (op2 & 0xC7) == 0x45                 // retn / reti
+                    || op2 == 0x4F || op2 == 0x5F           // ld r,a / ld a,r
+                    || (op2 & 0xF4) == 0xB0;                // ldir ... otdr
+        } else if (op2 == 0xDD || op2 == 0xFD || op2 == 0xED) {
+            return false;
+        } else if (op2 == 0xCB) {
+            // The prefix handler charges the rest of the T-states as it runs
+            if (room < 4)
+                return false;
+            out.lead = cycles_xycb[code[3]];
+            out.len = 4;
+            out.last = false;
+        } else {
+            out.lead = cycles_xy[op2];
+            out.len = 1 + base_length(op2) + uses_index(op2);
+            out.last = base_last(op2);
+        }
+    }
+    return out.len <= room;
+}
+
+// Counter opcode if code is one of the delay loops the executor can
+// fast-forward, jumping back to code[0]; 0 if it isn't
+static uint8_t loop_counter(const uint8_t *code, unsigned len) {
+    uint8_t op = code[0];
+    if (len == 2 && op == 0x10 && code[1] == 0xFE)                  // djnz $
+        return op;
+    if (len == 3 && (op & 0xC7) == 0x05 && op != 0x35               // dec r
+        && code[1] == 0x20 && code[2] == 0xFD)                      // jr nz,$-1
+        return op;
+    if (len == 5 && (op & 0xCF) == 0x0B && op != 0x3B               // dec rr
+        && code[3] == 0x20 && code[4] == 0xFB) {                    // jr nz,$-3
+        // ld a,hi / or lo, or the other way round
+        uint8_t hi = 0x78 + (op >> 3 & 6), lo = hi + 1;
+        return (code[1] == hi && code[2] == (0xB0 | (lo & 7)))
+            || (code[1] == lo && code[2] == (0xB0 | (hi & 7))) ? op : 0;
+    }
+    return 0;
+}
+
+// Unprefixed opcodes a spin-wait may run: loads into registers, ALU ops,
+// in a,(n) and flag twiddles. Nothing that writes memory, a port or sp.
+static bool spin_op(uint8_t op) {
+    switch (op) {
+        case 0x00: case 0x0A: case 0x1A: case 0x2A: case 0x3A:     // nop, ld a,(bc) ... ld a,(nn)
+        case 0x2F: case 0x37: case 0x3F: case 0xDB:                 // cpl, scf, ccf, in a,(n)
+            return true;
+    }
+    return ((op & 0xC7) == 0x06 && op != 0x36)                  // ld r,n
+        || (op >= 0x40 && op < 0x80 && (op < 0x70 || op > 0x77))   // ld r,r' / ld r,(hl)
+        || (op >= 0x80 && op < 0xC0)                            // alu a,r
+        || (op & 0xC7) == 0xC6;                                 // alu a,n
+}
+
+// True if code (len bytes from pc) is a spin-wait: reads and tests only,
+// then jr or jp (either may be conditional) back to pc
+static bool spin_wait(const uint8_t *code, unsigned len, uint16_t pc) {
+    unsigned at = 0;
+    for (;;) {
+        uint8_t op = code[at];
+        unsigned n = base_length(op);
+        bool ok = spin_op(op);
+        if (op == 0xCB) {                                           // bit b,r / bit b,(hl)
+            n = 2;
+            ok = (code[at + 1] & 0xC0) == 0x40;
+        } else if (op == 0xED) {                                    // in r,(c)
+            n = 2;
+            ok = (code[at + 1] & 0xC7) == 0x40;
+        } else if (op == 0xDD || op == 0xFD) {
+            uint8_t op2 = code[at + 1];
+            n = op2 == 0xCB ? 4 : 3;
+            ok = op2 == 0xCB ? (code[at + 3] & 0xC0) == 0x40        // bit b,(ix+d)
+               : ((op2 & 0xC7) == 0x46 && op2 != 0x76)              // ld r,(ix+d)
+                 || (op2 & 0xC7) == 0x86;                           // alu a,(ix+d)
+        }
+        if (at + n == len)
+            break;
+        if (!ok || at + n > len)
+            return false;
+        at += n;
+    }
+    uint8_t op = code[at];
+    if (op == 0x18 || op == 0x20 || op == 0x28 || op == 0x30 || op == 0x38)   // jr (cc)
+        return at + 2 == len && (uint16_t)(pc + len + (int8_t)code[at + 1]) == pc;
+    if (op == 0xC3 || (op & 0xC7) == 0xC2)                                    // jp (cc)
+        return at + 3 == len && (code[at + 1] | code[at + 2] << 8) == pc;
+    return false;
+}
+
+static void set_code(TranslationCache *tc, unsigned page, unsigned at, unsigned len) {
+    for (unsigned i = at; i < at + len; i++)
+        tc->code[page][i / 64] |= 1ull << (i % 64);
+}
+
+// True if another page can write the host memory behind page p's reads,
+// which would change code without the write landing on p
+static bool aliased(const MemoryMap *bus, unsigned p) {
+    uintptr_t host = bus->read[p] + ((uintptr_t)p << PAGE_SHIFT);
+    for (unsigned q = 0; q < PAGE_COUNT; q++) {
+        uintptr_t entry = bus->write[q] ? bus->write[q] : bus->parked[q];
+        if (q == p || !entry)
+            continue;
+        uintptr_t other = entry + ((uintptr_t)q << PAGE_SHIFT);
+        if (other < host + PAGE_SIZE && host < other + PAGE_SIZE)
+            return true;
+    }
+    return false;
+}
+
+static Block* remember(TranslationCache *tc, uint16_t pc, Block *b) {
+    tc->map[pc] = b;
+    tc->mapped |= 1ull << (pc >> PAGE_SHIFT);
+    return b;
+}
+
+// Drop every block in page p. Uops of a block that's running are pointed at
+// the bail handler, so the executor leaves it before the next instruction.
+static void drop_page(TranslationCache *tc, unsigned p) {
+    for (Block *b = tc->pages[p]; b; b = b->page_next) {
+        b->start = 0x10000;
+        b->exits[0] = b->exits[1] = &tc->none;
+        for (Uop *u = b->uops; ; u++) {
+            u->handler = tc->handlers.bail;
+            if (!u->m1)
+                break;
+        }
+    }
+    memset(&tc->map[p << PAGE_SHIFT], 0, PAGE_SIZE * sizeof(Block*));
+    memset(tc->code[p], 0, sizeof(tc->code[p]));
+    tc->pages[p] = nullptr;
+    tc->dropped++;
+    bus_unwatch(tc->bus, p, WATCH_CODE);
+}
+
+// Bus hook for writes to a WATCH_CODE page. Data sharing a page with code
+// costs a trap per write but leaves the blocks alone.
+static void code_write(void *ctx, uint16_t addr) {
+    TranslationCache *tc = (TranslationCache*)ctx;
+    unsigned p = addr >> PAGE_SHIFT;
+    unsigned at = addr & PAGE_MASK;
+    if (tc->code[p][at / 64] >> (at % 64) & 1) {
+        drop_page(tc, p);
+        if (tc->rewrites[p] < REWRITE_LIMIT)
+            tc->rewrites[p]++;
+    }
+}
+
+void tc_drop(TranslationCache *tc, uint16_t addr) {
+    drop_page(tc, addr >> PAGE_SHIFT);
+}
+
+TranslationCache* tc_create(State *state) {
+    TranslationCache *tc = (TranslationCache*)calloc(1, sizeof(TranslationCache));
+    if (!tc)
+        return nullptr;
+    tc->arena = (uint8_t*)malloc(ARENA_SIZE);
+    if (!tc->arena) {
+        free(tc);
+        return nullptr;
+    }
+    tc_attach(tc, state);
+    return tc;
+}
+
+void tc_attach(TranslationCache *tc, State *state) {
+    tc->bus = &state->bus;
+    state->bus.code_write = code_write;
+    state->bus.code_ctx = tc;
+    tc->interpret = 0;
+    tc_flush(tc, &state->bus);
+}
+
+void tc_destroy(TranslationCache *tc) {
+    if (!tc)
+        return;
+    jit_destroy(tc->jit);
+    free(tc->arena);
+    free(tc);
+}
+
+void tc_flush(TranslationCache *tc, MemoryMap *bus) {
+    for (unsigned p = 0; p < PAGE_COUNT; p++) {
+        if (tc->mapped >> p & 1)
+            memset(&tc->map[p << PAGE_SHIFT], 0, PAGE_SIZE * sizeof(Block*));
+        bus_unwatch(bus, p, WATCH_CODE);
+    }
+    memset(tc->pages, 0, sizeof(tc->pages));
+    memset(tc->code, 0, sizeof(tc->code));
+    memset(tc->rewrites, 0, sizeof(tc->rewrites));
+    tc->mapped = 0;
+    tc->used = 0;
+    tc->none.start = 0x10000;       // So no exit lookup matches it
+    tc->none.exits[0] = tc->none.exits[1] = &tc->none;
+    tc->epoch = bus->epoch;
+    tc->flushes++;
+    if (tc->jit)
+        jit_flush(tc->jit);
+}
+
+Block* tc_translate(TranslationCache *tc, State *state, uint16_t pc) {
+    MemoryMap *bus = &state->bus;
+    unsigned p = pc >> PAGE_SHIFT;
+    const uint8_t *code = bus_read_ptr(bus, pc);
+    const Debugger *debug = state->debug;
+    if (!code || tc->rewrites[p] >= REWRITE_LIMIT || aliased(bus, p)
+        || (debug && debug_breaks(debug, pc)))
+        return remember(tc, pc, &tc->none);
+
+    if (ARENA_SIZE - tc->used < MAX_BLOCK)
+        tc_flush(tc, bus);
+    Block *b = (Block*)(tc->arena + tc->used);
+    b->uops = (Uop*)(b + 1);
+    b->count = 0;
+    b->m1 = 0;
+    b->cycles = 0;
+    b->lead = 0;
+    b->hits = 0;
+    b->native = nullptr;
+    b->exits[0] = b->exits[1] = &tc->none;
+
+    // A device sees state->cycles when an access reaches it, and a whole
+    // block is charged on entry, so the block ends at an instruction that
+    // could reach one. Remapping flushes the cache, so the MMIO answer holds.
+    bool ports = state->ports != nullptr;
+    bool mmio = devices_mapped(bus);
+    unsigned at = pc & PAGE_MASK;
+    unsigned off = 0;
+    unsigned last_lead = 0;
+    Insn insn;
+    while (b->count < BLOCK_MAX_UOPS && at + off < PAGE_SIZE
+           && !(debug && off && debug_breaks(debug, pc + off))
+           && decode(tc->handlers, code + off, PAGE_SIZE - at - off, insn)) {
+        b->lead += insn.lead;
+        last_lead = insn.lead;
+        insn.uop.pc = pc + off + insn.uop.skip;
+        b->uops[b->count++] = insn.uop;
+        b->m1 += insn.uop.m1;
+        b->cycles += insn.uop.cycles;
+        set_code(tc, p, at + off, insn.len);
+        if (insn.last || (ports && port_access(code + off)) || (mmio && data_access(code + off))) {
+            off += insn.len;
+            break;
+        }
+        off += insn.len;
+    }
+    if (!b->count)
+        return remember(tc, pc, &tc->none);
+    b->lead -= last_lead;
+    b->uops[b->count] = { tc->handlers.end, 0, 0, 0, 0, 0 };
+    unsigned uops = b->count + 1;
+    if (uint8_t counter = loop_counter(code, off)) {
+        // The loop uop goes first; its m1 only keeps it inside the block
+        memmove(b->uops + 1, b->uops, uops * sizeof(Uop));
+        uint8_t branch = counter == 0x10 ? 0x10 : 0x20;
+        b->uops[0] = { tc->handlers.loop, counter, 0, cycles_op_taken[branch], 1, 0 };
+        uops++;
+    } else if (spin_wait(code, off, pc)) {
+        memmove(b->uops + 1, b->uops, uops * sizeof(Uop));
+        b->uops[0] = { tc->handlers.idle, 0, 0, 0, 1, 0 };
+        uops++;
+    }
+
+    b->start = pc;
+    b->page_next = tc->pages[p];
+    tc->pages[p] = b;
+    tc->used += sizeof(Block) + uops * sizeof(Uop);
+    tc->translated++;
+    bus_watch(bus, p, WATCH_CODE);
+    return remember(tc, pc, b);
+}
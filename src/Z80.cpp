@@ -0,0 +1,2381 @@
+#include "Z80.hpp"
+#include "Debug.hpp"
+#include "Events.hpp"
+#include "Jit.hpp"
+#include "Ports.hpp"
+#include "Profile.hpp"
+#include "Timing.hpp"
+#include "Trace.hpp"
+#include "Translate.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+
+// Dispatch strategy. GCC and Clang support labels-as-values, so every handler
+// can jump straight through the opcode table to the next handler (direct
+// threading, one indirect branch per handler). Other compilers get the same
+// handler bodies laid out as cases of a switch.
+#if defined(__GNUC__) && !defined(ZILOG_NO_THREADED_DISPATCH)
+#define ZILOG_THREADED 1
+#else
+#define ZILOG_THREADED 0
+#endif
+
+// Z80 opcodes
+// Load Group
+static inline uint16_t imm16(State *state) {
+    uint16_t lo = bus_read(&state->bus, state->pc++);
+    uint16_t hi = bus_read(&state->bus, state->pc++);
+    return (hi << 8) | lo;
+}
+
+static inline void push16(State *state, uint16_t value) {
+    bus_write(&state->bus, --state->sp, value >> 8);
+    bus_write(&state->bus, --state->sp, value & 0xff);
+}
+
+static inline uint16_t pop16(State *state) {
+    uint16_t lo = bus_read(&state->bus, state->sp++);
+    uint16_t hi = bus_read(&state->bus, state->sp++);
+    return (hi << 8) | lo;
+}
+
+// Exchange, Block Transfer, and Search Group
+static inline void ex(uint16_t &r1, uint16_t &r2) {
+    uint16_t t = r1;
+    r1 = r2;
+    r2 = t;
+}
+
+static inline void ex_sp(State *state, uint16_t &r) {
+    uint16_t t = bus_read(&state->bus, state->sp) | (bus_read(&state->bus, state->sp + 1) << 8);
+    bus_write(&state->bus, state->sp, r & 0xff);
+    bus_write(&state->bus, state->sp + 1, r >> 8);
+    r = t;
+}
+
+// The alternate sets are just the other bank; swapping is an index flip.
+// A deferred f belongs to the bank being swapped out, so it's settled first.
+static inline void ex_af(State *state) { flags_settle(state); state->af_bank ^= 1; }
+static inline void exx(State *state) { state->gp_bank ^= 1; }
+
+// General-Purpose Arithmetic and CPU Control Groups
+static inline void daa(State *state) {
+    uint8_t a = reg_a(state);
+    uint8_t carry = reg_f(state) & FLAG_C;
+    uint8_t corr = 0;
+    if ((reg_f(state) & FLAG_H) || (a & 0x0f) > 9)
+        corr |= 0x06;
+    if (carry || a > 0x99) {
+        corr |= 0x60;
+        carry = FLAG_C;
+    }
+    uint8_t r = (reg_f(state) & FLAG_N) ? a - corr : a + corr;
+    reg_f(state) = sz53p[r] | ((a ^ r) & FLAG_H) | (reg_f(state) & FLAG_N) | carry;
+    reg_a(state) = r;
+}
+
+static inline void cpl(State *state) {
+    reg_a(state) = ~reg_a(state);
+    reg_f(state) = (reg_f(state) & (FLAG_S | FLAG_Z | FLAG_PV | FLAG_C)) | FLAG_H | FLAG_N | (reg_a(state) & (FLAG_X | FLAG_Y));
+}
+
+static inline void ccf(State *state) {
+    reg_f(state) = ((reg_f(state) & (FLAG_S | FLAG_Z | FLAG_PV | FLAG_C)) | ((reg_f(state) & FLAG_C) << 4)
+                | (reg_a(state) & (FLAG_X | FLAG_Y))) ^ FLAG_C;
+}
+
+static inline void scf(State *state) {
+    reg_f(state) = (reg_f(state) & (FLAG_S | FLAG_Z | FLAG_PV)) | FLAG_C | (reg_a(state) & (FLAG_X | FLAG_Y));
+}
+
+// Arithmetical and Logical
+// Each helper returns the result and records how F follows from it (see
+// LazyFlags); reg_f and the condition tests below work F out when needed
+static inline void defer_flags(State *state, uint8_t op, uint8_t r, uint8_t r1, uint8_t r2,
+                               uint8_t c, uint8_t carry_out) {
+    state->lazy = LazyFlags{ op, r, r1, r2, c, carry_out };
+#ifdef ZILOG_NO_LAZY_FLAGS
+    flags_settle(state);
+#endif
+}
+
+// For ops that build all of F themselves; anything deferred is dropped
+static inline void set_flags(State *state, uint8_t f) {
+    state->lazy.op = FLAGS_READY;
+    state->af[state->af_bank].b.l = f;
+}
+
+// Carry in for adc/sbc and the carry inc8/dec8 keep
+static inline uint8_t carry(State *state) {
+    if (state->lazy.op != FLAGS_READY)
+        return state->lazy.carry;
+    return state->af[state->af_bank].b.l & FLAG_C;
+}
+
+static inline uint8_t add8(State *state, uint8_t r1, uint8_t r2) {
+    unsigned r = r1 + r2;
+    defer_flags(state, FLAGS_ADD, r, r1, r2, 0, r >> 8);
+    return r;
+}
+
+static inline uint8_t adc(State *state, uint8_t r1, uint8_t r2) {
+    uint8_t c = carry(state);
+    unsigned r = r1 + r2 + c;
+    defer_flags(state, FLAGS_ADD, r, r1, r2, c, r >> 8);
+    return r;
+}
+
+static inline uint8_t sub(State *state, uint8_t r1, uint8_t r2) {
+    unsigned r = r1 - r2;
+    defer_flags(state, FLAGS_SUB, r, r1, r2, 0, (r >> 8) & 1);
+    return r;
+}
+
+static inline uint8_t sbc(State *state, uint8_t r1, uint8_t r2) {
+    uint8_t c = carry(state);
+    unsigned r = r1 - r2 - c;
+    defer_flags(state, FLAGS_SUB, r, r1, r2, c, (r >> 8) & 1);
+    return r;
+}
+
+static inline uint8_t _and(State *state, uint8_t r1, uint8_t r2) {
+    uint8_t r = r1 & r2;
+    defer_flags(state, FLAGS_AND, r, 0, 0, 0, 0);
+    return r;
+}
+
+static inline uint8_t _xor(State *state, uint8_t r1, uint8_t r2) {
+    uint8_t r = r1 ^ r2;
+    defer_flags(state, FLAGS_LOGIC, r, 0, 0, 0, 0);
+    return r;
+}
+
+static inline uint8_t _or(State *state, uint8_t r1, uint8_t r2) {
+    uint8_t r = r1 | r2;
+    defer_flags(state, FLAGS_LOGIC, r, 0, 0, 0, 0);
+    return r;
+}
+
+// Like sub, but X and Y come from the operand rather than the result
+static inline void cp(State *state, uint8_t r1, uint8_t r2) {
+    unsigned r = r1 - r2;
+    defer_flags(state, FLAGS_CP, r, r1, r2, 0, (r >> 8) & 1);
+}
+
+static inline uint8_t inc8(State *state, uint8_t r1) {
+    uint8_t r = r1 + 1;
+    uint8_t c = carry(state);
+    defer_flags(state, FLAGS_INC, r, 0, 0, c, c);
+    return r;
+}
+
+static inline uint8_t dec8(State *state, uint8_t r1) {
+    uint8_t r = r1 - 1;
+    uint8_t c = carry(state);
+    defer_flags(state, FLAGS_DEC, r, 0, 0, c, c);
+    return r;
+}
+
+// S, Z and P/V survive; H and C come from bits 11 and 15
+static inline uint16_t add16(State *state, uint16_t r1, uint16_t r2) {
+    uint32_t r = r1 + r2;
+    reg_f(state) = (reg_f(state) & (FLAG_S | FLAG_Z | FLAG_PV)) | (((r1 ^ r2 ^ r) >> 8) & FLAG_H)
+               | ((r >> 8) & (FLAG_X | FLAG_Y)) | (r >> 16);
+    return r;
+}
+
+static inline uint16_t inc16(uint16_t r1) { return r1 += 1; }
+static inline uint16_t dec16(uint16_t r1) { return r1 -= 1; }
+
+// Rotate and Shift
+// The accumulator rotates only touch C, H and N (plus X/Y); S, Z and P/V survive
+static inline void rlca(State *state) {
+    reg_a(state) = (reg_a(state) << 1) | (reg_a(state) >> 7);
+    reg_f(state) = (reg_f(state) & (FLAG_S | FLAG_Z | FLAG_PV)) | (reg_a(state) & (FLAG_X | FLAG_Y | FLAG_C));
+}
+
+static inline void rrca(State *state) {
+    uint8_t c = reg_a(state) & 1;
+    reg_a(state) = (reg_a(state) >> 1) | (c << 7);
+    reg_f(state) = (reg_f(state) & (FLAG_S | FLAG_Z | FLAG_PV)) | (reg_a(state) & (FLAG_X | FLAG_Y)) | c;
+}
+
+static inline void rla(State *state) {
+    uint8_t c = reg_a(state) >> 7;
+    reg_a(state) = (reg_a(state) << 1) | (reg_f(state) & FLAG_C);
+    reg_f(state) = (reg_f(state) & (FLAG_S | FLAG_Z | FLAG_PV)) | (reg_a(state) & (FLAG_X | FLAG_Y)) | c;
+}
+
+static inline void rra(State *state) {
+    uint8_t c = reg_a(state) & 1;
+    reg_a(state) = (reg_a(state) >> 1) | ((reg_f(state) & FLAG_C) << 7);
+    reg_f(state) = (reg_f(state) & (FLAG_S | FLAG_Z | FLAG_PV)) | (reg_a(state) & (FLAG_X | FLAG_Y)) | c;
+}
+
+// CB group rotates and shifts: S, Z and P/V from the result, C from the bit shifted out
+static inline uint8_t rlc(State *state, uint8_t v) {
+    uint8_t r = (v << 1) | (v >> 7);
+    set_flags(state, sz53p[r] | (v >> 7));
+    return r;
+}
+
+static inline uint8_t rrc(State *state, uint8_t v) {
+    uint8_t r = (v >> 1) | (v << 7);
+    set_flags(state, sz53p[r] | (v & FLAG_C));
+    return r;
+}
+
+static inline uint8_t rl(State *state, uint8_t v) {
+    uint8_t r = (v << 1) | carry(state);
+    set_flags(state, sz53p[r] | (v >> 7));
+    return r;
+}
+
+static inline uint8_t rr(State *state, uint8_t v) {
+    uint8_t r = (v >> 1) | (carry(state) << 7);
+    set_flags(state, sz53p[r] | (v & FLAG_C));
+    return r;
+}
+
+static inline uint8_t sla(State *state, uint8_t v) {
+    uint8_t r = v << 1;
+    set_flags(state, sz53p[r] | (v >> 7));
+    return r;
+}
+
+static inline uint8_t sra(State *state, uint8_t v) {
+    uint8_t r = (v >> 1) | (v & 0x80);
+    set_flags(state, sz53p[r] | (v & FLAG_C));
+    return r;
+}
+
+// Undocumented: shifts a 1 into bit 0
+static inline uint8_t sll(State *state, uint8_t v) {
+    uint8_t r = (v << 1) | 1;
+    set_flags(state, sz53p[r] | (v >> 7));
+    return r;
+}
+
+static inline uint8_t srl(State *state, uint8_t v) {
+    uint8_t r = v >> 1;
+    set_flags(state, sz53p[r] | (v & FLAG_C));
+    return r;
+}
+
+// Bit Set, Reset, and Test Group
+// Z and P/V are set when the bit is clear, S only for a set bit 7
+static inline void bit(State *state, int n, uint8_t v) {
+    reg_f(state) = (reg_f(state) & FLAG_C) | FLAG_H | (sz53p[v & (1 << n)] & ~(FLAG_X | FLAG_Y))
+                   | (v & (FLAG_X | FLAG_Y));
+}
+
+// bit n,(ix+d) takes X and Y from the high byte of the effective address
+static inline void bit_mem(State *state, int n, uint8_t v, uint16_t addr) {
+    bit(state, n, v);
+    reg_f(state) = (reg_f(state) & ~(FLAG_X | FLAG_Y)) | ((addr >> 8) & (FLAG_X | FLAG_Y));
+}
+
+// 16-bit adc/sbc set every flag, unlike add16
+static inline uint16_t adc16(State *state, uint16_t r1, uint16_t r2) {
+    uint32_t r = r1 + r2 + (reg_f(state) & FLAG_C);
+    reg_f(state) = ((r >> 8) & (FLAG_S | FLAG_X | FLAG_Y)) | ((r & 0xffff) ? 0 : FLAG_Z)
+                   | (((r1 ^ r2 ^ r) >> 8) & FLAG_H) | ((~(r1 ^ r2) & (r1 ^ r) & 0x8000) >> 13)
+                   | (r >> 16);
+    return r;
+}
+
+static inline uint16_t sbc16(State *state, uint16_t r1, uint16_t r2) {
+    uint32_t r = r1 - r2 - (reg_f(state) & FLAG_C);
+    reg_f(state) = ((r >> 8) & (FLAG_S | FLAG_X | FLAG_Y)) | ((r & 0xffff) ? 0 : FLAG_Z)
+                   | (((r1 ^ r2 ^ r) >> 8) & FLAG_H) | (((r1 ^ r2) & (r1 ^ r) & 0x8000) >> 13)
+                   | ((r >> 16) & FLAG_C) | FLAG_N;
+    return r;
+}
+
+// Input and Output Group. Ports go to whatever devices are on state->ports;
+// without a port bus reads see a floating bus and writes go nowhere.
+static inline uint8_t port_in(State *state, uint16_t port) {
+    return state->ports ? port_read(state->ports, port) : 0xff;
+}
+
+static inline void port_out(State *state, uint16_t port, uint8_t value) {
+    if (state->ports)
+        port_write(state->ports, port, value);
+}
+
+// in r,(c) sets flags from the value read
+static inline uint8_t in_c(State *state) {
+    uint8_t v = port_in(state, reg_bc(state).w);
+    reg_f(state) = (reg_f(state) & FLAG_C) | sz53p[v];
+    return v;
+}
+
+// Register and memory shorthands for the opcode handlers
+#define A       reg_a(s)
+#define F       reg_f(s)
+#define B       reg_bc(s).b.h
+#define C       reg_bc(s).b.l
+#define D       reg_de(s).b.h
+#define E       reg_de(s).b.l
+#define H       reg_hl(s).b.h
+#define L       reg_hl(s).b.l
+#define AF      reg_af(s).w
+#define BC      reg_bc(s).w
+#define DE      reg_de(s).w
+#define HL      reg_hl(s).w
+#define SP      s->sp
+#define PC      s->pc
+#define XY      xy->w       // ix or iy, whichever prefix is being executed
+#define XYH     xy->b.h
+#define XYL     xy->b.l
+
+#define RD8(addr)       bus_read(&s->bus, (addr))
+#define WR8(addr, v)    bus_write(&s->bus, (addr), (v))
+#define IMM8()          RD8(PC++)
+#define IMM16()         imm16(s)
+#define IDX()           (uint16_t)(XY + (int8_t)IMM8())
+
+// S and Z follow a deferred result directly and C has a shortcut, so most
+// branches never build F; only P/V settles it
+#define DEFERRED        (s->lazy.op != FLAGS_READY)
+#define COND_NZ     (DEFERRED ? s->lazy.r != 0 : !(F & FLAG_Z))
+#define COND_Z      (DEFERRED ? s->lazy.r == 0 : (F & FLAG_Z))
+#define COND_NC     (!carry(s))
+#define COND_C      (carry(s))
+#define COND_PO     (!(F & FLAG_PV))
+#define COND_PE     (F & FLAG_PV)
+#define COND_P      (DEFERRED ? !(s->lazy.r & 0x80) : !(F & FLAG_S))
+#define COND_M      (DEFERRED ? (s->lazy.r & 0x80) : (F & FLAG_S))
+
+// A taken jr/call/ret costs more than a fall-through; TAKEN charges the
+// difference for the opcode being executed
+#define TAKEN()         (s->cycles += cycles_op_taken[op])
+#define JR_IF(cond)     { int8_t e = (int8_t)IMM8(); if (cond) { PC += e; TAKEN(); } }
+#define JP_IF(cond)     { uint16_t nn = IMM16(); if (cond) PC = nn; }
+#define CALL_IF(cond)   { uint16_t nn = IMM16(); if (cond) { push16(s, PC); PC = nn; TAKEN(); } }
+#define RET_IF(cond)    { if (cond) { PC = pop16(s); TAKEN(); } }
+#define RST(addr)       { push16(s, PC); PC = (addr); }
+
+// Counter of a delay loop the translator found, by the opcode that counts
+// it down: djnz, dec r or dec rr
+static inline uint8_t* loop_reg8(State *s, uint8_t op) {
+    switch (op) {
+        case 0x10: case 0x05: return &B;
+        case 0x0D: return &C;
+        case 0x15: return &D;
+        case 0x1D: return &E;
+        case 0x25: return &H;
+        case 0x2D: return &L;
+        default:   return &A;
+    }
+}
+
+static inline uint16_t* loop_reg16(State *s, uint8_t op) {
+    return op == 0x0B ? &BC : op == 0x1B ? &DE : &HL;
+}
+
+// Passes the loop makes before falling through; a zero counter wraps
+static inline uint32_t loop_passes(State *s, uint8_t op) {
+    if ((op & 0xCF) == 0x0B)
+        return *loop_reg16(s, op) ? *loop_reg16(s, op) : 0x10000;
+    return *loop_reg8(s, op) ? *loop_reg8(s, op) : 0x100;
+}
+
+// Leave the counter where the last pass starts. Nothing else survives a
+// pass: flags and a are overwritten by it.
+static inline void loop_last_pass(State *s, uint8_t op) {
+    if ((op & 0xCF) == 0x0B)
+        *loop_reg16(s, op) = 1;
+    else
+        *loop_reg8(s, op) = 1;
+}
+
+// Nibble rotates between a and (hl)
+static inline void rrd(State *s) {
+    uint8_t m = RD8(HL);
+    WR8(HL, (m >> 4) | (A << 4));
+    A = (A & 0xf0) | (m & 0x0f);
+    F = (F & FLAG_C) | sz53p[A];
+}
+
+static inline void rld(State *s) {
+    uint8_t m = RD8(HL);
+    WR8(HL, (m << 4) | (A & 0x0f));
+    A = (A & 0xf0) | (m >> 4);
+    F = (F & FLAG_C) | sz53p[A];
+}
+
+// Block transfer and search, one step. dir is 1 for the increment forms
+// (ldi/cpi/ini/outi) and -1 for the decrement forms; the repeating forms
+// step pc back over the instruction until the count runs out.
+static inline void ldi(State *s, int dir) {
+    uint8_t v = RD8(HL);
+    WR8(DE, v);
+    HL += dir;
+    DE += dir;
+    BC--;
+    uint8_t n = v + A;
+    F = (F & (FLAG_S | FLAG_Z | FLAG_C)) | (BC ? FLAG_PV : 0) | (n & FLAG_X) | ((n << 4) & FLAG_Y);
+}
+
+// Returns a - (hl) so cpir/cpdr can stop on a match
+static inline uint8_t cpi(State *s, int dir) {
+    uint8_t v = RD8(HL);
+    uint8_t r = A - v;
+    HL += dir;
+    BC--;
+    uint8_t f = (F & FLAG_C) | FLAG_N | (sz53[r] & ~(FLAG_X | FLAG_Y)) | ((A ^ v ^ r) & FLAG_H) | (BC ? FLAG_PV : 0);
+    uint8_t n = r - ((f & FLAG_H) ? 1 : 0);
+    F = f | (n & FLAG_X) | ((n << 4) & FLAG_Y);
+    return r;
+}
+
+// The block I/O flags depend on the byte moved plus c (ini) or l (outi)
+static inline void block_io_flags(State *s, uint8_t v, unsigned k) {
+    F = sz53[B] | ((v & 0x80) ? FLAG_N : 0) | (k > 0xff ? (FLAG_H | FLAG_C) : 0)
+        | (sz53p[(k & 7) ^ B] & FLAG_PV);
+}
+
+static inline void ini(State *s, int dir) {
+    uint8_t v = port_in(s, BC);
+    WR8(HL, v);
+    HL += dir;
+    B--;
+    block_io_flags(s, v, v + (uint8_t)(C + dir));
+}
+
+static inline void outi(State *s, int dir) {
+    uint8_t v = RD8(HL);
+    B--;
+    port_out(s, BC, v);
+    HL += dir;
+    block_io_flags(s, v, v + L);
+}
+
+// Repeating block instructions. Each iteration is architecturally a separate
+// instruction (pc steps back over ED xx), but only the last one's flags
+// survive, so the handlers below skip the first k-1 iterations in bulk and
+// run the last through the single-step helper above. spare is how many more
+// instructions the budget allows after this one; pass 0 to step one at a time.
+// Each returns the number of iterations it retired.
+static inline uint32_t block_span(uint32_t count, uint64_t spare) {
+    return spare < count - 1 ? (uint32_t)spare + 1 : count;
+}
+
+// Each iteration re-fetches ED xx, so a run that writes over its own opcode
+// (through any page that maps it) or remaps it has to end there and let
+// dispatch pick up the new bytes. BlockCode remembers where the opcode came
+// from; pc is already past it.
+struct BlockCode {
+    const uint8_t   *at[2];     // Host bytes of ED and xx; null if trapped
+    uint8_t         byte[2];
+};
+
+static inline BlockCode block_code(State *s) {
+    BlockCode code;
+    for (int i = 0; i < 2; i++) {
+        code.at[i] = bus_read_ptr(&s->bus, PC - 2 + i);
+        code.byte[i] = code.at[i] ? *code.at[i] : 0;
+    }
+    return code;
+}
+
+// False once the opcode has been overwritten or remapped, or if it was
+// fetched from a trapped page to begin with
+static inline bool block_code_intact(State *s, const BlockCode &code) {
+    for (int i = 0; i < 2; i++) {
+        if (!code.at[i] || bus_read_ptr(&s->bus, PC - 2 + i) != code.at[i] || *code.at[i] != code.byte[i])
+            return false;
+    }
+    return true;
+}
+
+// How many of the len bytes written from to in direction dir come before
+// one that lands on the opcode; len if none does
+static inline uint32_t block_code_clip(const BlockCode &code, const uint8_t *to, uint32_t len, int dir) {
+    for (int i = 0; i < 2; i++) {
+        uintptr_t hit = dir > 0 ? (uintptr_t)code.at[i] - (uintptr_t)to : (uintptr_t)to - (uintptr_t)code.at[i];
+        if (code.at[i] && hit < len)
+            len = hit;
+    }
+    return len;
+}
+
+// Copy n bytes upward from src to dst the way a byte-at-a-time LDIR would.
+// When dst sits inside the source run the early bytes get re-read, which
+// replicates the first dst-src bytes as a repeating pattern.
+static void copy_up(uint8_t *dst, const uint8_t *src, uint32_t n) {
+    uintptr_t d = (uintptr_t)dst - (uintptr_t)src;
+    if ((uintptr_t)dst <= (uintptr_t)src || d >= n) {
+        memmove(dst, src, n);
+        return;
+    }
+    for (uint32_t done = 0; done < n; ) {
+        uint32_t len = d + done < n - done ? d + done : n - done;
+        memcpy(dst + done, src, len);
+        done += len;
+    }
+}
+
+// The LDDR mirror image: dst and src point at the highest bytes of the runs
+static void copy_down(uint8_t *dst, const uint8_t *src, uint32_t n) {
+    uintptr_t d = (uintptr_t)src - (uintptr_t)dst;
+    if ((uintptr_t)src <= (uintptr_t)dst || d >= n) {
+        memmove(dst - n + 1, src - n + 1, n);
+        return;
+    }
+    for (uint32_t done = 0; done < n; ) {
+        uint32_t len = d + done < n - done ? d + done : n - done;
+        memcpy(dst - done - len + 1, src - len + 1, len);
+        done += len;
+    }
+}
+
+static uint32_t ldir_block(State *s, int dir, uint64_t spare) {
+    uint32_t k = block_span(BC ? BC : 0x10000, spare);
+    BlockCode code = block_code(s);
+    // Copy a page at a time through the host pointers. A trapped page on
+    // either side, or a write onto the opcode, ends the bulk part there;
+    // that step goes through ldi.
+    uint32_t n = k - 1;
+    while (n) {
+        const uint8_t *from = bus_read_ptr(&s->bus, HL);
+        uint8_t *to = bus_write_ptr(&s->bus, DE);
+        if (!from || !to)
+            break;
+        // Bytes left in each page in the direction of travel
+        uint32_t from_room = dir > 0 ? PAGE_SIZE - (HL & PAGE_MASK) : (HL & PAGE_MASK) + 1;
+        uint32_t to_room = dir > 0 ? PAGE_SIZE - (DE & PAGE_MASK) : (DE & PAGE_MASK) + 1;
+        uint32_t len = n;
+        if (len > from_room) len = from_room;
+        if (len > to_room) len = to_room;
+        uint32_t safe = block_code_clip(code, to, len, dir);
+        if (dir > 0)
+            copy_up(to, from, safe);
+        else
+            copy_down(to, from, safe);
+        HL += dir * (int)safe;
+        DE += dir * (int)safe;
+        BC -= safe;
+        n -= safe;
+        if (safe < len)
+            break;
+    }
+    ldi(s, dir);
+    return k - n;
+}
+
+static uint32_t cpir_block(State *s, int dir, uint64_t spare) {
+    uint32_t k = block_span(BC ? BC : 0x10000, spare);
+    // Find the first match among the first k-1 bytes; the compare that hits
+    // it (or the kth compare if none does) runs through cpi for the flags.
+    // A trapped page stops the scan the same way a match does.
+    uint32_t skip = 0;
+    while (skip < k - 1) {
+        uint16_t at = HL + dir * (int)skip;
+        const uint8_t *p = bus_read_ptr(&s->bus, at);
+        if (!p)
+            break;
+        uint32_t room = dir > 0 ? PAGE_SIZE - (at & PAGE_MASK) : (at & PAGE_MASK) + 1;
+        uint32_t len = k - 1 - skip;
+        if (len > room) len = room;
+        if (dir > 0) {
+            const uint8_t *hit = (const uint8_t*)memchr(p, A, len);
+            if (hit) { skip += hit - p; break; }
+            skip += len;
+        } else {
+            uint32_t i = 0;
+            while (i < len && p[-(int)i] != A) i++;
+            skip += i;
+            if (i < len) break;
+        }
+    }
+    HL += dir * (int)skip;
+    BC -= skip;
+    cpi(s, dir);
+    return skip + 1;
+}
+
+// Every port access is a side effect, so these still call ini/outi per byte
+// and only save the trip back through dispatch. A port or MMIO write can
+// bank-switch, so the opcode is rechecked after every step; a watchpoint
+// hit ends the run there too.
+static uint32_t inir_block(State *s, int dir, uint64_t spare) {
+    uint32_t k = block_span(B ? B : 0x100, spare);
+    BlockCode code = block_code(s);
+    uint32_t n = 0;
+    do {
+        ini(s, dir);
+        n++;
+    } while (n < k && block_code_intact(s, code) && !debug_hit(s));
+    return n;
+}
+
+static uint32_t otir_block(State *s, int dir, uint64_t spare) {
+    uint32_t k = block_span(B ? B : 0x100, spare);
+    BlockCode code = block_code(s);
+    uint32_t n = 0;
+    do {
+        outi(s, dir);
+        n++;
+    } while (n < k && block_code_intact(s, code) && !debug_hit(s));
+    return n;
+}
+
+// How many more iterations of block instruction op may run before either
+// budget check in FETCH would have stopped a stepping loop. The current
+// iteration has been charged cycles_ed[op]; every extra one loops first.
+static inline uint64_t block_spare(const State *s, uint64_t limit, uint64_t cycle_limit, uint8_t op) {
+    uint64_t spare = limit - s->instructions;
+    uint64_t start = s->cycles - cycles_ed[op];
+    if (cycle_limit <= start + 1)
+        return 0;
+    uint64_t by_cycles = (cycle_limit - start - 1) / (cycles_ed[op] + cycles_ed_taken[op]);
+    return by_cycles < spare ? by_cycles : spare;
+}
+
+#if ZILOG_THREADED
+// Where the last pass of a spin-wait block started (see block_idle)
+struct IdleMark {
+    const Block *block;
+    uint64_t    translated;     // tc->translated then; anything new may reuse the block
+    uint64_t    instructions;
+    uint64_t    cycles;
+    uint8_t     r;
+    uint16_t    regs[7];
+};
+
+// Everything a spin-wait pass can change but r and the counters
+static inline void idle_regs(State *s, uint16_t *regs) {
+    regs[0] = reg_af(s).w;
+    regs[1] = BC;
+    regs[2] = DE;
+    regs[3] = HL;
+    regs[4] = s->ix.w;
+    regs[5] = s->iy.w;
+    regs[6] = SP;
+}
+
+// A spin-wait only repeats itself if what it reads can't change under it:
+// RAM, ROM, open bus and unread ports can't, an MMIO page or port with a
+// read handler may
+static bool idle_reads_fixed(const State *s) {
+    if (s->ports && s->ports->readers)
+        return false;
+    for (unsigned p = 0; p < PAGE_COUNT; p++)
+        if (!s->bus.read[p] && s->bus.mmio[p] && s->bus.mmio[p]->read)
+            return false;
+    return true;
+}
+#endif
+
+// NOP M1 cycles a halted CPU runs before either budget check would stop it
+static inline uint64_t halt_nops(const State *s, uint64_t limit) {
+    uint64_t by_count = limit - s->instructions;
+    uint64_t wait = s->stop_cycle > s->cycles ? s->stop_cycle - s->cycles : 0;
+    uint64_t by_cycles = wait / 4 + (wait % 4 != 0);
+    return by_cycles < by_count ? by_cycles : by_count;
+}
+
+// Interrupts. Nothing here runs per instruction: whatever can make an
+// interrupt takeable lowers stop_cycle, and the core takes it when FETCH
+// finds cycles has reached that.
+static inline bool int_ready(const State *s) {
+    return s->nmi_pending || (s->int_line && s->iff1 && s->instructions > s->ei_after);
+}
+
+// Stop at the next instruction boundary if an interrupt may be takeable.
+// Straight after ei that's one instruction later: stopping at cycles + 1
+// lets exactly one more start.
+static inline void int_recheck(State *s) {
+    if (!s->nmi_pending && !(s->int_line && s->iff1))
+        return;
+    uint64_t at = s->nmi_pending || s->instructions > s->ei_after ? s->cycles : s->cycles + 1;
+    if (at < s->stop_cycle)
+        s->stop_cycle = at;
+}
+
+void z80_int(State *state, uint8_t source, bool asserted) {
+    state->int_line = asserted ? state->int_line | source : state->int_line & ~source;
+    int_recheck(state);
+}
+
+void z80_nmi(State *state) {
+    state->nmi_pending = 1;
+    int_recheck(state);
+}
+
+// Earliest of the cycle budget, the next event and a takeable interrupt
+static inline void plan_stop(State *s, uint64_t cycle_limit) {
+    uint64_t next = events_next(s->events);
+    s->stop_cycle = next < cycle_limit ? next : cycle_limit;
+    int_recheck(s);
+}
+
+// A halted CPU keeps going only while something could still wake it
+static inline bool halt_waits(const State *s) {
+    return s->nmi_pending || (s->int_line && s->iff1) || events_next(s->events) != UINT64_MAX;
+}
+
+// Acknowledge: push pc and go to the handler. NMI goes to 0066h keeping
+// iff2; IM 0 runs the rst the device put on the bus (any other byte is
+// taken as rst 38h, what a floating bus gives), IM 1 is rst 38h and IM 2
+// calls through the table entry at i:int_data. Returns the T-states taken.
+static uint32_t take_interrupt(State *s) {
+    uint16_t target = 0x38;
+    uint32_t cycles = 13;
+    if (s->nmi_pending) {
+        s->nmi_pending = 0;
+        s->iff1 = 0;
+        target = 0x66;
+        cycles = 11;
+    } else {
+        s->iff1 = s->iff2 = 0;
+        if (s->im == 2) {
+            uint16_t vector = s->i << 8 | s->int_data;
+            target = bus_read(&s->bus, vector) | bus_read(&s->bus, (uint16_t)(vector + 1)) << 8;
+            cycles = 19;
+        } else if (s->im == 0 && (s->int_data & 0xC7) == 0xC7) {
+            target = s->int_data & 0x38;
+        }
+    }
+    s->halted = 0;
+    s->r = (s->r & 0x80) | ((s->r + 1) & 0x7f);
+    push16(s, s->pc);
+    s->pc = target;
+    s->cycles += cycles;
+    return cycles;
+}
+
+// FETCH stopped at stop_cycle short of the budget: fire what's due, take an
+// interrupt if one is, and work out the next stop. The profiler sees an
+// interrupt as a call to its handler.
+static void serve_events(State *s, uint64_t cycle_limit) {
+    events_fire(s);
+    if (int_ready(s)) {
+        Profile *p = s->profile;
+        if (p && p->pending)
+            profile_retire(p, s);
+        uint32_t cycles = take_interrupt(s);
+        if (p)
+            profile_interrupt(p, s, cycles);
+    }
+    plan_stop(s, cycle_limit);
+}
+
+// Handler labels. Each prefix has its own 256-entry table; in the switch
+// build the prefix tables become nested switches.
+#if ZILOG_THREADED
+#define OP(n)               op_##n:
+#define CB(n)               cb_##n:
+#define ED(n)               ed_##n:
+#define DD(n)               dd_##n:
+#define DDCB(n)             ddcb_##n:
+#define NEXT                DISPATCH()
+#define BEGIN_PREFIX(table) goto *table[op];
+#define END_PREFIX
+#define ED_DEFAULT          ed_nop:
+#define DD_DEFAULT
+#else
+#define OP(n)               case n:
+#define CB(n)               case n:
+#define ED(n)               case n:
+#define DD(n)               case n:
+#define DDCB(n)             case n:
+#define NEXT                continue
+#define BEGIN_PREFIX(table) switch (op) {
+#define END_PREFIX          }
+#define ED_DEFAULT          default:
+#define DD_DEFAULT          default: goto base_op;
+#endif
+
+// Fetch the next opcode unless it's time to stop: stop_cycle covers the cycle
+// budget, events and interrupts, so this is the only check. Kept as a macro so the
+// threaded build gets its own copy (and its own indirect branch) per handler.
+#define FETCH()                                                 \
+    if (s->instructions >= limit || s->cycles >= s->stop_cycle) \
+        goto service;                                           \
+    if ((Blocks || Trace) && AT_BREAKPOINT())                   \
+        STOP(STOP_BREAKPOINT);                                  \
+    if (Trace && s->trace)                                      \
+        fprintf(trace_file, "%04x %x \n", PC, RD8(PC));         \
+    if (Trace && s->tracer)                                     \
+        trace_record(s->tracer, s);                             \
+    if (Trace && s->profile)                                    \
+        profile_step(s->profile, s);                            \
+    s->r = (s->r & 0x80) | ((s->r + 1) & 0x7f);                 \
+    s->instructions++;                                          \
+    op = IMM8();                                                \
+    s->cycles += cycles_op[op];
+
+// The block executor runs the next micro-op instead: pc is set past the
+// opcode bytes it stands for and its handler takes over from there. Storing
+// pc, rather than adding to it, keeps one uop from waiting on the last one's
+// write. The end marker and fast-forward uops (skip 0) leave pc alone.
+#define UOP()       { if (u->skip) PC = u->pc; op = u->op; goto *(u++)->handler; }
+
+#define DISPATCH()  do { if (Blocks) UOP(); FETCH(); goto *base_table[op]; } while (0)
+
+// The opcode after a prefix is another M1 cycle, so it bumps r too
+#define PREFIX_FETCH()                                          \
+    s->r = (s->r & 0x80) | ((s->r + 1) & 0x7f);                 \
+    op = IMM8();
+
+#define STOP(why)       { reason = (why); goto done; }
+
+// A breakpoint stops a run before its instruction, unless the run started
+// there. The block executor only gets to FETCH for pcs it couldn't put in
+// a block, which breakpoints are.
+#define AT_BREAKPOINT() \
+    (s->debug && debug_breaks(s->debug, PC) && (PC != resume_pc || s->instructions != resume_at))
+
+// Iterations both budgets still allow after the current one. Tracing records
+// every iteration of a block repeat, so it gets none.
+#define SPARE           (Trace ? 0 : block_spare(s, limit, s->stop_cycle, op))
+
+// Account for the extra iterations a block handler ran: each one is another
+// ED-prefixed fetch, so two r increments apiece, and each looped
+#define BLOCK_RETIRE(k)                                                 \
+    {                                                                   \
+        uint32_t extra = (k) - 1;                                       \
+        s->instructions += extra;                                       \
+        s->cycles += (uint64_t)extra * (cycles_ed[op] + cycles_ed_taken[op]); \
+        s->r = (s->r & 0x80) | ((s->r + 2 * extra) & 0x7f);             \
+    }
+
+// A block instruction that isn't finished steps back to run again
+#define REPEAT_IF(cond) { if (cond) { PC -= 2; s->cycles += cycles_ed_taken[op]; } }
+
+// Blocks selects the translation cache executor (threaded build only);
+// without it every instruction is fetched and decoded here. Trace adds the
+// text and binary traces, the profiler and breakpoints to every fetch; the
+// plain loop has no instrumentation at all.
+template <bool Blocks, bool Trace>
+static StopReason execute(State *s, uint64_t budget, uint64_t cycle_budget) {
+    uint64_t limit = s->instructions + budget;
+    if (limit < s->instructions)
+        limit = UINT64_MAX;
+    uint64_t cycle_limit = s->cycles + cycle_budget;
+    if (cycle_limit < s->cycles)
+        cycle_limit = UINT64_MAX;
+    StopReason reason = STOP_BUDGET;
+    uint8_t op;
+    Pair *xy = &s->ix;      // Register a DD or FD prefix selected
+    uint16_t addr = 0;      // Effective address of a DDCB/FDCB instruction
+    FILE *trace_file = s->trace_file ? s->trace_file : stdout;
+    const uint16_t resume_pc = PC;          // A breakpoint here was stopped at last run
+    const uint64_t resume_at = s->instructions;
+#if ZILOG_THREADED
+    TranslationCache *tc = s->tc;
+    static const Uop end_uop = { &&block_end, 0, 0, 0, 0, 0 };
+    const Uop *u = &end_uop;    // Next micro-op of the running block
+    IdleMark idle = {};         // Last spin-wait pass seen
+    uint32_t entries = 0;       // Blocks entered since the last look
+    uint64_t sampled = s->instructions;     // Count at the last look
+    Block *last = nullptr;      // Block that just ran, whose exits are tried first
+    uint64_t flushes = 0;       // tc->flushes when last was set
+#endif
+
+#if ZILOG_THREADED
+    static void* const base_table[256] = {
+        &&op_0x00, &&op_0x01, &&op_0x02, &&op_0x03, &&op_0x04, &&op_0x05, &&op_0x06, &&op_0x07,
+        &&op_0x08, &&op_0x09, &&op_0x0A, &&op_0x0B, &&op_0x0C, &&op_0x0D, &&op_0x0E, &&op_0x0F,
+        &&op_0x10, &&op_0x11, &&op_0x12, &&op_0x13, &&op_0x14, &&op_0x15, &&op_0x16, &&op_0x17,
+        &&op_0x18, &&op_0x19, &&op_0x1A, &&op_0x1B, &&op_0x1C, &&op_0x1D, &&op_0x1E, &&op_0x1F,
+        &&op_0x20, &&op_0x21, &&op_0x22, &&op_0x23, &&op_0x24, &&op_0x25, &&op_0x26, &&op_0x27,
+        &&op_0x28, &&op_0x29, &&op_0x2A, &&op_0x2B, &&op_0x2C, &&op_0x2D, &&op_0x2E, &&op_0x2F,
+        &&op_0x30, &&op_0x31, &&op_0x32, &&op_0x33, &&op_0x34, &&op_0x35, &&op_0x36, &&op_0x37,
+        &&op_0x38, &&op_0x39, &&op_0x3A, &&op_0x3B, &&op_0x3C, &&op_0x3D, &&op_0x3E, &&op_0x3F,
+        &&op_0x40, &&op_0x41, &&op_0x42, &&op_0x43, &&op_0x44, &&op_0x45, &&op_0x46, &&op_0x47,
+        &&op_0x48, &&op_0x49, &&op_0x4A, &&op_0x4B, &&op_0x4C, &&op_0x4D, &&op_0x4E, &&op_0x4F,
+        &&op_0x50, &&op_0x51, &&op_0x52, &&op_0x53, &&op_0x54, &&op_0x55, &&op_0x56, &&op_0x57,
+        &&op_0x58, &&op_0x59, &&op_0x5A, &&op_0x5B, &&op_0x5C, &&op_0x5D, &&op_0x5E, &&op_0x5F,
+        &&op_0x60, &&op_0x61, &&op_0x62, &&op_0x63, &&op_0x64, &&op_0x65, &&op_0x66, &&op_0x67,
+        &&op_0x68, &&op_0x69, &&op_0x6A, &&op_0x6B, &&op_0x6C, &&op_0x6D, &&op_0x6E, &&op_0x6F,
+        &&op_0x70, &&op_0x71, &&op_0x72, &&op_0x73, &&op_0x74, &&op_0x75, &&op_0x76, &&op_0x77,
+        &&op_0x78, &&op_0x79, &&op_0x7A, &&op_0x7B, &&op_0x7C, &&op_0x7D, &&op_0x7E, &&op_0x7F,
+        &&op_0x80, &&op_0x81, &&op_0x82, &&op_0x83, &&op_0x84, &&op_0x85, &&op_0x86, &&op_0x87,
+        &&op_0x88, &&op_0x89, &&op_0x8A, &&op_0x8B, &&op_0x8C, &&op_0x8D, &&op_0x8E, &&op_0x8F,
+        &&op_0x90, &&op_0x91, &&op_0x92, &&op_0x93, &&op_0x94, &&op_0x95, &&op_0x96, &&op_0x97,
+        &&op_0x98, &&op_0x99, &&op_0x9A, &&op_0x9B, &&op_0x9C, &&op_0x9D, &&op_0x9E, &&op_0x9F,
+        &&op_0xA0, &&op_0xA1, &&op_0xA2, &&op_0xA3, &&op_0xA4, &&op_0xA5, &&op_0xA6, &&op_0xA7,
+        &&op_0xA8, &&op_0xA9, &&op_0xAA, &&op_0xAB, &&op_0xAC, &&op_0xAD, &&op_0xAE, &&op_0xAF,
+        &&op_0xB0, &&op_0xB1, &&op_0xB2, &&op_0xB3, &&op_0xB4, &&op_0xB5, &&op_0xB6, &&op_0xB7,
+        &&op_0xB8, &&op_0xB9, &&op_0xBA, &&op_0xBB, &&op_0xBC, &&op_0xBD, &&op_0xBE, &&op_0xBF,
+        &&op_0xC0, &&op_0xC1, &&op_0xC2, &&op_0xC3, &&op_0xC4, &&op_0xC5, &&op_0xC6, &&op_0xC7,
+        &&op_0xC8, &&op_0xC9, &&op_0xCA, &&op_0xCB, &&op_0xCC, &&op_0xCD, &&op_0xCE, &&op_0xCF,
+        &&op_0xD0, &&op_0xD1, &&op_0xD2, &&op_0xD3, &&op_0xD4, &&op_0xD5, &&op_0xD6, &&op_0xD7,
+        &&op_0xD8, &&op_0xD9, &&op_0xDA, &&op_0xDB, &&op_0xDC, &&op_0xDD, &&op_0xDE, &&op_0xDF,
+        &&op_0xE0, &&op_0xE1, &&op_0xE2, &&op_0xE3, &&op_0xE4, &&op_0xE5, &&op_0xE6, &&op_0xE7,
+        &&op_0xE8, &&op_0xE9, &&op_0xEA, &&op_0xEB, &&op_0xEC, &&op_0xED, &&op_0xEE, &&op_0xEF,
+        &&op_0xF0, &&op_0xF1, &&op_0xF2, &&op_0xF3, &&op_0xF4, &&op_0xF5, &&op_0xF6, &&op_0xF7,
+        &&op_0xF8, &&op_0xF9, &&op_0xFA, &&op_0xFB, &&op_0xFC, &&op_0xFD, &&op_0xFE, &&op_0xFF,
+    };
+    static void* const cb_table[256] = {
+        &&cb_0x00, &&cb_0x01, &&cb_0x02, &&cb_0x03, &&cb_0x04, &&cb_0x05, &&cb_0x06, &&cb_0x07,
+        &&cb_0x08, &&cb_0x09, &&cb_0x0A, &&cb_0x0B, &&cb_0x0C, &&cb_0x0D, &&cb_0x0E, &&cb_0x0F,
+        &&cb_0x10, &&cb_0x11, &&cb_0x12, &&cb_0x13, &&cb_0x14, &&cb_0x15, &&cb_0x16, &&cb_0x17,
+        &&cb_0x18, &&cb_0x19, &&cb_0x1A, &&cb_0x1B, &&cb_0x1C, &&cb_0x1D, &&cb_0x1E, &&cb_0x1F,
+        &&cb_0x20, &&cb_0x21, &&cb_0x22, &&cb_0x23, &&cb_0x24, &&cb_0x25, &&cb_0x26, &&cb_0x27,
+        &&cb_0x28, &&cb_0x29, &&cb_0x2A, &&cb_0x2B, &&cb_0x2C, &&cb_0x2D, &&cb_0x2E, &&cb_0x2F,
+        &&cb_0x30, &&cb_0x31, &&cb_0x32, &&cb_0x33, &&cb_0x34, &&cb_0x35, &&cb_0x36, &&cb_0x37,
+        &&cb_0x38, &&cb_0x39, &&cb_0x3A, &&cb_0x3B, &&cb_0x3C, &&cb_0x3D, &&cb_0x3E, &&cb_0x3F,
+        &&cb_0x40, &&cb_0x41, &&cb_0x42, &&cb_0x43, &&cb_0x44, &&cb_0x45, &&cb_0x46, &&cb_0x47,
+        &&cb_0x48, &&cb_0x49, &&cb_0x4A, &&cb_0x4B, &&cb_0x4C, &&cb_0x4D, &&cb_0x4E, &&cb_0x4F,
+        &&cb_0x50, &&cb_0x51, &&cb_0x52, &&cb_0x53, &&cb_0x54, &&cb_0x55, &&cb_0x56, &&cb_0x57,
+        &&cb_0x58, &&cb_0x59, &&cb_0x5A, &&cb_0x5B, &&cb_0x5C, &&cb_0x5D, &&cb_0x5E, &&cb_0x5F,
+        &&cb_0x60, &&cb_0x61, &&cb_0x62, &&cb_0x63, &&cb_0x64, &&cb_0x65, &&cb_0x66, &&cb_0x67,
+        &&cb_0x68, &&cb_0x69, &&cb_0x6A, &&cb_0x6B, &&cb_0x6C, &&cb_0x6D, &&cb_0x6E, &&cb_0x6F,
+        &&cb_0x70, &&cb_0x71, &&cb_0x72, &&cb_0x73, &&cb_0x74, &&cb_0x75, &&cb_0x76, &&cb_0x77,
+        &&cb_0x78, &&cb_0x79, &&cb_0x7A, &&cb_0x7B, &&cb_0x7C, &&cb_0x7D, &&cb_0x7E, &&cb_0x7F,
+        &&cb_0x80, &&cb_0x81, &&cb_0x82, &&cb_0x83, &&cb_0x84, &&cb_0x85, &&cb_0x86, &&cb_0x87,
+        &&cb_0x88, &&cb_0x89, &&cb_0x8A, &&cb_0x8B, &&cb_0x8C, &&cb_0x8D, &&cb_0x8E, &&cb_0x8F,
+        &&cb_0x90, &&cb_0x91, &&cb_0x92, &&cb_0x93, &&cb_0x94, &&cb_0x95, &&cb_0x96, &&cb_0x97,
+        &&cb_0x98, &&cb_0x99, &&cb_0x9A, &&cb_0x9B, &&cb_0x9C, &&cb_0x9D, &&cb_0x9E, &&cb_0x9F,
+        &&cb_0xA0, &&cb_0xA1, &&cb_0xA2, &&cb_0xA3, &&cb_0xA4, &&cb_0xA5, &&cb_0xA6, &&cb_0xA7,
+        &&cb_0xA8, &&cb_0xA9, &&cb_0xAA, &&cb_0xAB, &&cb_0xAC, &&cb_0xAD, &&cb_0xAE, &&cb_0xAF,
+        &&cb_0xB0, &&cb_0xB1, &&cb_0xB2, &&cb_0xB3, &&cb_0xB4, &&cb_0xB5, &&cb_0xB6, &&cb_0xB7,
+        &&cb_0xB8, &&cb_0xB9, &&cb_0xBA, &&cb_0xBB, &&cb_0xBC, &&cb_0xBD, &&cb_0xBE, &&cb_0xBF,
+        &&cb_0xC0, &&cb_0xC1, &&cb_0xC2, &&cb_0xC3, &&cb_0xC4, &&cb_0xC5, &&cb_0xC6, &&cb_0xC7,
+        &&cb_0xC8, &&cb_0xC9, &&cb_0xCA, &&cb_0xCB, &&cb_0xCC, &&cb_0xCD, &&cb_0xCE, &&cb_0xCF,
+        &&cb_0xD0, &&cb_0xD1, &&cb_0xD2, &&cb_0xD3, &&cb_0xD4, &&cb_0xD5, &&cb_0xD6, &&cb_0xD7,
+        &&cb_0xD8, &&cb_0xD9, &&cb_0xDA, &&cb_0xDB, &&cb_0xDC, &&cb_0xDD, &&cb_0xDE, &&cb_0xDF,
+        &&cb_0xE0, &&cb_0xE1, &&cb_0xE2, &&cb_0xE3, &&cb_0xE4, &&cb_0xE5, &&cb_0xE6, &&cb_0xE7,
+        &&cb_0xE8, &&cb_0xE9, &&cb_0xEA, &&cb_0xEB, &&cb_0xEC, &&cb_0xED, &&cb_0xEE, &&cb_0xEF,
+        &&cb_0xF0, &&cb_0xF1, &&cb_0xF2, &&cb_0xF3, &&cb_0xF4, &&cb_0xF5, &&cb_0xF6, &&cb_0xF7,
+        &&cb_0xF8, &&cb_0xF9, &&cb_0xFA, &&cb_0xFB, &&cb_0xFC, &&cb_0xFD, &&cb_0xFE, &&cb_0xFF,
+    };
+    static void* const ed_table[256] = {
+        &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop,
+        &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop,
+        &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop,
+        &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop,
+        &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop,
+        &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop,
+        &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop,
+        &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop,
+        &&ed_0x40, &&ed_0x41, &&ed_0x42, &&ed_0x43, &&ed_0x44, &&ed_0x45, &&ed_0x46, &&ed_0x47,
+        &&ed_0x48, &&ed_0x49, &&ed_0x4A, &&ed_0x4B, &&ed_0x4C, &&ed_0x4D, &&ed_0x4E, &&ed_0x4F,
+        &&ed_0x50, &&ed_0x51, &&ed_0x52, &&ed_0x53, &&ed_0x54, &&ed_0x55, &&ed_0x56, &&ed_0x57,
+        &&ed_0x58, &&ed_0x59, &&ed_0x5A, &&ed_0x5B, &&ed_0x5C, &&ed_0x5D, &&ed_0x5E, &&ed_0x5F,
+        &&ed_0x60, &&ed_0x61, &&ed_0x62, &&ed_0x63, &&ed_0x64, &&ed_0x65, &&ed_0x66, &&ed_0x67,
+        &&ed_0x68, &&ed_0x69, &&ed_0x6A, &&ed_0x6B, &&ed_0x6C, &&ed_0x6D, &&ed_0x6E, &&ed_0x6F,
+        &&ed_0x70, &&ed_0x71, &&ed_0x72, &&ed_0x73, &&ed_0x74, &&ed_0x75, &&ed_0x76, &&ed_nop,
+        &&ed_0x78, &&ed_0x79, &&ed_0x7A, &&ed_0x7B, &&ed_0x7C, &&ed_0x7D, &&ed_0x7E, &&ed_nop,
+        &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop,
+        &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop,
+        &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop,
+        &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop,
+        &&ed_0xA0, &&ed_0xA1, &&ed_0xA2, &&ed_0xA3, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop,
+        &&ed_0xA8, &&ed_0xA9, &&ed_0xAA, &&ed_0xAB, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop,
+        &&ed_0xB0, &&ed_0xB1, &&ed_0xB2, &&ed_0xB3, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop,
+        &&ed_0xB8, &&ed_0xB9, &&ed_0xBA, &&ed_0xBB, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop,
+        &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop,
+        &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop,
+        &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop,
+        &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop,
+        &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop,
+        &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop,
+        &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop,
+        &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop, &&ed_nop,
+    };
+    static void* const dd_table[256] = {
+        &&op_0x00, &&op_0x01, &&op_0x02, &&op_0x03, &&op_0x04, &&op_0x05, &&op_0x06, &&op_0x07,
+        &&op_0x08, &&dd_0x09, &&op_0x0A, &&op_0x0B, &&op_0x0C, &&op_0x0D, &&op_0x0E, &&op_0x0F,
+        &&op_0x10, &&op_0x11, &&op_0x12, &&op_0x13, &&op_0x14, &&op_0x15, &&op_0x16, &&op_0x17,
+        &&op_0x18, &&dd_0x19, &&op_0x1A, &&op_0x1B, &&op_0x1C, &&op_0x1D, &&op_0x1E, &&op_0x1F,
+        &&op_0x20, &&dd_0x21, &&dd_0x22, &&dd_0x23, &&dd_0x24, &&dd_0x25, &&dd_0x26, &&op_0x27,
+        &&op_0x28, &&dd_0x29, &&dd_0x2A, &&dd_0x2B, &&dd_0x2C, &&dd_0x2D, &&dd_0x2E, &&op_0x2F,
+        &&op_0x30, &&op_0x31, &&op_0x32, &&op_0x33, &&dd_0x34, &&dd_0x35, &&dd_0x36, &&op_0x37,
+        &&op_0x38, &&dd_0x39, &&op_0x3A, &&op_0x3B, &&op_0x3C, &&op_0x3D, &&op_0x3E, &&op_0x3F,
+        &&op_0x40, &&op_0x41, &&op_0x42, &&op_0x43, &&dd_0x44, &&dd_0x45, &&dd_0x46, &&op_0x47,
+        &&op_0x48, &&op_0x49, &&op_0x4A, &&op_0x4B, &&dd_0x4C, &&dd_0x4D, &&dd_0x4E, &&op_0x4F,
+        &&op_0x50, &&op_0x51, &&op_0x52, &&op_0x53, &&dd_0x54, &&dd_0x55, &&dd_0x56, &&op_0x57,
+        &&op_0x58, &&op_0x59, &&op_0x5A, &&op_0x5B, &&dd_0x5C, &&dd_0x5D, &&dd_0x5E, &&op_0x5F,
+        &&dd_0x60, &&dd_0x61, &&dd_0x62, &&dd_0x63, &&dd_0x64, &&dd_0x65, &&dd_0x66, &&dd_0x67,
+        &&dd_0x68, &&dd_0x69, &&dd_0x6A, &&dd_0x6B, &&dd_0x6C, &&dd_0x6D, &&dd_0x6E, &&dd_0x6F,
+        &&dd_0x70, &&dd_0x71, &&dd_0x72, &&dd_0x73, &&dd_0x74, &&dd_0x75, &&op_0x76, &&dd_0x77,
+        &&op_0x78, &&op_0x79, &&op_0x7A, &&op_0x7B, &&dd_0x7C, &&dd_0x7D, &&dd_0x7E, &&op_0x7F,
+        &&op_0x80, &&op_0x81, &&op_0x82, &&op_0x83, &&dd_0x84, &&dd_0x85, &&dd_0x86, &&op_0x87,
+        &&op_0x88, &&op_0x89, &&op_0x8A, &&op_0x8B, &&dd_0x8C, &&dd_0x8D, &&dd_0x8E, &&op_0x8F,
+        &&op_0x90, &&op_0x91, &&op_0x92, &&op_0x93, &&dd_0x94, &&dd_0x95, &&dd_0x96, &&op_0x97,
+        &&op_0x98, &&op_0x99, &&op_0x9A, &&op_0x9B, &&dd_0x9C, &&dd_0x9D, &&dd_0x9E, &&op_0x9F,
+        &&op_0xA0, &&op_0xA1, &&op_0xA2, &&op_0xA3, &&dd_0xA4, &&dd_0xA5, &&dd_0xA6, &&op_0xA7,
+        &&op_0xA8, &&op_0xA9, &&op_0xAA, &&op_0xAB, &&dd_0xAC, &&dd_0xAD, &&dd_0xAE, &&op_0xAF,
+        &&op_0xB0, &&op_0xB1, &&op_0xB2, &&op_0xB3, &&dd_0xB4, &&dd_0xB5, &&dd_0xB6, &&op_0xB7,
+        &&op_0xB8, &&op_0xB9, &&op_0xBA, &&op_0xBB, &&dd_0xBC, &&dd_0xBD, &&dd_0xBE, &&op_0xBF,
+        &&op_0xC0, &&op_0xC1, &&op_0xC2, &&op_0xC3, &&op_0xC4, &&op_0xC5, &&op_0xC6, &&op_0xC7,
+        &&op_0xC8, &&op_0xC9, &&op_0xCA, &&dd_0xCB, &&op_0xCC, &&op_0xCD, &&op_0xCE, &&op_0xCF,
+        &&op_0xD0, &&op_0xD1, &&op_0xD2, &&op_0xD3, &&op_0xD4, &&op_0xD5, &&op_0xD6, &&op_0xD7,
+        &&op_0xD8, &&op_0xD9, &&op_0xDA, &&op_0xDB, &&op_0xDC, &&op_0xDD, &&op_0xDE, &&op_0xDF,
+        &&op_0xE0, &&dd_0xE1, &&op_0xE2, &&dd_0xE3, &&op_0xE4, &&dd_0xE5, &&op_0xE6, &&op_0xE7,
+        &&op_0xE8, &&dd_0xE9, &&op_0xEA, &&op_0xEB, &&op_0xEC, &&op_0xED, &&op_0xEE, &&op_0xEF,
+        &&op_0xF0, &&op_0xF1, &&op_0xF2, &&op_0xF3, &&op_0xF4, &&op_0xF5, &&op_0xF6, &&op_0xF7,
+        &&op_0xF8, &&dd_0xF9, &&op_0xFA, &&op_0xFB, &&op_0xFC, &&op_0xFD, &&op_0xFE, &&op_0xFF,
+    };
+    static void* const ddcb_table[256] = {
+        &&ddcb_0x00, &&ddcb_0x01, &&ddcb_0x02, &&ddcb_0x03, &&ddcb_0x04, &&ddcb_0x05, &&ddcb_0x06, &&ddcb_0x07,
+        &&ddcb_0x08, &&ddcb_0x09, &&ddcb_0x0A, &&ddcb_0x0B, &&ddcb_0x0C, &&ddcb_0x0D, &&ddcb_0x0E, &&ddcb_0x0F,
+        &&ddcb_0x10, &&ddcb_0x11, &&ddcb_0x12, &&ddcb_0x13, &&ddcb_0x14, &&ddcb_0x15, &&ddcb_0x16, &&ddcb_0x17,
+        &&ddcb_0x18, &&ddcb_0x19, &&ddcb_0x1A, &&ddcb_0x1B, &&ddcb_0x1C, &&ddcb_0x1D, &&ddcb_0x1E, &&ddcb_0x1F,
+        &&ddcb_0x20, &&ddcb_0x21, &&ddcb_0x22, &&ddcb_0x23, &&ddcb_0x24, &&ddcb_0x25, &&ddcb_0x26, &&ddcb_0x27,
+        &&ddcb_0x28, &&ddcb_0x29, &&ddcb_0x2A, &&ddcb_0x2B, &&ddcb_0x2C, &&ddcb_0x2D, &&ddcb_0x2E, &&ddcb_0x2F,
+        &&ddcb_0x30, &&ddcb_0x31, &&ddcb_0x32, &&ddcb_0x33, &&ddcb_0x34, &&ddcb_0x35, &&ddcb_0x36, &&ddcb_0x37,
+        &&ddcb_0x38, &&ddcb_0x39, &&ddcb_0x3A, &&ddcb_0x3B, &&ddcb_0x3C, &&ddcb_0x3D, &&ddcb_0x3E, &&ddcb_0x3F,
+        &&ddcb_0x40, &&ddcb_0x41, &&ddcb_0x42, &&ddcb_0x43, &&ddcb_0x44, &&ddcb_0x45, &&ddcb_0x46, &&ddcb_0x47,
+        &&ddcb_0x48, &&ddcb_0x49, &&ddcb_0x4A, &&ddcb_0x4B, &&ddcb_0x4C, &&ddcb_0x4D, &&ddcb_0x4E, &&ddcb_0x4F,
+        &&ddcb_0x50, &&ddcb_0x51, &&ddcb_0x52, &&ddcb_0x53, &&ddcb_0x54, &&ddcb_0x55, &&ddcb_0x56, &&ddcb_0x57,
+        &&ddcb_0x58, &&ddcb_0x59, &&ddcb_0x5A, &&ddcb_0x5B, &&ddcb_0x5C, &&ddcb_0x5D, &&ddcb_0x5E, &&ddcb_0x5F,
+        &&ddcb_0x60, &&ddcb_0x61, &&ddcb_0x62, &&ddcb_0x63, &&ddcb_0x64, &&ddcb_0x65, &&ddcb_0x66, &&ddcb_0x67,
+        &&ddcb_0x68, &&ddcb_0x69, &&ddcb_0x6A, &&ddcb_0x6B, &&ddcb_0x6C, &&ddcb_0x6D, &&ddcb_0x6E, &&ddcb_0x6F,
+        &&ddcb_0x70, &&ddcb_0x71, &&ddcb_0x72, &&ddcb_0x73, &&ddcb_0x74, &&ddcb_0x75, &&ddcb_0x76, &&ddcb_0x77,
+        &&ddcb_0x78, &&ddcb_0x79, &&ddcb_0x7A, &&ddcb_0x7B, &&ddcb_0x7C, &&ddcb_0x7D, &&ddcb_0x7E, &&ddcb_0x7F,
+        &&ddcb_0x80, &&ddcb_0x81, &&ddcb_0x82, &&ddcb_0x83, &&ddcb_0x84, &&ddcb_0x85, &&ddcb_0x86, &&ddcb_0x87,
+        &&ddcb_0x88, &&ddcb_0x89, &&ddcb_0x8A, &&ddcb_0x8B, &&ddcb_0x8C, &&ddcb_0x8D, &&ddcb_0x8E, &&ddcb_0x8F,
+        &&ddcb_0x90, &&ddcb_0x91, &&ddcb_0x92, &&ddcb_0x93, &&ddcb_0x94, &&ddcb_0x95, &&ddcb_0x96, &&ddcb_0x97,
+        &&ddcb_0x98, &&ddcb_0x99, &&ddcb_0x9A, &&ddcb_0x9B, &&ddcb_0x9C, &&ddcb_0x9D, &&ddcb_0x9E, &&ddcb_0x9F,
+        &&ddcb_0xA0, &&ddcb_0xA1, &&ddcb_0xA2, &&ddcb_0xA3, &&ddcb_0xA4, &&ddcb_0xA5, &&ddcb_0xA6, &&ddcb_0xA7,
+        &&ddcb_0xA8, &&ddcb_0xA9, &&ddcb_0xAA, &&ddcb_0xAB, &&ddcb_0xAC, &&ddcb_0xAD, &&ddcb_0xAE, &&ddcb_0xAF,
+        &&ddcb_0xB0, &&ddcb_0xB1, &&ddcb_0xB2, &&ddcb_0xB3, &&ddcb_0xB4, &&ddcb_0xB5, &&ddcb_0xB6, &&ddcb_0xB7,
+        &&ddcb_0xB8, &&ddcb_0xB9, &&ddcb_0xBA, &&ddcb_0xBB, &&ddcb_0xBC, &&ddcb_0xBD, &&ddcb_0xBE, &&ddcb_0xBF,
+        &&ddcb_0xC0, &&ddcb_0xC1, &&ddcb_0xC2, &&ddcb_0xC3, &&ddcb_0xC4, &&ddcb_0xC5, &&ddcb_0xC6, &&ddcb_0xC7,
+        &&ddcb_0xC8, &&ddcb_0xC9, &&ddcb_0xCA, &&ddcb_0xCB, &&ddcb_0xCC, &&ddcb_0xCD, &&ddcb_0xCE, &&ddcb_0xCF,
+        &&ddcb_0xD0, &&ddcb_0xD1, &&ddcb_0xD2, &&ddcb_0xD3, &&ddcb_0xD4, &&ddcb_0xD5, &&ddcb_0xD6, &&ddcb_0xD7,
+        &&ddcb_0xD8, &&ddcb_0xD9, &&ddcb_0xDA, &&ddcb_0xDB, &&ddcb_0xDC, &&ddcb_0xDD, &&ddcb_0xDE, &&ddcb_0xDF,
+        &&ddcb_0xE0, &&ddcb_0xE1, &&ddcb_0xE2, &&ddcb_0xE3, &&ddcb_0xE4, &&ddcb_0xE5, &&ddcb_0xE6, &&ddcb_0xE7,
+        &&ddcb_0xE8, &&ddcb_0xE9, &&ddcb_0xEA, &&ddcb_0xEB, &&ddcb_0xEC, &&ddcb_0xED, &&ddcb_0xEE, &&ddcb_0xEF,
+        &&ddcb_0xF0, &&ddcb_0xF1, &&ddcb_0xF2, &&ddcb_0xF3, &&ddcb_0xF4, &&ddcb_0xF5, &&ddcb_0xF6, &&ddcb_0xF7,
+        &&ddcb_0xF8, &&ddcb_0xF9, &&ddcb_0xFA, &&ddcb_0xFB, &&ddcb_0xFC, &&ddcb_0xFD, &&ddcb_0xFE, &&ddcb_0xFF,
+    };
+    if (Blocks)
+        tc->handlers = { base_table, cb_table, ed_table, &&block_end, &&block_bail, &&block_loop, &&block_idle };
+#endif
+    if (s->debug)
+        debug_enter(s);
+    plan_stop(s, cycle_limit);
+    if (s->halted) {
+        if (halt_waits(s))
+            goto halt_wait;
+        s->halted = 0;          // Resumed past a HALT that ended an earlier run
+    }
+#if ZILOG_THREADED
+    if (Blocks)
+        goto block_end;
+    DISPATCH();
+#else
+    for (;;) {
+fetch:
+    FETCH();
+base_op:
+    switch (op) {
+#endif
+        OP(0x00) NEXT;                                                  // nop
+        OP(0x01) BC = IMM16(); NEXT;
+        OP(0x02) WR8(BC, A); NEXT;
+        OP(0x03) BC = inc16(BC); NEXT;
+        OP(0x04) B = inc8(s, B); NEXT;
+        OP(0x05) B = dec8(s, B); NEXT;
+        OP(0x06) B = IMM8(); NEXT;
+        OP(0x07) rlca(s); NEXT;
+        OP(0x08) ex_af(s); NEXT;
+        OP(0x09) HL = add16(s, HL, BC); NEXT;
+        OP(0x0A) A = RD8(BC); NEXT;
+        OP(0x0B) BC = dec16(BC); NEXT;
+        OP(0x0C) C = inc8(s, C); NEXT;
+        OP(0x0D) C = dec8(s, C); NEXT;
+        OP(0x0E) C = IMM8(); NEXT;
+        OP(0x0F) rrca(s); NEXT;
+
+        OP(0x10) { int8_t e = (int8_t)IMM8(); if (--B != 0) { PC += e; TAKEN(); } } NEXT;   // djnz
+        OP(0x11) DE = IMM16(); NEXT;
+        OP(0x12) WR8(DE, A); NEXT;
+        OP(0x13) DE = inc16(DE); NEXT;
+        OP(0x14) D = inc8(s, D); NEXT;
+        OP(0x15) D = dec8(s, D); NEXT;
+        OP(0x16) D = IMM8(); NEXT;
+        OP(0x17) rla(s); NEXT;
+        OP(0x18) JR_IF(true); NEXT;
+        OP(0x19) HL = add16(s, HL, DE); NEXT;
+        OP(0x1A) A = RD8(DE); NEXT;
+        OP(0x1B) DE = dec16(DE); NEXT;
+        OP(0x1C) E = inc8(s, E); NEXT;
+        OP(0x1D) E = dec8(s, E); NEXT;
+        OP(0x1E) E = IMM8(); NEXT;
+        OP(0x1F) rra(s); NEXT;
+
+        OP(0x20) JR_IF(COND_NZ); NEXT;
+        OP(0x21) HL = IMM16(); NEXT;
+        OP(0x22) { uint16_t nn = IMM16(); WR8(nn, HL & 0xff); WR8(nn + 1, HL >> 8); } NEXT;
+        OP(0x23) HL = inc16(HL); NEXT;
+        OP(0x24) H = inc8(s, H); NEXT;
+        OP(0x25) H = dec8(s, H); NEXT;
+        OP(0x26) H = IMM8(); NEXT;
+        OP(0x27) daa(s); NEXT;
+        OP(0x28) JR_IF(COND_Z); NEXT;
+        OP(0x29) HL = add16(s, HL, HL); NEXT;
+        OP(0x2A) { uint16_t nn = IMM16(); HL = RD8(nn) | (RD8(nn + 1) << 8); } NEXT;
+        OP(0x2B) HL = dec16(HL); NEXT;
+        OP(0x2C) L = inc8(s, L); NEXT;
+        OP(0x2D) L = dec8(s, L); NEXT;
+        OP(0x2E) L = IMM8(); NEXT;
+        OP(0x2F) cpl(s); NEXT;
+
+        OP(0x30) JR_IF(COND_NC); NEXT;
+        OP(0x31) SP = IMM16(); NEXT;
+        OP(0x32) WR8(IMM16(), A); NEXT;
+        OP(0x33) SP = inc16(SP); NEXT;
+        OP(0x34) WR8(HL, inc8(s, RD8(HL))); NEXT;
+        OP(0x35) WR8(HL, dec8(s, RD8(HL))); NEXT;
+        OP(0x36) { uint8_t n = IMM8(); WR8(HL, n); } NEXT;
+        OP(0x37) scf(s); NEXT;
+        OP(0x38) JR_IF(COND_C); NEXT;
+        OP(0x39) HL = add16(s, HL, SP); NEXT;
+        OP(0x3A) A = RD8(IMM16()); NEXT;
+        OP(0x3B) SP = dec16(SP); NEXT;
+        OP(0x3C) A = inc8(s, A); NEXT;
+        OP(0x3D) A = dec8(s, A); NEXT;
+        OP(0x3E) A = IMM8(); NEXT;
+        OP(0x3F) ccf(s); NEXT;
+
+        OP(0x40) NEXT;
+        OP(0x41) B = C; NEXT;
+        OP(0x42) B = D; NEXT;
+        OP(0x43) B = E; NEXT;
+        OP(0x44) B = H; NEXT;
+        OP(0x45) B = L; NEXT;
+        OP(0x46) B = RD8(HL); NEXT;
+        OP(0x47) B = A; NEXT;
+        OP(0x48) C = B; NEXT;
+        OP(0x49) NEXT;
+        OP(0x4A) C = D; NEXT;
+        OP(0x4B) C = E; NEXT;
+        OP(0x4C) C = H; NEXT;
+        OP(0x4D) C = L; NEXT;
+        OP(0x4E) C = RD8(HL); NEXT;
+        OP(0x4F) C = A; NEXT;
+
+        OP(0x50) D = B; NEXT;
+        OP(0x51) D = C; NEXT;
+        OP(0x52) NEXT;
+        OP(0x53) D = E; NEXT;
+        OP(0x54) D = H; NEXT;
+        OP(0x55) D = L; NEXT;
+        OP(0x56) D = RD8(HL); NEXT;
+        OP(0x57) D = A; NEXT;
+        OP(0x58) E = B; NEXT;
+        OP(0x59) E = C; NEXT;
+        OP(0x5A) E = D; NEXT;
+        OP(0x5B) NEXT;
+        OP(0x5C) E = H; NEXT;
+        OP(0x5D) E = L; NEXT;
+        OP(0x5E) E = RD8(HL); NEXT;
+        OP(0x5F) E = A; NEXT;
+
+        OP(0x60) H = B; NEXT;
+        OP(0x61) H = C; NEXT;
+        OP(0x62) H = D; NEXT;
+        OP(0x63) H = E; NEXT;
+        OP(0x64) NEXT;
+        OP(0x65) H = L; NEXT;
+        OP(0x66) H = RD8(HL); NEXT;
+        OP(0x67) H = A; NEXT;
+        OP(0x68) L = B; NEXT;
+        OP(0x69) L = C; NEXT;
+        OP(0x6A) L = D; NEXT;
+        OP(0x6B) L = E; NEXT;
+        OP(0x6C) L = H; NEXT;
+        OP(0x6D) NEXT;
+        OP(0x6E) L = RD8(HL); NEXT;
+        OP(0x6F) L = A; NEXT;
+
+        OP(0x70) WR8(HL, B); NEXT;
+        OP(0x71) WR8(HL, C); NEXT;
+        OP(0x72) WR8(HL, D); NEXT;
+        OP(0x73) WR8(HL, E); NEXT;
+        OP(0x74) WR8(HL, H); NEXT;
+        OP(0x75) WR8(HL, L); NEXT;
+        OP(0x76) s->halted = 1; if (halt_waits(s)) goto halt_wait; STOP(STOP_HALT); // halt
+        OP(0x77) WR8(HL, A); NEXT;
+        OP(0x78) A = B; NEXT;
+        OP(0x79) A = C; NEXT;
+        OP(0x7A) A = D; NEXT;
+        OP(0x7B) A = E; NEXT;
+        OP(0x7C) A = H; NEXT;
+        OP(0x7D) A = L; NEXT;
+        OP(0x7E) A = RD8(HL); NEXT;
+        OP(0x7F) NEXT;
+
+        OP(0x80) A = add8(s, A, B); NEXT;
+        OP(0x81) A = add8(s, A, C); NEXT;
+        OP(0x82) A = add8(s, A, D); NEXT;
+        OP(0x83) A = add8(s, A, E); NEXT;
+        OP(0x84) A = add8(s, A, H); NEXT;
+        OP(0x85) A = add8(s, A, L); NEXT;
+        OP(0x86) A = add8(s, A, RD8(HL)); NEXT;
+        OP(0x87) A = add8(s, A, A); NEXT;
+        OP(0x88) A = adc(s, A, B); NEXT;
+        OP(0x89) A = adc(s, A, C); NEXT;
+        OP(0x8A) A = adc(s, A, D); NEXT;
+        OP(0x8B) A = adc(s, A, E); NEXT;
+        OP(0x8C) A = adc(s, A, H); NEXT;
+        OP(0x8D) A = adc(s, A, L); NEXT;
+        OP(0x8E) A = adc(s, A, RD8(HL)); NEXT;
+        OP(0x8F) A = adc(s, A, A); NEXT;
+
+        OP(0x90) A = sub(s, A, B); NEXT;
+        OP(0x91) A = sub(s, A, C); NEXT;
+        OP(0x92) A = sub(s, A, D); NEXT;
+        OP(0x93) A = sub(s, A, E); NEXT;
+        OP(0x94) A = sub(s, A, H); NEXT;
+        OP(0x95) A = sub(s, A, L); NEXT;
+        OP(0x96) A = sub(s, A, RD8(HL)); NEXT;
+        OP(0x97) A = sub(s, A, A); NEXT;
+        OP(0x98) A = sbc(s, A, B); NEXT;
+        OP(0x99) A = sbc(s, A, C); NEXT;
+        OP(0x9A) A = sbc(s, A, D); NEXT;
+        OP(0x9B) A = sbc(s, A, E); NEXT;
+        OP(0x9C) A = sbc(s, A, H); NEXT;
+        OP(0x9D) A = sbc(s, A, L); NEXT;
+        OP(0x9E) A = sbc(s, A, RD8(HL)); NEXT;
+        OP(0x9F) A = sbc(s, A, A); NEXT;
+
+        OP(0xA0) A = _and(s, A, B); NEXT;
+        OP(0xA1) A = _and(s, A, C); NEXT;
+        OP(0xA2) A = _and(s, A, D); NEXT;
+        OP(0xA3) A = _and(s, A, E); NEXT;
+        OP(0xA4) A = _and(s, A, H); NEXT;
+        OP(0xA5) A = _and(s, A, L); NEXT;
+        OP(0xA6) A = _and(s, A, RD8(HL)); NEXT;
+        OP(0xA7) A = _and(s, A, A); NEXT;
+        OP(0xA8) A = _xor(s, A, B); NEXT;
+        OP(0xA9) A = _xor(s, A, C); NEXT;
+        OP(0xAA) A = _xor(s, A, D); NEXT;
+        OP(0xAB) A = _xor(s, A, E); NEXT;
+        OP(0xAC) A = _xor(s, A, H); NEXT;
+        OP(0xAD) A = _xor(s, A, L); NEXT;
+        OP(0xAE) A = _xor(s, A, RD8(HL)); NEXT;
+        OP(0xAF) A = _xor(s, A, A); NEXT;
+
+        OP(0xB0) A = _or(s, A, B); NEXT;
+        OP(0xB1) A = _or(s, A, C); NEXT;
+        OP(0xB2) A = _or(s, A, D); NEXT;
+        OP(0xB3) A = _or(s, A, E); NEXT;
+        OP(0xB4) A = _or(s, A, H); NEXT;
+        OP(0xB5) A = _or(s, A, L); NEXT;
+        OP(0xB6) A = _or(s, A, RD8(HL)); NEXT;
+        OP(0xB7) A = _or(s, A, A); NEXT;
+        OP(0xB8) cp(s, A, B); NEXT;
+        OP(0xB9) cp(s, A, C); NEXT;
+        OP(0xBA) cp(s, A, D); NEXT;
+        OP(0xBB) cp(s, A, E); NEXT;
+        OP(0xBC) cp(s, A, H); NEXT;
+        OP(0xBD) cp(s, A, L); NEXT;
+        OP(0xBE) cp(s, A, RD8(HL)); NEXT;
+        OP(0xBF) cp(s, A, A); NEXT;
+
+        OP(0xC0) RET_IF(COND_NZ); NEXT;
+        OP(0xC1) BC = pop16(s); NEXT;
+        OP(0xC2) JP_IF(COND_NZ); NEXT;
+        OP(0xC3) PC = IMM16(); NEXT;
+        OP(0xC4) CALL_IF(COND_NZ); NEXT;
+        OP(0xC5) push16(s, BC); NEXT;
+        OP(0xC6) A = add8(s, A, IMM8()); NEXT;
+        OP(0xC7) RST(0x00); NEXT;
+        OP(0xC8) RET_IF(COND_Z); NEXT;
+        OP(0xC9) PC = pop16(s); NEXT;
+        OP(0xCA) JP_IF(COND_Z); NEXT;
+        OP(0xCB) goto cb_prefix;
+        OP(0xCC) CALL_IF(COND_Z); NEXT;
+        OP(0xCD) CALL_IF(true); NEXT;
+        OP(0xCE) A = adc(s, A, IMM8()); NEXT;
+        OP(0xCF) RST(0x08); NEXT;
+
+        OP(0xD0) RET_IF(COND_NC); NEXT;
+        OP(0xD1) DE = pop16(s); NEXT;
+        OP(0xD2) JP_IF(COND_NC); NEXT;
+        OP(0xD3) port_out(s, (A << 8) | IMM8(), A); NEXT;
+        OP(0xD4) CALL_IF(COND_NC); NEXT;
+        OP(0xD5) push16(s, DE); NEXT;
+        OP(0xD6) A = sub(s, A, IMM8()); NEXT;
+        OP(0xD7) RST(0x10); NEXT;
+        OP(0xD8) RET_IF(COND_C); NEXT;
+        OP(0xD9) exx(s); NEXT;
+        OP(0xDA) JP_IF(COND_C); NEXT;
+        OP(0xDB) A = port_in(s, (A << 8) | IMM8()); NEXT;
+        OP(0xDC) CALL_IF(COND_C); NEXT;
+        OP(0xDD) xy = &s->ix; goto dd_prefix;
+        OP(0xDE) A = sbc(s, A, IMM8()); NEXT;
+        OP(0xDF) RST(0x18); NEXT;
+
+        OP(0xE0) RET_IF(COND_PO); NEXT;
+        OP(0xE1) HL = pop16(s); NEXT;
+        OP(0xE2) JP_IF(COND_PO); NEXT;
+        OP(0xE3) ex_sp(s, HL); NEXT;
+        OP(0xE4) CALL_IF(COND_PO); NEXT;
+        OP(0xE5) push16(s, HL); NEXT;
+        OP(0xE6) A = _and(s, A, IMM8()); NEXT;
+        OP(0xE7) RST(0x20); NEXT;
+        OP(0xE8) RET_IF(COND_PE); NEXT;
+        OP(0xE9) PC = HL; NEXT;
+        OP(0xEA) JP_IF(COND_PE); NEXT;
+        OP(0xEB) ex(DE, HL); NEXT;
+        OP(0xEC) CALL_IF(COND_PE); NEXT;
+        OP(0xED) goto ed_prefix;
+        OP(0xEE) A = _xor(s, A, IMM8()); NEXT;
+        OP(0xEF) RST(0x28); NEXT;
+
+        OP(0xF0) RET_IF(COND_P); NEXT;
+        OP(0xF1) AF = pop16(s); NEXT;
+        OP(0xF2) JP_IF(COND_P); NEXT;
+        OP(0xF3) s->iff1 = s->iff2 = 0; NEXT;                           // di
+        OP(0xF4) CALL_IF(COND_P); NEXT;
+        OP(0xF5) push16(s, AF); NEXT;
+        OP(0xF6) A = _or(s, A, IMM8()); NEXT;
+        OP(0xF7) RST(0x30); NEXT;
+        OP(0xF8) RET_IF(COND_M); NEXT;
+        OP(0xF9) SP = HL; NEXT;
+        OP(0xFA) JP_IF(COND_M); NEXT;
+        OP(0xFB) s->iff1 = s->iff2 = 1; s->ei_after = s->instructions; int_recheck(s); NEXT;    // ei
+        OP(0xFC) CALL_IF(COND_M); NEXT;
+        OP(0xFD) xy = &s->iy; goto dd_prefix;
+        OP(0xFE) cp(s, A, IMM8()); NEXT;
+        OP(0xFF) RST(0x38); NEXT;
+
+        // CB: rotates, shifts and single-bit operations
+cb_prefix:
+        PREFIX_FETCH();
+        s->cycles += cycles_cb[op];
+        BEGIN_PREFIX(cb_table)
+        CB(0x00) B = rlc(s, B); NEXT;
+        CB(0x01) C = rlc(s, C); NEXT;
+        CB(0x02) D = rlc(s, D); NEXT;
+        CB(0x03) E = rlc(s, E); NEXT;
+        CB(0x04) H = rlc(s, H); NEXT;
+        CB(0x05) L = rlc(s, L); NEXT;
+        CB(0x06) WR8(HL, rlc(s, RD8(HL))); NEXT;
+        CB(0x07) A = rlc(s, A); NEXT;
+        CB(0x08) B = rrc(s, B); NEXT;
+        CB(0x09) C = rrc(s, C); NEXT;
+        CB(0x0A) D = rrc(s, D); NEXT;
+        CB(0x0B) E = rrc(s, E); NEXT;
+        CB(0x0C) H = rrc(s, H); NEXT;
+        CB(0x0D) L = rrc(s, L); NEXT;
+        CB(0x0E) WR8(HL, rrc(s, RD8(HL))); NEXT;
+        CB(0x0F) A = rrc(s, A); NEXT;
+        CB(0x10) B = rl(s, B); NEXT;
+        CB(0x11) C = rl(s, C); NEXT;
+        CB(0x12) D = rl(s, D); NEXT;
+        CB(0x13) E = rl(s, E); NEXT;
+        CB(0x14) H = rl(s, H); NEXT;
+        CB(0x15) L = rl(s, L); NEXT;
+        CB(0x16) WR8(HL, rl(s, RD8(HL))); NEXT;
+        CB(0x17) A = rl(s, A); NEXT;
+        CB(0x18) B = rr(s, B); NEXT;
+        CB(0x19) C = rr(s, C); NEXT;
+        CB(0x1A) D = rr(s, D); NEXT;
+        CB(0x1B) E = rr(s, E); NEXT;
+        CB(0x1C) H = rr(s, H); NEXT;
+        CB(0x1D) L = rr(s, L); NEXT;
+        CB(0x1E) WR8(HL, rr(s, RD8(HL))); NEXT;
+        CB(0x1F) A = rr(s, A); NEXT;
+        CB(0x20) B = sla(s, B); NEXT;
+        CB(0x21) C = sla(s, C); NEXT;
+        CB(0x22) D = sla(s, D); NEXT;
+        CB(0x23) E = sla(s, E); NEXT;
+        CB(0x24) H = sla(s, H); NEXT;
+        CB(0x25) L = sla(s, L); NEXT;
+        CB(0x26) WR8(HL, sla(s, RD8(HL))); NEXT;
+        CB(0x27) A = sla(s, A); NEXT;
+        CB(0x28) B = sra(s, B); NEXT;
+        CB(0x29) C = sra(s, C); NEXT;
+        CB(0x2A) D = sra(s, D); NEXT;
+        CB(0x2B) E = sra(s, E); NEXT;
+        CB(0x2C) H = sra(s, H); NEXT;
+        CB(0x2D) L = sra(s, L); NEXT;
+        CB(0x2E) WR8(HL, sra(s, RD8(HL))); NEXT;
+        CB(0x2F) A = sra(s, A); NEXT;
+        CB(0x30) B = sll(s, B); NEXT;
+        CB(0x31) C = sll(s, C); NEXT;
+        CB(0x32) D = sll(s, D); NEXT;
+        CB(0x33) E = sll(s, E); NEXT;
+        CB(0x34) H = sll(s, H); NEXT;
+        CB(0x35) L = sll(s, L); NEXT;
+        CB(0x36) WR8(HL, sll(s, RD8(HL))); NEXT;
+        CB(0x37) A = sll(s, A); NEXT;
+        CB(0x38) B = srl(s, B); NEXT;
+        CB(0x39) C = srl(s, C); NEXT;
+        CB(0x3A) D = srl(s, D); NEXT;
+        CB(0x3B) E = srl(s, E); NEXT;
+        CB(0x3C) H = srl(s, H); NEXT;
+        CB(0x3D) L = srl(s, L); NEXT;
+        CB(0x3E) WR8(HL, srl(s, RD8(HL))); NEXT;
+        CB(0x3F) A = srl(s, A); NEXT;
+        CB(0x40) bit(s, 0, B); NEXT;
+        CB(0x41) bit(s, 0, C); NEXT;
+        CB(0x42) bit(s, 0, D); NEXT;
+        CB(0x43) bit(s, 0, E); NEXT;
+        CB(0x44) bit(s, 0, H); NEXT;
+        CB(0x45) bit(s, 0, L); NEXT;
+        CB(0x46) bit(s, 0, RD8(HL)); NEXT;
+        CB(0x47) bit(s, 0, A); NEXT;
+        CB(0x48) bit(s, 1, B); NEXT;
+        CB(0x49) bit(s, 1, C); NEXT;
+        CB(0x4A) bit(s, 1, D); NEXT;
+        CB(0x4B) bit(s, 1, E); NEXT;
+        CB(0x4C) bit(s, 1, H); NEXT;
+        CB(0x4D) bit(s, 1, L); NEXT;
+        CB(0x4E) bit(s, 1, RD8(HL)); NEXT;
+        CB(0x4F) bit(s, 1, A); NEXT;
+        CB(0x50) bit(s, 2, B); NEXT;
+        CB(0x51) bit(s, 2, C); NEXT;
+        CB(0x52) bit(s, 2, D); NEXT;
+        CB(0x53) bit(s, 2, E); NEXT;
+        CB(0x54) bit(s, 2, H); NEXT;
+        CB(0x55) bit(s, 2, L); NEXT;
+        CB(0x56) bit(s, 2, RD8(HL)); NEXT;
+        CB(0x57) bit(s, 2, A); NEXT;
+        CB(0x58) bit(s, 3, B); NEXT;
+        CB(0x59) bit(s, 3, C); NEXT;
+        CB(0x5A) bit(s, 3, D); NEXT;
+        CB(0x5B) bit(s, 3, E); NEXT;
+        CB(0x5C) bit(s, 3, H); NEXT;
+        CB(0x5D) bit(s, 3, L); NEXT;
+        CB(0x5E) bit(s, 3, RD8(HL)); NEXT;
+        CB(0x5F) bit(s, 3, A); NEXT;
+        CB(0x60) bit(s, 4, B); NEXT;
+        CB(0x61) bit(s, 4, C); NEXT;
+        CB(0x62) bit(s, 4, D); NEXT;
+        CB(0x63) bit(s, 4, E); NEXT;
+        CB(0x64) bit(s, 4, H); NEXT;
+        CB(0x65) bit(s, 4, L); NEXT;
+        CB(0x66) bit(s, 4, RD8(HL)); NEXT;
+        CB(0x67) bit(s, 4, A); NEXT;
+        CB(0x68) bit(s, 5, B); NEXT;
+        CB(0x69) bit(s, 5, C); NEXT;
+        CB(0x6A) bit(s, 5, D); NEXT;
+        CB(0x6B) bit(s, 5, E); NEXT;
+        CB(0x6C) bit(s, 5, H); NEXT;
+        CB(0x6D) bit(s, 5, L); NEXT;
+        CB(0x6E) bit(s, 5, RD8(HL)); NEXT;
+        CB(0x6F) bit(s, 5, A); NEXT;
+        CB(0x70) bit(s, 6, B); NEXT;
+        CB(0x71) bit(s, 6, C); NEXT;
+        CB(0x72) bit(s, 6, D); NEXT;
+        CB(0x73) bit(s, 6, E); NEXT;
+        CB(0x74) bit(s, 6, H); NEXT;
+        CB(0x75) bit(s, 6, L); NEXT;
+        CB(0x76) bit(s, 6, RD8(HL)); NEXT;
+        CB(0x77) bit(s, 6, A); NEXT;
+        CB(0x78) bit(s, 7, B); NEXT;
+        CB(0x79) bit(s, 7, C); NEXT;
+        CB(0x7A) bit(s, 7, D); NEXT;
+        CB(0x7B) bit(s, 7, E); NEXT;
+        CB(0x7C) bit(s, 7, H); NEXT;
+        CB(0x7D) bit(s, 7, L); NEXT;
+        CB(0x7E) bit(s, 7, RD8(HL)); NEXT;
+        CB(0x7F) bit(s, 7, A); NEXT;
+        CB(0x80) B &= 0xFE; NEXT;
+        CB(0x81) C &= 0xFE; NEXT;
+        CB(0x82) D &= 0xFE; NEXT;
+        CB(0x83) E &= 0xFE; NEXT;
+        CB(0x84) H &= 0xFE; NEXT;
+        CB(0x85) L &= 0xFE; NEXT;
+        CB(0x86) WR8(HL, RD8(HL) & 0xFE); NEXT;
+        CB(0x87) A &= 0xFE; NEXT;
+        CB(0x88) B &= 0xFD; NEXT;
+        CB(0x89) C &= 0xFD; NEXT;
+        CB(0x8A) D &= 0xFD; NEXT;
+        CB(0x8B) E &= 0xFD; NEXT;
+        CB(0x8C) H &= 0xFD; NEXT;
+        CB(0x8D) L &= 0xFD; NEXT;
+        CB(0x8E) WR8(HL, RD8(HL) & 0xFD); NEXT;
+        CB(0x8F) A &= 0xFD; NEXT;
+        CB(0x90) B &= 0xFB; NEXT;
+        CB(0x91) C &= 0xFB; NEXT;
+        CB(0x92) D &= 0xFB; NEXT;
+        CB(0x93) E &= 0xFB; NEXT;
+        CB(0x94) H &= 0xFB; NEXT;
+        CB(0x95) L &= 0xFB; NEXT;
+        CB(0x96) WR8(HL, RD8(HL) & 0xFB); NEXT;
+        CB(0x97) A &= 0xFB; NEXT;
+        CB(0x98) B &= 0xF7; NEXT;
+        CB(0x99) C &= 0xF7; NEXT;
+        CB(0x9A) D &= 0xF7; NEXT;
+        CB(0x9B) E &= 0xF7; NEXT;
+        CB(0x9C) H &= 0xF7; NEXT;
+        CB(0x9D) L &= 0xF7; NEXT;
+        CB(0x9E) WR8(HL, RD8(HL) & 0xF7); NEXT;
+        CB(0x9F) A &= 0xF7; NEXT;
+        CB(0xA0) B &= 0xEF; NEXT;
+        CB(0xA1) C &= 0xEF; NEXT;
+        CB(0xA2) D &= 0xEF; NEXT;
+        CB(0xA3) E &= 0xEF; NEXT;
+        CB(0xA4) H &= 0xEF; NEXT;
+        CB(0xA5) L &= 0xEF; NEXT;
+        CB(0xA6) WR8(HL, RD8(HL) & 0xEF); NEXT;
+        CB(0xA7) A &= 0xEF; NEXT;
+        CB(0xA8) B &= 0xDF; NEXT;
+        CB(0xA9) C &= 0xDF; NEXT;
+        CB(0xAA) D &= 0xDF; NEXT;
+        CB(0xAB) E &= 0xDF; NEXT;
+        CB(0xAC) H &= 0xDF; NEXT;
+        CB(0xAD) L &= 0xDF; NEXT;
+        CB(0xAE) WR8(HL, RD8(HL) & 0xDF); NEXT;
+        CB(0xAF) A &= 0xDF; NEXT;
+        CB(0xB0) B &= 0xBF; NEXT;
+        CB(0xB1) C &= 0xBF; NEXT;
+        CB(0xB2) D &= 0xBF; NEXT;
+        CB(0xB3) E &= 0xBF; NEXT;
+        CB(0xB4) H &= 0xBF; NEXT;
+        CB(0xB5) L &= 0xBF; NEXT;
+        CB(0xB6) WR8(HL, RD8(HL) & 0xBF); NEXT;
+        CB(0xB7) A &= 0xBF; NEXT;
+        CB(0xB8) B &= 0x7F; NEXT;
+        CB(0xB9) C &= 0x7F; NEXT;
+        CB(0xBA) D &= 0x7F; NEXT;
+        CB(0xBB) E &= 0x7F; NEXT;
+        CB(0xBC) H &= 0x7F; NEXT;
+        CB(0xBD) L &= 0x7F; NEXT;
+        CB(0xBE) WR8(HL, RD8(HL) & 0x7F); NEXT;
+        CB(0xBF) A &= 0x7F; NEXT;
+        CB(0xC0) B |= 0x01; NEXT;
+        CB(0xC1) C |= 0x01; NEXT;
+        CB(0xC2) D |= 0x01; NEXT;
+        CB(0xC3) E |= 0x01; NEXT;
+        CB(0xC4) H |= 0x01; NEXT;
+        CB(0xC5) L |= 0x01; NEXT;
+        CB(0xC6) WR8(HL, RD8(HL) | 0x01); NEXT;
+        CB(0xC7) A |= 0x01; NEXT;
+        CB(0xC8) B |= 0x02; NEXT;
+        CB(0xC9) C |= 0x02; NEXT;
+        CB(0xCA) D |= 0x02; NEXT;
+        CB(0xCB) E |= 0x02; NEXT;
+        CB(0xCC) H |= 0x02; NEXT;
+        CB(0xCD) L |= 0x02; NEXT;
+        CB(0xCE) WR8(HL, RD8(HL) | 0x02); NEXT;
+        CB(0xCF) A |= 0x02; NEXT;
+        CB(0xD0) B |= 0x04; NEXT;
+        CB(0xD1) C |= 0x04; NEXT;
+        CB(0xD2) D |= 0x04; NEXT;
+        CB(0xD3) E |= 0x04; NEXT;
+        CB(0xD4) H |= 0x04; NEXT;
+        CB(0xD5) L |= 0x04; NEXT;
+        CB(0xD6) WR8(HL, RD8(HL) | 0x04); NEXT;
+        CB(0xD7) A |= 0x04; NEXT;
+        CB(0xD8) B |= 0x08; NEXT;
+        CB(0xD9) C |= 0x08; NEXT;
+        CB(0xDA) D |= 0x08; NEXT;
+        CB(0xDB) E |= 0x08; NEXT;
+        CB(0xDC) H |= 0x08; NEXT;
+        CB(0xDD) L |= 0x08; NEXT;
+        CB(0xDE) WR8(HL, RD8(HL) | 0x08); NEXT;
+        CB(0xDF) A |= 0x08; NEXT;
+        CB(0xE0) B |= 0x10; NEXT;
+        CB(0xE1) C |= 0x10; NEXT;
+        CB(0xE2) D |= 0x10; NEXT;
+        CB(0xE3) E |= 0x10; NEXT;
+        CB(0xE4) H |= 0x10; NEXT;
+        CB(0xE5) L |= 0x10; NEXT;
+        CB(0xE6) WR8(HL, RD8(HL) | 0x10); NEXT;
+        CB(0xE7) A |= 0x10; NEXT;
+        CB(0xE8) B |= 0x20; NEXT;
+        CB(0xE9) C |= 0x20; NEXT;
+        CB(0xEA) D |= 0x20; NEXT;
+        CB(0xEB) E |= 0x20; NEXT;
+        CB(0xEC) H |= 0x20; NEXT;
+        CB(0xED) L |= 0x20; NEXT;
+        CB(0xEE) WR8(HL, RD8(HL) | 0x20); NEXT;
+        CB(0xEF) A |= 0x20; NEXT;
+        CB(0xF0) B |= 0x40; NEXT;
+        CB(0xF1) C |= 0x40; NEXT;
+        CB(0xF2) D |= 0x40; NEXT;
+        CB(0xF3) E |= 0x40; NEXT;
+        CB(0xF4) H |= 0x40; NEXT;
+        CB(0xF5) L |= 0x40; NEXT;
+        CB(0xF6) WR8(HL, RD8(HL) | 0x40); NEXT;
+        CB(0xF7) A |= 0x40; NEXT;
+        CB(0xF8) B |= 0x80; NEXT;
+        CB(0xF9) C |= 0x80; NEXT;
+        CB(0xFA) D |= 0x80; NEXT;
+        CB(0xFB) E |= 0x80; NEXT;
+        CB(0xFC) H |= 0x80; NEXT;
+        CB(0xFD) L |= 0x80; NEXT;
+        CB(0xFE) WR8(HL, RD8(HL) | 0x80); NEXT;
+        CB(0xFF) A |= 0x80; NEXT;
+        END_PREFIX
+        NEXT;
+
+        // DD/FD: ix/iy in place of hl, (ix+d) in place of (hl). Opcodes that
+        // don't touch hl run their unprefixed handler.
+dd_prefix:
+        PREFIX_FETCH();
+        s->cycles += cycles_xy[op];
+        BEGIN_PREFIX(dd_table)
+        DD(0x09) XY = add16(s, XY, BC); NEXT;
+        DD(0x19) XY = add16(s, XY, DE); NEXT;
+        DD(0x21) XY = IMM16(); NEXT;
+        DD(0x22) { uint16_t nn = IMM16(); WR8(nn, XYL); WR8(nn + 1, XYH); } NEXT;
+        DD(0x23) XY = inc16(XY); NEXT;
+        DD(0x24) XYH = inc8(s, XYH); NEXT;
+        DD(0x25) XYH = dec8(s, XYH); NEXT;
+        DD(0x26) XYH = IMM8(); NEXT;
+        DD(0x29) XY = add16(s, XY, XY); NEXT;
+        DD(0x2A) { uint16_t nn = IMM16(); XY = RD8(nn) | (RD8(nn + 1) << 8); } NEXT;
+        DD(0x2B) XY = dec16(XY); NEXT;
+        DD(0x2C) XYL = inc8(s, XYL); NEXT;
+        DD(0x2D) XYL = dec8(s, XYL); NEXT;
+        DD(0x2E) XYL = IMM8(); NEXT;
+        DD(0x34) { uint16_t a = IDX(); WR8(a, inc8(s, RD8(a))); } NEXT;
+        DD(0x35) { uint16_t a = IDX(); WR8(a, dec8(s, RD8(a))); } NEXT;
+        DD(0x36) { uint16_t a = IDX(); uint8_t n = IMM8(); WR8(a, n); } NEXT;
+        DD(0x39) XY = add16(s, XY, SP); NEXT;
+        DD(0x44) B = XYH; NEXT;
+        DD(0x45) B = XYL; NEXT;
+        DD(0x46) B = RD8(IDX()); NEXT;
+        DD(0x4C) C = XYH; NEXT;
+        DD(0x4D) C = XYL; NEXT;
+        DD(0x4E) C = RD8(IDX()); NEXT;
+        DD(0x54) D = XYH; NEXT;
+        DD(0x55) D = XYL; NEXT;
+        DD(0x56) D = RD8(IDX()); NEXT;
+        DD(0x5C) E = XYH; NEXT;
+        DD(0x5D) E = XYL; NEXT;
+        DD(0x5E) E = RD8(IDX()); NEXT;
+        DD(0x60) XYH = B; NEXT;
+        DD(0x61) XYH = C; NEXT;
+        DD(0x62) XYH = D; NEXT;
+        DD(0x63) XYH = E; NEXT;
+        DD(0x64) NEXT;
+        DD(0x65) XYH = XYL; NEXT;
+        DD(0x66) H = RD8(IDX()); NEXT;
+        DD(0x67) XYH = A; NEXT;
+        DD(0x68) XYL = B; NEXT;
+        DD(0x69) XYL = C; NEXT;
+        DD(0x6A) XYL = D; NEXT;
+        DD(0x6B) XYL = E; NEXT;
+        DD(0x6C) XYL = XYH; NEXT;
+        DD(0x6D) NEXT;
+        DD(0x6E) L = RD8(IDX()); NEXT;
+        DD(0x6F) XYL = A; NEXT;
+        DD(0x70) WR8(IDX(), B); NEXT;
+        DD(0x71) WR8(IDX(), C); NEXT;
+        DD(0x72) WR8(IDX(), D); NEXT;
+        DD(0x73) WR8(IDX(), E); NEXT;
+        DD(0x74) WR8(IDX(), H); NEXT;
+        DD(0x75) WR8(IDX(), L); NEXT;
+        DD(0x77) WR8(IDX(), A); NEXT;
+        DD(0x7C) A = XYH; NEXT;
+        DD(0x7D) A = XYL; NEXT;
+        DD(0x7E) A = RD8(IDX()); NEXT;
+        DD(0x84) A = add8(s, A, XYH); NEXT;
+        DD(0x85) A = add8(s, A, XYL); NEXT;
+        DD(0x86) A = add8(s, A, RD8(IDX())); NEXT;
+        DD(0x8C) A = adc(s, A, XYH); NEXT;
+        DD(0x8D) A = adc(s, A, XYL); NEXT;
+        DD(0x8E) A = adc(s, A, RD8(IDX())); NEXT;
+        DD(0x94) A = sub(s, A, XYH); NEXT;
+        DD(0x95) A = sub(s, A, XYL); NEXT;
+        DD(0x96) A = sub(s, A, RD8(IDX())); NEXT;
+        DD(0x9C) A = sbc(s, A, XYH); NEXT;
+        DD(0x9D) A = sbc(s, A, XYL); NEXT;
+        DD(0x9E) A = sbc(s, A, RD8(IDX())); NEXT;
+        DD(0xA4) A = _and(s, A, XYH); NEXT;
+        DD(0xA5) A = _and(s, A, XYL); NEXT;
+        DD(0xA6) A = _and(s, A, RD8(IDX())); NEXT;
+        DD(0xAC) A = _xor(s, A, XYH); NEXT;
+        DD(0xAD) A = _xor(s, A, XYL); NEXT;
+        DD(0xAE) A = _xor(s, A, RD8(IDX())); NEXT;
+        DD(0xB4) A = _or(s, A, XYH); NEXT;
+        DD(0xB5) A = _or(s, A, XYL); NEXT;
+        DD(0xB6) A = _or(s, A, RD8(IDX())); NEXT;
+        DD(0xBC) cp(s, A, XYH); NEXT;
+        DD(0xBD) cp(s, A, XYL); NEXT;
+        DD(0xBE) cp(s, A, RD8(IDX())); NEXT;
+        DD(0xE1) XY = pop16(s); NEXT;
+        DD(0xE3) ex_sp(s, XY); NEXT;
+        DD(0xE5) push16(s, XY); NEXT;
+        DD(0xE9) PC = XY; NEXT;
+        DD(0xF9) SP = XY; NEXT;
+
+        // DDCB/FDCB: displacement comes before the opcode; results are also
+        // copied to the register in the low three bits (undocumented)
+        DD(0xCB)
+        addr = IDX();
+        op = IMM8();
+        s->cycles += cycles_xycb[op];
+        BEGIN_PREFIX(ddcb_table)
+        DDCB(0x00) { uint8_t v = rlc(s, RD8(addr)); WR8(addr, v); B = v; } NEXT;
+        DDCB(0x01) { uint8_t v = rlc(s, RD8(addr)); WR8(addr, v); C = v; } NEXT;
+        DDCB(0x02) { uint8_t v = rlc(s, RD8(addr)); WR8(addr, v); D = v; } NEXT;
+        DDCB(0x03) { uint8_t v = rlc(s, RD8(addr)); WR8(addr, v); E = v; } NEXT;
+        DDCB(0x04) { uint8_t v = rlc(s, RD8(addr)); WR8(addr, v); H = v; } NEXT;
+        DDCB(0x05) { uint8_t v = rlc(s, RD8(addr)); WR8(addr, v); L = v; } NEXT;
+        DDCB(0x06) { uint8_t v = rlc(s, RD8(addr)); WR8(addr, v); } NEXT;
+        DDCB(0x07) { uint8_t v = rlc(s, RD8(addr)); WR8(addr, v); A = v; } NEXT;
+        DDCB(0x08) { uint8_t v = rrc(s, RD8(addr)); WR8(addr, v); B = v; } NEXT;
+        DDCB(0x09) { uint8_t v = rrc(s, RD8(addr)); WR8(addr, v); C = v; } NEXT;
+        DDCB(0x0A) { uint8_t v = rrc(s, RD8(addr)); WR8(addr, v); D = v; } NEXT;
+        DDCB(0x0B) { uint8_t v = rrc(s, RD8(addr)); WR8(addr, v); E = v; } NEXT;
+        DDCB(0x0C) { uint8_t v = rrc(s, RD8(addr)); WR8(addr, v); H = v; } NEXT;
+        DDCB(0x0D) { uint8_t v = rrc(s, RD8(addr)); WR8(addr, v); L = v; } NEXT;
+        DDCB(0x0E) { uint8_t v = rrc(s, RD8(addr)); WR8(addr, v); } NEXT;
+        DDCB(0x0F) { uint8_t v = rrc(s, RD8(addr)); WR8(addr, v); A = v; } NEXT;
+        DDCB(0x10) { uint8_t v = rl(s, RD8(addr)); WR8(addr, v); B = v; } NEXT;
+        DDCB(0x11) { uint8_t v = rl(s, RD8(addr)); WR8(addr, v); C = v; } NEXT;
+        DDCB(0x12) { uint8_t v = rl(s, RD8(addr)); WR8(addr, v); D = v; } NEXT;
+        DDCB(0x13) { uint8_t v = rl(s, RD8(addr)); WR8(addr, v); E = v; } NEXT;
+        DDCB(0x14) { uint8_t v = rl(s, RD8(addr)); WR8(addr, v); H = v; } NEXT;
+        DDCB(0x15) { uint8_t v = rl(s, RD8(addr)); WR8(addr, v); L = v; } NEXT;
+        DDCB(0x16) { uint8_t v = rl(s, RD8(addr)); WR8(addr, v); } NEXT;
+        DDCB(0x17) { uint8_t v = rl(s, RD8(addr)); WR8(addr, v); A = v; } NEXT;
+        DDCB(0x18) { uint8_t v = rr(s, RD8(addr)); WR8(addr, v); B = v; } NEXT;
+        DDCB(0x19) { uint8_t v = rr(s, RD8(addr)); WR8(addr, v); C = v; } NEXT;
+        DDCB(0x1A) { uint8_t v = rr(s, RD8(addr)); WR8(addr, v); D = v; } NEXT;
+        DDCB(0x1B) { uint8_t v = rr(s, RD8(addr)); WR8(addr, v); E = v; } NEXT;
+        DDCB(0x1C) { uint8_t v = rr(s, RD8(addr)); WR8(addr, v); H = v; } NEXT;
+        DDCB(0x1D) { uint8_t v = rr(s, RD8(addr)); WR8(addr, v); L = v; } NEXT;
+        DDCB(0x1E) { uint8_t v = rr(s, RD8(addr)); WR8(addr, v); } NEXT;
+        DDCB(0x1F) { uint8_t v = rr(s, RD8(addr)); WR8(addr, v); A = v; } NEXT;
+        DDCB(0x20) { uint8_t v = sla(s, RD8(addr)); WR8(addr, v); B = v; } NEXT;
+        DDCB(0x21) { uint8_t v = sla(s, RD8(addr)); WR8(addr, v); C = v; } NEXT;
+        DDCB(0x22) { uint8_t v = sla(s, RD8(addr)); WR8(addr, v); D = v; } NEXT;
+        DDCB(0x23) { uint8_t v = sla(s, RD8(addr)); WR8(addr, v); E = v; } NEXT;
+        DDCB(0x24) { uint8_t v = sla(s, RD8(addr)); WR8(addr, v); H = v; } NEXT;
+        DDCB(0x25) { uint8_t v = sla(s, RD8(addr)); WR8(addr, v); L = v; } NEXT;
+        DDCB(0x26) { uint8_t v = sla(s, RD8(addr)); WR8(addr, v); } NEXT;
+        DDCB(0x27) { uint8_t v = sla(s, RD8(addr)); WR8(addr, v); A = v; } NEXT;
+        DDCB(0x28) { uint8_t v = sra(s, RD8(addr)); WR8(addr, v); B = v; } NEXT;
+        DDCB(0x29) { uint8_t v = sra(s, RD8(addr)); WR8(addr, v); C = v; } NEXT;
+        DDCB(0x2A) { uint8_t v = sra(s, RD8(addr)); WR8(addr, v); D = v; } NEXT;
+        DDCB(0x2B) { uint8_t v = sra(s, RD8(addr)); WR8(addr, v); E = v; } NEXT;
+        DDCB(0x2C) { uint8_t v = sra(s, RD8(addr)); WR8(addr, v); H = v; } NEXT;
+        DDCB(0x2D) { uint8_t v = sra(s, RD8(addr)); WR8(addr, v); L = v; } NEXT;
+        DDCB(0x2E) { uint8_t v = sra(s, RD8(addr)); WR8(addr, v); } NEXT;
+        DDCB(0x2F) { uint8_t v = sra(s, RD8(addr)); WR8(addr, v); A = v; } NEXT;
+        DDCB(0x30) { uint8_t v = sll(s, RD8(addr)); WR8(addr, v); B = v; } NEXT;
+        DDCB(0x31) { uint8_t v = sll(s, RD8(addr)); WR8(addr, v); C = v; } NEXT;
+        DDCB(0x32) { uint8_t v = sll(s, RD8(addr)); WR8(addr, v); D = v; } NEXT;
+        DDCB(0x33) { uint8_t v = sll(s, RD8(addr)); WR8(addr, v); E = v; } NEXT;
+        DDCB(0x34) { uint8_t v = sll(s, RD8(addr)); WR8(addr, v); H = v; } NEXT;
+        DDCB(0x35) { uint8_t v = sll(s, RD8(addr)); WR8(addr, v); L = v; } NEXT;
+        DDCB(0x36) { uint8_t v = sll(s, RD8(addr)); WR8(addr, v); } NEXT;
+        DDCB(0x37) { uint8_t v = sll(s, RD8(addr)); WR8(addr, v); A = v; } NEXT;
+        DDCB(0x38) { uint8_t v = srl(s, RD8(addr)); WR8(addr, v); B = v; } NEXT;
+        DDCB(0x39) { uint8_t v = srl(s, RD8(addr)); WR8(addr, v); C = v; } NEXT;
+        DDCB(0x3A) { uint8_t v = srl(s, RD8(addr)); WR8(addr, v); D = v; } NEXT;
+        DDCB(0x3B) { uint8_t v = srl(s, RD8(addr)); WR8(addr, v); E = v; } NEXT;
+        DDCB(0x3C) { uint8_t v = srl(s, RD8(addr)); WR8(addr, v); H = v; } NEXT;
+        DDCB(0x3D) { uint8_t v = srl(s, RD8(addr)); WR8(addr, v); L = v; } NEXT;
+        DDCB(0x3E) { uint8_t v = srl(s, RD8(addr)); WR8(addr, v); } NEXT;
+        DDCB(0x3F) { uint8_t v = srl(s, RD8(addr)); WR8(addr, v); A = v; } NEXT;
+        DDCB(0x40) bit_mem(s, 0, RD8(addr), addr); NEXT;
+        DDCB(0x41) bit_mem(s, 0, RD8(addr), addr); NEXT;
+        DDCB(0x42) bit_mem(s, 0, RD8(addr), addr); NEXT;
+        DDCB(0x43) bit_mem(s, 0, RD8(addr), addr); NEXT;
+        DDCB(0x44) bit_mem(s, 0, RD8(addr), addr); NEXT;
+        DDCB(0x45) bit_mem(s, 0, RD8(addr), addr); NEXT;
+        DDCB(0x46) bit_mem(s, 0, RD8(addr), addr); NEXT;
+        DDCB(0x47) bit_mem(s, 0, RD8(addr), addr); NEXT;
+        DDCB(0x48) bit_mem(s, 1, RD8(addr), addr); NEXT;
+        DDCB(0x49) bit_mem(s, 1, RD8(addr), addr); NEXT;
+        DDCB(0x4A) bit_mem(s, 1, RD8(addr), addr); NEXT;
+        DDCB(0x4B) bit_mem(s, 1, RD8(addr), addr); NEXT;
+        DDCB(0x4C) bit_mem(s, 1, RD8(addr), addr); NEXT;
+        DDCB(0x4D) bit_mem(s, 1, RD8(addr), addr); NEXT;
+        DDCB(0x4E) bit_mem(s, 1, RD8(addr), addr); NEXT;
+        DDCB(0x4F) bit_mem(s, 1, RD8(addr), addr); NEXT;
+        DDCB(0x50) bit_mem(s, 2, RD8(addr), addr); NEXT;
+        DDCB(0x51) bit_mem(s, 2, RD8(addr), addr); NEXT;
+        DDCB(0x52) bit_mem(s, 2, RD8(addr), addr); NEXT;
+        DDCB(0x53) bit_mem(s, 2, RD8(addr), addr); NEXT;
+        DDCB(0x54) bit_mem(s, 2, RD8(addr), addr); NEXT;
+        DDCB(0x55) bit_mem(s, 2, RD8(addr), addr); NEXT;
+        DDCB(0x56) bit_mem(s, 2, RD8(addr), addr); NEXT;
+        DDCB(0x57) bit_mem(s, 2, RD8(addr), addr); NEXT;
+        DDCB(0x58) bit_mem(s, 3, RD8(addr), addr); NEXT;
+        DDCB(0x59) bit_mem(s, 3, RD8(addr), addr); NEXT;
+        DDCB(0x5A) bit_mem(s, 3, RD8(addr), addr); NEXT;
+        DDCB(0x5B) bit_mem(s, 3, RD8(addr), addr); NEXT;
+        DDCB(0x5C) bit_mem(s, 3, RD8(addr), addr); NEXT;
+        DDCB(0x5D) bit_mem(s, 3, RD8(addr), addr); NEXT;
+        DDCB(0x5E) bit_mem(s, 3, RD8(addr), addr); NEXT;
+        DDCB(0x5F) bit_mem(s, 3, RD8(addr), addr); NEXT;
+        DDCB(0x60) bit_mem(s, 4, RD8(addr), addr); NEXT;
+        DDCB(0x61) bit_mem(s, 4, RD8(addr), addr); NEXT;
+        DDCB(0x62) bit_mem(s, 4, RD8(addr), addr); NEXT;
+        DDCB(0x63) bit_mem(s, 4, RD8(addr), addr); NEXT;
+        DDCB(0x64) bit_mem(s, 4, RD8(addr), addr); NEXT;
+        DDCB(0x65) bit_mem(s, 4, RD8(addr), addr); NEXT;
+        DDCB(0x66) bit_mem(s, 4, RD8(addr), addr); NEXT;
+        DDCB(0x67) bit_mem(s, 4, RD8(addr), addr); NEXT;
+        DDCB(0x68) bit_mem(s, 5, RD8(addr), addr); NEXT;
+        DDCB(0x69) bit_mem(s, 5, RD8(addr), addr); NEXT;
+        DDCB(0x6A) bit_mem(s, 5, RD8(addr), addr); NEXT;
+        DDCB(0x6B) bit_mem(s, 5, RD8(addr), addr); NEXT;
+        DDCB(0x6C) bit_mem(s, 5, RD8(addr), addr); NEXT;
+        DDCB(0x6D) bit_mem(s, 5, RD8(addr), addr); NEXT;
+        DDCB(0x6E) bit_mem(s, 5, RD8(addr), addr); NEXT;
+        DDCB(0x6F) bit_mem(s, 5, RD8(addr), addr); NEXT;
+        DDCB(0x70) bit_mem(s, 6, RD8(addr), addr); NEXT;
+        DDCB(0x71) bit_mem(s, 6, RD8(addr), addr); NEXT;
+        DDCB(0x72) bit_mem(s, 6, RD8(addr), addr); NEXT;
+        DDCB(0x73) bit_mem(s, 6, RD8(addr), addr); NEXT;
+        DDCB(0x74) bit_mem(s, 6, RD8(addr), addr); NEXT;
+        DDCB(0x75) bit_mem(s, 6, RD8(addr), addr); NEXT;
+        DDCB(0x76) bit_mem(s, 6, RD8(addr), addr); NEXT;
+        DDCB(0x77) bit_mem(s, 6, RD8(addr), addr); NEXT;
+        DDCB(0x78) bit_mem(s, 7, RD8(addr), addr); NEXT;
+        DDCB(0x79) bit_mem(s, 7, RD8(addr), addr); NEXT;
+        DDCB(0x7A) bit_mem(s, 7, RD8(addr), addr); NEXT;
+        DDCB(0x7B) bit_mem(s, 7, RD8(addr), addr); NEXT;
+        DDCB(0x7C) bit_mem(s, 7, RD8(addr), addr); NEXT;
+        DDCB(0x7D) bit_mem(s, 7, RD8(addr), addr); NEXT;
+        DDCB(0x7E) bit_mem(s, 7, RD8(addr), addr); NEXT;
+        DDCB(0x7F) bit_mem(s, 7, RD8(addr), addr); NEXT;
+        DDCB(0x80) { uint8_t v = RD8(addr) & 0xFE; WR8(addr, v); B = v; } NEXT;
+        DDCB(0x81) { uint8_t v = RD8(addr) & 0xFE; WR8(addr, v); C = v; } NEXT;
+        DDCB(0x82) { uint8_t v = RD8(addr) & 0xFE; WR8(addr, v); D = v; } NEXT;
+        DDCB(0x83) { uint8_t v = RD8(addr) & 0xFE; WR8(addr, v); E = v; } NEXT;
+        DDCB(0x84) { uint8_t v = RD8(addr) & 0xFE; WR8(addr, v); H = v; } NEXT;
+        DDCB(0x85) { uint8_t v = RD8(addr) & 0xFE; WR8(addr, v); L = v; } NEXT;
+        DDCB(0x86) { uint8_t v = RD8(addr) & 0xFE; WR8(addr, v); } NEXT;
+        DDCB(0x87) { uint8_t v = RD8(addr) & 0xFE; WR8(addr, v); A = v; } NEXT;
+        DDCB(0x88) { uint8_t v = RD8(addr) & 0xFD; WR8(addr, v); B = v; } NEXT;
+        DDCB(0x89) { uint8_t v = RD8(addr) & 0xFD; WR8(addr, v); C = v; } NEXT;
+        DDCB(0x8A) { uint8_t v = RD8(addr) & 0xFD; WR8(addr, v); D = v; } NEXT;
+        DDCB(0x8B) { uint8_t v = RD8(addr) & 0xFD; WR8(addr, v); E = v; } NEXT;
+        DDCB(0x8C) { uint8_t v = RD8(addr) & 0xFD; WR8(addr, v); H = v; } NEXT;
+        DDCB(0x8D) { uint8_t v = RD8(addr) & 0xFD; WR8(addr, v); L = v; } NEXT;
+        DDCB(0x8E) { uint8_t v = RD8(addr) & 0xFD; WR8(addr, v); } NEXT;
+        DDCB(0x8F) { uint8_t v = RD8(addr) & 0xFD; WR8(addr, v); A = v; } NEXT;
+        DDCB(0x90) { uint8_t v = RD8(addr) & 0xFB; WR8(addr, v); B = v; } NEXT;
+        DDCB(0x91) { uint8_t v = RD8(addr) & 0xFB; WR8(addr, v); C = v; } NEXT;
+        DDCB(0x92) { uint8_t v = RD8(addr) & 0xFB; WR8(addr, v); D = v; } NEXT;
+        DDCB(0x93) { uint8_t v = RD8(addr) & 0xFB; WR8(addr, v); E = v; } NEXT;
+        DDCB(0x94) { uint8_t v = RD8(addr) & 0xFB; WR8(addr, v); H = v; } NEXT;
+        DDCB(0x95) { uint8_t v = RD8(addr) & 0xFB; WR8(addr, v); L = v; } NEXT;
+        DDCB(0x96) { uint8_t v = RD8(addr) & 0xFB; WR8(addr, v); } NEXT;
+        DDCB(0x97) { uint8_t v = RD8(addr) & 0xFB; WR8(addr, v); A = v; } NEXT;
+        DDCB(0x98) { uint8_t v = RD8(addr) & 0xF7; WR8(addr, v); B = v; } NEXT;
+        DDCB(0x99) { uint8_t v = RD8(addr) & 0xF7; WR8(addr, v); C = v; } NEXT;
+        DDCB(0x9A) { uint8_t v = RD8(addr) & 0xF7; WR8(addr, v); D = v; } NEXT;
+        DDCB(0x9B) { uint8_t v = RD8(addr) & 0xF7; WR8(addr, v); E = v; } NEXT;
+        DDCB(0x9C) { uint8_t v = RD8(addr) & 0xF7; WR8(addr, v); H = v; } NEXT;
+        DDCB(0x9D) { uint8_t v = RD8(addr) & 0xF7; WR8(addr, v); L = v; } NEXT;
+        DDCB(0x9E) { uint8_t v = RD8(addr) & 0xF7; WR8(addr, v); } NEXT;
+        DDCB(0x9F) { uint8_t v = RD8(addr) & 0xF7; WR8(addr, v); A = v; } NEXT;
+        DDCB(0xA0) { uint8_t v = RD8(addr) & 0xEF; WR8(addr, v); B = v; } NEXT;
+        DDCB(0xA1) { uint8_t v = RD8(addr) & 0xEF; WR8(addr, v); C = v; } NEXT;
+        DDCB(0xA2) { uint8_t v = RD8(addr) & 0xEF; WR8(addr, v); D = v; } NEXT;
+        DDCB(0xA3) { uint8_t v = RD8(addr) & 0xEF; WR8(addr, v); E = v; } NEXT;
+        DDCB(0xA4) { uint8_t v = RD8(addr) & 0xEF; WR8(addr, v); H = v; } NEXT;
+        DDCB(0xA5) { uint8_t v = RD8(addr) & 0xEF; WR8(addr, v); L = v; } NEXT;
+        DDCB(0xA6) { uint8_t v = RD8(addr) & 0xEF; WR8(addr, v); } NEXT;
+        DDCB(0xA7) { uint8_t v = RD8(addr) & 0xEF; WR8(addr, v); A = v; } NEXT;
+        DDCB(0xA8) { uint8_t v = RD8(addr) & 0xDF; WR8(addr, v); B = v; } NEXT;
+        DDCB(0xA9) { uint8_t v = RD8(addr) & 0xDF; WR8(addr, v); C = v; } NEXT;
+        DDCB(0xAA) { uint8_t v = RD8(addr) & 0xDF; WR8(addr, v); D = v; } NEXT;
+        DDCB(0xAB) { uint8_t v = RD8(addr) & 0xDF; WR8(addr, v); E = v; } NEXT;
+        DDCB(0xAC) { uint8_t v = RD8(addr) & 0xDF; WR8(addr, v); H = v; } NEXT;
+        DDCB(0xAD) { uint8_t v = RD8(addr) & 0xDF; WR8(addr, v); L = v; } NEXT;
+        DDCB(0xAE) { uint8_t v = RD8(addr) & 0xDF; WR8(addr, v); } NEXT;
+        DDCB(0xAF) { uint8_t v = RD8(addr) & 0xDF; WR8(addr, v); A = v; } NEXT;
+        DDCB(0xB0) { uint8_t v = RD8(addr) & 0xBF; WR8(addr, v); B = v; } NEXT;
+        DDCB(0xB1) { uint8_t v = RD8(addr) & 0xBF; WR8(addr, v); C = v; } NEXT;
+        DDCB(0xB2) { uint8_t v = RD8(addr) & 0xBF; WR8(addr, v); D = v; } NEXT;
+        DDCB(0xB3) { uint8_t v = RD8(addr) & 0xBF; WR8(addr, v); E = v; } NEXT;
+        DDCB(0xB4) { uint8_t v = RD8(addr) & 0xBF; WR8(addr, v); H = v; } NEXT;
+        DDCB(0xB5) { uint8_t v = RD8(addr) & 0xBF; WR8(addr, v); L = v; } NEXT;
+        DDCB(0xB6) { uint8_t v = RD8(addr) & 0xBF; WR8(addr, v); } NEXT;
+        DDCB(0xB7) { uint8_t v = RD8(addr) & 0xBF; WR8(addr, v); A = v; } NEXT;
+        DDCB(0xB8) { uint8_t v = RD8(addr) & 0x7F; WR8(addr, v); B = v; } NEXT;
+        DDCB(0xB9) { uint8_t v = RD8(addr) & 0x7F; WR8(addr, v); C = v; } NEXT;
+        DDCB(0xBA) { uint8_t v = RD8(addr) & 0x7F; WR8(addr, v); D = v; } NEXT;
+        DDCB(0xBB) { uint8_t v = RD8(addr) & 0x7F; WR8(addr, v); E = v; } NEXT;
+        DDCB(0xBC) { uint8_t v = RD8(addr) & 0x7F; WR8(addr, v); H = v; } NEXT;
+        DDCB(0xBD) { uint8_t v = RD8(addr) & 0x7F; WR8(addr, v); L = v; } NEXT;
+        DDCB(0xBE) { uint8_t v = RD8(addr) & 0x7F; WR8(addr, v); } NEXT;
+        DDCB(0xBF) { uint8_t v = RD8(addr) & 0x7F; WR8(addr, v); A = v; } NEXT;
+        DDCB(0xC0) { uint8_t v = RD8(addr) | 0x01; WR8(addr, v); B = v; } NEXT;
+        DDCB(0xC1) { uint8_t v = RD8(addr) | 0x01; WR8(addr, v); C = v; } NEXT;
+        DDCB(0xC2) { uint8_t v = RD8(addr) | 0x01; WR8(addr, v); D = v; } NEXT;
+        DDCB(0xC3) { uint8_t v = RD8(addr) | 0x01; WR8(addr, v); E = v; } NEXT;
+        DDCB(0xC4) { uint8_t v = RD8(addr) | 0x01; WR8(addr, v); H = v; } NEXT;
+        DDCB(0xC5) { uint8_t v = RD8(addr) | 0x01; WR8(addr, v); L = v; } NEXT;
+        DDCB(0xC6) { uint8_t v = RD8(addr) | 0x01; WR8(addr, v); } NEXT;
+        DDCB(0xC7) { uint8_t v = RD8(addr) | 0x01; WR8(addr, v); A = v; } NEXT;
+        DDCB(0xC8) { uint8_t v = RD8(addr) | 0x02; WR8(addr, v); B = v; } NEXT;
+        DDCB(0xC9) { uint8_t v = RD8(addr) | 0x02; WR8(addr, v); C = v; } NEXT;
+        DDCB(0xCA) { uint8_t v = RD8(addr) | 0x02; WR8(addr, v); D = v; } NEXT;
+        DDCB(0xCB) { uint8_t v = RD8(addr) | 0x02; WR8(addr, v); E = v; } NEXT;
+        DDCB(0xCC) { uint8_t v = RD8(addr) | 0x02; WR8(addr, v); H = v; } NEXT;
+        DDCB(0xCD) { uint8_t v = RD8(addr) | 0x02; WR8(addr, v); L = v; } NEXT;
+        DDCB(0xCE) { uint8_t v = RD8(addr) | 0x02; WR8(addr, v); } NEXT;
+        DDCB(0xCF) { uint8_t v = RD8(addr) | 0x02; WR8(addr, v); A = v; } NEXT;
+        DDCB(0xD0) { uint8_t v = RD8(addr) | 0x04; WR8(addr, v); B = v; } NEXT;
+        DDCB(0xD1) { uint8_t v = RD8(addr) | 0x04; WR8(addr, v); C = v; } NEXT;
+        DDCB(0xD2) { uint8_t v = RD8(addr) | 0x04; WR8(addr, v); D = v; } NEXT;
+        DDCB(0xD3) { uint8_t v = RD8(addr) | 0x04; WR8(addr, v); E = v; } NEXT;
+        DDCB(0xD4) { uint8_t v = RD8(addr) | 0x04; WR8(addr, v); H = v; } NEXT;
+        DDCB(0xD5) { uint8_t v = RD8(addr) | 0x04; WR8(addr, v); L = v; } NEXT;
+        DDCB(0xD6) { uint8_t v = RD8(addr) | 0x04; WR8(addr, v); } NEXT;
+        DDCB(0xD7) { uint8_t v = RD8(addr) | 0x04; WR8(addr, v); A = v; } NEXT;
+        DDCB(0xD8) { uint8_t v = RD8(addr) | 0x08; WR8(addr, v); B = v; } NEXT;
+        DDCB(0xD9) { uint8_t v = RD8(addr) | 0x08; WR8(addr, v); C = v; } NEXT;
+        DDCB(0xDA) { uint8_t v = RD8(addr) | 0x08; WR8(addr, v); D = v; } NEXT;
+        DDCB(0xDB) { uint8_t v = RD8(addr) | 0x08; WR8(addr, v); E = v; } NEXT;
+        DDCB(0xDC) { uint8_t v = RD8(addr) | 0x08; WR8(addr, v); H = v; } NEXT;
+        DDCB(0xDD) { uint8_t v = RD8(addr) | 0x08; WR8(addr, v); L = v; } NEXT;
+        DDCB(0xDE) { uint8_t v = RD8(addr) | 0x08; WR8(addr, v); } NEXT;
+        DDCB(0xDF) { uint8_t v = RD8(addr) | 0x08; WR8(addr, v); A = v; } NEXT;
+        DDCB(0xE0) { uint8_t v = RD8(addr) | 0x10; WR8(addr, v); B = v; } NEXT;
+        DDCB(0xE1) { uint8_t v = RD8(addr) | 0x10; WR8(addr, v); C = v; } NEXT;
+        DDCB(0xE2) { uint8_t v = RD8(addr) | 0x10; WR8(addr, v); D = v; } NEXT;
+        DDCB(0xE3) { uint8_t v = RD8(addr) | 0x10; WR8(addr, v); E = v; } NEXT;
+        DDCB(0xE4) { uint8_t v = RD8(addr) | 0x10; WR8(addr, v); H = v; } NEXT;
+        DDCB(0xE5) { uint8_t v = RD8(addr) | 0x10; WR8(addr, v); L = v; } NEXT;
+        DDCB(0xE6) { uint8_t v = RD8(addr) | 0x10; WR8(addr, v); } NEXT;
+        DDCB(0xE7) { uint8_t v = RD8(addr) | 0x10; WR8(addr, v); A = v; } NEXT;
+        DDCB(0xE8) { uint8_t v = RD8(addr) | 0x20; WR8(addr, v); B = v; } NEXT;
+        DDCB(0xE9) { uint8_t v = RD8(addr) | 0x20; WR8(addr, v); C = v; } NEXT;
+        DDCB(0xEA) { uint8_t v = RD8(addr) | 0x20; WR8(addr, v); D = v; } NEXT;
+        DDCB(0xEB) { uint8_t v = RD8(addr) | 0x20; WR8(addr, v); E = v; } NEXT;
+        DDCB(0xEC) { uint8_t v = RD8(addr) | 0x20; WR8(addr, v); H = v; } NEXT;
+        DDCB(0xED) { uint8_t v = RD8(addr) | 0x20; WR8(addr, v); L = v; } NEXT;
+        DDCB(0xEE) { uint8_t v = RD8(addr) | 0x20; WR8(addr, v); } NEXT;
+        DDCB(0xEF) { uint8_t v = RD8(addr) | 0x20; WR8(addr, v); A = v; } NEXT;
+        DDCB(0xF0) { uint8_t v = RD8(addr) | 0x40; WR8(addr, v); B = v; } NEXT;
+        DDCB(0xF1) { uint8_t v = RD8(addr) | 0x40; WR8(addr, v); C = v; } NEXT;
+        DDCB(0xF2) { uint8_t v = RD8(addr) | 0x40; WR8(addr, v); D = v; } NEXT;
+        DDCB(0xF3) { uint8_t v = RD8(addr) | 0x40; WR8(addr, v); E = v; } NEXT;
+        DDCB(0xF4) { uint8_t v = RD8(addr) | 0x40; WR8(addr, v); H = v; } NEXT;
+        DDCB(0xF5) { uint8_t v = RD8(addr) | 0x40; WR8(addr, v); L = v; } NEXT;
+        DDCB(0xF6) { uint8_t v = RD8(addr) | 0x40; WR8(addr, v); } NEXT;
+        DDCB(0xF7) { uint8_t v = RD8(addr) | 0x40; WR8(addr, v); A = v; } NEXT;
+        DDCB(0xF8) { uint8_t v = RD8(addr) | 0x80; WR8(addr, v); B = v; } NEXT;
+        DDCB(0xF9) { uint8_t v = RD8(addr) | 0x80; WR8(addr, v); C = v; } NEXT;
+        DDCB(0xFA) { uint8_t v = RD8(addr) | 0x80; WR8(addr, v); D = v; } NEXT;
+        DDCB(0xFB) { uint8_t v = RD8(addr) | 0x80; WR8(addr, v); E = v; } NEXT;
+        DDCB(0xFC) { uint8_t v = RD8(addr) | 0x80; WR8(addr, v); H = v; } NEXT;
+        DDCB(0xFD) { uint8_t v = RD8(addr) | 0x80; WR8(addr, v); L = v; } NEXT;
+        DDCB(0xFE) { uint8_t v = RD8(addr) | 0x80; WR8(addr, v); } NEXT;
+        DDCB(0xFF) { uint8_t v = RD8(addr) | 0x80; WR8(addr, v); A = v; } NEXT;
+        END_PREFIX
+        NEXT;
+        DD_DEFAULT
+        END_PREFIX
+        NEXT;
+
+        // ED: extended instructions. Undefined slots are two-byte nops.
+ed_prefix:
+        PREFIX_FETCH();
+        s->cycles += cycles_ed[op];
+        BEGIN_PREFIX(ed_table)
+        ED(0x40) B = in_c(s); NEXT;
+        ED(0x41) port_out(s, BC, B); NEXT;
+        ED(0x42) HL = sbc16(s, HL, BC); NEXT;
+        ED(0x43) { uint16_t nn = IMM16(); WR8(nn, C); WR8(nn + 1, B); } NEXT;
+        ED(0x44) A = sub(s, 0, A); NEXT;
+        ED(0x45) PC = pop16(s); s->iff1 = s->iff2; int_recheck(s); NEXT;
+        ED(0x46) s->im = 0; NEXT;
+        ED(0x47) s->i = A; NEXT;
+        ED(0x48) C = in_c(s); NEXT;
+        ED(0x49) port_out(s, BC, C); NEXT;
+        ED(0x4A) HL = adc16(s, HL, BC); NEXT;
+        ED(0x4B) { uint16_t nn = IMM16(); BC = RD8(nn) | (RD8(nn + 1) << 8); } NEXT;
+        ED(0x4C) A = sub(s, 0, A); NEXT;
+        ED(0x4D) PC = pop16(s); s->iff1 = s->iff2; int_recheck(s); NEXT;
+        ED(0x4E) s->im = 0; NEXT;
+        ED(0x4F) s->r = A; NEXT;
+        ED(0x50) D = in_c(s); NEXT;
+        ED(0x51) port_out(s, BC, D); NEXT;
+        ED(0x52) HL = sbc16(s, HL, DE); NEXT;
+        ED(0x53) { uint16_t nn = IMM16(); WR8(nn, E); WR8(nn + 1, D); } NEXT;
+        ED(0x54) A = sub(s, 0, A); NEXT;
+        ED(0x55) PC = pop16(s); s->iff1 = s->iff2; int_recheck(s); NEXT;
+        ED(0x56) s->im = 1; NEXT;
+        ED(0x57) A = s->i; F = (F & FLAG_C) | sz53[A] | (s->iff2 ? FLAG_PV : 0); NEXT;
+        ED(0x58) E = in_c(s); NEXT;
+        ED(0x59) port_out(s, BC, E); NEXT;
+        ED(0x5A) HL = adc16(s, HL, DE); NEXT;
+        ED(0x5B) { uint16_t nn = IMM16(); DE = RD8(nn) | (RD8(nn + 1) << 8); } NEXT;
+        ED(0x5C) A = sub(s, 0, A); NEXT;
+        ED(0x5D) PC = pop16(s); s->iff1 = s->iff2; int_recheck(s); NEXT;
+        ED(0x5E) s->im = 2; NEXT;
+        ED(0x5F) A = s->r; F = (F & FLAG_C) | sz53[A] | (s->iff2 ? FLAG_PV : 0); NEXT;
+        ED(0x60) H = in_c(s); NEXT;
+        ED(0x61) port_out(s, BC, H); NEXT;
+        ED(0x62) HL = sbc16(s, HL, HL); NEXT;
+        ED(0x63) { uint16_t nn = IMM16(); WR8(nn, L); WR8(nn + 1, H); } NEXT;
+        ED(0x64) A = sub(s, 0, A); NEXT;
+        ED(0x65) PC = pop16(s); s->iff1 = s->iff2; int_recheck(s); NEXT;
+        ED(0x66) s->im = 0; NEXT;
+        ED(0x67) rrd(s); NEXT;
+        ED(0x68) L = in_c(s); NEXT;
+        ED(0x69) port_out(s, BC, L); NEXT;
+        ED(0x6A) HL = adc16(s, HL, HL); NEXT;
+        ED(0x6B) { uint16_t nn = IMM16(); HL = RD8(nn) | (RD8(nn + 1) << 8); } NEXT;
+        ED(0x6C) A = sub(s, 0, A); NEXT;
+        ED(0x6D) PC = pop16(s); s->iff1 = s->iff2; int_recheck(s); NEXT;
+        ED(0x6E) s->im = 0; NEXT;
+        ED(0x6F) rld(s); NEXT;
+        ED(0x70) in_c(s); NEXT;
+        ED(0x71) port_out(s, BC, 0); NEXT;
+        ED(0x72) HL = sbc16(s, HL, SP); NEXT;
+        ED(0x73) { uint16_t nn = IMM16(); WR8(nn, SP & 0xff); WR8(nn + 1, SP >> 8); } NEXT;
+        ED(0x74) A = sub(s, 0, A); NEXT;
+        ED(0x75) PC = pop16(s); s->iff1 = s->iff2; int_recheck(s); NEXT;
+        ED(0x76) s->im = 1; NEXT;
+        ED(0x78) A = in_c(s); NEXT;
+        ED(0x79) port_out(s, BC, A); NEXT;
+        ED(0x7A) HL = adc16(s, HL, SP); NEXT;
+        ED(0x7B) { uint16_t nn = IMM16(); SP = RD8(nn) | (RD8(nn + 1) << 8); } NEXT;
+        ED(0x7C) A = sub(s, 0, A); NEXT;
+        ED(0x7D) PC = pop16(s); s->iff1 = s->iff2; int_recheck(s); NEXT;
+        ED(0x7E) s->im = 2; NEXT;
+        ED(0xA0) ldi(s, 1); NEXT;
+        ED(0xA1) cpi(s, 1); NEXT;
+        ED(0xA2) ini(s, 1); NEXT;
+        ED(0xA3) outi(s, 1); NEXT;
+        ED(0xA8) ldi(s, -1); NEXT;
+        ED(0xA9) cpi(s, -1); NEXT;
+        ED(0xAA) ini(s, -1); NEXT;
+        ED(0xAB) outi(s, -1); NEXT;
+        ED(0xB0) BLOCK_RETIRE(ldir_block(s, 1, SPARE)); REPEAT_IF(BC); NEXT;
+        ED(0xB1) BLOCK_RETIRE(cpir_block(s, 1, SPARE)); REPEAT_IF(!(F & FLAG_Z) && BC); NEXT;
+        ED(0xB2) BLOCK_RETIRE(inir_block(s, 1, SPARE)); REPEAT_IF(B); NEXT;
+        ED(0xB3) BLOCK_RETIRE(otir_block(s, 1, SPARE)); REPEAT_IF(B); NEXT;
+        ED(0xB8) BLOCK_RETIRE(ldir_block(s, -1, SPARE)); REPEAT_IF(BC); NEXT;
+        ED(0xB9) BLOCK_RETIRE(cpir_block(s, -1, SPARE)); REPEAT_IF(!(F & FLAG_Z) && BC); NEXT;
+        ED(0xBA) BLOCK_RETIRE(inir_block(s, -1, SPARE)); REPEAT_IF(B); NEXT;
+        ED(0xBB) BLOCK_RETIRE(otir_block(s, -1, SPARE)); REPEAT_IF(B); NEXT;
+        ED_DEFAULT NEXT;
+        END_PREFIX
+        NEXT;
+#if !ZILOG_THREADED
+    }
+    }
+#else
+
+        // Between blocks. A whole block runs only if both budgets would have
+        // let its last instruction start; otherwise, or if pc can't be
+        // translated, one instruction is interpreted and we come back here.
+        // The next block is looked for first among the two that followed
+        // the last one before, then in the map, which a miss links in.
+block_end: {
+        if (tc->epoch != s->bus.epoch)
+            tc_flush(tc, &s->bus);
+        if (tc->flushes != flushes) {       // last went with the rest
+            flushes = tc->flushes;
+            last = &tc->none;
+        }
+        Block *b = last->exits[0];
+        if (b->start != PC) {
+            b = last->exits[1];
+            if (b->start != PC) {
+                b = tc->map[PC];
+                if (!b)
+                    b = tc_translate(tc, s, PC);
+                if (b->count && last != &tc->none && tc->flushes == flushes) {
+                    last->exits[1] = last->exits[0];
+                    last->exits[0] = b;
+                }
+                flushes = tc->flushes;
+            }
+        }
+        last = &tc->none;
+        if (b->count && s->instructions + b->count <= limit && s->cycles + b->lead < s->stop_cycle) {
+            last = b;
+            // Mostly short blocks since the last look: stop, and leave the
+            // next stretch to the interpreter (execute_blocks). Not with a
+            // debugger, which that interpreter doesn't check, or the JIT.
+            if (++entries == BLOCK_SAMPLE) {
+                if (s->instructions - sampled < BLOCK_SAMPLE * BLOCK_SHORT && !s->debug && !s->jit) {
+                    tc->interpret = INTERPRET_SLICE;
+                    goto done;
+                }
+                entries = 0;
+                sampled = s->instructions;
+            }
+#if ZILOG_JIT
+            if (b->native || (s->jit && ++b->hits == JIT_THRESHOLD && jit_compile(tc, s, b))) {
+                jit_run(tc, s, b, limit, s->stop_cycle);
+                goto block_end;
+            }
+#endif
+            s->instructions += b->count;
+            s->cycles += b->cycles;
+            s->r = (s->r & 0x80) | ((s->r + b->m1) & 0x7f);
+            u = b->uops;
+            UOP();
+        }
+        FETCH();
+        u = &end_uop;
+        goto *base_table[op];
+    }
+
+        // A write dropped the running block. Its remaining instructions were
+        // charged on entry, so hand those back and go on from pc.
+block_bail: {
+        const Uop *at = u - 1;
+        PC -= at->skip;
+        uint32_t m1 = 0;
+        for (; at->m1; at++) {
+            s->instructions--;
+            s->cycles -= at->cycles;
+            m1 += at->m1;
+        }
+        s->r = (s->r & 0x80) | ((s->r - m1) & 0x7f);
+        goto block_end;
+    }
+
+        // First uop of a block that is one pass of a counted delay loop
+        // (djnz $, dec r / jr nz,$, dec rr / ld a,hi / or lo / jr nz,$).
+        // Entry charged one pass; every pass but the last only moves the
+        // counter, so those are charged here in one go if both budgets would
+        // have let the whole loop run, and the uops after this one do the
+        // last pass as usual. u->cycles is what a taken branch adds.
+block_loop: {
+        const Block *b = (const Block*)(u - 1) - 1;
+        uint64_t extra = loop_passes(s, op) - 1;
+        uint64_t pass = b->cycles + u[-1].cycles;
+        if (extra && s->instructions + extra * b->count <= limit
+            && s->cycles - b->cycles + extra * pass + b->lead < s->stop_cycle) {
+            s->instructions += extra * b->count;
+            s->cycles += extra * pass;
+            s->r = (s->r & 0x80) | ((s->r + extra * b->m1) & 0x7f);
+            loop_last_pass(s, op);
+        }
+        UOP();
+    }
+
+        // First uop of a spin-wait block. If this pass follows straight on
+        // from the last one (nothing else ran in between) and starts from
+        // the same registers, the last pass took the registers back to
+        // where they were and this one will too, as will every pass after
+        // it until memory changes, which only an event can do (service
+        // forgets the last pass whenever events are served). So every
+        // pass but this one that both budgets would have let start is
+        // charged at once. The pass length is measured, taken branch
+        // included, and so is r, which prefixes bump more than once. With
+        // no budget and nothing that could interrupt it, the wait never
+        // ends, and it spins pass by pass as the interpreter would.
+block_idle: {
+        const Block *b = (const Block*)(u - 1) - 1;
+        uint64_t first = s->instructions - b->count;
+        uint64_t start = s->cycles - b->cycles;
+        uint16_t regs[7];
+        idle_regs(s, regs);
+        if (idle.block == b && idle.translated == tc->translated
+            && first - idle.instructions == b->count
+            && memcmp(regs, idle.regs, sizeof(regs)) == 0 && idle_reads_fixed(s)
+            && (limit != UINT64_MAX || s->stop_cycle != UINT64_MAX || halt_waits(s))) {
+            uint64_t pass = start - idle.cycles;
+            uint8_t m1 = (s->r - idle.r) & 0x7f;
+            uint64_t extra = (s->stop_cycle - start - b->lead - 1) / pass;
+            uint64_t by_count = (limit - first) / b->count - 1;
+            if (by_count < extra)
+                extra = by_count;
+            s->instructions += extra * b->count;
+            s->cycles += extra * pass;
+            s->r = (s->r & 0x80) | ((s->r + extra * m1) & 0x7f);
+            first += extra * b->count;
+            start += extra * pass;
+        }
+        idle.block = b;
+        idle.translated = tc->translated;
+        idle.instructions = first;
+        idle.cycles = start;
+        idle.r = s->r;
+        memcpy(idle.regs, regs, sizeof(regs));
+        UOP();
+    }
+#endif
+
+        // Halted: the CPU repeats NOP M1 cycles, each counted as an
+        // instruction, until an event or interrupt wakes it. Nothing else
+        // happens meanwhile, so they are counted in one go.
+halt_wait: {
+        uint64_t nops = halt_nops(s, limit);
+        s->instructions += nops;
+        s->cycles += nops * 4;
+        s->r = (s->r & 0x80) | ((s->r + nops) & 0x7f);
+    }
+
+        // FETCH (or a halt) reached stop_cycle or the instruction budget
+service:
+    if (debug_hit(s))
+        STOP(STOP_WATCHPOINT);
+    if (s->instructions >= limit || s->cycles >= cycle_limit)
+        goto done;
+    serve_events(s, cycle_limit);
+    if (debug_hit(s))           // An event or the interrupt acknowledge touched one
+        STOP(STOP_WATCHPOINT);
+#if ZILOG_THREADED
+    idle.block = nullptr;       // Events may have written what a spin-wait reads
+#endif
+    if (s->halted) {
+        if (halt_waits(s))
+            goto halt_wait;
+        STOP(STOP_HALT);
+    }
+#if ZILOG_THREADED
+    if (Blocks)
+        goto block_end;
+    DISPATCH();
+#else
+    goto fetch;
+#endif
+
+done:
+    if (Trace && s->profile && s->profile->pending)
+        profile_retire(s->profile, s);
+    return reason;
+}
+
+// Tracing and profiling see every fetch, so they run in the instrumented loop
+static bool instrumented(const State *state) {
+    return state->trace || state->tracer || state->profile;
+}
+
+// Translated blocks unless instrumented or translation is off (or the cache
+// can't be allocated)
+static bool use_blocks(State *state) {
+#if ZILOG_THREADED
+    if (instrumented(state) || !state->translate)
+        return false;
+    if (!state->tc)
+        state->tc = tc_create(state);
+    return state->tc != nullptr;
+#else
+    (void)state;
+    return false;
+#endif
+}
+
+// Blocks, but with stretches of short ones interpreted: the block executor
+// stops early to hand them over (tc->interpret), and gets the run back
+// once the slice is done
+static StopReason execute_blocks(State *state, uint64_t budget, uint64_t cycle_budget) {
+    TranslationCache *tc = state->tc;
+    if (state->debug || state->jit)     // Attached since the slice was handed over
+        tc->interpret = 0;
+    uint64_t limit = state->instructions + budget;
+    if (limit < state->instructions)
+        limit = UINT64_MAX;
+    uint64_t cycle_limit = state->cycles + cycle_budget;
+    if (cycle_limit < state->cycles)
+        cycle_limit = UINT64_MAX;
+    for (;;) {
+        uint64_t left = limit - state->instructions;
+        uint64_t cycles_left = cycle_limit == UINT64_MAX ? UINT64_MAX : cycle_limit - state->cycles;
+        StopReason why;
+        if (tc->interpret) {
+            uint64_t start = state->instructions;
+            why = execute<false, false>(state, left < tc->interpret ? left : tc->interpret, cycles_left);
+            uint64_t ran = state->instructions - start;
+            tc->interpret = ran < tc->interpret ? tc->interpret - ran : 0;
+        } else {
+            why = execute<true, false>(state, left, cycles_left);
+        }
+        if (why != STOP_BUDGET || state->instructions >= limit || state->cycles >= cycle_limit)
+            return why;
+    }
+}
+
+static StopReason execute_any(State *state, uint64_t budget, uint64_t cycle_budget) {
+    if (use_blocks(state))
+        return execute_blocks(state, budget, cycle_budget);
+    if (instrumented(state) || state->debug)
+        return execute<false, true>(state, budget, cycle_budget);
+    return execute<false, false>(state, budget, cycle_budget);
+}
+
+// Run until HALT or until max_instructions have retired.
+StopReason run(State *state, uint64_t max_instructions) {
+    return execute_any(state, max_instructions, UINT64_MAX);
+}
+
+// Same, but the budget is T-states. The instruction that crosses the budget
+// completes, so state->cycles can end up to one instruction past it.
+StopReason run_cycles(State *state, uint64_t max_cycles) {
+    return execute_any(state, UINT64_MAX, max_cycles);
+}
+
+// Both at once: stop before the first instruction either budget wouldn't
+// let start
+StopReason run_budgets(State *state, uint64_t max_instructions, uint64_t max_cycles) {
+    return execute_any(state, max_instructions, max_cycles);
+}
+
+// Single-step entry point kept for the REPL; nonzero means stop
+int emulate(State *state) {
+    return run(state, 1) != STOP_BUDGET;
+}
+
+const char* stop_reason_name(StopReason reason) {
+    switch (reason) {
+        case STOP_BUDGET: return "budget";
+        case STOP_HALT: return "halt";
+        case STOP_BREAKPOINT: return "breakpoint";
+        case STOP_WATCHPOINT: return "watchpoint";
+    }
+    return "unknown";
+}
+
+// Initialize space for z80 states and memory. Memory is its own anonymous
+// mapping so ROM pages can be mapped over it (see rom_load).
+State* z80init(void) {
+    State* state = (State*)calloc(1,sizeof(State));
+    if (!state)
+        return NULL;
+    state->mem_size = 0x10000;
+    flags_init();
+    void *mem = mmap(NULL, state->mem_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        free(state);
+        return NULL;
+    }
+    state->memory = (uint8_t*)mem;  //64kb
+    state->translate = 1;
+    state->int_data = 0xff;
+    bus_map_ram(&state->bus, 0, state->mem_size, state->memory);
+    return state;
+}
+
+// Back to how z80init left it, keeping the memory mapping, the (now
+// empty) translation cache and scheduler, and the port bus
+void z80reset(State *state) {
+    uint8_t *memory = state->memory;
+    uint32_t mem_size = state->mem_size;
+    TranslationCache *tc = state->tc;
+    Scheduler *events = state->events;
+    PortBus *ports = state->ports;
+    Debugger *debug = state->debug;
+    *state = State();
+    state->memory = memory;
+    state->mem_size = mem_size;
+    state->translate = 1;
+    memset(memory, 0, mem_size);
+    bus_map_ram(&state->bus, 0, mem_size, memory);
+    state->tc = tc;
+    if (tc)
+        tc_attach(tc, state);
+    state->events = events;
+    state->ports = ports;
+    if (events)
+        events->count = 0;
+    if (debug)
+        debug_attach(state, debug);
+}
+
+void z80free(State *state) {
+    if (!state)
+        return;
+    munmap(state->memory, state->mem_size);
+    tc_destroy(state->tc);
+    free(state);
+}
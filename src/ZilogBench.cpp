@@ -0,0 +1,339 @@
+// zilog_bench: repeatable timings for the core, the disassembler and ROM
+// loading. Every benchmark runs once to warm up (and, under the JIT, to
+// compile), then --reps timed times; the report is the median with its
+// median absolute deviation, so one noisy repetition doesn't move it.
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "Disassembler.hpp"
+#include "Jit.hpp"
+#include "Lockstep.hpp"
+#include "Rom.hpp"
+#include "Z80.hpp"
+
+struct BenchOptions {
+    unsigned    reps = 7;
+    uint64_t    instructions = 20000000;    // Per timed repetition of a core benchmark
+    const char  *filter = nullptr;          // Only names containing this
+};
+
+// Median and median absolute deviation of per-unit times
+struct Stats {
+    double      median;
+    double      mad;
+    double      min;
+};
+
+static Stats summarize(std::vector<double> ns) {
+    std::sort(ns.begin(), ns.end());
+    Stats st;
+    st.median = ns[ns.size() / 2];
+    st.min = ns[0];
+    std::vector<double> dev;
+    for (double v : ns)
+        dev.push_back(v > st.median ? v - st.median : st.median - v);
+    std::sort(dev.begin(), dev.end());
+    st.mad = dev[dev.size() / 2];
+    return st;
+}
+
+// The rate is scale / median ns: 1e3 gives millions per second (MIPS)
+static void report(const std::string &name, const Stats &st, const char *unit, double scale, const char *rate) {
+    printf("%-20s %10.3f ns/%-5s %10.1f %-4s +-%5.1f%%  (min %.3f)\n", name.c_str(), st.median, unit,
+           scale / st.median, rate, 100.0 * st.mad / st.median, st.min);
+    fflush(stdout);
+}
+
+static bool selected(const BenchOptions &opt, const std::string &name) {
+    return !opt.filter || name.find(opt.filter) != std::string::npos;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// Deterministic filler so every run sees the same bytes
+static uint32_t lcg(uint32_t &seed) {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 16;
+}
+
+// Core workloads. Each fills memory with a program that never halts.
+static void setup_nop(State *s) {
+    memset(s->memory, 0x00, s->mem_size);
+}
+
+// The straight-line ALU/load mix mips uses
+static void setup_alu(State *s) {
+    static const uint8_t mix[] = { 0x04, 0x80, 0x4F, 0xA9, 0x15, 0x00, 0x78, 0xB1 };
+    for (uint32_t i = 0; i < s->mem_size; i++)
+        s->memory[i] = mix[i % sizeof(mix)];
+}
+
+// A short loop of data-dependent conditional branches:
+//   L: inc c / ld a,c / and 3 / jr nz,1f / inc d
+//   1: cp 2 / jr c,2f / inc e
+//   2: djnz L / jr L
+static void setup_branch(State *s) {
+    static const uint8_t loop[] = {
+        0x0C, 0x79, 0xE6, 0x03, 0x20, 0x01, 0x14,
+        0xFE, 0x02, 0x38, 0x01, 0x1C,
+        0x10, 0xF2, 0x18, 0xF0
+    };
+    memset(s->memory, 0x00, s->mem_size);
+    memcpy(s->memory, loop, sizeof(loop));
+}
+
+// ld hl,4000h / ld de,8000h / ld bc,1000h / ldir / jr back to the start.
+// Every ldir iteration counts as an instruction.
+static void setup_ldir(State *s) {
+    static const uint8_t loop[] = {
+        0x21, 0x00, 0x40, 0x11, 0x00, 0x80, 0x01, 0x00, 0x10,
+        0xED, 0xB0, 0x18, 0xF3
+    };
+    memset(s->memory, 0x00, s->mem_size);
+    memcpy(s->memory, loop, sizeof(loop));
+    uint32_t seed = 1;
+    for (uint32_t i = 0x4000; i < 0x5000; i++)
+        s->memory[i] = lcg(seed);
+}
+
+struct Workload {
+    const char  *name;
+    void        (*setup)(State *s);
+};
+
+static const Workload workloads[] = {
+    { "nop", setup_nop },
+    { "alu", setup_alu },
+    { "branch", setup_branch },
+    { "ldir", setup_ldir },
+};
+
+enum CoreMode { MODE_INTERP, MODE_BLOCKS, MODE_JIT };
+static const char *mode_names[] = { "interp", "blocks", "jit" };
+
+static bool bench_core(const BenchOptions &opt, const Workload &w, CoreMode mode) {
+    std::string name = std::string(w.name) + "/" + mode_names[mode];
+    if (!selected(opt, name))
+        return true;
+    State *s = z80init();
+    if (!s) {
+        fprintf(stderr, "%s: out of memory\n", name.c_str());
+        return false;
+    }
+    w.setup(s);
+    bus_touch(&s->bus);
+    s->translate = mode != MODE_INTERP;
+    s->jit = mode == MODE_JIT ? JIT_ON : JIT_OFF;
+
+    std::vector<double> ns;
+    bool ok = true;
+    for (unsigned rep = 0; rep <= opt.reps && ok; rep++) {
+        uint64_t before = s->instructions;
+        auto t0 = std::chrono::steady_clock::now();
+        StopReason why = run(s, rep ? opt.instructions : opt.instructions / 4);
+        double sec = seconds_since(t0);
+        if (why != STOP_BUDGET) {
+            fprintf(stderr, "%s: stopped (%s) at %04x\n", name.c_str(), stop_reason_name(why), s->pc);
+            ok = false;
+        } else if (rep) {
+            ns.push_back(sec * 1e9 / (s->instructions - before));
+        }
+    }
+    if (ok)
+        report(name, summarize(ns), "instr", 1e3, "MIPS");
+    z80free(s);
+    return ok;
+}
+
+// The same workloads on LOCKSTEP_MACHINES machines with different registers,
+// run in lockstep gangs on one thread; ns/instr is over all machines
+enum { LOCKSTEP_MACHINES = 256 };
+
+static bool bench_lockstep(const BenchOptions &opt, const Workload &w) {
+    std::string name = std::string(w.name) + "/lockstep";
+    if (!selected(opt, name))
+        return true;
+    std::vector<State*> states(LOCKSTEP_MACHINES);
+    std::vector<StopReason> why(LOCKSTEP_MACHINES);
+    uint32_t seed = 4;
+    bool ok = true;
+    for (State *&s : states) {
+        if (!(s = z80init())) {
+            fprintf(stderr, "%s: out of memory\n", name.c_str());
+            ok = false;
+            break;
+        }
+        w.setup(s);
+        bus_touch(&s->bus);
+        reg_bc(s).w = lcg(seed);
+        reg_de(s).w = lcg(seed);
+    }
+
+    std::vector<double> ns;
+    uint64_t each = opt.instructions / LOCKSTEP_MACHINES + 1;
+    for (unsigned rep = 0; rep <= opt.reps && ok; rep++) {
+        uint64_t before = 0, after = 0;
+        for (State *s : states)
+            before += s->instructions;
+        auto t0 = std::chrono::steady_clock::now();
+        lockstep_run(states.data(), states.size(), rep ? each : each / 4, UINT64_MAX, why.data(), nullptr, 1);
+        double sec = seconds_since(t0);
+        for (size_t i = 0; i < states.size(); i++) {
+            after += states[i]->instructions;
+            if (why[i] != STOP_BUDGET && ok) {
+                fprintf(stderr, "%s: stopped (%s) at %04x\n", name.c_str(), stop_reason_name(why[i]), states[i]->pc);
+                ok = false;
+            }
+        }
+        if (rep)
+            ns.push_back(sec * 1e9 / (after - before));
+    }
+    if (ok)
+        report(name, summarize(ns), "instr", 1e3, "MIPS");
+    for (State *s : states)
+        z80free(s);
+    return ok;
+}
+
+// disasm_range over 1 MiB, or disasm_parallel on every core over 16 MiB,
+// into a sink that drops the text, so this is decoding and formatting alone
+static bool discard(void *context, const char*, size_t size) {
+    *(uint64_t*)context += size;
+    return true;
+}
+
+static bool bench_disassembler(const BenchOptions &opt, const char *name, bool parallel) {
+    if (!selected(opt, name))
+        return true;
+    std::vector<uint8_t> code(parallel ? 16 << 20 : 1 << 20);
+    uint32_t seed = 2;
+    for (uint8_t &b : code)
+        b = lcg(seed);
+
+    std::vector<char> buffer(DISASM_SINK_BYTES);
+    uint64_t bytes = 0;
+    DisasmSink sink = disasm_sink(buffer.data(), buffer.size(), discard, &bytes);
+    std::vector<double> ns;
+    for (unsigned rep = 0; rep <= opt.reps; rep++) {
+        auto t0 = std::chrono::steady_clock::now();
+        uint64_t count = parallel ? disasm_parallel(code.data(), code.size(), 0, &sink)
+                                  : disasm_range(code.data(), code.size(), 0, &sink);
+        disasm_flush(&sink);
+        double sec = seconds_since(t0);
+        if (rep)
+            ns.push_back(sec * 1e9 / count);
+    }
+    report(name, summarize(ns), "instr", 1e3, "M/s");
+    return true;
+}
+
+// Map and place a 64 KiB image at 0, as --run does
+static bool bench_rom_load(const BenchOptions &opt) {
+    if (!selected(opt, "rom_load"))
+        return true;
+    const char *dir = getenv("TMPDIR");
+    std::string path = std::string(dir ? dir : "/tmp") + "/zilog_bench_XXXXXX";
+    int fd = mkstemp(&path[0]);
+    std::vector<uint8_t> image(0x10000);
+    uint32_t seed = 3;
+    for (uint8_t &b : image)
+        b = lcg(seed);
+    bool ok = fd >= 0 && write(fd, image.data(), image.size()) == (ssize_t)image.size();
+    if (fd >= 0)
+        close(fd);
+    State *s = ok ? z80init() : nullptr;
+    if (!s) {
+        fprintf(stderr, "rom_load: couldn't set up %s: %s\n", path.c_str(), strerror(errno));
+        unlink(path.c_str());
+        return false;
+    }
+
+    enum { LOADS = 200 };
+    std::vector<double> ns;
+    for (unsigned rep = 0; rep <= opt.reps && ok; rep++) {
+        auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < LOADS && ok; i++) {
+            Rom rom;
+            ok = rom_open(&rom, path.c_str()) && rom_load(s, &rom, 0);
+            rom_close(&rom);
+        }
+        double sec = seconds_since(t0);
+        if (rep)
+            ns.push_back(sec * 1e9 / LOADS);
+    }
+    if (ok)
+        report("rom_load", summarize(ns), "load", 0x10000 * 1e3, "MB/s");
+    else
+        fprintf(stderr, "rom_load: %s\n", strerror(errno));
+    z80free(s);
+    unlink(path.c_str());
+    return ok;
+}
+
+static void usage() {
+    fprintf(stderr,
+        "usage: zilog_bench [--reps n] [--instructions n] [--filter text]\n"
+        "Times the core on nop, alu, branch and ldir workloads (interp, blocks and, where\n"
+        "available, jit) and on 256 machines in lockstep, the disassembler over 1 MiB of\n"
+        "random bytes (and in parallel over 16 MiB) and 64 KiB ROM loads.\n"
+        "Each line is the median of --reps runs (default 7) after a warm-up, with its median\n"
+        "absolute deviation. --filter keeps benchmarks whose name contains text (alu/jit).\n");
+}
+
+static bool parse_number(const char *text, uint64_t &out) {
+    try {
+        size_t used = 0;
+        out = std::stoull(text, &used, 0);
+        return text[used] == '\0' && out > 0;
+    } catch (...) {
+        return false;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions opt;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        uint64_t n = 0;
+        if (i + 1 >= argc || (arg != "--reps" && arg != "--instructions" && arg != "--filter")) {
+            usage();
+            return 1;
+        }
+        const char *value = argv[++i];
+        if (arg == "--filter") {
+            opt.filter = value;
+            continue;
+        }
+        if (!parse_number(value, n) || (arg == "--reps" && n > 1000)) {
+            fprintf(stderr, "error: bad value for %s: %s\n", arg.c_str(), value);
+            return 1;
+        }
+        if (arg == "--reps")
+            opt.reps = n;
+        else
+            opt.instructions = n;
+    }
+
+    bool ok = true;
+    for (const Workload &w : workloads) {
+        ok &= bench_core(opt, w, MODE_INTERP);
+        ok &= bench_core(opt, w, MODE_BLOCKS);
+        if (ZILOG_JIT)
+            ok &= bench_core(opt, w, MODE_JIT);
+        ok &= bench_lockstep(opt, w);
+    }
+    ok &= bench_disassembler(opt, "disassemble", false);
+    ok &= bench_disassembler(opt, "disassemble/parallel", true);
+    ok &= bench_rom_load(opt);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+// zilog_trace: print a binary instruction trace (Trace.hpp) as text, one
+// instruction per line
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "Trace.hpp"
+
+enum {
+    READ_RECORDS = 4096
+};
+
+static void usage() {
+    fprintf(stderr,
+        "usage: zilog_trace trace.bin [--from n] [--count n]\n"
+        "Prints one line per traced instruction: T-states, pc, the four bytes at pc, then\n"
+        "af bc de hl ix iy sp and r as they were before it ran. --from skips the first n\n"
+        "records, --count stops after n.\n");
+}
+
+static bool parse_number(const char *text, uint64_t &out) {
+    try {
+        size_t used = 0;
+        out = std::stoull(text, &used, 0);
+        return text[used] == '\0';
+    } catch (...) {
+        return false;
+    }
+}
+
+// A trace written on a host of the other byte order
+static void swap_record(TraceRecord &r) {
+    r.cycles = __builtin_bswap64(r.cycles);
+    uint16_t *words[] = { &r.pc, &r.sp, &r.af, &r.bc, &r.de, &r.hl, &r.ix, &r.iy };
+    for (uint16_t *w : words)
+        *w = __builtin_bswap16(*w);
+}
+
+static void print_record(const TraceRecord &r) {
+    printf("%12llu %04x  %02x %02x %02x %02x  af=%04x bc=%04x de=%04x hl=%04x ix=%04x iy=%04x sp=%04x r=%02x%s%s\n",
+           (unsigned long long)r.cycles, r.pc, r.bytes[0], r.bytes[1], r.bytes[2], r.bytes[3],
+           r.af, r.bc, r.de, r.hl, r.ix, r.iy, r.sp, r.r,
+           (r.banks & 1) ? " af'" : "", (r.banks & 2) ? " exx" : "");
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = nullptr;
+    uint64_t from = 0;
+    uint64_t count = UINT64_MAX;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--from" || arg == "--count") {
+            if (i + 1 >= argc || !parse_number(argv[++i], arg == "--from" ? from : count)) {
+                fprintf(stderr, "error: bad value for %s\n", arg.c_str());
+                return 1;
+            }
+        } else if (arg[0] == '-' || path) {
+            usage();
+            return 1;
+        } else {
+            path = argv[i];
+        }
+    }
+    if (!path) {
+        usage();
+        return 1;
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "error: couldn't open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    TraceHeader header;
+    bool swap = false;
+    if (fread(&header, sizeof(header), 1, f) == 1 && memcmp(header.magic, "ZTRC", 4) == 0) {
+        swap = header.byte_order != TRACE_BYTE_ORDER;
+        if (swap) {
+            header.version = __builtin_bswap16(header.version);
+            header.record_size = __builtin_bswap16(header.record_size);
+        }
+    } else {
+        header.version = 0;
+    }
+    if (header.version != TRACE_VERSION || header.record_size != sizeof(TraceRecord)) {
+        fprintf(stderr, "error: %s isn't a version %d trace\n", path, TRACE_VERSION);
+        fclose(f);
+        return 1;
+    }
+    if (from && fseeko(f, (off_t)(from * sizeof(TraceRecord)), SEEK_CUR) != 0) {
+        fprintf(stderr, "error: couldn't seek in %s: %s\n", path, strerror(errno));
+        fclose(f);
+        return 1;
+    }
+
+    std::vector<TraceRecord> buffer(READ_RECORDS);
+    while (count) {
+        size_t want = count < (uint64_t)READ_RECORDS ? count : (uint64_t)READ_RECORDS;
+        size_t got = fread(buffer.data(), sizeof(TraceRecord), want, f);
+        for (size_t i = 0; i < got; i++) {
+            if (swap)
+                swap_record(buffer[i]);
+            print_record(buffer[i]);
+        }
+        count -= got;
+        if (got < want)
+            break;
+    }
+    bool failed = ferror(f);
+    fclose(f);
+    if (failed) {
+        fprintf(stderr, "error: couldn't read %s\n", path);
+        return 1;
+    }
+    return 0;
+}